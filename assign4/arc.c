@@ -0,0 +1,313 @@
+#include <stdlib.h>
+#include "arc.h"
+#include "lru_linked_list.h"
+
+/*
+ * ARC replacement state of a partition, after Megiddo and Modha,
+ * "ARC: A Self-Tuning, Low Overhead Replacement Cache", FAST 2003.
+ *
+ * Resident pages are in T1, seen once lately, or T2, seen at least
+ * twice. Pages replaced from them are remembered, without data, in the
+ * ghost lists B1 and B2. A miss on a page in B1 means T1 should have
+ * been larger, in B2 that T2 should, and the target size p of T1 moves
+ * that way. A scan only passes through T1, so T2 keeps the pages used
+ * again, and p adapts by itself to how much of each the load has.
+ *
+ * Here a frame is on its list only while unpinned, arcList tells which
+ * it belongs to while pinned too. Pins of a pinned page belong to the
+ * reference going on, so they take no lock and move nothing. Ghosts
+ * are page numbers in a small open addressing table.
+ */
+
+#define GHOST_NIL -1
+
+typedef struct BM_ARCGhost {
+  PageNumber pn;
+  int list;               // ARC_B1 or ARC_B2, 0 if free
+  int prev, next;
+} BM_ARCGhost;
+
+typedef struct BM_GhostList {
+  int head, tail, size;   // head is the LRU ghost
+} BM_GhostList;
+
+struct BM_ARC {
+  int c;                  // Frames of the partition
+  int p;                  // Target size of T1
+  int t1Size, t2Size;     // Resident pages, pinned ones too
+  BM_FrameList t1, t2;    // Unpinned frames, LRU first
+  BM_FrameList empty;     // Frames with no page yet
+  BM_GhostList b1, b2;
+  BM_ARCGhost *ghosts;    // c+1, a replacement adds one before trimming
+  int freeGhost;          // Free ghosts linked by next
+  int *slots;             // Ghost numbers, GHOST_NIL if empty
+  int mask;
+};
+
+#define ARC_B1 1
+#define ARC_B2 2
+
+static unsigned int hashGhost(PageNumber pn)
+{
+  return (unsigned int) (((unsigned long long) pn * 0xff51afd7ed558ccdULL) >> 32);
+}
+
+static int findGhost(struct BM_ARC *a, PageNumber pn)
+{
+  int i;
+
+  for (i= hashGhost(pn) & a->mask; a->slots[i] != GHOST_NIL; i= (i+1) & a->mask)
+    if (a->ghosts[a->slots[i]].pn == pn)
+      return a->slots[i];
+  return GHOST_NIL;
+}
+
+static BM_GhostList* ghostList(struct BM_ARC *a, int list)
+{
+  return list == ARC_B1 ? &a->b1 : &a->b2;
+}
+
+// Drop ghost g from its list and the table
+static void removeGhost(struct BM_ARC *a, int g)
+{
+  BM_ARCGhost *gh= &a->ghosts[g];
+  BM_GhostList *l= ghostList(a, gh->list);
+  int i, j, home;
+
+  if (gh->prev == GHOST_NIL)
+    l->head= gh->next;
+  else
+    a->ghosts[gh->prev].next= gh->next;
+  if (gh->next == GHOST_NIL)
+    l->tail= gh->prev;
+  else
+    a->ghosts[gh->next].prev= gh->prev;
+  l->size--;
+
+  // Out of the table, moving back later entries of the run as in
+  // page_table.c
+  for (i= hashGhost(gh->pn) & a->mask; a->slots[i] != g; i= (i+1) & a->mask)
+    ;
+  for (j= (i+1) & a->mask; a->slots[j] != GHOST_NIL; j= (j+1) & a->mask)
+  {
+    home= hashGhost(a->ghosts[a->slots[j]].pn) & a->mask;
+    if (i <= j ? (i < home && home <= j) : (i < home || home <= j))
+      continue;
+    a->slots[i]= a->slots[j];
+    i= j;
+  }
+  a->slots[i]= GHOST_NIL;
+
+  gh->list= 0;
+  gh->next= a->freeGhost;
+  a->freeGhost= g;
+}
+
+// Remember pn as most recent of list
+static void addGhost(struct BM_ARC *a, int list, PageNumber pn)
+{
+  BM_GhostList *l= ghostList(a, list);
+  int g= a->freeGhost, i;
+  BM_ARCGhost *gh= &a->ghosts[g];
+
+  a->freeGhost= gh->next;
+  gh->pn= pn;
+  gh->list= list;
+  gh->prev= l->tail;
+  gh->next= GHOST_NIL;
+  if (l->tail == GHOST_NIL)
+    l->head= g;
+  else
+    a->ghosts[l->tail].next= g;
+  l->tail= g;
+  l->size++;
+
+  for (i= hashGhost(pn) & a->mask; a->slots[i] != GHOST_NIL; i= (i+1) & a->mask)
+    ;
+  a->slots[i]= g;
+}
+
+// Target size of T1 after a miss on pn, *ghost the ghost of pn if any
+static int adaptedTarget(struct BM_ARC *a, PageNumber pn, int *ghost)
+{
+  int g= findGhost(a, pn);
+
+  *ghost= g;
+  if (g == GHOST_NIL)
+    return a->p;
+  if (a->ghosts[g].list == ARC_B1)
+  {
+    int delta= a->b2.size > a->b1.size ? a->b2.size / a->b1.size : 1;
+    return a->p + delta < a->c ? a->p + delta : a->c;
+  }
+  else
+  {
+    int delta= a->b1.size > a->b2.size ? a->b1.size / a->b2.size : 1;
+    return a->p - delta > 0 ? a->p - delta : 0;
+  }
+}
+
+// First frame of l not being written
+static BM_PageFrame* firstFree(BM_StrategyInfo *si, BM_FrameList *l)
+{
+  int i;
+
+  for (i= l->head; i != LRU_NIL; i= si->lru_frames[i].lruNext)
+    if (!si->lru_frames[i].writing)
+      return &si->lru_frames[i];
+  return NULL;
+}
+
+void initARC(BM_StrategyInfo *si, int numFrames)
+{
+  struct BM_ARC *a;
+  int i, numSlots;
+
+  a= (struct BM_ARC*) calloc(1, sizeof(struct BM_ARC));
+  a->c= numFrames;
+  a->t1.head= a->t1.tail= LRU_NIL;
+  a->t2.head= a->t2.tail= LRU_NIL;
+  a->empty.head= a->empty.tail= LRU_NIL;
+  a->b1.head= a->b1.tail= GHOST_NIL;
+  a->b2.head= a->b2.tail= GHOST_NIL;
+
+  a->ghosts= (BM_ARCGhost*) malloc((numFrames+1)*sizeof(BM_ARCGhost));
+  for (i=0; i<=numFrames; i++)
+  {
+    a->ghosts[i].list= 0;
+    a->ghosts[i].next= i < numFrames ? i+1 : GHOST_NIL;
+  }
+  a->freeGhost= 0;
+  for (numSlots= 8; numSlots < 2*(numFrames+1); numSlots*= 2)
+    ;
+  a->slots= (int*) malloc(numSlots*sizeof(int));
+  for (i=0; i<numSlots; i++)
+    a->slots[i]= GHOST_NIL;
+  a->mask= numSlots-1;
+  si->arc= a;
+
+  for (i=0; i<numFrames; i++)
+  {
+    si->lru_frames[i].arcList= 0;
+    appendFrame(si->lru_frames, &a->empty, &si->lru_frames[i]);
+  }
+}
+
+void freeARC(BM_StrategyInfo *si)
+{
+  struct BM_ARC *a= si->arc;
+
+  if (!a)
+    return;
+  free(a->slots);
+  free(a->ghosts);
+  free(a);
+  si->arc= NULL;
+}
+
+// Unpinned frame gets pinned for its page, a hit. It belongs to T2 now.
+void pinARCFrame(BM_StrategyInfo *si, BM_PageFrame *pf)
+{
+  struct BM_ARC *a= si->arc;
+
+  if (pf->arcList == ARC_T1)
+  {
+    removeFrame(si->lru_frames, &a->t1, pf);
+    a->t1Size--;
+    a->t2Size++;
+  }
+  else if (pf->arcList == ARC_T2)
+    removeFrame(si->lru_frames, &a->t2, pf);
+  else
+    removeFrame(si->lru_frames, &a->empty, pf);
+  if (pf->arcList)
+    pf->arcList= ARC_T2;
+}
+
+// Unpinned frame with oldPn gets pinned for newPn, a miss
+void claimARCFrame(BM_StrategyInfo *si, BM_PageFrame *pf, PageNumber oldPn, PageNumber newPn)
+{
+  struct BM_ARC *a= si->arc;
+  int ghost, g;
+
+  a->p= adaptedTarget(a, newPn, &ghost);
+  if (ghost != GHOST_NIL)
+    removeGhost(a, ghost);
+
+  // Victim's page is remembered in the ghost list of where it was
+  if (pf->arcList == ARC_T1)
+  {
+    removeFrame(si->lru_frames, &a->t1, pf);
+    a->t1Size--;
+    if (oldPn != NO_PAGE)
+      addGhost(a, ARC_B1, oldPn);
+  }
+  else if (pf->arcList == ARC_T2)
+  {
+    removeFrame(si->lru_frames, &a->t2, pf);
+    a->t2Size--;
+    if (oldPn != NO_PAGE)
+      addGhost(a, ARC_B2, oldPn);
+  }
+  else
+    removeFrame(si->lru_frames, &a->empty, pf);
+
+  // Seen before it goes to T2, else T1
+  if (ghost != GHOST_NIL)
+  {
+    pf->arcList= ARC_T2;
+    a->t2Size++;
+  }
+  else
+  {
+    pf->arcList= ARC_T1;
+    a->t1Size++;
+  }
+
+  // Keep |T1|+|B1| <= c and all four <= 2c, oldest ghosts go first
+  while (a->t1Size + a->b1.size > a->c && a->b1.size > 0)
+    removeGhost(a, a->b1.head);
+  while (a->t1Size + a->t2Size + a->b1.size + a->b2.size > 2*a->c)
+  {
+    g= a->b2.size > 0 ? a->b2.head : a->b1.head;
+    removeGhost(a, g);
+  }
+}
+
+// Frame got unpinned
+void releaseARCFrame(BM_StrategyInfo *si, BM_PageFrame *pf)
+{
+  struct BM_ARC *a= si->arc;
+
+  if (pf->arcList == ARC_T1)
+    appendFrame(si->lru_frames, &a->t1, pf);
+  else if (pf->arcList == ARC_T2)
+    appendFrame(si->lru_frames, &a->t2, pf);
+  else
+    appendFrame(si->lru_frames, &a->empty, pf);
+}
+
+// Frame to replace for a miss on pn, not being written, NULL if none
+BM_PageFrame* findARCFrame(BM_StrategyInfo *si, PageNumber pn)
+{
+  struct BM_ARC *a= si->arc;
+  BM_PageFrame *pf;
+  int ghost, p;
+
+  if ((pf= firstFree(si, &a->empty)))
+    return pf;
+
+  // T1 if above its target, or at it and pn was replaced from T2
+  p= adaptedTarget(a, pn, &ghost);
+  if (a->t1Size > 0 &&
+      (a->t1Size > p ||
+       (ghost != GHOST_NIL && a->ghosts[ghost].list == ARC_B2 && a->t1Size == p)))
+  {
+    if ((pf= firstFree(si, &a->t1)))
+      return pf;
+    return firstFree(si, &a->t2);
+  }
+  if ((pf= firstFree(si, &a->t2)))
+    return pf;
+  return firstFree(si, &a->t1);
+}
@@ -0,0 +1,14 @@
+#ifndef ARC_H
+#define ARC_H
+#include "buffer_mgr.h"
+
+// ARC state of a partition, see arc.c. Caller holds the partition
+// lock.
+void initARC         (BM_StrategyInfo *si, int numFrames);
+void freeARC         (BM_StrategyInfo *si);
+void pinARCFrame     (BM_StrategyInfo *si, BM_PageFrame *pf);
+void claimARCFrame   (BM_StrategyInfo *si, BM_PageFrame *pf,
+                      PageNumber oldPn, PageNumber newPn);
+void releaseARCFrame (BM_StrategyInfo *si, BM_PageFrame *pf);
+BM_PageFrame* findARCFrame (BM_StrategyInfo *si, PageNumber pn);
+#endif
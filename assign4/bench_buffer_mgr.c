@@ -0,0 +1,581 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "dberror.h"
+#include "storage_mgr.h"
+#include "buffer_mgr.h"
+
+/*
+ * Buffer manager micro benchmarks.
+ *
+ * Usage: bench_buffer_mgr [name ...]
+ * Runs every benchmark when no name is given.
+ */
+
+#define BENCH_FILE      "bench_bufferpool.bin"
+#define BENCH_PAGES     8192  // 32MB page file
+#define POOL_FRAMES     1024
+#define PINS_PER_RUN    (256*1024)
+#define MAX_THREADS     32
+
+typedef struct Bench {
+    char *name;
+    void (*run)(void);
+} Bench;
+
+// Wall clock in seconds
+static double now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec/1e6;
+}
+
+// Simple per thread random generator, rand() is not thread safe.
+static unsigned int nextRand(unsigned int *seed)
+{
+    *seed= *seed * 1103515245 + 12345;
+    return (*seed >> 16) & 0x7fff;
+}
+
+// Create page file with numPages pages, each page stamped with its number
+static void createBenchFile(int numPages)
+{
+    SM_FileHandle fh;
+    char page[PAGE_SIZE];
+    int i;
+
+    destroyPageFile(BENCH_FILE);
+    CHECK(createPageFile(BENCH_FILE));
+    CHECK(openPageFile(BENCH_FILE, &fh));
+    for (i=0; i<numPages; i++)
+    {
+        memset(page, 0, PAGE_SIZE);
+        *(int*)page= i;
+        CHECK(writeBlock(i, &fh, page));
+    }
+    CHECK(closePageFile(&fh));
+}
+
+/*
+ * pin: random pinPage/unpinPage from N threads sharing one pool
+ */
+typedef struct PinArgs {
+    BM_BufferPool *bm;
+    int numPins;
+    int numPages;   // Pages pinned are [0, numPages)
+    int dirtyEvery; // markDirty every n-th pin, 0 for never
+    unsigned int seed;
+} PinArgs;
+
+static void *randomPinner(void *arg)
+{
+    PinArgs *pa= (PinArgs*) arg;
+    BM_PageHandle h;
+    int i, pn;
+
+    for (i=0; i<pa->numPins; i++)
+    {
+        pn= (nextRand(&pa->seed) << 15 | nextRand(&pa->seed)) % pa->numPages;
+        CHECK(pinPage(pa->bm, &h, pn));
+        if (*(int*)h.data != pn)
+        {
+            printf("page %d has wrong content %d\n", pn, *(int*)h.data);
+            exit(1);
+        }
+        if (pa->dirtyEvery && i % pa->dirtyEvery == 0)
+            CHECK(markDirty(pa->bm, &h));
+        CHECK(unpinPage(pa->bm, &h));
+    }
+    return NULL;
+}
+
+// Pins per second from nThreads, over pages [0, numPages)
+static double runPinners(BM_BufferPool *bm, int nThreads, int numPages, int dirtyEvery)
+{
+    pthread_t tid[MAX_THREADS];
+    PinArgs args[MAX_THREADS];
+    double start;
+    int i;
+
+    start= now();
+    for (i=0; i<nThreads; i++)
+    {
+        args[i].bm= bm;
+        args[i].numPins= PINS_PER_RUN / nThreads;
+        args[i].numPages= numPages;
+        args[i].dirtyEvery= dirtyEvery;
+        args[i].seed= i+1;
+        pthread_create(&tid[i], NULL, randomPinner, &args[i]);
+    }
+    for (i=0; i<nThreads; i++)
+        pthread_join(tid[i], NULL);
+    return PINS_PER_RUN / (now()-start);
+}
+
+static void benchPin()
+{
+    BM_BufferPool bm;
+    int nThreads;
+    double hit, miss, hitBase= 0, missBase= 0;
+
+    createBenchFile(BENCH_PAGES);
+    CHECK(initBufferPool(&bm, BENCH_FILE, POOL_FRAMES, RS_LRU, NULL));
+
+    printf("pin: random pinPage+unpinPage, %d frame pool in %d partitions, LRU\n",
+           POOL_FRAMES, ((BM_Pool_MgmtData*) bm.mgmtData)->numPartitions);
+    printf("%8s %12s %9s %12s %9s\n", "threads", "hits/sec", "speedup",
+           "mixed/sec", "speedup");
+
+    for (nThreads=1; nThreads<=MAX_THREADS; nThreads*=2)
+    {
+        // Half the pool, after the first run all hits
+        runPinners(&bm, 1, POOL_FRAMES/2, 0);
+        hit= runPinners(&bm, nThreads, POOL_FRAMES/2, 0);
+        // Whole file, mostly misses, some write backs
+        miss= runPinners(&bm, nThreads, BENCH_PAGES, 16);
+        if (nThreads == 1)
+        {
+            hitBase= hit;
+            missBase= miss;
+        }
+        printf("%8d %12.0f %8.2fx %12.0f %8.2fx\n", nThreads,
+               hit, hit/hitBase, miss, miss/missBase);
+    }
+
+    CHECK(shutdownBufferPool(&bm));
+    CHECK(destroyPageFile(BENCH_FILE));
+    printf("\n");
+}
+
+/*
+ * hit: latency of pinPage+unpinPage of pages already in the pool,
+ * unpinned or held pinned by someone else
+ */
+#define HOT_PAGES       16
+#define HITS_PER_RUN    (1024*1024)
+
+static double hitLatency(BM_BufferPool *bm)
+{
+    BM_PageHandle h;
+    double start;
+    int i;
+
+    start= now();
+    for (i=0; i<HITS_PER_RUN; i++)
+    {
+        CHECK(pinPage(bm, &h, i % HOT_PAGES));
+        CHECK(unpinPage(bm, &h));
+    }
+    return (now()-start)*1e9 / HITS_PER_RUN;
+}
+
+static void benchHit()
+{
+    BM_BufferPool bm;
+    BM_PageHandle held[HOT_PAGES];
+    double unpinnedNs, pinnedNs;
+    int i;
+
+    createBenchFile(HOT_PAGES);
+    CHECK(initBufferPool(&bm, BENCH_FILE, POOL_FRAMES, RS_LRU, NULL));
+
+    printf("hit: pinPage+unpinPage of %d resident pages, %d frame pool, LRU\n",
+           HOT_PAGES, POOL_FRAMES);
+    printf("%14s %14s\n", "unpinned ns", "pinned ns");
+
+    for (i=0; i<HOT_PAGES; i++)
+    {
+        CHECK(pinPage(&bm, &held[i], i));
+        CHECK(unpinPage(&bm, &held[i]));
+    }
+    unpinnedNs= hitLatency(&bm);
+
+    for (i=0; i<HOT_PAGES; i++)
+        CHECK(pinPage(&bm, &held[i], i));
+    pinnedNs= hitLatency(&bm);
+    for (i=0; i<HOT_PAGES; i++)
+        CHECK(unpinPage(&bm, &held[i]));
+
+    printf("%14.1f %14.1f\n", unpinnedNs, pinnedNs);
+
+    CHECK(shutdownBufferPool(&bm));
+    CHECK(destroyPageFile(BENCH_FILE));
+    printf("\n");
+}
+
+/*
+ * cycle: pin/unpin cycles per second on resident pages, where every
+ * unpin frees the frame for replacement and every pin takes it back
+ */
+#define CYCLE_PAGES     256
+
+static void benchCycle()
+{
+    ReplacementStrategy strategies[]= { RS_FIFO, RS_LRU, RS_CLOCK };
+    char *names[]= { "FIFO", "LRU", "CLOCK" };
+    BM_BufferPool bm;
+    BM_PageHandle h;
+    unsigned int seed= 1;
+    double start;
+    int s, i;
+
+    printf("cycle: pinPage+unpinPage of %d resident pages in random order\n", CYCLE_PAGES);
+    printf("%8s %14s\n", "strategy", "cycles/sec");
+
+    createBenchFile(CYCLE_PAGES);
+    for (s=0; s<3; s++)
+    {
+        CHECK(initBufferPool(&bm, BENCH_FILE, CYCLE_PAGES, strategies[s], NULL));
+        for (i=0; i<CYCLE_PAGES; i++)
+        {
+            CHECK(pinPage(&bm, &h, i));
+            CHECK(unpinPage(&bm, &h));
+        }
+
+        start= now();
+        for (i=0; i<HITS_PER_RUN; i++)
+        {
+            CHECK(pinPage(&bm, &h, nextRand(&seed) % CYCLE_PAGES));
+            CHECK(unpinPage(&bm, &h));
+        }
+        printf("%8s %14.0f\n", names[s], HITS_PER_RUN / (now()-start));
+        CHECK(shutdownBufferPool(&bm));
+    }
+
+    CHECK(destroyPageFile(BENCH_FILE));
+    printf("\n");
+}
+
+/*
+ * zipf: hit ratio and pins per second of the replacement strategies.
+ * Page ranks Zipf distributed (s=1) over the file, alone and with a
+ * sequential scan taking every SCAN_EVERY-th pin. And lookups: pins
+ * spread evenly over HOT_SET pages, e.g. the inner and leaf pages of
+ * an index, with a scan taking every other pin.
+ */
+#define ZIPF_FRAMES     512
+#define ZIPF_PINS       (256*1024)
+#define SCAN_EVERY      4
+#define HOT_SET         384
+
+enum { ZIPF, ZIPF_SCAN, LOOKUP_SCAN };
+
+static double zipfCdf[BENCH_PAGES];
+
+static void initZipf()
+{
+    double sum= 0;
+    int r;
+
+    for (r=0; r<BENCH_PAGES; r++)
+        zipfCdf[r]= (sum+= 1.0/(r+1));
+    for (r=0; r<BENCH_PAGES; r++)
+        zipfCdf[r]/= sum;
+}
+
+// Page of a Zipf distributed rank, hot pages spread over the file
+static int nextZipfPage(unsigned int *seed)
+{
+    double u= (nextRand(seed) << 15 | nextRand(seed)) / (double) (1 << 30);
+    int lo= 0, hi= BENCH_PAGES-1, mid;
+
+    while (lo < hi)
+    {
+        mid= (lo+hi)/2;
+        if (zipfCdf[mid] < u)
+            lo= mid+1;
+        else
+            hi= mid;
+    }
+    return (int) ((lo * 5077LL) % BENCH_PAGES);
+}
+
+// Hit ratio of ZIPF_PINS pins after as many to warm up, *pinsPerSec set
+static double workloadHitRatio(ReplacementStrategy strategy, int workload,
+                               double *pinsPerSec)
+{
+    BM_BufferPool bm;
+    BM_PageHandle h;
+    unsigned int seed= 1;
+    int i, pn, scanPage= 0, reads= 0;
+    double start= 0;
+
+    CHECK(initBufferPool(&bm, BENCH_FILE, ZIPF_FRAMES, strategy, NULL));
+    for (i=0; i<2*ZIPF_PINS; i++)
+    {
+        if (i == ZIPF_PINS)
+        {
+            reads= getNumReadIO(&bm);
+            start= now();
+        }
+        if (workload == ZIPF_SCAN && i % SCAN_EVERY == 0)
+            pn= scanPage++ % BENCH_PAGES;
+        else if (workload == LOOKUP_SCAN && i % 2 == 0)
+            pn= HOT_SET + scanPage++ % (BENCH_PAGES - HOT_SET);
+        else if (workload == LOOKUP_SCAN)
+            pn= (nextRand(&seed) << 15 | nextRand(&seed)) % HOT_SET;
+        else
+            pn= nextZipfPage(&seed);
+        CHECK(pinPage(&bm, &h, pn));
+        CHECK(unpinPage(&bm, &h));
+    }
+    *pinsPerSec= ZIPF_PINS / (now()-start);
+    reads= getNumReadIO(&bm) - reads;
+    CHECK(shutdownBufferPool(&bm));
+    return 1 - (double) reads / ZIPF_PINS;
+}
+
+static void benchZipf()
+{
+    ReplacementStrategy strategies[]= { RS_FIFO, RS_LRU, RS_CLOCK, RS_LFU, RS_LRU_K, RS_ARC,
+                                        RS_CLOCK_PRO };
+    char *names[]= { "FIFO", "LRU", "CLOCK", "LFU", "LRU-2", "ARC", "CLK-Pro" };
+    double hit, pps;
+    int s, w;
+
+    printf("zipf: %d frame pool, %d page file, hit ratio and pins/sec\n",
+           ZIPF_FRAMES, BENCH_PAGES);
+    printf("  zipf: Zipf s=1, +scan: and a scan taking 1/%d of pins\n", SCAN_EVERY);
+    printf("  lookup+scan: %d pages evenly and a scan taking 1/2 of pins\n", HOT_SET);
+    printf("%8s %19s %19s %19s\n", "strategy", "zipf", "zipf+scan", "lookup+scan");
+
+    createBenchFile(BENCH_PAGES);
+    initZipf();
+    for (s=0; s<7; s++)
+    {
+        printf("%8s", names[s]);
+        for (w= ZIPF; w <= LOOKUP_SCAN; w++)
+        {
+            hit= workloadHitRatio(strategies[s], w, &pps);
+            printf(" %6.1f%% %11.0f", 100*hit, pps);
+        }
+        printf("\n");
+    }
+
+    CHECK(destroyPageFile(BENCH_FILE));
+    printf("\n");
+}
+
+/*
+ * evict: cost of a miss in a mostly pinned pool, EVICT_FREE frames of
+ * each partition unpinned, as pools grow
+ */
+#define EVICT_FREE      4
+#define EVICT_MISSES    (64*1024)
+
+// Pin pages from 0 on until each partition has all but EVICT_FREE
+// frames pinned, returns the first page not pinned
+static int pinAllButFree(BM_BufferPool *bm)
+{
+    BM_Pool_MgmtData *mgmtData= bm->mgmtData;
+    BM_Partition *part;
+    BM_PageHandle h;
+    int pinned[BM_MAX_PARTITIONS]= { 0 };
+    int full= 0, pn, frame, p;
+
+    for (pn=0; full < mgmtData->numPartitions; pn++)
+    {
+        CHECK(pinPage(bm, &h, pn));
+        frame= (h.data - mgmtData->frameData) / bm->pageSize;
+        for (p=0; frame >= mgmtData->partitions[p].firstFrame +
+                          mgmtData->partitions[p].numFrames; p++)
+            ;
+        part= &mgmtData->partitions[p];
+        if (pinned[p] < part->numFrames - EVICT_FREE)
+        {
+            if (++pinned[p] == part->numFrames - EVICT_FREE)
+                full++;
+        }
+        else
+            CHECK(unpinPage(bm, &h));
+    }
+    return pn;
+}
+
+static void unpinAll(BM_BufferPool *bm, int numPages)
+{
+    int *fixCounts= getFixCounts(bm);
+    PageNumber *pages= getFrameContents(bm);
+    BM_PageHandle h;
+    int i;
+
+    for (i=0; i<numPages; i++)
+        if (fixCounts[i])
+        {
+            h.pageNum= pages[i];
+            CHECK(unpinPage(bm, &h));
+        }
+    free(fixCounts);
+    free(pages);
+}
+
+static void benchEvict()
+{
+    ReplacementStrategy strategies[]= { RS_LRU, RS_CLOCK, RS_CLOCK_PRO };
+    int sizes[]= { 4096, 32768, 262144 };
+    BM_BufferPool bm;
+    BM_PageHandle h;
+    double start, ns[3];
+    int s, n, i, next;
+
+    printf("evict: ns per miss, all but %d frames per partition pinned\n", EVICT_FREE);
+    printf("%8s %10s %10s %10s\n", "frames", "LRU", "CLOCK", "CLOCK-Pro");
+
+    for (n=0; n<3; n++)
+    {
+        destroyPageFile(BENCH_FILE);
+        CHECK(createPageFile(BENCH_FILE));
+        for (s=0; s<3; s++)
+        {
+            CHECK(initBufferPool(&bm, BENCH_FILE, sizes[n], strategies[s], NULL));
+            next= pinAllButFree(&bm);
+            start= now();
+            for (i=0; i<EVICT_MISSES; i++)
+            {
+                CHECK(pinPage(&bm, &h, next + i));
+                CHECK(unpinPage(&bm, &h));
+            }
+            ns[s]= (now()-start)*1e9 / EVICT_MISSES;
+            unpinAll(&bm, sizes[n]);
+            CHECK(shutdownBufferPool(&bm));
+        }
+        printf("%8d %10.0f %10.0f %10.0f\n", sizes[n], ns[0], ns[1], ns[2]);
+    }
+
+    CHECK(destroyPageFile(BENCH_FILE));
+    printf("\n");
+}
+
+/*
+ * write: random pins over the whole file, most of them dirtying the
+ * page, with and without the background writer
+ */
+#define WRITER_HIGH     20  // Percent of frames dirty
+#define WRITER_LOW      10
+
+static void benchWrite()
+{
+    int dirtyEvery[]= { 1, 4 };
+    int threads[]= { 1, 4 };
+    BM_BufferPool bm;
+    double rate;
+    int d, t, w, fg, bg;
+
+    createBenchFile(BENCH_PAGES);
+
+    printf("write: random pins over %d pages, %d frames, LRU, background writer at %d%%..%d%% dirty\n",
+           BENCH_PAGES, POOL_FRAMES, WRITER_HIGH, WRITER_LOW);
+    printf("%8s %8s %7s %12s %10s %10s\n", "dirty", "threads", "writer",
+           "pins/sec", "fg writes", "bg writes");
+
+    for (d=0; d<2; d++)
+        for (t=0; t<2; t++)
+            for (w=0; w<2; w++)
+            {
+                CHECK(initBufferPool(&bm, BENCH_FILE, POOL_FRAMES, RS_LRU, NULL));
+                runPinners(&bm, 1, BENCH_PAGES, dirtyEvery[d]); // Fill the pool
+                if (w)
+                    CHECK(startBackgroundWriter(&bm, WRITER_HIGH, WRITER_LOW));
+                fg= getNumForegroundWriteIO(&bm);
+                bg= getNumBackgroundWriteIO(&bm);
+                rate= runPinners(&bm, threads[t], BENCH_PAGES, dirtyEvery[d]);
+                printf("%7d%% %8d %7s %12.0f %10d %10d\n", 100 / dirtyEvery[d],
+                       threads[t], w ? "on" : "off", rate,
+                       getNumForegroundWriteIO(&bm) - fg,
+                       getNumBackgroundWriteIO(&bm) - bg);
+                CHECK(shutdownBufferPool(&bm));
+            }
+
+    CHECK(destroyPageFile(BENCH_FILE));
+    printf("\n");
+}
+
+/*
+ * prefetch: sequential scan of a file not in the pool, reading each
+ * page's bytes, with the pool reading pages ahead or not. The file is
+ * opened with SM_OPEN_DIRECT, so reads go to the device.
+ */
+#define PREFETCH_SCAN   4096
+
+static volatile long long scanSum; // Keeps the reads of page bytes
+
+static double scanRate(int window)
+{
+    BM_BufferPool bm;
+    BM_PageHandle h;
+    double start;
+    long long sum= 0;
+    int pn, i;
+
+    CHECK(initBufferPoolWithFlags(&bm, BENCH_FILE, POOL_FRAMES, RS_LRU, NULL,
+                                  SM_OPEN_DIRECT));
+    start= now();
+    if (window)
+        CHECK(prefetchRange(&bm, 0, window));
+    for (pn=0; pn<PREFETCH_SCAN; pn++)
+    {
+        if (window)
+            CHECK(prefetchPage(&bm, pn+window));
+        CHECK(pinPage(&bm, &h, pn));
+        for (i=0; i<bm.pageSize; i+= sizeof(int))
+            sum+= *(int*) (h.data+i);
+        CHECK(unpinPage(&bm, &h));
+    }
+    start= now()-start;
+    CHECK(shutdownBufferPool(&bm));
+    scanSum= sum;
+    return PREFETCH_SCAN / start;
+}
+
+static void benchPrefetch()
+{
+    int windows[]= { 0, 8, 32, 128 };
+    int w;
+
+    createBenchFile(BENCH_PAGES);
+
+    printf("prefetch: sequential scan of %d pages, %d frames, direct I/O\n",
+           PREFETCH_SCAN, POOL_FRAMES);
+    printf("%8s %12s\n", "window", "pages/sec");
+    for (w=0; w<4; w++)
+        printf("%8d %12.0f\n", windows[w], scanRate(windows[w]));
+
+    CHECK(destroyPageFile(BENCH_FILE));
+    printf("\n");
+}
+
+static Bench benches[]= {
+    { "pin", benchPin },
+    { "hit", benchHit },
+    { "cycle", benchCycle },
+    { "zipf", benchZipf },
+    { "evict", benchEvict },
+    { "write", benchWrite },
+    { "prefetch", benchPrefetch },
+    { NULL, NULL }
+};
+
+int main(int argc, char **argv)
+{
+    Bench *b;
+    int i;
+
+    initStorageManager();
+    for (b= benches; b->name; b++)
+    {
+        if (argc > 1)
+        {
+            for (i=1; i<argc; i++)
+                if (!strcmp(argv[i], b->name))
+                    break;
+            if (i == argc)
+                continue;
+        }
+        b->run();
+    }
+    shutdownStorageManager();
+    return 0;
+}
@@ -0,0 +1,945 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+
+#include "dberror.h"
+#include "storage_mgr.h"
+#include "buffer_mgr.h"
+#include "tables.h"
+#include "crc32c.h"
+
+/*
+ * Storage manager micro benchmarks.
+ *
+ * Usage: bench_storage_mgr [name ...]
+ * Runs every benchmark when no name is given.
+ */
+
+#define BENCH_FILE      "bench_pagefile.bin"
+#define BENCH_PAGES     8192  // 32MB page file
+#define READS_PER_RUN   (64*1024)
+#define MAX_THREADS     16
+
+// Wall clock in seconds
+static double now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec/1e6;
+}
+
+// Simple per thread random generator, rand() is not thread safe.
+static unsigned int nextRand(unsigned int *seed)
+{
+    *seed= *seed * 1103515245 + 12345;
+    return (*seed >> 16) & 0x7fff;
+}
+
+// Create page file with numPages pages, each page stamped with its number
+static void createBenchFile(int numPages)
+{
+    SM_FileHandle fh;
+    char page[PAGE_SIZE];
+    int i;
+
+    destroyPageFile(BENCH_FILE);
+    CHECK(createPageFile(BENCH_FILE));
+    CHECK(openPageFile(BENCH_FILE, &fh));
+    for (i=0; i<numPages; i++)
+    {
+        memset(page, 0, PAGE_SIZE);
+        *(int*)page= i;
+        CHECK(writeBlock(i, &fh, page));
+    }
+    CHECK(closePageFile(&fh));
+}
+
+/*
+ * threads: random readBlock() from N threads sharing one handle
+ */
+typedef struct ReaderArgs {
+    SM_FileHandle *fh;
+    int numReads;
+    unsigned int seed;
+} ReaderArgs;
+
+static void *randomReader(void *arg)
+{
+    ReaderArgs *ra= (ReaderArgs*) arg;
+    char page[PAGE_SIZE];
+    int i, pn;
+
+    for (i=0; i<ra->numReads; i++)
+    {
+        pn= nextRand(&ra->seed) % BENCH_PAGES;
+        CHECK(readBlock(pn, ra->fh, page));
+        if (*(int*)page != pn)
+        {
+            printf("page %d has wrong content %d\n", pn, *(int*)page);
+            exit(1);
+        }
+    }
+    return NULL;
+}
+
+static void benchThreads()
+{
+    SM_FileHandle fh;
+    pthread_t tid[MAX_THREADS];
+    ReaderArgs args[MAX_THREADS];
+    int nThreads, i;
+    double start, elapsed;
+
+    printf("threads: random %d-byte readBlock, one shared handle\n", PAGE_SIZE);
+    printf("%8s %12s %10s\n", "threads", "pages/sec", "speedup");
+
+    createBenchFile(BENCH_PAGES);
+    CHECK(openPageFile(BENCH_FILE, &fh));
+
+    double base= 0;
+    for (nThreads=1; nThreads<=MAX_THREADS; nThreads*=2)
+    {
+        start= now();
+        for (i=0; i<nThreads; i++)
+        {
+            args[i].fh= &fh;
+            args[i].numReads= READS_PER_RUN / nThreads;
+            args[i].seed= i+1;
+            pthread_create(&tid[i], NULL, randomReader, &args[i]);
+        }
+        for (i=0; i<nThreads; i++)
+            pthread_join(tid[i], NULL);
+        elapsed= now()-start;
+
+        double rate= READS_PER_RUN / elapsed;
+        if (nThreads == 1)
+            base= rate;
+        printf("%8d %12.0f %9.2fx\n", nThreads, rate, rate/base);
+    }
+
+    CHECK(closePageFile(&fh));
+    CHECK(destroyPageFile(BENCH_FILE));
+    printf("\n");
+}
+
+/*
+ * handles: per call overhead of readBlock() as number of open files grows
+ */
+#define HANDLE_STEPS    5
+#define CALLS_PER_RUN   (256*1024)
+
+static void benchHandles()
+{
+    int counts[HANDLE_STEPS]= { 1, 16, 256, 4096, 8192 };
+    SM_FileHandle *fhs;
+    char page[PAGE_SIZE];
+    unsigned int seed= 1;
+    int step, i, opened= 0;
+    double start, readNs, checkNs;
+
+    printf("handles: readBlock cost vs. open handles\n");
+    printf("%8s %14s %18s\n", "handles", "readBlock ns", "handle check ns");
+
+    createBenchFile(BENCH_PAGES);
+    fhs= (SM_FileHandle*) malloc(counts[HANDLE_STEPS-1]*sizeof(SM_FileHandle));
+
+    for (step=0; step<HANDLE_STEPS; step++)
+    {
+        for (; opened<counts[step]; opened++)
+            if (openPageFile(BENCH_FILE, &fhs[opened]) != RC_OK)
+                break; // Out of fd's
+        if (opened < counts[step])
+        {
+            printf("%8d  (could not open, fd limit)\n", counts[step]);
+            break;
+        }
+
+        // Full read of a cached page
+        start= now();
+        for (i=0; i<CALLS_PER_RUN; i++)
+            CHECK(readBlock(nextRand(&seed) % BENCH_PAGES, &fhs[opened/2], page));
+        readNs= (now()-start)*1e9 / CALLS_PER_RUN;
+
+        // Rejected read, so only handle validation is timed
+        start= now();
+        for (i=0; i<CALLS_PER_RUN; i++)
+            readBlock(-1, &fhs[opened/2], page);
+        checkNs= (now()-start)*1e9 / CALLS_PER_RUN;
+
+        printf("%8d %14.0f %18.1f\n", opened, readNs, checkNs);
+    }
+
+    for (i=0; i<opened; i++)
+        CHECK(closePageFile(&fhs[i]));
+    free(fhs);
+    CHECK(destroyPageFile(BENCH_FILE));
+    printf("\n");
+}
+
+/*
+ * opens: open, read one page, close, from N threads with a handle each
+ */
+#define OPENS_PER_RUN   (16*1024)
+
+static void *openReadClose(void *arg)
+{
+    SM_FileHandle fh;
+    char page[PAGE_SIZE];
+    int i, n= *(int*) arg;
+
+    for (i=0; i<n; i++)
+    {
+        CHECK(openPageFile(BENCH_FILE, &fh));
+        CHECK(readBlock(i % BENCH_PAGES, &fh, page));
+        CHECK(closePageFile(&fh));
+    }
+    return NULL;
+}
+
+static void benchOpens()
+{
+    pthread_t tid[MAX_THREADS];
+    int nThreads, i, perThread;
+    double start, elapsed, rate, base= 0;
+
+    printf("opens: openPageFile + readBlock + closePageFile, handle per thread\n");
+    printf("%8s %12s %10s\n", "threads", "opens/sec", "speedup");
+
+    createBenchFile(BENCH_PAGES);
+    for (nThreads=1; nThreads<=MAX_THREADS; nThreads*=2)
+    {
+        perThread= OPENS_PER_RUN / nThreads;
+        start= now();
+        for (i=0; i<nThreads; i++)
+            pthread_create(&tid[i], NULL, openReadClose, &perThread);
+        for (i=0; i<nThreads; i++)
+            pthread_join(tid[i], NULL);
+        elapsed= now()-start;
+
+        rate= OPENS_PER_RUN / elapsed;
+        if (nThreads == 1)
+            base= rate;
+        printf("%8d %12.0f %9.2fx\n", nThreads, rate, rate/base);
+    }
+
+    CHECK(destroyPageFile(BENCH_FILE));
+    printf("\n");
+}
+
+/*
+ * mmap: pread based readBlock vs. mapped readBlock vs. getBlockPtr
+ */
+#define MMAP_PASSES     8
+
+typedef enum ReadMode { READ_PREAD, READ_MMAP_COPY, READ_MMAP_PTR } ReadMode;
+
+// Read all pages once per pass, in order or at random. Returns pages/sec.
+static double readPages(SM_FileHandle *fh, ReadMode mode, int random)
+{
+    char page[PAGE_SIZE];
+    SM_PageHandle ptr;
+    unsigned int seed= 7;
+    int pass, i, pn;
+    long sum= 0;
+    double start= now();
+
+    for (pass=0; pass<MMAP_PASSES; pass++)
+        for (i=0; i<BENCH_PAGES; i++)
+        {
+            pn= random ? (int) (nextRand(&seed)*32768u + nextRand(&seed)) % BENCH_PAGES : i;
+            if (mode == READ_MMAP_PTR)
+            {
+                CHECK(getBlockPtr(pn, fh, &ptr));
+                sum+= *(int*)ptr;
+            }
+            else
+            {
+                CHECK(readBlock(pn, fh, page));
+                sum+= *(int*)page;
+            }
+        }
+
+    if (sum < 0) // Keep the reads
+        printf("bad sum\n");
+    return (double) MMAP_PASSES * BENCH_PAGES / (now()-start);
+}
+
+static void benchMmap()
+{
+    SM_FileHandle fh, mfh;
+    int r;
+
+    printf("mmap: %d page file, %d passes, pages/sec (page cache warm)\n",
+           BENCH_PAGES, MMAP_PASSES);
+    printf("%10s %14s %14s %14s\n", "order", "pread", "mmap copy", "mmap ptr");
+
+    createBenchFile(BENCH_PAGES);
+    CHECK(openPageFile(BENCH_FILE, &fh));
+    CHECK(openPageFileWithFlags(BENCH_FILE, &mfh, SM_OPEN_MMAP));
+
+    for (r=0; r<2; r++)
+        printf("%10s %14.0f %14.0f %14.0f\n", r ? "random" : "sequential",
+               readPages(&fh, READ_PREAD, r),
+               readPages(&mfh, READ_MMAP_COPY, r),
+               readPages(&mfh, READ_MMAP_PTR, r));
+
+    CHECK(closePageFile(&mfh));
+    CHECK(closePageFile(&fh));
+    CHECK(destroyPageFile(BENCH_FILE));
+    printf("\n");
+}
+
+/*
+ * vectored: full file scan with readBlock vs. readBlocks runs
+ */
+#define MAX_RUN_PAGES   256
+
+static void benchVectored()
+{
+    SM_FileHandle fh;
+    SM_PageHandle pages[MAX_RUN_PAGES];
+    int runs[]= { 1, 8, 32, 128, 256 };
+    int r, i, pn, n;
+    double start, elapsed;
+
+    printf("vectored: scan of %d pages, readBlocks() run length sweep\n", BENCH_PAGES);
+    printf("%8s %10s %12s %10s\n", "run", "syscalls", "pages/sec", "speedup");
+
+    createBenchFile(BENCH_PAGES);
+    CHECK(openPageFile(BENCH_FILE, &fh));
+    for (i=0; i<MAX_RUN_PAGES; i++)
+        pages[i]= (SM_PageHandle) malloc(PAGE_SIZE);
+
+    double base= 0;
+    for (r=0; r<sizeof(runs)/sizeof(runs[0]); r++)
+    {
+        start= now();
+        for (i=0; i<MMAP_PASSES; i++)
+            for (pn=0; pn<BENCH_PAGES; pn+=runs[r])
+            {
+                n= (BENCH_PAGES-pn < runs[r]) ? BENCH_PAGES-pn : runs[r];
+                if (runs[r] == 1)
+                    CHECK(readBlock(pn, &fh, pages[0]))
+                else
+                    CHECK(readBlocks(pn, n, &fh, pages));
+                if (*(int*)pages[n-1] != pn+n-1)
+                {
+                    printf("page %d has wrong content\n", pn+n-1);
+                    exit(1);
+                }
+            }
+        elapsed= now()-start;
+
+        double rate= (double) MMAP_PASSES * BENCH_PAGES / elapsed;
+        if (r == 0)
+            base= rate;
+        printf("%8d %10d %12.0f %9.2fx\n", runs[r],
+               (BENCH_PAGES+runs[r]-1)/runs[r], rate, rate/base);
+    }
+
+    for (i=0; i<MAX_RUN_PAGES; i++)
+        free(pages[i]);
+    CHECK(closePageFile(&fh));
+    CHECK(destroyPageFile(BENCH_FILE));
+    printf("\n");
+}
+
+/*
+ * async: random single page reads through the async queue, keeping
+ * 'depth' requests in flight, for io_uring and thread pool backends
+ */
+#define ASYNC_MAX_DEPTH 64
+
+static double asyncReads(SM_FileHandle *fh, int depth, int flags)
+{
+    SM_AsyncQueue *queue;
+    SM_AsyncTicket tickets[ASYNC_MAX_DEPTH];
+    int expect[ASYNC_MAX_DEPTH];
+    SM_PageHandle pages[ASYNC_MAX_DEPTH];
+    unsigned int seed= 11;
+    int i, slot;
+    double start;
+
+    CHECK(initAsyncQueue(&queue, depth, flags));
+    for (i=0; i<depth; i++)
+        pages[i]= (SM_PageHandle) malloc(PAGE_SIZE);
+
+    start= now();
+    for (i=0; i<READS_PER_RUN+depth; i++)
+    {
+        slot= i % depth;
+        if (i >= depth)
+        {
+            // Oldest request in this slot must be done first
+            CHECK(waitAsyncIO(queue, tickets[slot]));
+            if (*(int*)pages[slot] != expect[slot])
+            {
+                printf("page %d has wrong content\n", expect[slot]);
+                exit(1);
+            }
+        }
+        if (i < READS_PER_RUN)
+        {
+            expect[slot]= nextRand(&seed) % BENCH_PAGES;
+            CHECK(submitReadBlocks(queue, expect[slot], 1, fh, &pages[slot],
+                                   &tickets[slot]));
+        }
+    }
+    double rate= READS_PER_RUN / (now()-start);
+
+    for (i=0; i<depth; i++)
+        free(pages[i]);
+    CHECK(shutdownAsyncQueue(queue));
+    return rate;
+}
+
+static void benchAsync()
+{
+    SM_FileHandle fh;
+    SM_AsyncQueue *queue;
+    int depth, uring;
+
+    CHECK(initAsyncQueue(&queue, 1, SM_ASYNC_DEFAULT));
+    uring= isAsyncQueueUring(queue);
+    CHECK(shutdownAsyncQueue(queue));
+
+    printf("async: random single page reads, queue depth sweep, pages/sec\n");
+    if (!uring)
+        printf("(io_uring not available, both columns use threads)\n");
+    printf("%8s %14s %14s\n", "depth", "io_uring", "threads");
+
+    createBenchFile(BENCH_PAGES);
+    CHECK(openPageFile(BENCH_FILE, &fh));
+
+    for (depth=1; depth<=ASYNC_MAX_DEPTH; depth*=2)
+        printf("%8d %14.0f %14.0f\n", depth,
+               asyncReads(&fh, depth, SM_ASYNC_DEFAULT),
+               asyncReads(&fh, depth, SM_ASYNC_THREADS));
+
+    CHECK(closePageFile(&fh));
+    CHECK(destroyPageFile(BENCH_FILE));
+    printf("\n");
+}
+
+/*
+ * direct: buffer pool over a working set larger than the pool, with
+ * and without SM_OPEN_DIRECT. Memory is pool frames + file pages the
+ * kernel keeps cached, which direct I/O should bring close to zero.
+ */
+#define DIRECT_FILE_PAGES  16384 // 64MB working set
+#define DIRECT_POOL_PAGES  1000  // Same as openTable()/openBtree()
+#define DIRECT_PINS        (64*1024)
+
+// Drop (clean) cached pages of the file
+static void dropFileCache(char *fileName)
+{
+    int fd= open(fileName, O_RDONLY);
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+// Bytes of the file in kernel page cache
+static long cachedFileBytes(char *fileName)
+{
+    int fd= open(fileName, O_RDONLY);
+    long size= lseek(fd, 0, SEEK_END), pages, i, cached= 0;
+    long sysPage= sysconf(_SC_PAGESIZE);
+    unsigned char *vec;
+    void *map;
+
+    pages= (size+sysPage-1) / sysPage;
+    map= mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    vec= (unsigned char*) malloc(pages);
+    if (map != MAP_FAILED && mincore(map, size, vec) == 0)
+        for (i=0; i<pages; i++)
+            cached+= (vec[i] & 1);
+    if (map != MAP_FAILED)
+        munmap(map, size);
+    free(vec);
+    close(fd);
+    return cached*sysPage;
+}
+
+static void benchDirect()
+{
+    BM_BufferPool bm;
+    BM_PageHandle ph;
+    ReplacementStrategy strategies[]= { RS_FIFO, RS_LRU, RS_CLOCK };
+    char *names[]= { "FIFO", "LRU", "CLOCK" };
+    unsigned int seed;
+    int s, direct, i, pn;
+    double start, rate, poolMB, cacheMB;
+
+    printf("direct: %d frame pool, random pins over %d pages, 1 in 8 dirty\n",
+           DIRECT_POOL_PAGES, DIRECT_FILE_PAGES);
+    printf("%8s %8s %12s %10s %12s %10s\n", "strategy", "mode", "pins/sec",
+           "pool MB", "pgcache MB", "total MB");
+
+    createBenchFile(DIRECT_FILE_PAGES);
+    poolMB= (double) DIRECT_POOL_PAGES*PAGE_SIZE / (1 << 20);
+
+    for (s=0; s<sizeof(strategies)/sizeof(strategies[0]); s++)
+        for (direct=0; direct<2; direct++)
+        {
+            dropFileCache(BENCH_FILE);
+            CHECK(initBufferPoolWithFlags(&bm, BENCH_FILE, DIRECT_POOL_PAGES,
+                                          strategies[s], NULL,
+                                          direct ? SM_OPEN_DIRECT : SM_OPEN_DEFAULT));
+            seed= 3;
+            start= now();
+            for (i=0; i<DIRECT_PINS; i++)
+            {
+                pn= (int) (nextRand(&seed)*32768u + nextRand(&seed)) % DIRECT_FILE_PAGES;
+                CHECK(pinPage(&bm, &ph, pn));
+                if (*(int*)ph.data != pn)
+                {
+                    printf("page %d has wrong content\n", pn);
+                    exit(1);
+                }
+                if ((i & 7) == 0)
+                    CHECK(markDirty(&bm, &ph));
+                CHECK(unpinPage(&bm, &ph));
+            }
+            rate= DIRECT_PINS / (now()-start);
+            cacheMB= (double) cachedFileBytes(BENCH_FILE) / (1 << 20);
+            CHECK(shutdownBufferPool(&bm));
+
+            printf("%8s %8s %12.0f %10.1f %12.1f %10.1f\n", names[s],
+                   direct ? "direct" : "buffered", rate, poolMB, cacheMB,
+                   poolMB+cacheMB);
+        }
+
+    CHECK(destroyPageFile(BENCH_FILE));
+    printf("\n");
+}
+
+/*
+ * append: grow a file page by page with appendEmptyBlock(), extent
+ * size sweep, against writing a zero page per append
+ */
+#define APPEND_PAGES    16384
+
+// On disk fragments of the file, -1 if unknown
+static int fileExtents(char *fileName)
+{
+    struct fiemap fm;
+    int fd= open(fileName, O_RDONLY), rc;
+
+    memset(&fm, 0, sizeof(fm));
+    fm.fm_length= FIEMAP_MAX_OFFSET;
+    fm.fm_flags= FIEMAP_FLAG_SYNC;
+    rc= ioctl(fd, FS_IOC_FIEMAP, &fm);
+    close(fd);
+    return rc < 0 ? -1 : (int) fm.fm_mapped_extents;
+}
+
+static void benchAppend()
+{
+    SM_FileHandle fh;
+    char page[PAGE_SIZE];
+    int extents[]= { 0, 1, 16, 64, 256 }; // 0 = zero page writes
+    int e, i;
+    double start, rate;
+
+    printf("append: %d appended pages, extent size sweep\n", APPEND_PAGES);
+    printf("%8s %14s %12s\n", "extent", "appends/sec", "fragments");
+
+    memset(page, 0, PAGE_SIZE);
+    for (e=0; e<sizeof(extents)/sizeof(extents[0]); e++)
+    {
+        destroyPageFile(BENCH_FILE);
+        CHECK(createPageFile(BENCH_FILE));
+        CHECK(openPageFile(BENCH_FILE, &fh));
+        if (extents[e])
+            CHECK(setExtentSize(extents[e], &fh));
+
+        start= now();
+        for (i=0; i<APPEND_PAGES; i++)
+            if (extents[e])
+                CHECK(appendEmptyBlock(&fh))
+            else
+                CHECK(writeBlock(fh.totalNumPages, &fh, page));
+        rate= APPEND_PAGES / (now()-start);
+        CHECK(closePageFile(&fh));
+
+        if (extents[e])
+            printf("%8d %14.0f %12d\n", extents[e], rate, fileExtents(BENCH_FILE));
+        else
+            printf("%8s %14.0f %12d\n", "write", rate, fileExtents(BENCH_FILE));
+    }
+
+    CHECK(destroyPageFile(BENCH_FILE));
+    printf("\n");
+}
+
+/*
+ * compress: plain against compressed page file, for pages like those of
+ * tables (fixed length records, padded strings), B-tree leaves (keys
+ * as Values) and random bytes. Ratio is page bytes over file size,
+ * scans read every page in order, cold ones after dropping the cache.
+ */
+#define COMPRESS_PAGES  8192
+#define NAME_LENGTH     32
+
+typedef struct LeafElement {
+    long long ptr;
+    Value key;
+} LeafElement;
+
+// Records of an int key and a zero padded string, as the record manager
+static void fillTablePage(char *page, int pn, unsigned int *seed)
+{
+    int recordSize= sizeof(int) + NAME_LENGTH, r;
+    char *record;
+
+    memset(page, 0, PAGE_SIZE);
+    for (r=0; (r+1)*recordSize <= PAGE_SIZE; r++)
+    {
+        record= page + r*recordSize;
+        *(int*)record= pn*100 + r;
+        snprintf(record + sizeof(int), NAME_LENGTH, "customer %u",
+                 nextRand(seed) % 10000);
+    }
+}
+
+// Sorted int keys with their RIDs, as a B-tree leaf
+static void fillLeafPage(char *page, int pn, unsigned int *seed)
+{
+    LeafElement *el= (LeafElement*) (page + 32);
+    int i;
+
+    memset(page, 0, PAGE_SIZE);
+    for (i=0; (i+1)*sizeof(LeafElement) <= PAGE_SIZE-32; i++)
+    {
+        el[i].key.dt= DT_INT;
+        el[i].key.v.intV= pn*1000 + i*3 + nextRand(seed) % 3;
+        el[i].ptr= ((long long) (pn*7 + i/20) << 16) | (i % 20);
+    }
+}
+
+static void fillRandomPage(char *page, int pn, unsigned int *seed)
+{
+    int i;
+
+    for (i=0; i<PAGE_SIZE; i++)
+        page[i]= (char) nextRand(seed);
+}
+
+// Read every page in order, MB/s
+static double scanPages(int cold)
+{
+    SM_FileHandle fh;
+    char page[PAGE_SIZE];
+    double start, elapsed;
+    int i;
+
+    if (cold)
+        dropFileCache(BENCH_FILE);
+    CHECK(openPageFile(BENCH_FILE, &fh));
+    start= now();
+    for (i=0; i<COMPRESS_PAGES; i++)
+        CHECK(readBlock(i, &fh, page));
+    elapsed= now()-start;
+    CHECK(closePageFile(&fh));
+    return (double) COMPRESS_PAGES*PAGE_SIZE / (1 << 20) / elapsed;
+}
+
+static void benchCompress()
+{
+    void (*fills[])(char*, int, unsigned int*)= { fillTablePage, fillLeafPage, fillRandomPage };
+    char *names[]= { "table", "btree", "random" };
+    SM_FileHandle fh;
+    char page[PAGE_SIZE];
+    unsigned int seed;
+    struct stat st;
+    int f, compressed, i;
+    double start, writeRate, ratio;
+
+    printf("compress: %d pages written then scanned, plain vs compressed file\n",
+           COMPRESS_PAGES);
+    printf("%8s %10s %10s %8s %12s %12s\n", "pages", "file", "write MB/s",
+           "ratio", "cold MB/s", "warm MB/s");
+
+    for (f=0; f<sizeof(fills)/sizeof(fills[0]); f++)
+        for (compressed=0; compressed<2; compressed++)
+        {
+            destroyPageFile(BENCH_FILE);
+            if (compressed)
+                CHECK(createCompressedPageFile(BENCH_FILE, PAGE_SIZE))
+            else
+                CHECK(createPageFile(BENCH_FILE));
+            CHECK(openPageFile(BENCH_FILE, &fh));
+            seed= 5;
+            start= now();
+            for (i=0; i<COMPRESS_PAGES; i++)
+            {
+                fills[f](page, i, &seed);
+                CHECK(writeBlock(i, &fh, page));
+            }
+            writeRate= (double) COMPRESS_PAGES*PAGE_SIZE / (1 << 20) / (now()-start);
+            CHECK(closePageFile(&fh));
+            stat(BENCH_FILE, &st);
+            ratio= (double) COMPRESS_PAGES*PAGE_SIZE / st.st_size;
+
+            printf("%8s %10s %10.0f %8.2f %12.0f %12.0f\n", names[f],
+                   compressed ? "compressed" : "plain", writeRate, ratio,
+                   scanPages(1), scanPages(0));
+        }
+
+    CHECK(destroyPageFile(BENCH_FILE));
+    printf("\n");
+}
+
+/*
+ * durability: writeBlock() + syncPageFile() commits from N threads,
+ * fdatasync per commit vs group commit
+ */
+#define COMMITS_PER_RUN 512
+
+typedef struct CommitArgs {
+    SM_FileHandle *fh;
+    int first, numCommits;
+} CommitArgs;
+
+static void *committer(void *arg)
+{
+    CommitArgs *ca= (CommitArgs*) arg;
+    char page[PAGE_SIZE];
+    int i;
+
+    memset(page, 0, PAGE_SIZE);
+    for (i=0; i<ca->numCommits; i++)
+    {
+        *(int*)page= ca->first+i;
+        CHECK(writeBlock(ca->first+i, ca->fh, page));
+        CHECK(syncPageFile(ca->fh));
+    }
+    return NULL;
+}
+
+static void benchDurability()
+{
+    SM_FileHandle fh;
+    pthread_t tid[MAX_THREADS];
+    CommitArgs args[MAX_THREADS];
+    int modes[]= { SM_DURABILITY_SYNC, SM_DURABILITY_GROUP, SM_DURABILITY_GROUP };
+    int windows[]= { 0, 0, SM_DEFAULT_GROUP_WINDOW_USEC };
+    int nThreads, m, i;
+    long long syncs;
+    double start, rate;
+
+    printf("durability: %d page commits (writeBlock + syncPageFile)\n", COMMITS_PER_RUN);
+    printf("%8s %8s %8s %12s %12s\n", "mode", "window", "threads", "commits/sec", "syncs");
+
+    createBenchFile(COMMITS_PER_RUN);
+    CHECK(openPageFile(BENCH_FILE, &fh));
+    for (m=0; m<sizeof(modes)/sizeof(modes[0]); m++)
+    {
+        CHECK(setDurability(&fh, modes[m], windows[m]));
+        for (nThreads=1; nThreads<=MAX_THREADS; nThreads*=4)
+        {
+            syncs= getNumSyncs(&fh);
+            start= now();
+            for (i=0; i<nThreads; i++)
+            {
+                args[i].fh= &fh;
+                args[i].numCommits= COMMITS_PER_RUN / nThreads;
+                args[i].first= i*args[i].numCommits;
+                pthread_create(&tid[i], NULL, committer, &args[i]);
+            }
+            for (i=0; i<nThreads; i++)
+                pthread_join(tid[i], NULL);
+            rate= COMMITS_PER_RUN / (now()-start);
+            printf("%8s %8d %8d %12.0f %12lld\n",
+                   modes[m] == SM_DURABILITY_SYNC ? "sync" : "group", windows[m],
+                   nThreads, rate, getNumSyncs(&fh)-syncs);
+        }
+    }
+
+    CHECK(closePageFile(&fh));
+    CHECK(destroyPageFile(BENCH_FILE));
+    printf("\n");
+}
+
+/*
+ * checksum: CRC32C speed, and readBlock with vs. without checking
+ * page checksums
+ */
+#define CRC_BYTES       (256 << 20)
+
+static double crcRate(unsigned int (*crc)(unsigned int, const void*, size_t))
+{
+    char page[PAGE_SIZE];
+    unsigned int sum= 0;
+    long done;
+    double start;
+
+    memset(page, 0x5a, PAGE_SIZE);
+    start= now();
+    for (done=0; done<CRC_BYTES; done+=PAGE_SIZE)
+        sum^= crc(sum, page, PAGE_SIZE);
+    if (sum == 1) // Keep the work
+        printf("bad sum\n");
+    return (double) CRC_BYTES / (1 << 20) / (now()-start);
+}
+
+static void benchChecksum()
+{
+    SM_FileHandle fh, nfh;
+    double checked, unchecked;
+    int r;
+
+    printf("checksum: CRC32C of %d byte pages, MB/s\n", PAGE_SIZE);
+    printf("%10s %14s %14s\n", "", "software", "crc32c()");
+    printf("%10s %14.0f %14.0f %s\n", "", crcRate(crc32cSoftware), crcRate(crc32c),
+           crc32cHardware() ? "(SSE4.2)" : "(no SSE4.2)");
+
+    printf("readBlock: %d page file, %d passes, pages/sec (page cache warm)\n",
+           BENCH_PAGES, MMAP_PASSES);
+    printf("%10s %14s %14s %10s\n", "order", "unchecked", "checked", "overhead");
+
+    createBenchFile(BENCH_PAGES);
+    CHECK(openPageFile(BENCH_FILE, &fh));
+    CHECK(openPageFileWithFlags(BENCH_FILE, &nfh, SM_OPEN_NO_VERIFY));
+    for (r=0; r<2; r++)
+    {
+        unchecked= readPages(&nfh, READ_PREAD, r);
+        checked= readPages(&fh, READ_PREAD, r);
+        printf("%10s %14.0f %14.0f %9.1f%%\n", r ? "random" : "sequential",
+               unchecked, checked, (unchecked/checked - 1) * 100);
+    }
+
+    CHECK(closePageFile(&nfh));
+    CHECK(closePageFile(&fh));
+    CHECK(destroyPageFile(BENCH_FILE));
+    printf("\n");
+}
+
+/*
+ * readahead: cold cache scans and point lookups, with and without
+ * access pattern hints. Lookups go through a mapped handle, page
+ * faults read around the page unless told not to.
+ */
+#define READAHEAD_PAGES   16384 // 64MB
+#define READAHEAD_WINDOW  256   // Pages advised ahead of the scan
+#define LOOKUPS           2048
+
+static double coldScan(int pattern, int window)
+{
+    SM_FileHandle fh;
+    char page[PAGE_SIZE];
+    double start;
+    int i;
+
+    dropFileCache(BENCH_FILE);
+    CHECK(openPageFile(BENCH_FILE, &fh));
+    CHECK(setAccessPattern(&fh, pattern));
+    start= now();
+    for (i=0; i<READAHEAD_PAGES; i++)
+    {
+        if (window && i % window == 0 && i + window < READAHEAD_PAGES)
+            CHECK(adviseBlocks(i + window, window, &fh, SM_ACCESS_WILLNEED));
+        CHECK(readBlock(i, &fh, page));
+    }
+    start= now()-start;
+    CHECK(closePageFile(&fh));
+    return (double) READAHEAD_PAGES*PAGE_SIZE / (1 << 20) / start;
+}
+
+static double coldLookups(int pattern, long *cachedBytes)
+{
+    SM_FileHandle fh;
+    char page[PAGE_SIZE];
+    unsigned int seed= 11;
+    double start;
+    int i;
+
+    dropFileCache(BENCH_FILE);
+    CHECK(openPageFileWithFlags(BENCH_FILE, &fh, SM_OPEN_MMAP));
+    CHECK(setAccessPattern(&fh, pattern));
+    start= now();
+    for (i=0; i<LOOKUPS; i++)
+        CHECK(readBlock((nextRand(&seed)*32768u + nextRand(&seed)) % READAHEAD_PAGES,
+                        &fh, page));
+    start= now()-start;
+    CHECK(closePageFile(&fh));
+    *cachedBytes= cachedFileBytes(BENCH_FILE);
+    return LOOKUPS / start;
+}
+
+static void benchReadahead()
+{
+    char *names[]= { "normal", "sequential", "random" };
+    long cached;
+    double rate;
+    int p;
+
+    printf("readahead: cold cache, %d page file\n", READAHEAD_PAGES);
+    printf("%12s %12s\n", "scan hint", "MB/s");
+    createBenchFile(READAHEAD_PAGES);
+    for (p=SM_ACCESS_NORMAL; p<=SM_ACCESS_RANDOM; p++)
+        printf("%12s %12.0f\n", names[p], coldScan(p, 0));
+    printf("%12s %12.0f\n", "willneed", coldScan(SM_ACCESS_NORMAL, READAHEAD_WINDOW));
+
+    printf("%12s %12s %12s\n", "lookup hint", "lookups/sec", "cached MB");
+    for (p=SM_ACCESS_NORMAL; p<=SM_ACCESS_RANDOM; p+= SM_ACCESS_RANDOM)
+    {
+        rate= coldLookups(p, &cached);
+        printf("%12s %12.0f %12.1f\n", names[p], rate, (double) cached / (1 << 20));
+    }
+
+    CHECK(destroyPageFile(BENCH_FILE));
+    printf("\n");
+}
+
+typedef struct Bench {
+    char *name;
+    void (*run)(void);
+} Bench;
+
+static Bench benches[]= {
+    { "threads", benchThreads },
+    { "handles", benchHandles },
+    { "opens", benchOpens },
+    { "mmap", benchMmap },
+    { "vectored", benchVectored },
+    { "async", benchAsync },
+    { "direct", benchDirect },
+    { "append", benchAppend },
+    { "durability", benchDurability },
+    { "compress", benchCompress },
+    { "checksum", benchChecksum },
+    { "readahead", benchReadahead },
+    { NULL, NULL }
+};
+
+int main(int argc, char **argv)
+{
+    Bench *b;
+    int i;
+
+    initStorageManager();
+    for (b= benches; b->name; b++)
+    {
+        if (argc > 1)
+        {
+            for (i=1; i<argc; i++)
+                if (!strcmp(argv[i], b->name))
+                    break;
+            if (i == argc)
+                continue;
+        }
+        b->run();
+    }
+    shutdownStorageManager();
+    return 0;
+}
@@ -18,11 +18,22 @@ typedef struct BT_MgmtData {
 } BT_MgmtData;
 
 typedef struct BT_NodeElement {
-	long long ptr; // if (leaf) ptr is a PageNumber
-	               // else ptr is a RID
-                   // long long = 8 bytes = sizeof(RID)
+	long long ptr; // if (leaf) ptr is a RID, packed by RID_TO_PTR()
+	               // else ptr is a PageNumber
 	Value key;
 } BT_NodeElement;
+
+// RID in a leaf element, page number above the slot bits
+#define RID_SLOT_BITS   16
+#define RID_TO_PTR(rid) (((long long) (rid).page << RID_SLOT_BITS) | (rid).slot)
+
+static RID ptrToRID(long long ptr)
+{
+    RID rid;
+    rid.page= ptr >> RID_SLOT_BITS;
+    rid.slot= (int) (ptr & ((1 << RID_SLOT_BITS)-1));
+    return rid;
+}
 // We keep elements in BT_Node sorted by keys.
 // Sorting is done by moving elements. We can consider
 // using 2 more points like BT_NodeElement *next, *prev in
@@ -51,27 +62,30 @@ typedef struct BT_ScanMgmtData {
 } BT_ScanMgmtData;
 
 // Supporting MACROS
-#define MAX_ELEMENTS()  (((PAGE_SIZE - sizeof(BT_Node))/sizeof(BT_NodeElement))-1)
+#define MAX_ELEMENTS(ps) ((((ps) - sizeof(BT_Node))/sizeof(BT_NodeElement))-1)
 #define IS_TRUE(tres)    (tres.v.boolV)
 #define IS_FALSE(tres)   (!tres.v.boolV)
 #define SPLIT_POINT(o)  ((o+1)/2)
-#define MIN_KEYS(t,n)   SPLIT_POINT(t->order)
+#define MIN_KEYS(t,leaf) ((leaf) ? SPLIT_POINT(t->order) : (t->order)/2)
 #define	CAPACITY(t)   (t->order)
 #define MAX_TREE_DEPTH  10000
 
 // Supporting functions
 // SCAN
 static BT_Node* findElement (BTreeHandle *tree, BT_Node *node, Value *key,
-                             int *elemPos, int *pageNum,
+                             int *elemPos, PageNumber *pageNum,
                              bool even_if_dont_match);
 
 // INSERT
 static int addKeyInNode(BTreeHandle *tree, BT_Node *node, long long ptr, Value *key);
-static int delKeyFromNode(BTreeHandle *tree, BT_Node *node, PageNumber ptr, Value *key);
-static int createBTNode(BTreeHandle *tree);
+static int delKeyFromNode(BTreeHandle *tree, BT_Node *node, Value *key);
+static PageNumber createBTNode(BTreeHandle *tree);
+static void freeBTNode(BTreeHandle *tree, PageNumber pn);
 static RC insertKeyInParent(BTreeHandle *tree, PageNumber leftPn, 
                             PageNumber rightPn, Value key);
 static RC splitAndInsertKey(BTreeHandle *tree, PageNumber pn, bool leaf);
+static void setParentNode(BTreeHandle *tree, PageNumber pn, PageNumber parentPn);
+static RC rebalanceNode(BTreeHandle *tree, PageNumber pn);
 static RC mergeElements(BTreeHandle *tree, PageNumber lpn, PageNumber rpn);
 static RC distributeElements(BTreeHandle *tree, PageNumber lpn, PageNumber rpn);
 
@@ -93,6 +107,33 @@ static void unpinBTNode(BTreeHandle *tree, PageNumber pn)
     unpinPage(&btmd->bm, &ph);
 }
 
+// Nodes are changed in place through the pinned frame, unpin
+// a changed node with this one, else the change is lost on eviction.
+static void unpinDirtyBTNode(BTreeHandle *tree, PageNumber pn)
+{
+    BT_MgmtData *btmd= (BT_MgmtData*) tree->mgmtData;
+    BM_PageHandle ph;
+
+    ph.pageNum= pn;
+    markDirty(&btmd->bm, &ph);
+    unpinPage(&btmd->bm, &ph);
+}
+
+// Scans know the next leaf, have the pool read it in while this one
+// is used. The pool skips it if it would have to write a node first,
+// the kernel still reads it ahead then.
+static void prefetchNextLeaf(BTreeHandle *tree, BT_Node *leaf)
+{
+    BT_MgmtData *btmd= (BT_MgmtData*) tree->mgmtData;
+    BM_Pool_MgmtData *pmd= btmd->bm.mgmtData;
+
+    if (leaf->nodePtr != -1)
+    {
+        adviseBlocks(leaf->nodePtr, 1, &pmd->fh, SM_ACCESS_WILLNEED);
+        prefetchPage(&btmd->bm, leaf->nodePtr);
+    }
+}
+
 // DELETE
 
 // init and shutdown index manager
@@ -125,25 +166,34 @@ RC shutdownIndexManager ()
 
 // create, destroy, open, and close an btree index
 RC createBtree (char *idxId, DataType keyType, int n)
+{
+    return createBtreeWithPageSize(idxId, keyType, n, PAGE_SIZE);
+}
+
+// Larger pages allow a higher order 'n', so a flatter tree
+RC createBtreeWithPageSize (char *idxId, DataType keyType, int n, int pageSize)
 {
     SM_FileHandle fh;
-    char data[PAGE_SIZE];
-    char *offset= data;
+    char *data;
+    char *offset;
     RC rc;
 
     // Initialized ?
     if ((rc=isStorageManagerInitialized()) != RC_OK)
         return(rc);
 
+    if (pageSize < SM_MIN_PAGE_SIZE || pageSize > SM_MAX_PAGE_SIZE)
+        RETURN(RC_INVALID_PAGE_SIZE);
+
     // Stop if 'n' (the order) is too high to fit in a page
-    if ( n > MAX_ELEMENTS())
+    if ( n > MAX_ELEMENTS(pageSize))
         RETURN(RC_ORDER_TOO_HIGH_FOR_PAGE);
 
     // rootPage, nodeCount, entryCount, keytype, order
-    memset(offset, 0, PAGE_SIZE);
-    *(int*)offset = 1; // At the begining page 1 contains root node.
+    offset= data= (char*) calloc(1, pageSize);
+    *(PageNumber*)offset = 1; // At the begining page 1 contains root node.
                        // Whenever new root is generated, we update this page.
-    offset+= sizeof(int);
+    offset+= sizeof(PageNumber);
 
     *(int*)offset = 0;
     offset+= sizeof(int);
@@ -158,19 +208,17 @@ RC createBtree (char *idxId, DataType keyType, int n)
     offset+= sizeof(int);
 
     // Create a file with 1 page index data
-    if ((rc=createPageFile(idxId)) != RC_OK)
-        return rc;
-
-    if ((rc=openPageFile(idxId, &fh)) != RC_OK)
-        return rc;
-
-    if ((rc=writeBlock(0, &fh, data)) != RC_OK)
-        return rc;
-
-    if ((rc=closePageFile(&fh)) != RC_OK)
-        return rc;
+    if ((rc=createPageFileWithPageSize(idxId, pageSize)) == RC_OK &&
+        (rc=openPageFile(idxId, &fh)) == RC_OK)
+    {
+        if ((rc=writeBlock(0, &fh, data)) == RC_OK)
+            rc=closePageFile(&fh);
+        else
+            closePageFile(&fh);
+    }
+    free(data);
 
-    RETURN(RC_OK);
+    return rc;
 }
 
 RC openBtree (BTreeHandle **tree, char *idxId)
@@ -195,10 +243,14 @@ RC openBtree (BTreeHandle **tree, char *idxId)
                             RS_LRU, NULL)) != RC_OK)
         return rc;
 
+    // Lookups jump between nodes, kernel readahead would only
+    // pollute the page cache. Scans prefetch their next leaf.
+    setAccessPattern(&((BM_Pool_MgmtData*) btmd->bm.mgmtData)->fh, SM_ACCESS_RANDOM);
+
     // Read page and prepare schema
     offset= (char*) getPinnedBTNode(*tree, (PageNumber)0);
     btmd->rootPage= *(PageNumber*)offset;
-    offset+= sizeof(int);
+    offset+= sizeof(PageNumber);
     btmd->nodeCount= *(int*)offset;
     offset+= sizeof(int);
     btmd->entryCount= *(int*)offset;
@@ -230,8 +282,8 @@ RC closeBtree (BTreeHandle *tree)
     offset= (char*) getPinnedBTNode(tree, (PageNumber)0);
 
     markDirty(&btmd->bm, &btmd->ph);
-    *(int*)offset= btmd->rootPage;
-    offset+= sizeof(int);
+    *(PageNumber*)offset= btmd->rootPage;
+    offset+= sizeof(PageNumber);
     *(int*)offset= btmd->nodeCount;
     offset+= sizeof(int);
     *(int*)offset= btmd->entryCount;
@@ -307,7 +359,7 @@ RC getKeyType (BTreeHandle *tree, DataType *result)
 
 // index access
 BT_Node* findElement (BTreeHandle *tree, BT_Node *node, Value *key,
-                      int *elemPos, int *pageNum, bool even_if_dont_match)
+                      int *elemPos, PageNumber *pageNum, bool even_if_dont_match)
 {
     int cnt= 0;
     Value res, eqRes;
@@ -412,7 +464,7 @@ RC findKey (BTreeHandle *tree, Value *key, RID *result)
     // Search succeeded
     n= getPinnedBTNode(tree, pnRes);
     el= &node->el;
-    *result= *((RID*) &el[elemPos].ptr);
+    *result= ptrToRID(el[elemPos].ptr);
     unpinBTNode(tree, pnRes);
 
     RETURN(RC_OK);
@@ -457,18 +509,32 @@ static int addKeyInNode(BTreeHandle *tree, BT_Node *node, long long ptr, Value *
 }
 
 // Create new BT_Node 
-static int createBTNode(BTreeHandle *tree)
+static PageNumber createBTNode(BTreeHandle *tree)
 {
     BT_MgmtData *btmd= (BT_MgmtData*) tree->mgmtData;
     BM_Pool_MgmtData *pmd= btmd->bm.mgmtData;
+    PageNumber pn;
 
-    // Create new node page
-    if (appendEmptyBlock(&pmd->fh) != RC_OK)
+    // Create new node page, or reuse a freed one
+    if (allocatePage(&pmd->fh, &pn) != RC_OK)
         RETURN(RC_RM_INSERT_FAILED);
 
+    // Buffer may still hold the page from before it was freed
+    memset(getPinnedBTNode(tree, pn), 0, btmd->bm.pageSize);
+    unpinDirtyBTNode(tree, pn);
+
     // Increase node count
     btmd->nodeCount++;
-    return(pmd->fh.totalNumPages-1);
+    return(pn);
+}
+
+// Give the page of an unlinked BT_Node back for reuse
+static void freeBTNode(BTreeHandle *tree, PageNumber pn)
+{
+    BT_MgmtData *btmd= (BT_MgmtData*) tree->mgmtData;
+    BM_Pool_MgmtData *pmd= btmd->bm.mgmtData;
+
+    freePage(pn, &pmd->fh);
 }
 
 // Add new parent BT_Node and store pointers for left and right.
@@ -521,17 +587,13 @@ static RC insertKeyInParent(BTreeHandle *tree, PageNumber leftPn,
 
     left->parent= right->parent= pn;
 
-    unpinBTNode(tree, pn);
-    unpinBTNode(tree, leftPn);
-    unpinBTNode(tree, rightPn);
+    unpinDirtyBTNode(tree, pn);
+    unpinDirtyBTNode(tree, leftPn);
+    unpinDirtyBTNode(tree, rightPn);
 
     // Simple Insert
     if (parentKeys <= CAPACITY(btmd))
-    {
-       unpinBTNode(tree, pn);
        RETURN(RC_OK);
-    }
-    unpinBTNode(tree, pn);
 
     // Insert and then slipt
     return (splitAndInsertKey(tree, pn, 0));
@@ -544,7 +606,7 @@ static RC splitAndInsertKey(BTreeHandle *tree, PageNumber lpn, bool leaf)
 {
     char *dest_el, *src_el;
     BT_MgmtData *btmd= (BT_MgmtData*) tree->mgmtData;
-    int copyCnt, ignore=0;
+    int copyCnt, ignore=0, cnt;
     Value splitKey;
     PageNumber splitPtr;
 
@@ -586,8 +648,16 @@ static RC splitAndInsertKey(BTreeHandle *tree, PageNumber lpn, bool leaf)
 
     left->numKeys -= copyCnt+ignore;
 
-    unpinBTNode(tree, lpn);
-    unpinBTNode(tree, rpn);
+    // Children moved to right node
+    if (!leaf)
+    {
+        for (cnt=0; cnt<right->numKeys; cnt++)
+            setParentNode(tree, (PageNumber) rEl[cnt].ptr, rpn);
+        setParentNode(tree, right->nodePtr, rpn);
+    }
+
+    unpinDirtyBTNode(tree, lpn);
+    unpinDirtyBTNode(tree, rpn);
 
     // Insert element in parent
     return(insertKeyInParent(tree, lpn, rpn, splitKey));
@@ -620,8 +690,8 @@ RC insertKey (BTreeHandle *tree, Value *key, RID rid)
        newNode->leaf= 1;
        newNode->parent= -1;
        newNode->nodePtr= -1;
-       addKeyInNode(tree, newNode, *((long long*) &rid), key);
-       unpinBTNode(tree, newPn);
+       addKeyInNode(tree, newNode, RID_TO_PTR(rid), key);
+       unpinDirtyBTNode(tree, newPn);
 
        RETURN(RC_OK);
     }
@@ -632,31 +702,35 @@ RC insertKey (BTreeHandle *tree, Value *key, RID rid)
     node= findElement (tree, node, key, &elemPos, &pn, 1);
     el= &node->el;
 
-    // Stop if we already have element
-    valueEquals(&el[elemPos].key, key, &res);
+    // Stop if we already have element, past the last one
+    // is what a delete left behind
+    res.v.boolV= FALSE;
+    if (elemPos < node->numKeys)
+        valueEquals(&el[elemPos].key, key, &res);
     unpinBTNode(tree, btmd->rootPage);
     if (IS_TRUE(res))
       RETURN(RC_IM_KEY_ALREADY_EXISTS);
 
     // Add key
     node= getPinnedBTNode(tree, pn);
-    cnt= addKeyInNode(tree, node, *((long long*) &rid), key);
+    cnt= addKeyInNode(tree, node, RID_TO_PTR(rid), key);
 
     // Simple Insert
     // el[elemPos] in 'node' is right place to insert
     if (node->numKeys <= CAPACITY(btmd))
     {
-       unpinBTNode(tree, pn);
+       unpinDirtyBTNode(tree, pn);
        RETURN(RC_OK);
     }
-    unpinBTNode(tree, pn);
+    unpinDirtyBTNode(tree, pn);
 
     // Needs split
     return (splitAndInsertKey(tree, pn, 1));
 }
 
 // DELETE ****
-static int delKeyFromNode(BTreeHandle *tree, BT_Node *node, PageNumber ptr, Value *key)
+// Leaf only, non leafs lose elements in mergeElements()
+static int delKeyFromNode(BTreeHandle *tree, BT_Node *node, Value *key)
 {
     int cnt=0;
     BT_NodeElement *el;
@@ -666,426 +740,257 @@ static int delKeyFromNode(BTreeHandle *tree, BT_Node *node, PageNumber ptr, Valu
     el= &node->el;
     while(cnt < node->numKeys)
     {
-        if (node->leaf)
+        valueEquals(&el[cnt].key, key, &res);
+        if (IS_TRUE(res))
         {
-            valueEquals(&el[cnt].key, key, &res);
-            if (IS_TRUE(res))
-            {
-                if (cnt < node->numKeys-1)
-                    memmove((char*) &el[cnt], (char*) &el[cnt+1],
-                            (int) (node->numKeys-cnt+1)*sizeof(BT_NodeElement));
-                node->numKeys--;
-                btmd->entryCount--;
+            memmove((char*) &el[cnt], (char*) &el[cnt+1],
+                    (int) (node->numKeys-cnt-1)*sizeof(BT_NodeElement));
+            node->numKeys--;
+            btmd->entryCount--;
 
-                return(cnt);
-            }
-        }
-        else
-        {
-            valueEquals(&el[cnt].key, key, &res);
-            if (IS_TRUE(res) || el[cnt].ptr==ptr)
-            {
-                PageNumber tmpPn;
-                if (cnt==0)
-                    tmpPn= el[0].ptr;
-
-                memmove((char*) &el[cnt], (char*) &el[cnt+1],
-                        (int) (node->numKeys-cnt+1)*sizeof(BT_NodeElement));
-                if (cnt==0)
-                    el[0].ptr= tmpPn;
-
-                node->numKeys--;
-                btmd->entryCount--;
-
-                return(cnt);
-            }
-            if (cnt+1 == node->numKeys && node->nodePtr == ptr)
-            {
-                node->numKeys--;
-                btmd->entryCount--;
-                return(cnt+1);
-            }
+            return(cnt);
         }
         cnt++;
     }
-    if (node->leaf)
-      assert(!"We should not be here");
-    return (0);
+    assert(!"We should not be here");
+    return (-1);
 }
 
-// Prefer left, else right
-// returns -1 if parent is root.
-// returns 0 if this alone
-static PageNumber getNeighborNode(BTreeHandle *tree, PageNumber pn)
+// Child 'pos' of a non leaf, the right most child is in 'nodePtr'
+static PageNumber getChild(BT_Node *node, int pos)
 {
-    BT_Node *parent, *tmp;
-    BT_NodeElement *el;
-    PageNumber neighborPn;
-    int cnt, parentPage;
+    BT_NodeElement *el= &node->el;
 
-    tmp= getPinnedBTNode(tree, pn);
-    parentPage= tmp->parent;
-    unpinBTNode(tree, pn);
-    if (parentPage < 0)
-        return 0; // should not hit this
+    return (pos < node->numKeys) ? (PageNumber) el[pos].ptr : node->nodePtr;
+}
 
-    parent= getPinnedBTNode(tree, parentPage);
+static void setChild(BT_Node *node, int pos, PageNumber pn)
+{
+    BT_NodeElement *el= &node->el;
+
+    if (pos < node->numKeys)
+        el[pos].ptr= pn;
+    else
+        node->nodePtr= pn;
+}
+
+// Position of child 'pn' in 'parent', numKeys for the right most
+static int getChildPos(BT_Node *parent, PageNumber pn)
+{
+    int cnt;
 
-    el= &parent->el;
     for (cnt=0; cnt<parent->numKeys; cnt++)
-        if (pn == el[cnt].ptr)
+        if (getChild(parent, cnt) == pn)
             break;
+    return cnt;
+}
 
-    // Get neighbor page number
-    if (cnt == parent->numKeys && pn == parent->nodePtr )
-        neighborPn= el[parent->numKeys-1].ptr;
-    else if (cnt == parent->numKeys-1)
-        neighborPn= -parent->nodePtr;
-    else if (cnt == 0 )
-        neighborPn= -el[cnt+1].ptr;     // Right neighbor
-    else
-        neighborPn= el[cnt-1].ptr; // Left neighbor
-
-    unpinBTNode(tree, parentPage);
+static void setParentNode(BTreeHandle *tree, PageNumber pn, PageNumber parentPn)
+{
+    BT_Node *node= getPinnedBTNode(tree, pn);
 
-    return neighborPn;
+    node->parent= parentPn;
+    unpinDirtyBTNode(tree, pn);
 }
 
-static RC deleteElement(BTreeHandle *tree, PageNumber fromPn, Value *key)
+// Fix 'pn' after it lost an element. An underfull node is merged
+// with a neighbor if both fit in one node, else it borrows one.
+// Prefer left neighbor, the left most child only has a right one.
+static RC rebalanceNode(BTreeHandle *tree, PageNumber pn)
 {
-    int neighborKeys, remainingKeys, cnt;
-    BT_Node *node, *neighborNode, *parentNode, *tmpNode;
-    BT_NodeElement *el;
-    PageNumber neighborPn, parentPn;
     BT_MgmtData *btmd= (BT_MgmtData*) tree->mgmtData;
-    RC rc= RC_OK;
+    BT_Node *node, *parent, *l, *r;
+    PageNumber parentPn, childPn, lpn, rpn;
+    int numKeys, pos, total;
+    bool leaf;
 
-    // Delete the element from BTNode
-    node= getPinnedBTNode(tree, fromPn);
+    node= getPinnedBTNode(tree, pn);
     parentPn= node->parent;
-    cnt= delKeyFromNode(tree, node, fromPn, key); // search by ptr on nonleaf
-    remainingKeys= node->numKeys;
-    unpinBTNode(tree, fromPn);
+    numKeys= node->numKeys;
+    leaf= node->leaf;
+    childPn= node->nodePtr;
+    unpinBTNode(tree, pn);
 
-    // Special case
-    if (parentPn>0)
+    // Root may get as small as it likes
+    if (parentPn < 0)
     {
-        parentNode= getPinnedBTNode(tree, parentPn);
-        if (node->numKeys && cnt==0)
-        {
-            Value eqRes;
-            // just update parent with new first element
-            el= &parentNode->el;
-            for(cnt=0; cnt<parentNode->numKeys; cnt++)
-            {
-                valueEquals(&el[cnt].key, key, &eqRes);
-                if (IS_TRUE(eqRes))
-                {
-                    el[cnt].key = node->el.key;
-                    break;
-                }
-            }
-        }
-        else if(node->numKeys==0 && parentNode->numKeys==1) // Remove root
-        {
-            if (fromPn == parentNode->el.ptr)
-                btmd->rootPage= parentNode->nodePtr;
-            else
-                btmd->rootPage= parentNode->el.ptr;
-            node->parent= -1;
-            btmd->nodeCount--;
-            parentNode->numKeys--;
-            if (node->leaf)
-                node->nodePtr= -1;
-        }
-        unpinBTNode(tree, parentPn);
-    }
+        if (numKeys)
+            RETURN(RC_OK);
 
-    // We need not worry about merge/distribute
-    // if we are at root node.
-    if (btmd->rootPage == fromPn || node->parent < 0)
-    {
-        // If root is completely empty then
-        // we reset all counters
-        if (btmd->entryCount == 0)
-        {
-            btmd->rootPage= 1;
-            btmd->entryCount= 0;
-            btmd->nodeCount= 0;
-        }
+        // Empty tree, next insert starts a fresh root
+        freeBTNode(tree, pn);
+        btmd->nodeCount--;
+        if (leaf)
+            RETURN(RC_OK);
 
-        // Special case - remove root
-        if (node->numKeys == 1 && node->parent < 0)
-        {
-            tmpNode= getPinnedBTNode(tree, node->el.ptr);
-            if (tmpNode->numKeys==0)
-            {
-                btmd->rootPage= node->nodePtr;
-                tmpNode->parent= -1;
-                btmd->nodeCount--;
-                if (tmpNode->leaf)
-                    tmpNode->nodePtr= -1;
-            }
-            unpinBTNode(tree, node->el.ptr);
-            tmpNode= getPinnedBTNode(tree, node->nodePtr);
-            if (tmpNode->numKeys==0)
-            {
-                btmd->rootPage= node->el.ptr;
-                tmpNode->parent= -1;
-                btmd->nodeCount--;
-                if (tmpNode->leaf)
-                    tmpNode->nodePtr= -1;
-            }
-            unpinBTNode(tree, node->nodePtr);
-        }
+        // Root left with a single child, the child becomes root
+        btmd->rootPage= childPn;
+        setParentNode(tree, childPn, -1);
         RETURN(RC_OK);
     }
 
-    // Was that simple delete ?
-    if (remainingKeys > MIN_KEYS(btmd,node))
+    if (numKeys >= MIN_KEYS(btmd, leaf))
         RETURN(RC_OK);
 
     // Find neighbor BT_Node
-    neighborPn= getNeighborNode(tree, fromPn);
-    neighborNode= getPinnedBTNode(tree, (PageNumber) neighborPn<0?neighborPn*-1:neighborPn);
-    neighborKeys= neighborNode->numKeys;
-    unpinBTNode(tree, (PageNumber) neighborPn);
+    parent= getPinnedBTNode(tree, parentPn);
+    pos= getChildPos(parent, pn);
+    lpn= pos ? getChild(parent, pos-1) : pn;
+    rpn= pos ? pn : getChild(parent, 1);
+    unpinBTNode(tree, parentPn);
+
+    l= getPinnedBTNode(tree, lpn);
+    r= getPinnedBTNode(tree, rpn);
+    total= l->numKeys + r->numKeys + (leaf ? 0 : 1); // + separator
+    unpinBTNode(tree, lpn);
+    unpinBTNode(tree, rpn);
 
     // Merge ?
-    if ((neighborKeys+remainingKeys) <= CAPACITY(btmd))
-       rc= mergeElements(tree, neighborPn, fromPn);
+    if (total <= CAPACITY(btmd))
+        return(mergeElements(tree, lpn, rpn));
 
     // Distribute
-    else if (remainingKeys < MIN_KEYS(btmd, node))
-       rc= distributeElements(tree, neighborPn, fromPn);
+    return(distributeElements(tree, lpn, rpn));
+}
+
+static RC deleteElement(BTreeHandle *tree, PageNumber fromPn, Value *key)
+{
+    BT_Node *node;
+
+    // Delete the element from BTNode
+    node= getPinnedBTNode(tree, fromPn);
+    delKeyFromNode(tree, node, key);
+    unpinDirtyBTNode(tree, fromPn);
 
-    RETURN(rc);
+    return(rebalanceNode(tree, fromPn));
 }
 
+// Move one element from the fuller of neighbors 'lpn', 'rpn' to the
+// other one, the separator in the parent follows the boundary.
 static RC distributeElements(BTreeHandle *tree, PageNumber lpn, PageNumber rpn)
 {
-    BT_Node *l, *r;
-    BT_NodeElement *lEl, *rEl;
-    bool mergeRight= (lpn < 0);
-    BT_MgmtData *btmd= (BT_MgmtData*) tree->mgmtData;
-    int mergePtr;
-    Value mergeKey;
+    BT_Node *l, *r, *parent;
+    BT_NodeElement *lEl, *rEl, *pEl;
+    PageNumber parentPn, movedPn= -1, movedTo= lpn;
+    int pos;
 
-    lpn= mergeRight ? (lpn*-1) : lpn; // ABS()
     l= getPinnedBTNode(tree, lpn);
     r= getPinnedBTNode(tree, rpn);
     lEl= &l->el;
     rEl= &r->el;
+    parentPn= l->parent;
+    parent= getPinnedBTNode(tree, parentPn);
+    pEl= &parent->el;
+    pos= getChildPos(parent, lpn);
 
-    // Leaf distribute
-    if (l->leaf)
+    if (l->numKeys < r->numKeys) // Move right to left
     {
-        mergeKey= rEl[0].key;
-        mergePtr= r->parent;
-
-        // Move 1 element from right to left
-        memcpy((char*) &lEl[l->numKeys], (char*) &rEl[0],
-               (int) sizeof(BT_NodeElement));
-        if (mergeRight) // special case
+        if (l->leaf)
         {
-            char *tmp= (char*) malloc(l->numKeys*sizeof(BT_NodeElement));
-            memcpy(tmp, (char*) &lEl[0], l->numKeys*sizeof(BT_NodeElement));
-            memcpy((char*) &lEl[0], (char*) &rEl[0], sizeof(BT_NodeElement));
-            memcpy((char*) &lEl[1], (char*) tmp, l->numKeys*sizeof(BT_NodeElement));
+            lEl[l->numKeys]= rEl[0];
+            pEl[pos].key= rEl[1].key;
         }
-        else // move left
-          l->nodePtr= r->nodePtr;
-
-        l->numKeys+= 1;
-        r->numKeys-= 1;
-
-        unpinBTNode(tree, lpn);
-        unpinBTNode(tree, rpn);
-
-        RETURN(deleteElement(tree, mergePtr, &mergeKey));
+        else
+        {
+            // Separator comes down, first key of right goes up
+            lEl[l->numKeys].key= pEl[pos].key;
+            lEl[l->numKeys].ptr= l->nodePtr;
+            l->nodePtr= movedPn= (PageNumber) rEl[0].ptr;
+            pEl[pos].key= rEl[0].key;
+        }
+        memmove((char*) &rEl[0], (char*) &rEl[1],
+                (int) (r->numKeys-1)*sizeof(BT_NodeElement));
+        l->numKeys++;
+        r->numKeys--;
     }
-    /* Non Leaf merge - TODO nonleaf distribution
-    else 
+    else // Move left to right
     {
-        BT_NodeElement *el;
-        BT_Node *tmp;
-        BT_Node *parentNode;
-        int parentIdx;
-
-        // Get neighbor element from parent
-        parentNode= getPinnedBTNode(tree, r->parent);
-        el= &parentNode->el;
-        for(cnt=0; cnt<parentNode->numKeys; cnt++)
-            if (el[cnt].ptr == rpn)
-            {
-              parentIdx= cnt;
-              break;
-            }
-
-        // First copy k,p from parent into left node.
-        lEl[l->numKeys].key= el[parentIdx].key;
-        lEl[l->numKeys].ptr= l->nodePtr;
-        l->numKeys++;
-
-        // Move all the elements from right to left
-        memcpy((char*) &lEl[l->numKeys], (char*) &rEl[0],
-               (int) r->numKeys*sizeof(BT_NodeElement));
-        if (mergeRight) // special case
+        memmove((char*) &rEl[1], (char*) &rEl[0],
+                (int) r->numKeys*sizeof(BT_NodeElement));
+        movedTo= rpn;
+        if (l->leaf)
         {
-            char *tmp= (char*) malloc(l->numKeys*sizeof(BT_NodeElement));
-            memcpy(tmp, (char*) &lEl[0], 
-                   l->numKeys*sizeof(BT_NodeElement));
-            memcpy((char*) &lEl[0], (char*) &rEl[0], 
-                   r->numKeys*sizeof(BT_NodeElement));
-            memcpy((char*) &lEl[r->numKeys], (char*) tmp, 
-                   l->numKeys*sizeof(BT_NodeElement));
+            rEl[0]= lEl[l->numKeys-1];
+            pEl[pos].key= rEl[0].key;
         }
-        else // move left
-          l->nodePtr= r->nodePtr;
-
-        mergeKey= rEl[0].key;
-        mergePtr= r->parent;
-        l->numKeys+= r->numKeys;
-
-        // Free right node - TODO-Need to reuse these pages
-        r->numKeys= 0;
-        btmd->nodeCount--;
-
-        // Update parent of all childs in left node (for which we copied)
-        for(cnt=0; cnt<l->numKeys; cnt++)
+        else
         {
-           tmp= getPinnedBTNode(tree, lEl[cnt].ptr);
-           tmp->parent= lpn;
-           unpinBTNode(tree, lEl[cnt].ptr);
+            // Separator comes down, last key of left goes up
+            rEl[0].key= pEl[pos].key;
+            rEl[0].ptr= movedPn= l->nodePtr;
+            l->nodePtr= (PageNumber) lEl[l->numKeys-1].ptr;
+            pEl[pos].key= lEl[l->numKeys-1].key;
         }
-    
-        unpinBTNode(tree, r->parent);
-        unpinBTNode(tree, lpn);
-        unpinBTNode(tree, rpn);
+        l->numKeys--;
+        r->numKeys++;
+    }
 
-        RETURN(deleteElement(tree, mergePtr, &mergeKey));
-    } */
-    return(RC_OK);
+    unpinDirtyBTNode(tree, parentPn);
+    unpinDirtyBTNode(tree, lpn);
+    unpinDirtyBTNode(tree, rpn);
+
+    // Child moved to the other non leaf
+    if (movedPn >= 0)
+        setParentNode(tree, movedPn, movedTo);
+
+    RETURN(RC_OK);
 }
 
+// Merge 'rpn' into its left neighbor 'lpn', whichever of them is
+// underfull. The left one stays, so the node before it in the leaf
+// chain still links the right one, and the right page is freed.
 static RC mergeElements(BTreeHandle *tree, PageNumber lpn, PageNumber rpn)
 {
-    BT_Node *l, *r, *tmpNode;
-    BT_NodeElement *lEl, *rEl;
-    bool mergeRight= (lpn < 0);
+    BT_Node *l, *r, *parent;
+    BT_NodeElement *lEl, *rEl, *pEl;
     BT_MgmtData *btmd= (BT_MgmtData*) tree->mgmtData;
-    int cnt=0, mergePtr;
-    Value mergeKey;
+    PageNumber parentPn;
+    int cnt, pos;
 
-    lpn= mergeRight ? (lpn*-1) : lpn; // ABS()
     l= getPinnedBTNode(tree, lpn);
     r= getPinnedBTNode(tree, rpn);
     lEl= &l->el;
     rEl= &r->el;
+    parentPn= l->parent;
+    parent= getPinnedBTNode(tree, parentPn);
+    pEl= &parent->el;
+    pos= getChildPos(parent, lpn);
 
-    // Leaf merge
-    if (l->leaf)
+    // Non leaf merge, separator comes down between the two
+    if (!l->leaf)
     {
-        mergeKey= rEl[0].key;
-        mergePtr= r->parent;
-
-        // Move all the elements from right to left
-        memcpy((char*) &lEl[l->numKeys], (char*) &rEl[0],
-               (int) r->numKeys*sizeof(BT_NodeElement));
-        if (mergeRight) // special case
-        {
-            char *tmp= (char*) malloc(l->numKeys*sizeof(BT_NodeElement));
-            memcpy(tmp, (char*) &lEl[0], 
-                   l->numKeys*sizeof(BT_NodeElement));
-            memcpy((char*) &lEl[0], (char*) &rEl[0], 
-                   r->numKeys*sizeof(BT_NodeElement));
-            memcpy((char*) &lEl[r->numKeys], (char*) tmp, 
-                   l->numKeys*sizeof(BT_NodeElement));
-        }
-        else // move left
-          l->nodePtr= r->nodePtr;
-
-        l->numKeys+= r->numKeys;
-
-        // Update parent - find r and replace it by l
-        Value eqRes;
-        tmpNode= getPinnedBTNode(tree, r->parent);
-        // just update parent with new first element
-        if (tmpNode->nodePtr == rpn)
-            tmpNode->nodePtr = lpn;
-        unpinBTNode(tree, r->parent);
-
-        // Free right node - TODO-Need to reuse these pages
-        r->numKeys= 0;
-        btmd->nodeCount--;
-
-        unpinBTNode(tree, lpn);
-        unpinBTNode(tree, rpn);
-
-        RETURN(deleteElement(tree, mergePtr, &mergeKey));
-    }
-    // Non Leaf merge
-    else if ( (l->numKeys+r->numKeys) < CAPACITY(btmd) ) // We need extra space for nonleaf merge
-    {
-        BT_NodeElement *el;
-        BT_Node *tmp;
-        BT_Node *parentNode;
-        int parentIdx;
-
-        // Get neighbor element from parent
-        parentNode= getPinnedBTNode(tree, r->parent);
-        el= &parentNode->el;
-        for(cnt=0; cnt<parentNode->numKeys; cnt++)
-            if (el[cnt].ptr == rpn)
-            {
-              parentIdx= cnt;
-              break;
-            }
-
-        // First copy k,p from parent into left node.
-        lEl[l->numKeys].key= el[parentIdx].key;
+        lEl[l->numKeys].key= pEl[pos].key;
         lEl[l->numKeys].ptr= l->nodePtr;
         l->numKeys++;
 
-        // Move all the elements from right to left
-        memcpy((char*) &lEl[l->numKeys], (char*) &rEl[0],
-               (int) r->numKeys*sizeof(BT_NodeElement));
-        if (mergeRight) // special case
-        {
-            char *tmp= (char*) malloc(l->numKeys*sizeof(BT_NodeElement));
-            memcpy(tmp, (char*) &lEl[0], 
-                   l->numKeys*sizeof(BT_NodeElement));
-            memcpy((char*) &lEl[0], (char*) &rEl[0], 
-                   r->numKeys*sizeof(BT_NodeElement));
-            memcpy((char*) &lEl[r->numKeys], (char*) tmp, 
-                   l->numKeys*sizeof(BT_NodeElement));
-        }
-        else // move left
-          l->nodePtr= r->nodePtr;
-
-        mergeKey= rEl[0].key;
-        mergePtr= r->parent;
-        l->numKeys+= r->numKeys;
+        // Children of right node move to left
+        for (cnt=0; cnt<r->numKeys; cnt++)
+            setParentNode(tree, (PageNumber) rEl[cnt].ptr, lpn);
+        setParentNode(tree, r->nodePtr, lpn);
+    }
 
-        // Free right node - TODO-Need to reuse these pages
-        r->numKeys= 0;
-        btmd->nodeCount--;
+    // Move all the elements from right to left, nodePtr is
+    // the next leaf or the right most child
+    memcpy((char*) &lEl[l->numKeys], (char*) &rEl[0],
+           (int) r->numKeys*sizeof(BT_NodeElement));
+    l->numKeys+= r->numKeys;
+    l->nodePtr= r->nodePtr;
+
+    // Parent loses separator and the pointer to right node
+    setChild(parent, pos+1, lpn);
+    memmove((char*) &pEl[pos], (char*) &pEl[pos+1],
+            (int) (parent->numKeys-pos-1)*sizeof(BT_NodeElement));
+    parent->numKeys--;
+
+    unpinDirtyBTNode(tree, parentPn);
+    unpinDirtyBTNode(tree, lpn);
+    unpinBTNode(tree, rpn);
 
-        // Update parent of all childs in left node (for which we copied)
-        for(cnt=0; cnt<l->numKeys; cnt++)
-        {
-           tmp= getPinnedBTNode(tree, lEl[cnt].ptr);
-           tmp->parent= lpn;
-           unpinBTNode(tree, lEl[cnt].ptr);
-        }
-    
-        unpinBTNode(tree, r->parent);
-        unpinBTNode(tree, lpn);
-        unpinBTNode(tree, rpn);
+    // Free right node
+    freeBTNode(tree, rpn);
+    btmd->nodeCount--;
 
-        RETURN(deleteElement(tree, mergePtr, &mergeKey));
-    }
-    return(RC_OK);
+    return(rebalanceNode(tree, parentPn));
 }
 
 RC deleteKey (BTreeHandle *tree, Value *key)
@@ -1167,6 +1072,7 @@ RC nextEntry (BT_ScanHandle *handle, RID *result)
         btsmd->pn= pn; // The first page to get elements from.
         btsmd->curPos= 0;
         btsmd->curNode= n;
+        prefetchNextLeaf(handle->tree, n);
     }
 
     // Should we go to next node ?
@@ -1189,11 +1095,12 @@ RC nextEntry (BT_ScanHandle *handle, RID *result)
         btsmd->pn= pn;
         btsmd->curPos= 0;
         n= btsmd->curNode= getPinnedBTNode(handle->tree, pn);
+        prefetchNextLeaf(handle->tree, n);
     }
 
     // Read the RID
     el= &n->el;
-    *result= *((RID*) &el[btsmd->curPos].ptr);
+    *result= ptrToRID(el[btsmd->curPos].ptr);
     btsmd->curPos++;
 
     return(RC_OK);
@@ -1233,7 +1140,7 @@ static char* printTreeOut(BTreeHandle *tree, char *outbuf)
 
     typedef struct Node
     {
-       int nodeNumber;
+       PageNumber nodeNumber;
        struct Node *next;
     } Node;
 
@@ -1241,7 +1148,7 @@ static char* printTreeOut(BTreeHandle *tree, char *outbuf)
     el= &n->el;
 
     //create table of node location on disk to in-order node location in tree
-    int table[btmd->nodeCount];
+    PageNumber table[btmd->nodeCount];
     
     //will make a stack and a queue
     Node *sn,*head;
@@ -1251,14 +1158,14 @@ static char* printTreeOut(BTreeHandle *tree, char *outbuf)
     if (n->nodePtr>=0  )
     {
          sn = malloc(sizeof(Node));
-         sn->nodeNumber = (int)n->nodePtr;
+         sn->nodeNumber = n->nodePtr;
          sn->next = head;
          head = sn;
     }
     for(cnt=n->numKeys-1; cnt>=0; cnt--)
     {
          sn = malloc(sizeof(Node));
-         sn->nodeNumber = (int)el[cnt].ptr;
+         sn->nodeNumber = el[cnt].ptr;
          sn->next = head;
          head = sn;
     }
@@ -1270,7 +1177,7 @@ static char* printTreeOut(BTreeHandle *tree, char *outbuf)
          if (nextNode->leaf)
          {
              //pop stack
-             table[node++] = (int)(head->nodeNumber);
+             table[node++] = head->nodeNumber;
              sn = head;
              head = head->next;
 	     free(sn);
@@ -1287,14 +1194,14 @@ static char* printTreeOut(BTreeHandle *tree, char *outbuf)
     	     if (nextNode->nodePtr>=0)
 	     {
 	         sn = malloc(sizeof(Node));
-                 sn->nodeNumber = (int)nextNode->nodePtr;
+                 sn->nodeNumber = nextNode->nodePtr;
                  sn->next = head;
                  head = sn;
              }
 	     for(cnt=nextNode->numKeys-1; cnt>=0; cnt--)
              {
                  sn = malloc(sizeof(Node));
-                 sn->nodeNumber = (int)el[cnt].ptr;
+                 sn->nodeNumber = el[cnt].ptr;
                  sn->next = head;
                  head = sn;
 	     }
@@ -1312,8 +1219,8 @@ static char* printTreeOut(BTreeHandle *tree, char *outbuf)
           if(cnt) outbuf+= sprintf(outbuf,",");
           if (n->leaf)
           {
-             RID r= *((RID*) &el[cnt].ptr);
-             outbuf+= sprintf(outbuf,"%d.%d", r.page, r.slot);
+             RID r= ptrToRID(el[cnt].ptr);
+             outbuf+= sprintf(outbuf,"%lld.%d", r.page, r.slot);
           }
           else
           {
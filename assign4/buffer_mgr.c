@@ -1,20 +1,90 @@
 #include "buffer_mgr.h"
 #include <string.h>
+#include <stdlib.h>
+#include <time.h>
 #include "storage_mgr.h"
 #include "lru_linked_list.h"
+#include "lfu_buckets.h"
+#include "lru_k.h"
+#include "arc.h"
+#include "clock_pro.h"
 #include "page_table.h"
 #include "assert.h"
 
 // Some non-interface static functions
-static BM_PageFrame* findFreeFrameFIFO(BM_BufferPool *bm);
-static BM_PageFrame* findFreeFrameLRU(BM_BufferPool *bm);
-static BM_PageFrame* findFreeFrameCLOCK(BM_BufferPool *bm);
-static BM_PageFrame* findFreeFrame(BM_BufferPool *bm);
-static RC writeIfDirty(BM_BufferPool *const bm, BM_PageFrame *pf);
+static BM_PageFrame* findFreeFrameFIFO(BM_BufferPool *bm, BM_Partition *part);
+static BM_PageFrame* findFreeFrameLRU(BM_BufferPool *bm, BM_Partition *part);
+static BM_PageFrame* findFreeFrameCLOCK(BM_BufferPool *bm, BM_Partition *part);
+static BM_PageFrame* peekFreeFrameFIFO(BM_BufferPool *bm, BM_Partition *part);
+static BM_PageFrame* peekFreeFrameCLOCK(BM_BufferPool *bm, BM_Partition *part);
+static BM_PageFrame* findFreeFrameLFU(BM_BufferPool *bm, BM_Partition *part);
+static BM_PageFrame* findFreeFrameLRUK(BM_BufferPool *bm, BM_Partition *part);
+static BM_PageFrame* findFreeFrameARC(BM_BufferPool *bm, BM_Partition *part, PageNumber pn);
+static BM_PageFrame* findFreeFrameClockPro(BM_BufferPool *bm, BM_Partition *part);
+static BM_PageFrame* findFreeFrame(BM_BufferPool *bm, BM_Partition *part, PageNumber pn);
+static BM_PageFrame* peekFreeFrame(BM_BufferPool *bm, BM_Partition *part, PageNumber pn);
+static RC writeFrame(BM_BufferPool *const bm, BM_Partition *part, BM_PageFrame *pf);
+static void stopPrefetcher(BM_BufferPool *const bm);
+
+// Runs in flight during forceFlushPool()
+#define FLUSH_QUEUE_DEPTH 32
+
+// Background writer looks at the dirty count this often, also when
+// nobody wakes it
+#define WRITER_INTERVAL_MS 20
 
 // Handy lock macros to make BM thread safe.
-#define BM_LOCK()   pthread_mutex_lock(&mgmtData->bm_mutex);
-#define BM_UNLOCK() pthread_mutex_unlock(&mgmtData->bm_mutex);
+#define BM_LOCK(part)   pthread_mutex_lock(&(part)->lock);
+#define BM_UNLOCK(part) pthread_mutex_unlock(&(part)->lock);
+#define BM_WAIT_IO(part) pthread_cond_wait(&(part)->ioDone, &(part)->lock);
+
+// Frame fields also read without the partition lock
+#define FIX_COUNT(pf)   __atomic_load_n(&(pf)->fixCount, __ATOMIC_RELAXED)
+#define PAGE_OF(pf)     __atomic_load_n(&(pf)->pn, __ATOMIC_ACQUIRE)
+
+// Set or clear a frame's dirty flag, counting dirty frames. markDirty()
+// sets it without the partition lock, so both are atomic. The one that
+// takes the count past writerHigh wakes the background writer.
+static void setDirty(BM_Pool_MgmtData *mgmtData, BM_PageFrame *pf)
+{
+  if (!__atomic_exchange_n(&pf->dirty, TRUE, __ATOMIC_RELAXED) &&
+      __atomic_add_fetch(&mgmtData->numDirty, 1, __ATOMIC_RELAXED) ==
+      __atomic_load_n(&mgmtData->writerHigh, __ATOMIC_RELAXED)+1)
+    pthread_cond_signal(&mgmtData->writerWake);
+}
+
+static void setClean(BM_Pool_MgmtData *mgmtData, BM_PageFrame *pf)
+{
+  if (__atomic_exchange_n(&pf->dirty, FALSE, __ATOMIC_RELAXED))
+    __atomic_sub_fetch(&mgmtData->numDirty, 1, __ATOMIC_RELAXED);
+}
+
+// Partition of a page. Numbers are mixed, so neighbouring pages go to
+// different partitions and a scan spreads over all of them.
+static BM_Partition* pagePartition(BM_Pool_MgmtData *mgmtData, PageNumber pn)
+{
+  unsigned long long h= (unsigned long long) pn * 0x9e3779b97f4a7c15ULL;
+  return &mgmtData->partitions[(h >> 32) & (mgmtData->numPartitions-1)];
+}
+
+static BM_Partition* framePartition(BM_Pool_MgmtData *mgmtData, BM_PageFrame *pf)
+{
+  BM_Partition *part= mgmtData->partitions;
+  int frmNo= pf - mgmtData->pool;
+
+  while (frmNo >= part->firstFrame + part->numFrames)
+    part++;
+  return part;
+}
+
+static int choosePartitions(int numPages)
+{
+  int n= 1;
+
+  while (n*2 <= BM_MAX_PARTITIONS && n*2*BM_PARTITION_FRAMES <= numPages)
+    n*= 2;
+  return n;
+}
 
 
 // Buffer Manager Interface Pool Handling
@@ -22,9 +92,27 @@ static RC writeIfDirty(BM_BufferPool *const bm, BM_PageFrame *pf);
 RC initBufferPool(BM_BufferPool *const bm, const char *const pageFileName,
 		  const int numPages, ReplacementStrategy strategy,
 		  void *stratData)
+{
+  return initBufferPoolWithFlags(bm, pageFileName, numPages, strategy,
+                                 stratData, SM_OPEN_DEFAULT);
+}
+
+RC initBufferPoolWithFlags(BM_BufferPool *const bm, const char *const pageFileName,
+		  const int numPages, ReplacementStrategy strategy,
+		  void *stratData, int openFlags)
 {
   BM_Pool_MgmtData *mgmtData;
-  int i;
+  BM_Partition *part;
+  BM_LRUKParams lruK= { 2, numPages, BM_LRU_K_PERIOD };
+  int i, p;
+
+  if (strategy == RS_LRU_K && stratData)
+  {
+    lruK= *(BM_LRUKParams*) stratData;
+    if (lruK.k < 1 || lruK.k > LRU_K_MAX || lruK.historySize < 0 ||
+        lruK.correlatedPeriod < 0)
+      RETURN(RC_INVALID_STRATEGY_DATA);
+  }
 
   // Initialize Pool
   bm->pageFile= strdup(pageFileName);
@@ -35,32 +123,82 @@ RC initBufferPool(BM_BufferPool *const bm, const char *const pageFileName,
   mgmtData= MAKE_POOL_MGMTDATA();
   mgmtData->io_reads= 0;
   mgmtData->io_writes= 0;
-  mgmtData->stratData.fifoLastFreeFrame= -1;
-  mgmtData->stratData.lru_head= NULL;
-  mgmtData->stratData.lru_tail= NULL;
-  mgmtData->stratData.clockCurrentFrame= -1;
-  openPageFile(bm->pageFile, &mgmtData->fh);
-  initPageTable(&mgmtData->pt_head);
+  mgmtData->fg_writes= 0;
+  mgmtData->bg_writes= 0;
+  mgmtData->numDirty= 0;
+  bm->pageSize= PAGE_SIZE;
+  if (openPageFileWithFlags(bm->pageFile, &mgmtData->fh, openFlags) == RC_OK)
+    bm->pageSize= mgmtData->fh.pageSize;
+  mgmtData->flushQueue= NULL;
+  mgmtData->flushQueueTried= FALSE;
+  pthread_mutex_init(&mgmtData->flushLock, NULL);
+  pthread_mutex_init(&mgmtData->writerLock, NULL);
+  pthread_cond_init(&mgmtData->writerWake, NULL);
+  mgmtData->writerRunning= FALSE;
+  mgmtData->writerHigh= numPages; // Never passed while not running
+  mgmtData->writerLow= numPages;
+  pthread_mutex_init(&mgmtData->prefetchLock, NULL);
+  pthread_cond_init(&mgmtData->prefetchWake, NULL);
+  mgmtData->prefetcherRunning= FALSE;
+  mgmtData->prefetchRing= NULL;
+
+  // Split frames evenly over partitions
+  mgmtData->numPartitions= choosePartitions(numPages);
+  if (posix_memalign((void**) &mgmtData->partitions, __alignof__(BM_Partition),
+                     mgmtData->numPartitions*sizeof(BM_Partition)))
+    mgmtData->partitions= NULL;
 
   // Create Pool pages and initialize them
   mgmtData->pool = MAKE_BUFFER_POOL(numPages);
-  for (i=0; i<numPages; i++)
+  if (posix_memalign((void**) &mgmtData->frameData, SM_IO_ALIGN,
+                     (size_t) numPages*bm->pageSize))
+    mgmtData->frameData= NULL;
+  for (p=0; p<mgmtData->numPartitions; p++)
   {
-    mgmtData->pool[i].dirty= FALSE;
-    mgmtData->pool[i].fixCount= 0;
-    mgmtData->pool[i].pn= NO_PAGE;
-    
-    // Add all frames in LRU list
-    // representing free frame to use.
-    appendMRUFrame(&mgmtData->stratData, &mgmtData->pool[i]);
-
-    mgmtData->pool[i].clockReplaceFlag= TRUE;
+    part= &mgmtData->partitions[p];
+    pthread_mutex_init(&part->lock, NULL);
+    pthread_cond_init(&part->ioDone, NULL);
+    part->stratData.fifoLastFreeFrame= -1;
+    part->stratData.clockCurrentFrame= -1;
+    part->numPrefetching= 0;
+    part->firstFrame= (int) ((long long) numPages*p / mgmtData->numPartitions);
+    part->numFrames= (int) ((long long) numPages*(p+1) / mgmtData->numPartitions)
+                     - part->firstFrame;
+    initLRUlist(&part->stratData, &mgmtData->pool[part->firstFrame]);
+    initPageTable(&part->pt_head, part->numFrames);
+
+    for (i=part->firstFrame; i<part->firstFrame+part->numFrames; i++)
+    {
+      mgmtData->pool[i].data= mgmtData->frameData + (size_t) i*bm->pageSize;
+      mgmtData->pool[i].dirty= FALSE;
+      mgmtData->pool[i].fixCount= 0;
+      mgmtData->pool[i].pn= NO_PAGE;
+      mgmtData->pool[i].reading= FALSE;
+      mgmtData->pool[i].writing= FALSE;
+
+      // Add all frames in LRU list
+      // representing free frame to use.
+      if (strategy == RS_LRU)
+        appendMRUFrame(&part->stratData, &mgmtData->pool[i]);
+
+      mgmtData->pool[i].clockReplaceFlag= TRUE;
+    }
+    if (strategy == RS_LFU)
+      initLFUbuckets(&part->stratData, part->numFrames);
+    part->stratData.lruK= NULL;
+    if (strategy == RS_LRU_K)
+      initLRUK(&part->stratData, part->numFrames, lruK.k,
+               (lruK.historySize + mgmtData->numPartitions-1) / mgmtData->numPartitions,
+               lruK.correlatedPeriod);
+    part->stratData.arc= NULL;
+    if (strategy == RS_ARC)
+      initARC(&part->stratData, part->numFrames);
+    part->stratData.clockPro= NULL;
+    if (strategy == RS_CLOCK_PRO)
+      initClockPro(&part->stratData, part->numFrames);
   }
   bm->mgmtData= mgmtData;
 
-  // Initialize thread lock
-  pthread_mutex_init(&mgmtData->bm_mutex, NULL);
-
   RETURN(RC_OK);
 }
 
@@ -68,113 +206,519 @@ RC initBufferPool(BM_BufferPool *const bm, const char *const pageFileName,
 RC shutdownBufferPool(BM_BufferPool *const bm)
 {
   RC rc= RC_OK;
-  int frmNo;
+  int frmNo, p;
   BM_PageFrame *pf;
+  BM_Partition *part;
   BM_Pool_MgmtData *mgmtData= bm->mgmtData;
 
+  stopBackgroundWriter(bm);
+  stopPrefetcher(bm);
+
   // Flush dirty pages
   rc= forceFlushPool(bm);
   if (rc != RC_OK)
     RETURN(rc);
 
-  BM_LOCK();
   // Check if we have pinned pages,
-  pf= &mgmtData->pool[0];
   for (frmNo=0; frmNo < bm->numPages; frmNo++)
-  {
-    if (pf->fixCount)
-    {
-      BM_UNLOCK();
+    if (FIX_COUNT(&mgmtData->pool[frmNo]))
       RETURN(RC_HAVE_PINNED_PAGE);
-    }
 
-    // Also reset page table
-    if (pf->pn != NO_PAGE)
-      resetPageFrame(&mgmtData->pt_head, pf->pn);
-    pf++;
-  }
-  
   rc= closePageFile(&mgmtData->fh);
   if (rc != RC_OK)
-  {
-    BM_UNLOCK();
     RETURN(rc);
+
+  for (p=0; p<mgmtData->numPartitions; p++)
+  {
+    part= &mgmtData->partitions[p];
+
+    // Also reset page table
+    pf= &mgmtData->pool[part->firstFrame];
+    for (frmNo=0; frmNo < part->numFrames; frmNo++, pf++)
+      if (pf->pn != NO_PAGE)
+        resetPageFrame(&part->pt_head, pf->pn);
+    freePageTable(&part->pt_head);
+    freeLRUK(&part->stratData);
+    freeARC(&part->stratData);
+    freeClockPro(&part->stratData);
+    pthread_cond_destroy(&part->ioDone);
+    pthread_mutex_destroy(&part->lock);
   }
 
-  cleanLRUlist(&mgmtData->stratData);
+  if (mgmtData->flushQueue)
+    shutdownAsyncQueue(mgmtData->flushQueue);
+  pthread_mutex_destroy(&mgmtData->flushLock);
+  pthread_cond_destroy(&mgmtData->writerWake);
+  pthread_mutex_destroy(&mgmtData->writerLock);
+  pthread_cond_destroy(&mgmtData->prefetchWake);
+  pthread_mutex_destroy(&mgmtData->prefetchLock);
+  free(mgmtData->prefetchRing);
+  free(mgmtData->partitions);
   free(mgmtData->pool);
+  free(mgmtData->frameData);
   free(bm->pageFile);
-  BM_UNLOCK();
-  pthread_mutex_destroy(&mgmtData->bm_mutex);
   free(mgmtData);
 
   RETURN(RC_OK);
 }
 
+// Order frames by page number
+static int compareFramePage(const void *a, const void *b)
+{
+  PageNumber pa= (*(BM_PageFrame**)a)->pn;
+  PageNumber pb= (*(BM_PageFrame**)b)->pn;
+  return (pa > pb) - (pa < pb);
+}
+
+// Wait for oldest flush run in flight
+static RC finishFlushRun(BM_Pool_MgmtData *mgmtData, SM_AsyncTicket *tickets,
+                         int *runLens, int slot)
+{
+  RC rc;
+
+  rc= waitAsyncIO(mgmtData->flushQueue, tickets[slot]);
+  if (rc!=RC_OK)
+    return rc;
+  __atomic_add_fetch(&mgmtData->io_writes, runLens[slot], __ATOMIC_RELAXED);
+  return RC_OK;
+}
+
+// Write frames marked as being written, in page order. Each run of
+// consecutive pages goes to disk in one write. With an async queue up
+// to FLUSH_QUEUE_DEPTH runs are in flight at once. Then the frames are
+// done writing, on error all stay dirty, rewriting some is harmless.
+// Caller holds flushLock, pages has room for numFrames.
+static RC writeFrames(BM_BufferPool *const bm, BM_PageFrame **frames,
+                      int numFrames, SM_PageHandle *pages)
+{
+  RC rc= RC_OK, waitRc;
+  BM_Pool_MgmtData *mgmtData= bm->mgmtData;
+  int frmNo, runStart, runLen, maxRun;
+  int inFlight= 0, oldest= 0;
+  SM_AsyncTicket tickets[FLUSH_QUEUE_DEPTH];
+  int runLens[FLUSH_QUEUE_DEPTH];
+  BM_PageFrame *pf;
+  BM_Partition *part;
+
+  // Pools never flushed, most of them, pay nothing for the queue
+  if (numFrames > 1 && !mgmtData->flushQueueTried)
+  {
+    mgmtData->flushQueueTried= TRUE;
+    if (initAsyncQueue(&mgmtData->flushQueue, FLUSH_QUEUE_DEPTH, SM_ASYNC_DEFAULT) != RC_OK)
+      mgmtData->flushQueue= NULL;
+  }
+
+  maxRun= mgmtData->flushQueue ? SM_ASYNC_MAX_PAGES : numFrames;
+  qsort(frames, numFrames, sizeof(BM_PageFrame*), compareFramePage);
+
+  for (runStart=0; runStart < numFrames; runStart+= runLen)
+  {
+    runLen= 0;
+    do {
+      pages[runLen]= frames[runStart+runLen]->data;
+      runLen++;
+    } while (runStart+runLen < numFrames && runLen < maxRun &&
+             frames[runStart+runLen]->pn == frames[runStart]->pn+runLen);
+
+    if (!mgmtData->flushQueue)
+    {
+      rc= writeBlocks(frames[runStart]->pn, runLen, &mgmtData->fh, pages);
+      if (rc!=RC_OK)
+        break;
+      __atomic_add_fetch(&mgmtData->io_writes, runLen, __ATOMIC_RELAXED);
+      continue;
+    }
+
+    // Queue full, retire oldest run first
+    if (inFlight == FLUSH_QUEUE_DEPTH)
+    {
+      rc= finishFlushRun(mgmtData, tickets, runLens, oldest);
+      oldest= (oldest+1) % FLUSH_QUEUE_DEPTH;
+      inFlight--;
+      if (rc!=RC_OK)
+        break;
+    }
+
+    frmNo= (oldest+inFlight) % FLUSH_QUEUE_DEPTH;
+    rc= submitWriteBlocks(mgmtData->flushQueue, frames[runStart]->pn, runLen,
+                          &mgmtData->fh, pages, &tickets[frmNo]);
+    if (rc!=RC_OK)
+      break;
+    runLens[frmNo]= runLen;
+    inFlight++;
+  }
+
+  // Collect the rest, keep first error
+  for (; inFlight > 0; inFlight--)
+  {
+    waitRc= finishFlushRun(mgmtData, tickets, runLens, oldest);
+    oldest= (oldest+1) % FLUSH_QUEUE_DEPTH;
+    if (rc==RC_OK)
+      rc= waitRc;
+  }
+
+  for (frmNo=0; frmNo < numFrames; frmNo++)
+  {
+    pf= frames[frmNo];
+    part= framePartition(mgmtData, pf);
+    BM_LOCK(part);
+    pf->writing= FALSE;
+    if (rc!=RC_OK)
+      setDirty(mgmtData, pf);
+    pthread_cond_broadcast(&part->ioDone);
+    BM_UNLOCK(part);
+  }
+  return rc;
+}
+
 // Write page frame data to disk
 // with dirty=true and fixCount==0
 RC forceFlushPool(BM_BufferPool *const bm)
 {
-  RC rc= RC_OK;
+  RC rc;
   BM_Pool_MgmtData *mgmtData;
-  int frmNo;
-  BM_PageFrame *pf;
+  int frmNo, numDirty= 0, p;
+  BM_PageFrame *pf, **dirty;
+  BM_Partition *part;
+  SM_PageHandle *pages;
   mgmtData= bm->mgmtData;
 
-  BM_LOCK();
+  dirty= (BM_PageFrame**) malloc(bm->numPages*sizeof(BM_PageFrame*));
+  pages= (SM_PageHandle*) malloc(bm->numPages*sizeof(SM_PageHandle));
 
-  pf= &mgmtData->pool[0];
-  for (frmNo=0; frmNo < bm->numPages; frmNo++)
+  pthread_mutex_lock(&mgmtData->flushLock);
+
+  // Collect frames to write. They are marked as being written and
+  // clean, a markDirty() meanwhile makes them dirty again. A write
+  // already going on is waited for, it may be of a dirty page.
+  for (p=0; p<mgmtData->numPartitions; p++)
   {
-    rc= writeIfDirty(bm, pf);
-    if (rc!=RC_OK)
-      break;
-    pf++;
+    part= &mgmtData->partitions[p];
+    BM_LOCK(part);
+    pf= &mgmtData->pool[part->firstFrame];
+    for (frmNo=0; frmNo < part->numFrames; frmNo++, pf++)
+    {
+      while (pf->writing)
+        BM_WAIT_IO(part);
+      if (pf->dirty && FIX_COUNT(pf)==0)
+      {
+        pf->writing= TRUE;
+        setClean(mgmtData, pf);
+        dirty[numDirty++]= pf;
+      }
+    }
+    BM_UNLOCK(part);
   }
+  rc= writeFrames(bm, dirty, numDirty, pages);
 
-  BM_UNLOCK();
+  pthread_mutex_unlock(&mgmtData->flushLock);
 
+  // Outside the lock, so concurrent forces can share a group sync
+  if (rc==RC_OK)
+    rc= syncPageFile(&mgmtData->fh);
+
+  free(pages);
+  free(dirty);
   RETURN(rc);
 }
 
-// Buffer Manager Interface Access Pages
+// Background Writer
 // ***************************************
-static RC writeIfDirty(BM_BufferPool *const bm, BM_PageFrame *pf)
+
+// Take a frame to write if it is dirty and could be replaced. Caller
+// holds the partition lock.
+static int takeCleanable(BM_Pool_MgmtData *mgmtData, BM_PageFrame *pf, BM_PageFrame **out)
+{
+  if (!pf->dirty || FIX_COUNT(pf) || pf->writing || pf->pn == NO_PAGE)
+    return 0;
+  pf->writing= TRUE;
+  setClean(mgmtData, pf);
+  *out= pf;
+  return 1;
+}
+
+// Take up to max frames to write from a partition, those the strategy
+// replaces first before others. Strategies without an order that is
+// cheap to walk go in frame order. Caller holds the partition lock.
+static int collectCleanable(BM_BufferPool *bm, BM_Partition *part,
+                            BM_PageFrame **out, int max)
 {
-  RC rc;
   BM_Pool_MgmtData *mgmtData= bm->mgmtData;
+  BM_StrategyInfo *si= &part->stratData;
+  unsigned int buckets;
+  int n= 0, i, start= 0;
 
-  if (pf->dirty && pf->fixCount==0)
+  switch (bm->strategy)
   {
-    rc= writeBlock(pf->pn, &mgmtData->fh, (SM_PageHandle) &pf->data);
-    if (rc!=RC_OK)
-      RETURN(rc);
-    mgmtData->io_writes++;
-    pf->dirty= FALSE;
-    resetPageFrame(&mgmtData->pt_head, pf->pn);
+    case RS_LRU:
+      for (i= si->lru.head; i != LRU_NIL && n < max; i= si->lru_frames[i].lruNext)
+        n+= takeCleanable(mgmtData, &si->lru_frames[i], out+n);
+      return n;
+    case RS_LFU:
+      for (buckets= si->lfuNonEmpty; buckets && n < max; buckets&= buckets-1)
+        for (i= si->lfuBuckets[__builtin_ctz(buckets)].head;
+             i != LRU_NIL && n < max; i= si->lru_frames[i].lruNext)
+          n+= takeCleanable(mgmtData, &si->lru_frames[i], out+n);
+      return n;
+    case RS_FIFO:
+      start= si->fifoLastFreeFrame+1;
+      break;
+    case RS_CLOCK:
+      start= si->clockCurrentFrame+1;
+      break;
+    default:
+      break;
+  }
+
+  for (i=0; i < part->numFrames && n < max; i++)
+    n+= takeCleanable(mgmtData, &si->lru_frames[(start+i) % part->numFrames], out+n);
+  return n;
+}
+
+// One round of cleaning: write the dirty frames above target, each
+// partition its share of them. Returns the number written.
+static int cleanPool(BM_BufferPool *bm, int target, BM_PageFrame **frames,
+                     SM_PageHandle *pages)
+{
+  BM_Pool_MgmtData *mgmtData= bm->mgmtData;
+  BM_Partition *part;
+  int excess, n= 0, p;
+
+  pthread_mutex_lock(&mgmtData->flushLock);
+  excess= __atomic_load_n(&mgmtData->numDirty, __ATOMIC_RELAXED) - target;
+  for (p=0; excess > 0 && p<mgmtData->numPartitions; p++)
+  {
+    part= &mgmtData->partitions[p];
+    BM_LOCK(part);
+    n+= collectCleanable(bm, part, frames+n,
+          (int) (((long long) excess*part->numFrames + bm->numPages-1) / bm->numPages));
+    BM_UNLOCK(part);
+  }
+  if (n > 0 && writeFrames(bm, frames, n, pages) == RC_OK)
+    __atomic_add_fetch(&mgmtData->bg_writes, n, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&mgmtData->flushLock);
+  return n;
+}
+
+// Once past writerHigh dirty frames, clean down to writerLow. Write
+// errors are left to whoever writes the page next.
+static void *backgroundWriter(void *arg)
+{
+  BM_BufferPool *bm= (BM_BufferPool*) arg;
+  BM_Pool_MgmtData *mgmtData= bm->mgmtData;
+  BM_PageFrame **frames;
+  SM_PageHandle *pages;
+  struct timespec until;
+  int numDirty, target, cleaning= 0;
+
+  frames= (BM_PageFrame**) malloc(bm->numPages*sizeof(BM_PageFrame*));
+  pages= (SM_PageHandle*) malloc(bm->numPages*sizeof(SM_PageHandle));
+
+  pthread_mutex_lock(&mgmtData->writerLock);
+  while (!mgmtData->writerStop)
+  {
+    numDirty= __atomic_load_n(&mgmtData->numDirty, __ATOMIC_RELAXED);
+    if (numDirty > mgmtData->writerHigh)
+      cleaning= 1;
+    else if (numDirty <= mgmtData->writerLow)
+      cleaning= 0;
+
+    if (cleaning)
+    {
+      target= mgmtData->writerLow;
+      pthread_mutex_unlock(&mgmtData->writerLock);
+      numDirty= cleanPool(bm, target, frames, pages);
+      pthread_mutex_lock(&mgmtData->writerLock);
+      if (numDirty > 0)
+        continue;
+      // All pinned or being written, look again later
+    }
+
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_nsec+= WRITER_INTERVAL_MS*1000000L;
+    if (until.tv_nsec >= 1000000000L)
+    {
+      until.tv_sec++;
+      until.tv_nsec-= 1000000000L;
+    }
+    pthread_cond_timedwait(&mgmtData->writerWake, &mgmtData->writerLock, &until);
   }
+  pthread_mutex_unlock(&mgmtData->writerLock);
+
+  free(pages);
+  free(frames);
+  return NULL;
+}
+
+RC startBackgroundWriter(BM_BufferPool *const bm, int highPercent, int lowPercent)
+{
+  BM_Pool_MgmtData *mgmtData= bm->mgmtData;
 
+  if (lowPercent < 0 || lowPercent >= highPercent || highPercent > 100)
+    RETURN(RC_INVALID_WRITER_THRESHOLD);
+
+  pthread_mutex_lock(&mgmtData->writerLock);
+  __atomic_store_n(&mgmtData->writerHigh,
+                   (int) ((long long) bm->numPages*highPercent / 100), __ATOMIC_RELAXED);
+  mgmtData->writerLow= (int) ((long long) bm->numPages*lowPercent / 100);
+  if (mgmtData->writerRunning)
+    pthread_cond_signal(&mgmtData->writerWake);
+  else
+  {
+    mgmtData->writerStop= FALSE;
+    if (pthread_create(&mgmtData->writer, NULL, backgroundWriter, bm))
+    {
+      __atomic_store_n(&mgmtData->writerHigh, bm->numPages, __ATOMIC_RELAXED);
+      mgmtData->writerLow= bm->numPages;
+      pthread_mutex_unlock(&mgmtData->writerLock);
+      RETURN(RC_WRITER_START_FAILED);
+    }
+    mgmtData->writerRunning= TRUE;
+  }
+  pthread_mutex_unlock(&mgmtData->writerLock);
   RETURN(RC_OK);
 }
 
+// Stop the background writer, waiting for a round of writes under way.
+// Nothing to do if it is not running.
+RC stopBackgroundWriter(BM_BufferPool *const bm)
+{
+  BM_Pool_MgmtData *mgmtData= bm->mgmtData;
+  int running;
+
+  pthread_mutex_lock(&mgmtData->writerLock);
+  running= mgmtData->writerRunning;
+  mgmtData->writerStop= TRUE;
+  mgmtData->writerRunning= FALSE;
+  __atomic_store_n(&mgmtData->writerHigh, bm->numPages, __ATOMIC_RELAXED);
+  mgmtData->writerLow= bm->numPages;
+  pthread_cond_signal(&mgmtData->writerWake);
+  pthread_mutex_unlock(&mgmtData->writerLock);
+
+  if (running)
+    pthread_join(mgmtData->writer, NULL);
+  RETURN(RC_OK);
+}
+
+// Buffer Manager Interface Access Pages
+// ***************************************
+
+// Write a dirty frame, without holding part->lock while at it. The
+// frame is marked clean before, so a markDirty() during the write is
+// not lost. Caller holds part->lock, also on return.
+static RC writeFrame(BM_BufferPool *const bm, BM_Partition *part, BM_PageFrame *pf)
+{
+  RC rc;
+  BM_Pool_MgmtData *mgmtData= bm->mgmtData;
+
+  pf->writing= TRUE;
+  setClean(mgmtData, pf);
+  BM_UNLOCK(part);
+
+  rc= writeBlock(pf->pn, &mgmtData->fh, pf->data);
+
+  BM_LOCK(part);
+  pf->writing= FALSE;
+  if (rc!=RC_OK)
+    setDirty(mgmtData, pf);
+  else
+    __atomic_add_fetch(&mgmtData->io_writes, 1, __ATOMIC_RELAXED);
+  pthread_cond_broadcast(&part->ioDone);
+  return rc;
+}
+
+// Some unpinned frame of the partition is being written. Caller holds
+// part->lock.
+static int unpinnedWriting(BM_Partition *part, BM_Pool_MgmtData *mgmtData)
+{
+  BM_PageFrame *pf= &mgmtData->pool[part->firstFrame];
+  int frmNo;
+
+  for (frmNo=0; frmNo < part->numFrames; frmNo++, pf++)
+    if (pf->writing && FIX_COUNT(pf)==0)
+      return 1;
+  return 0;
+}
+
+// Drop one pin. Caller holds part->lock.
+static void releaseFrame(BM_BufferPool *const bm, BM_Partition *part, BM_PageFrame *pf)
+{
+  // Mark that page frame is not used by client now.
+  int fixCount= __atomic_sub_fetch(&pf->fixCount, 1, __ATOMIC_ACQ_REL);
+
+  // Add frame back to the list as MRU frame,
+  // so that this can be used, in next pinPage.
+  if(fixCount == 0 && bm->strategy == RS_LRU)
+	appendMRUFrame(&part->stratData, pf);
+  else if (fixCount == 0 && bm->strategy == RS_LFU)
+    releaseLFUFrame(&part->stratData, pf);
+  else if (fixCount == 0 && bm->strategy == RS_LRU_K)
+    releaseLRUKFrame(&part->stratData, pf);
+  else if (fixCount == 0 && bm->strategy == RS_ARC)
+    releaseARCFrame(&part->stratData, pf);
+  else if (fixCount == 0 && bm->strategy == RS_CLOCK_PRO)
+    releaseClockProFrame(&part->stratData, pf);
+}
+
+// Pins that neither make a frame pinned nor unpinned change no
+// replacement state, so they are counted without part->lock. A frame
+// keeps its page while pinned, so a frame found unlocked that is
+// pinned before and after is the one of the page.
+
+// Add a pin to a frame that has one already. 0 if it has none.
+static int pinIfPinned(BM_PageFrame *pf)
+{
+  int fixCount= FIX_COUNT(pf);
+
+  while (fixCount > 0)
+    if (__atomic_compare_exchange_n(&pf->fixCount, &fixCount, fixCount+1, 1,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+      return 1;
+  return 0;
+}
+
+// Drop a pin, unless it is the last one. 0 if it is.
+static int unpinIfShared(BM_PageFrame *pf)
+{
+  int fixCount= FIX_COUNT(pf);
+
+  while (fixCount > 1)
+    if (__atomic_compare_exchange_n(&pf->fixCount, &fixCount, fixCount-1, 1,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+      return 1;
+  return 0;
+}
+
 // Mark page as dirty
 RC markDirty (BM_BufferPool *const bm, BM_PageHandle *const page)
 {
   BM_PageFrame *pf;
   BM_Pool_MgmtData *mgmtData= bm->mgmtData;
-  BM_LOCK();
+  BM_Partition *part= pagePartition(mgmtData, page->pageNum);
 
-  // Check if we already have a frame assigned to this page
-  pf= findPageFrame(&mgmtData->pt_head, page->pageNum);
+  // The caller's pin keeps the frame, no lock needed
+  pf= findPageFrame(&part->pt_head, page->pageNum);
+  if (pf && FIX_COUNT(pf) > 0 && PAGE_OF(pf) == page->pageNum)
+  {
+    setDirty(mgmtData, pf);
+    RETURN(RC_OK);
+  }
+
+  BM_LOCK(part);
+
+  // Check if we already have a frame assigned to this page. Locked,
+  // a frame has a page if and only if it is mapped to it.
+  if (!pf || pf->pn != page->pageNum)
+    pf= findPageFrame(&part->pt_head, page->pageNum);
   if (!pf)
   {
-    BM_UNLOCK();
+    BM_UNLOCK(part);
     RETURN(RC_PAGE_NOT_PINNED);
   }
 
-  pf->dirty= TRUE;
+  setDirty(mgmtData, pf);
 
-  BM_UNLOCK();
+  BM_UNLOCK(part);
   RETURN(RC_OK);
 }
 
@@ -182,26 +726,27 @@ RC markDirty (BM_BufferPool *const bm, BM_PageHandle *const page)
 RC unpinPage (BM_BufferPool *const bm, BM_PageHandle *const page)
 {
   BM_PageFrame *pf;
-  BM_Pool_MgmtData *mgmtData= bm->mgmtData;
-  BM_LOCK();
+  BM_Partition *part= pagePartition(bm->mgmtData, page->pageNum);
+
+  // Others still have it pinned
+  pf= findPageFrame(&part->pt_head, page->pageNum);
+  if (pf && PAGE_OF(pf) == page->pageNum && unpinIfShared(pf))
+    RETURN(RC_OK);
+
+  BM_LOCK(part);
 
   // Check if we already have a frame assigned to this page
-  pf= findPageFrame(&mgmtData->pt_head, page->pageNum);
+  if (!pf || pf->pn != page->pageNum)
+    pf= findPageFrame(&part->pt_head, page->pageNum);
   if (!pf)
   {
-    BM_UNLOCK();
+    BM_UNLOCK(part);
     RETURN(RC_PAGE_NOT_PINNED);
   }
 
-  // Mark that page frame is not used by client now.
-  pf->fixCount--;
-
-  // Add frame back to the list as MRU frame, 
-  // so that this can be used, in next pinPage.
-  if(pf->fixCount == 0 && bm->strategy == RS_LRU)
-	appendMRUFrame(&mgmtData->stratData, pf);
+  releaseFrame(bm, part, pf);
 
-  BM_UNLOCK();
+  BM_UNLOCK(part);
   RETURN(RC_OK);
 }
 
@@ -211,209 +756,523 @@ RC forcePage (BM_BufferPool *const bm, BM_PageHandle *const page)
   RC rc= RC_OK;
   BM_PageFrame *pf;
   BM_Pool_MgmtData *mgmtData= bm->mgmtData;
-  BM_LOCK();
+  BM_Partition *part= pagePartition(mgmtData, page->pageNum);
+  BM_LOCK(part);
 
-  // Check if we already have a frame assigned to this page
-  pf= findPageFrame(&mgmtData->pt_head, page->pageNum);
-  if (pf)
-    rc= writeIfDirty(bm, pf);
+  // Check if we already have a frame assigned to this page. A write
+  // going on may be an eviction, after which the page is gone.
+  while ((pf= findPageFrame(&part->pt_head, page->pageNum)) && pf->writing)
+    BM_WAIT_IO(part);
+  if (pf && pf->dirty && FIX_COUNT(pf)==0)
+    rc= writeFrame(bm, part, pf);
 
-  // We force to write dirty block, even if fixCount>0. Last arg=true.
-  BM_UNLOCK();
+  BM_UNLOCK(part);
+
+  // Also when clean, it may have been written unsynced on eviction
+  if (rc==RC_OK)
+    rc= syncPageFile(&mgmtData->fh);
   RETURN(rc);
 }
 
+// Give a clean victim frame to page pageNum, pinned and marked as
+// being read. Who pins the page before the read is done waits for it.
+// Caller holds part->lock.
+static void claimFrame(BM_BufferPool *const bm, BM_Partition *part, BM_PageFrame *pf,
+                       PageNumber pageNum)
+{
+  if (bm->strategy == RS_LRU)
+    reuseLRUFrame(&part->stratData, pf);
+  else if (bm->strategy == RS_LFU)
+  {
+    claimLFUFrame(&part->stratData, pf, part->numFrames);
+    touchLFUFrame(pf);
+  }
+  else if (bm->strategy == RS_LRU_K)
+    claimLRUKFrame(&part->stratData, pf, pf->pn, pageNum);
+  else if (bm->strategy == RS_ARC)
+    claimARCFrame(&part->stratData, pf, pf->pn, pageNum);
+  else if (bm->strategy == RS_CLOCK_PRO)
+    claimClockProFrame(&part->stratData, pf, pf->pn, pageNum);
+  if (pf->pn != NO_PAGE)
+  {
+    // Reset Map, as we give this frame to different pn.
+    resetPageFrame(&part->pt_head, pf->pn);
+  }
+
+  // Mark page frame as used, and map page number to frame.
+  __atomic_add_fetch(&pf->fixCount, 1, __ATOMIC_ACQ_REL);
+  __atomic_store_n(&pf->pn, pageNum, __ATOMIC_RELAXED);
+  __atomic_store_n(&pf->reading, TRUE, __ATOMIC_RELAXED);
+  setPageFrame(&part->pt_head, pageNum, pf);
+
+   //Set the flag for the flag as false, which will prevent any replacement of this frame
+   if (bm->strategy == RS_CLOCK)
+     pf->clockReplaceFlag = FALSE;
+}
+
+// The read into a frame from claimFrame() is done. If it failed the
+// frame is given up, with its pin. Caller holds part->lock.
+static void finishRead(BM_BufferPool *const bm, BM_Partition *part, BM_PageFrame *pf, RC rc)
+{
+  BM_Pool_MgmtData *mgmtData= bm->mgmtData;
+
+  __atomic_store_n(&pf->reading, FALSE, __ATOMIC_RELEASE);
+  pthread_cond_broadcast(&part->ioDone);
+  if (rc!=RC_OK)
+  {
+    resetPageFrame(&part->pt_head, pf->pn);
+    __atomic_store_n(&pf->pn, NO_PAGE, __ATOMIC_RELAXED);
+    releaseFrame(bm, part, pf);
+  }
+  else
+    __atomic_add_fetch(&mgmtData->io_reads, 1, __ATOMIC_RELAXED);
+}
+
 // Read a page and put it in buffer. Mark frame as used.
 RC pinPage (BM_BufferPool *const bm, BM_PageHandle *const page, 
 	    const PageNumber pageNum)
 {
   RC rc;
-  BM_PageFrame *pf;
+  BM_PageFrame *pf, *victim= NULL;
   BM_Pool_MgmtData *mgmtData= bm->mgmtData;
-  BM_LOCK();
+  BM_Partition *part= pagePartition(mgmtData, pageNum);
 
-  // Check if we already have a frame assigned to this page
-  pf= findPageFrame(&mgmtData->pt_head, pageNum);
-  if (pf)
+  // Hit on a frame pinned already, e.g. the root of an index
+  pf= findPageFrame(&part->pt_head, pageNum);
+  if (pf && pinIfPinned(pf))
   {
-    // If fixCount==0, then remove it from LRU
-    // Representing that frame is no more free
-    if(pf->fixCount==0 && bm->strategy == RS_LRU)
-      reuseLRUFrame(&mgmtData->stratData, pf);
-
-    pf->fixCount++;
-    page->pageNum= pageNum;
-    page->data= (char*)&pf->data;
-    if (bm->strategy == RS_CLOCK)
+    if (PAGE_OF(pf) == pageNum && !__atomic_load_n(&pf->reading, __ATOMIC_ACQUIRE))
     {
-       pf->clockReplaceFlag = FALSE;
+      if (bm->strategy == RS_CLOCK)
+        __atomic_store_n(&pf->clockReplaceFlag, FALSE, __ATOMIC_RELAXED);
+      else if (bm->strategy == RS_LFU)
+        touchLFUFrame(pf);
+      else if (bm->strategy == RS_CLOCK_PRO)
+        touchClockProFrame(&part->stratData, pf);
+      page->pageNum= pageNum;
+      page->data= pf->data;
+      RETURN(RC_OK);
     }
-    BM_UNLOCK();
-    RETURN(RC_OK);
+
+    // Still being read in, or taken for another page since found
+    BM_LOCK(part);
+    while (pf->reading)
+      BM_WAIT_IO(part);
+    if (pf->pn == pageNum)
+    {
+      if (bm->strategy == RS_LFU)
+        touchLFUFrame(pf);
+      else if (bm->strategy == RS_CLOCK_PRO)
+        touchClockProFrame(&part->stratData, pf);
+      page->pageNum= pageNum;
+      page->data= pf->data;
+      BM_UNLOCK(part);
+      RETURN(RC_OK);
+    }
+    releaseFrame(bm, part, pf);
+    pf= NULL;
   }
+  else
+    BM_LOCK(part);
 
-  // Get free frame from pool
-  pf= findFreeFrame(bm);
-  if (pf==NULL)
+  for (;;)
   {
-    BM_UNLOCK();
-    RETURN(RC_BUFFER_POOL_FULL);
+    // Check if we already have a frame assigned to this page
+    if (!pf || pf->pn != pageNum)
+      pf= findPageFrame(&part->pt_head, pageNum);
+    if (pf)
+    {
+      // If fixCount==0, then remove it from LRU
+      // Representing that frame is no more free
+      if(FIX_COUNT(pf)==0 && bm->strategy == RS_LRU)
+        reuseLRUFrame(&part->stratData, pf);
+      else if (FIX_COUNT(pf)==0 && bm->strategy == RS_LFU)
+        reuseLFUFrame(&part->stratData, pf);
+      else if (FIX_COUNT(pf)==0 && bm->strategy == RS_LRU_K)
+        pinLRUKFrame(&part->stratData, pf);
+      else if (FIX_COUNT(pf)==0 && bm->strategy == RS_ARC)
+        pinARCFrame(&part->stratData, pf);
+      else if (bm->strategy == RS_CLOCK_PRO)
+      {
+        if (FIX_COUNT(pf)==0)
+          pinClockProFrame(&part->stratData, pf);
+        else
+          touchClockProFrame(&part->stratData, pf);
+      }
+
+      __atomic_add_fetch(&pf->fixCount, 1, __ATOMIC_ACQ_REL);
+      if (bm->strategy == RS_CLOCK)
+      {
+         pf->clockReplaceFlag = FALSE;
+      }
+      else if (bm->strategy == RS_LFU)
+        touchLFUFrame(pf);
+
+      // Another thread is reading it in. If that fails the frame
+      // is given up, try again.
+      while (pf->reading)
+        BM_WAIT_IO(part);
+      if (pf->pn != pageNum)
+      {
+        releaseFrame(bm, part, pf);
+        continue;
+      }
+
+      page->pageNum= pageNum;
+      page->data= pf->data;
+      BM_UNLOCK(part);
+      RETURN(RC_OK);
+    }
+
+    // Get free frame from pool, unless the one just written back
+    // is still free
+    if (!victim || FIX_COUNT(victim) || victim->writing)
+      victim= findFreeFrame(bm, part, pageNum);
+    if (victim==NULL && (part->numPrefetching || unpinnedWriting(part, mgmtData)))
+    {
+      // Free once written, by a flush or the background writer, or
+      // read in by the prefetcher
+      BM_WAIT_IO(part);
+      continue;
+    }
+    if (victim==NULL)
+    {
+      BM_UNLOCK(part);
+      RETURN(RC_BUFFER_POOL_FULL);
+    }
+    if (!victim->dirty)
+      break;
+
+    // Write it back unlocked. Meanwhile it may get pinned or dirty,
+    // or our page read in by another thread, so look again after.
+    rc= writeFrame(bm, part, victim);
+    if (rc!=RC_OK)
+    {
+      BM_UNLOCK(part);
+      return rc;
+    }
+    __atomic_add_fetch(&mgmtData->fg_writes, 1, __ATOMIC_RELAXED);
   }
+  pf= victim;
+  claimFrame(bm, part, pf, pageNum);
+  BM_UNLOCK(part);
 
   // Read physical page and keep it in buffer
+  rc= RC_OK;
   if (pageNum >= mgmtData->fh.totalNumPages)
-  {
     rc= ensureCapacity(pageNum+1, &mgmtData->fh);
-    if (rc!=RC_OK)
+  if (rc==RC_OK)
+    rc= readBlock(pageNum, &mgmtData->fh, pf->data);
+
+  BM_LOCK(part);
+  finishRead(bm, part, pf, rc);
+  BM_UNLOCK(part);
+  if (rc!=RC_OK)
+    return rc;
+
+  page->pageNum= pageNum;
+  page->data= pf->data;
+  RETURN(RC_OK);
+}
+
+// Prefetch
+// ***************************************
+
+// Read the frames queued by prefetchRange() in order, consecutive pages
+// in one read, then unpin them. Runs until stopped with nothing queued.
+static void *prefetcher(void *arg)
+{
+  BM_BufferPool *bm= (BM_BufferPool*) arg;
+  BM_Pool_MgmtData *mgmtData= bm->mgmtData;
+  BM_PageFrame *run[SM_ASYNC_MAX_PAGES];
+  SM_PageHandle pages[SM_ASYNC_MAX_PAGES];
+  BM_PageFrame **ring= mgmtData->prefetchRing;
+  BM_Partition *part;
+  RC rc;
+  int n, i;
+
+  pthread_mutex_lock(&mgmtData->prefetchLock);
+  for (;;)
+  {
+    while (!mgmtData->prefetchCount && !mgmtData->prefetchStop)
+      pthread_cond_wait(&mgmtData->prefetchWake, &mgmtData->prefetchLock);
+    if (!mgmtData->prefetchCount)
+      break;
+
+    // The frames are pinned, their pages stay
+    n= 0;
+    do {
+      run[n]= ring[mgmtData->prefetchHead];
+      pages[n]= run[n]->data;
+      n++;
+      mgmtData->prefetchHead= (mgmtData->prefetchHead+1) % bm->numPages;
+      mgmtData->prefetchCount--;
+    } while (mgmtData->prefetchCount && n < SM_ASYNC_MAX_PAGES &&
+             ring[mgmtData->prefetchHead]->pn == run[0]->pn+n);
+    pthread_mutex_unlock(&mgmtData->prefetchLock);
+
+    rc= readBlocks(run[0]->pn, n, &mgmtData->fh, pages);
+
+    for (i=0; i<n; i++)
     {
-      BM_UNLOCK();
-      return rc;
+      part= framePartition(mgmtData, run[i]);
+      BM_LOCK(part);
+      part->numPrefetching--;
+      finishRead(bm, part, run[i], rc);
+      if (rc==RC_OK)
+        releaseFrame(bm, part, run[i]);
+      BM_UNLOCK(part);
     }
+    pthread_mutex_lock(&mgmtData->prefetchLock);
   }
-  rc= readBlock(pageNum, &mgmtData->fh, &pf->data[0]);
-  if (rc!=RC_OK)
+  pthread_mutex_unlock(&mgmtData->prefetchLock);
+  return NULL;
+}
+
+// Start the prefetcher on first use
+static RC startPrefetcher(BM_BufferPool *const bm)
+{
+  BM_Pool_MgmtData *mgmtData= bm->mgmtData;
+  RC rc= RC_OK;
+
+  pthread_mutex_lock(&mgmtData->prefetchLock);
+  if (!mgmtData->prefetcherRunning)
   {
-    BM_UNLOCK();
-    return rc;
+    if (!mgmtData->prefetchRing)
+      mgmtData->prefetchRing= (BM_PageFrame**) malloc(bm->numPages*sizeof(BM_PageFrame*));
+    mgmtData->prefetchHead= 0;
+    mgmtData->prefetchCount= 0;
+    mgmtData->prefetchStop= FALSE;
+    if (pthread_create(&mgmtData->prefetcher, NULL, prefetcher, bm))
+      rc= RC_PREFETCH_START_FAILED;
+    else
+      mgmtData->prefetcherRunning= TRUE;
   }
-  mgmtData->io_reads++;
+  pthread_mutex_unlock(&mgmtData->prefetchLock);
+  return rc;
+}
 
-  // Mark page frame as used
-  pf->fixCount++;
-  pf->pn= page->pageNum= pageNum;
-  page->data= &pf->data[0];
+// Stop the prefetcher once the reads queued are done
+static void stopPrefetcher(BM_BufferPool *const bm)
+{
+  BM_Pool_MgmtData *mgmtData= bm->mgmtData;
+  int running;
 
-  // Map page number to frame;
-  setPageFrame(&mgmtData->pt_head, pageNum, pf);
+  pthread_mutex_lock(&mgmtData->prefetchLock);
+  running= mgmtData->prefetcherRunning;
+  mgmtData->prefetchStop= TRUE;
+  mgmtData->prefetcherRunning= FALSE;
+  pthread_cond_signal(&mgmtData->prefetchWake);
+  pthread_mutex_unlock(&mgmtData->prefetchLock);
 
-   //Set the flag for the flag as false, which will prevent any replacement of this frame
-   if (bm->strategy == RS_CLOCK)
-     pf->clockReplaceFlag = FALSE;
+  if (running)
+    pthread_join(mgmtData->prefetcher, NULL);
+}
+
+RC prefetchPage (BM_BufferPool *const bm, const PageNumber pageNum)
+{
+  return prefetchRange(bm, pageNum, 1);
+}
+
+// Claim a frame for each page as pinPage() would, leaving the read to
+// the prefetcher. The prefetcher's pin keeps the frame until then.
+// Pages whose victim is dirty are skipped, the replacement state as it
+// was, writing it back is up to pinPage() or the background writer.
+RC prefetchRange (BM_BufferPool *const bm, const PageNumber startPage, int count)
+{
+  BM_Pool_MgmtData *mgmtData= bm->mgmtData;
+  BM_PageFrame *victim;
+  BM_Partition *part;
+  PageNumber pn;
+  int queued= 0;
+  RC rc;
+
+  rc= startPrefetcher(bm);
+  if (rc!=RC_OK)
+    RETURN(rc);
+
+  for (pn= startPage < 0 ? 0 : startPage; pn < startPage+count; pn++)
+  {
+    if (pn >= mgmtData->fh.totalNumPages)
+      break;
+    part= pagePartition(mgmtData, pn);
+    BM_LOCK(part);
+    if (findPageFrame(&part->pt_head, pn) || part->numPrefetching >= part->numFrames/2 ||
+        !(victim= peekFreeFrame(bm, part, pn)) || victim->dirty ||
+        !(victim= findFreeFrame(bm, part, pn)) || victim->dirty)
+    {
+      BM_UNLOCK(part);
+      continue;
+    }
+    claimFrame(bm, part, victim, pn);
+    part->numPrefetching++;
+    BM_UNLOCK(part);
+
+    pthread_mutex_lock(&mgmtData->prefetchLock);
+    mgmtData->prefetchRing[(mgmtData->prefetchHead+mgmtData->prefetchCount) % bm->numPages]= victim;
+    mgmtData->prefetchCount++;
+    pthread_mutex_unlock(&mgmtData->prefetchLock);
+    queued++;
+  }
 
-  BM_UNLOCK();
+  if (queued)
+    pthread_cond_signal(&mgmtData->prefetchWake);
   RETURN(RC_OK);
 }
 
 /**************************************************
  * Strategy management functions
+ *
+ * Pick an unpinned frame of the partition that is not being written,
+ * to put page pn in. It keeps its page until pinPage() takes it, which
+ * may first write it back if dirty.
  */
-static BM_PageFrame* findFreeFrame(BM_BufferPool *bm)
+static BM_PageFrame* findFreeFrame(BM_BufferPool *bm, BM_Partition *part, PageNumber pn)
 {
   switch (bm->strategy)
   {
       case RS_FIFO:
-        return findFreeFrameFIFO(bm);
+        return findFreeFrameFIFO(bm, part);
         
       case RS_CLOCK: 
-        return findFreeFrameCLOCK(bm);
+        return findFreeFrameCLOCK(bm, part);
       case RS_LRU:
-        return findFreeFrameLRU(bm);
-        
+        return findFreeFrameLRU(bm, part);
       case RS_LFU:
+        return findFreeFrameLFU(bm, part);
       case RS_LRU_K:
+        return findFreeFrameLRUK(bm, part);
+      case RS_ARC:
+        return findFreeFrameARC(bm, part, pn);
+      case RS_CLOCK_PRO:
+        return findFreeFrameClockPro(bm, part);
+        
       default:
         assert(!"Strategy not implemented\n");
   }
 }
 
+// The frame findFreeFrame() would pick, without the side effects some
+// strategies have: moving hands, clearing reference bits. LRU, LFU and
+// ARC only look. LRU-K moves frames past their correlated period to
+// its heap, which any later lookup would do as well.
+static BM_PageFrame* peekFreeFrame(BM_BufferPool *bm, BM_Partition *part, PageNumber pn)
+{
+  switch (bm->strategy)
+  {
+      case RS_FIFO:
+        return peekFreeFrameFIFO(bm, part);
+      case RS_CLOCK:
+        return peekFreeFrameCLOCK(bm, part);
+      case RS_CLOCK_PRO:
+        return peekClockProFrame(&part->stratData);
+      default:
+        return findFreeFrame(bm, part, pn);
+  }
+}
+
 /*
  * FIFO free page find strategy
  */
-static BM_PageFrame* findFreeFrameFIFO(BM_BufferPool *bm)
+static BM_PageFrame* peekFreeFrameFIFO(BM_BufferPool *bm, BM_Partition *part)
 {
-  RC rc;
   int frmNo, curFrame;
-  BM_Pool_MgmtData *mgmtData= mgmtData= bm->mgmtData;
+  BM_Pool_MgmtData *mgmtData= bm->mgmtData;
 
-  curFrame= mgmtData->stratData.fifoLastFreeFrame+1;
-  for (frmNo=0; frmNo < bm->numPages; frmNo++)
+  curFrame= part->stratData.fifoLastFreeFrame+1;
+  for (frmNo=0; frmNo < part->numFrames; frmNo++)
   {
-    curFrame= curFrame % bm->numPages;
-    BM_PageFrame *pf= &mgmtData->pool[curFrame];
-    if (pf->fixCount==0)
-    {
-        if (pf->dirty)
-        {
-          rc= writeIfDirty(bm, pf);
-          if (rc!=RC_OK)
-            return NULL;
-        }
-        else if (pf->pn != NO_PAGE)
-        {
-          // Reset Map, as we give this frame to different pn.
-          resetPageFrame(&mgmtData->pt_head, pf->pn);
-        }
-
-        mgmtData->stratData.fifoLastFreeFrame= curFrame;
+    curFrame= curFrame % part->numFrames;
+    BM_PageFrame *pf= &mgmtData->pool[part->firstFrame + curFrame];
+    if (FIX_COUNT(pf)==0 && !pf->writing)
         return pf;
-    }
     curFrame++;
   }
 
   return NULL;
 }
 
+static BM_PageFrame* findFreeFrameFIFO(BM_BufferPool *bm, BM_Partition *part)
+{
+  BM_PageFrame *pf= peekFreeFrameFIFO(bm, part);
+
+  if (pf)
+    part->stratData.fifoLastFreeFrame= pf - &((BM_Pool_MgmtData*) bm->mgmtData)->pool[part->firstFrame];
+  return pf;
+}
+
 /*
  * LRU free page find strategy
  */
-static BM_PageFrame* findFreeFrameLRU(BM_BufferPool *bm)
+static BM_PageFrame* findFreeFrameLRU(BM_BufferPool *bm, BM_Partition *part)
 {
-  RC rc;
-  BM_PageFrame *pf;
-  BM_Pool_MgmtData *mgmtData= mgmtData= bm->mgmtData;
+  BM_StrategyInfo *si= &part->stratData;
+  int i;
 
-  pf= retriveLRUFrame(&mgmtData->stratData);
-  if (!pf)
-    return NULL; // All frames pinned
-  
-  if (pf->dirty)
-  {
-     rc= writeIfDirty(bm, pf);
-     if (rc!=RC_OK)
-        return NULL;
-  }
-  else if (pf->pn != NO_PAGE)
-  {
-    // Reset Map, as we give this frame to different pn.
-    resetPageFrame(&mgmtData->pt_head, pf->pn);
-  }
+  // Least recently used first, frames being written are left for later
+  for (i= si->lru.head; i != LRU_NIL; i= si->lru_frames[i].lruNext)
+    if (!si->lru_frames[i].writing)
+      return &si->lru_frames[i];
 
-  return pf;
+  return NULL; // All frames pinned
+}
+
+/*
+ * LFU free page find strategy, least referenced first and of those
+ * the least recently used, see lfu_buckets.c
+ */
+static BM_PageFrame* findFreeFrameLFU(BM_BufferPool *bm, BM_Partition *part)
+{
+  return findLFUFrame(&part->stratData);
+}
+
+/*
+ * LRU-K free page find strategy, the oldest K-th latest reference,
+ * see lru_k.c
+ */
+static BM_PageFrame* findFreeFrameLRUK(BM_BufferPool *bm, BM_Partition *part)
+{
+  return findLRUKFrame(&part->stratData);
+}
+
+/*
+ * ARC free page find strategy, from T1 or T2 as their target sizes
+ * say, see arc.c
+ */
+static BM_PageFrame* findFreeFrameARC(BM_BufferPool *bm, BM_Partition *part, PageNumber pn)
+{
+  return findARCFrame(&part->stratData, pn);
+}
+
+/*
+ * CLOCK-Pro free page find strategy, the cold hand over bitmaps of
+ * frame state, see clock_pro.c
+ */
+static BM_PageFrame* findFreeFrameClockPro(BM_BufferPool *bm, BM_Partition *part)
+{
+  return findClockProFrame(&part->stratData);
 }
 
 /*
  *  CLOCK free page find strategy
  */
-static BM_PageFrame* findFreeFrameCLOCK(BM_BufferPool *bm)
+static BM_PageFrame* findFreeFrameCLOCK(BM_BufferPool *bm, BM_Partition *part)
 {
-  RC rc;
   int frmNo, curFrame;
-  BM_Pool_MgmtData *mgmtData= mgmtData= bm->mgmtData;
+  BM_Pool_MgmtData *mgmtData= bm->mgmtData;
 
-  curFrame= mgmtData->stratData.clockCurrentFrame+1;
+  curFrame= part->stratData.clockCurrentFrame+1;
   // cycle through buffer so that we can find an unpinned page
   // that may have its flag set to false
-  for (frmNo=0; frmNo < bm->numPages * 2 ; frmNo++)
+  for (frmNo=0; frmNo < part->numFrames * 2 ; frmNo++)
   {
-    curFrame= curFrame % bm->numPages;
-    BM_PageFrame *pf= &mgmtData->pool[curFrame];
+    curFrame= curFrame % part->numFrames;
+    BM_PageFrame *pf= &mgmtData->pool[part->firstFrame + curFrame];
     if (pf->clockReplaceFlag == TRUE)
     {
-      if (pf->fixCount==0)
+      if (FIX_COUNT(pf)==0 && !pf->writing)
       {
-        if (pf->dirty)
-        {
-          rc= writeIfDirty(bm, pf);
-          if (rc!=RC_OK)
-            return NULL;
-        }
-        else if (pf->pn != NO_PAGE)
-        {
-          // Reset Map, as we give this frame to different pn.
-          resetPageFrame(&mgmtData->pt_head, pf->pn);
-        }
-
-        mgmtData->stratData.clockCurrentFrame= curFrame;
+        part->stratData.clockCurrentFrame= curFrame;
         return pf;
       }
     }
@@ -427,72 +1286,113 @@ static BM_PageFrame* findFreeFrameCLOCK(BM_BufferPool *bm)
   return NULL;
 }
 
+/*
+ * The frame findFreeFrameCLOCK() would pick, flags left as they are:
+ * the first replaceable one its first round passes, else the first
+ * unpinned one, as the first round made them all replaceable.
+ */
+static BM_PageFrame* peekFreeFrameCLOCK(BM_BufferPool *bm, BM_Partition *part)
+{
+  int frmNo, curFrame, round;
+  BM_Pool_MgmtData *mgmtData= bm->mgmtData;
+
+  for (round=0; round < 2; round++)
+  {
+    curFrame= part->stratData.clockCurrentFrame+1;
+    for (frmNo=0; frmNo < part->numFrames; frmNo++)
+    {
+      curFrame= curFrame % part->numFrames;
+      BM_PageFrame *pf= &mgmtData->pool[part->firstFrame + curFrame];
+      if ((round || pf->clockReplaceFlag == TRUE) && FIX_COUNT(pf)==0 && !pf->writing)
+        return pf;
+      curFrame++;
+    }
+  }
+
+  return NULL;
+}
+
 
 // Statistics Interface
 // ***************************************
 PageNumber *getFrameContents (BM_BufferPool *const bm)
 {
   BM_Pool_MgmtData *mgmtData= bm->mgmtData;
-  BM_PageFrame *pf= &mgmtData->pool[0];
+  BM_Partition *part;
   PageNumber *pn;
-  int frmNo;
-  BM_LOCK();
+  int frmNo, p;
 
   pn= (PageNumber*) malloc(bm->numPages*sizeof(PageNumber));
 
-  for (frmNo=0; frmNo < bm->numPages; frmNo++)
+  for (p=0; p<mgmtData->numPartitions; p++)
   {
-    pn[frmNo]= pf->pn;
-    pf++;
+    part= &mgmtData->partitions[p];
+    BM_LOCK(part);
+    for (frmNo=part->firstFrame; frmNo < part->firstFrame+part->numFrames; frmNo++)
+      pn[frmNo]= mgmtData->pool[frmNo].pn;
+    BM_UNLOCK(part);
   }
 
-  BM_UNLOCK();
   return pn;
 }
 bool *getDirtyFlags (BM_BufferPool *const bm)
 {
   bool *dirty_array= (bool*) malloc(bm->numPages*sizeof(bool));
   BM_Pool_MgmtData *mgmtData= bm->mgmtData;
-  int frmNo;
-  BM_PageFrame *pf= &mgmtData->pool[0];
-  BM_LOCK();
+  BM_Partition *part;
+  int frmNo, p;
 
-  for (frmNo=0; frmNo < bm->numPages; frmNo++)
+  for (p=0; p<mgmtData->numPartitions; p++)
   {
-    if (pf->dirty)
-      dirty_array[frmNo]= TRUE;
-    else
-      dirty_array[frmNo]= FALSE;
-    pf++;
+    part= &mgmtData->partitions[p];
+    BM_LOCK(part);
+    for (frmNo=part->firstFrame; frmNo < part->firstFrame+part->numFrames; frmNo++)
+    {
+      if (mgmtData->pool[frmNo].dirty)
+        dirty_array[frmNo]= TRUE;
+      else
+        dirty_array[frmNo]= FALSE;
+    }
+    BM_UNLOCK(part);
   }
 
-  BM_UNLOCK();
   return dirty_array;
 }
 int *getFixCounts (BM_BufferPool *const bm)
 {
   int *fixCounts= (int*) malloc(bm->numPages*sizeof(int));
   BM_Pool_MgmtData *mgmtData= bm->mgmtData;
-  int frmNo;
-  BM_LOCK();
+  BM_Partition *part;
+  int frmNo, p;
 
-  BM_PageFrame *pf= &mgmtData->pool[0];
-  for (frmNo=0; frmNo < bm->numPages; frmNo++)
+  for (p=0; p<mgmtData->numPartitions; p++)
   {
-    fixCounts[frmNo]= pf->fixCount;
-    pf++;
+    part= &mgmtData->partitions[p];
+    BM_LOCK(part);
+    for (frmNo=part->firstFrame; frmNo < part->firstFrame+part->numFrames; frmNo++)
+      fixCounts[frmNo]= FIX_COUNT(&mgmtData->pool[frmNo]);
+    BM_UNLOCK(part);
   }
 
-  BM_UNLOCK();
   return fixCounts;
 }
 int getNumReadIO (BM_BufferPool *const bm)
 {
   BM_Pool_MgmtData *mgmtData= bm->mgmtData;
-  return mgmtData->io_reads;
+  return __atomic_load_n(&mgmtData->io_reads, __ATOMIC_RELAXED);
 }
 int getNumWriteIO (BM_BufferPool *const bm)
 {
   BM_Pool_MgmtData *mgmtData= bm->mgmtData;
-  return mgmtData->io_writes;
+  return __atomic_load_n(&mgmtData->io_writes, __ATOMIC_RELAXED);
+}
+int getNumForegroundWriteIO (BM_BufferPool *const bm)
+{
+  BM_Pool_MgmtData *mgmtData= bm->mgmtData;
+  return __atomic_load_n(&mgmtData->fg_writes, __ATOMIC_RELAXED);
+}
+int getNumBackgroundWriteIO (BM_BufferPool *const bm)
+{
+  BM_Pool_MgmtData *mgmtData= bm->mgmtData;
+  return __atomic_load_n(&mgmtData->bg_writes, __ATOMIC_RELAXED);
 }
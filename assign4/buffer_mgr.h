@@ -14,11 +14,13 @@ typedef enum ReplacementStrategy {
   RS_LRU = 1,
   RS_CLOCK = 2,
   RS_LFU = 3,
-  RS_LRU_K = 4
+  RS_LRU_K = 4,
+  RS_ARC = 5,
+  RS_CLOCK_PRO = 6
 } ReplacementStrategy;
 
 // Data Types and Structures
-typedef int PageNumber;
+// PageNumber comes from storage_mgr.h
 #define NO_PAGE -1
 
 typedef short bool;
@@ -29,10 +31,23 @@ typedef struct BM_BufferPool {
   char *pageFile;
   int numPages;
   ReplacementStrategy strategy;
+  int pageSize; // Bytes per page, from the page file header
   void *mgmtData; // use this one to store the bookkeeping info your buffer 
                   // manager needs for a buffer pool
 } BM_BufferPool;
 
+// stratData of initBufferPool() for RS_LRU_K, NULL for the defaults
+#define LRU_K_MAX       4
+typedef struct BM_LRUKParams {
+  int k;                // References kept per page, 1..LRU_K_MAX, default 2
+  int historySize;      // Replaced pages whose references are kept,
+                        // default the pool size, 0 for none
+  int correlatedPeriod; // A pin within this many pins of a partition
+                        // after the page's unpin is the same reference,
+                        // default BM_LRU_K_PERIOD
+} BM_LRUKParams;
+#define BM_LRU_K_PERIOD 4
+
 typedef struct BM_PageHandle {
   PageNumber pageNum;
   char *data;
@@ -44,60 +59,140 @@ typedef struct BM_PageFrame {
     int fixCount;
     PageNumber pn;  // Owner of the frame.
 
-    // Helps remove node in LRU faster,
-    // When in case, we request of pin and the page is
-    // found in pagetable, it is better to use same
-    // page so as to avoid disk read. This need removal
-    // of node from LRU, may be from mid of list.
-    struct LRU_Node *lru_node;
+    // Links of the LRU list or LFU bucket the frame is on, frame
+    // numbers in the partition, LRU_NIL at either end. Kept in the
+    // frame, so when we request a pin and the page is found in
+    // pagetable, it is removed from the mid of the list in O(1), and
+    // lists never allocate.
+    int lruPrev, lruNext;
     bool clockReplaceFlag;
 
-    char data[PAGE_SIZE];
+    // For LFU, references since the frame got its page, halved each
+    // time the partition ages after lfuEpoch.
+    int lfuCount;
+    unsigned int lfuEpoch;
+
+    // For ARC, ARC_T1 or ARC_T2 while the frame has a page, else 0
+    short arcList;
+
+    // Disk I/O runs without the partition lock. A frame being read
+    // is pinned, pinning it waits for the data. A frame being written
+    // is never chosen for replacement, it may still be pinned.
+    bool reading;
+    bool writing;
+
+    // Points into BM_Pool_MgmtData.frameData, SM_IO_ALIGN aligned
+    // so pages can go to disk with direct I/O.
+    char *data;
 } BM_PageFrame;
 
-// Per page table entries
-#define BITS_PER_LEVEL 8   // Considering 4 byte int. 
-                           // Each byte for 1 level of paging
-#define MAX_PT_ENTRIES 256 // pow(2, BITS_PER_LEVEL)
+// Page table, an open addressing hash table of page number to frame.
+// Sized for numFrames pages at load 1/2, so it never grows and a
+// lookup is mostly one cache line. Writers are serialized by the
+// caller, lookups take no lock, see page_table.c.
+typedef struct BM_PageTableSlot {
+    PageNumber pn;
+    BM_PageFrame *frame;  // NULL if the slot is empty
+} BM_PageTableSlot;
+
 typedef struct BM_PageTable {
-    // If this refCount is 0, then we can delete 'this' page table.
+    // Mapped pages. If this refCount is 0, the table is empty.
     int refCount;
-
-    // Entry can hold ptr to another page table
-    // or ptr to page frame.
-    void* entry[MAX_PT_ENTRIES];
+    int mask;             // Number of slots - 1, a power of 2 - 1
+    unsigned int seq;     // Odd while a removal moves entries
+    BM_PageTableSlot *slots;
 } BM_PageTable;
 
 // Strategy Related data structures
-typedef struct LRU_Node {
-  BM_PageFrame *frame;
-  
-  // List organized in a way that HEAD points to LRU frame
-  // and TAIL points to MRU
-  struct LRU_Node *next;
-  struct LRU_Node *prev;
-} LRU_Node;
+#define LRU_NIL -1
+
+#define ARC_T1 1
+#define ARC_T2 2
+
+// Reference counts above are kept as LFU_MAX_FREQ-1, one bucket each
+#define LFU_MAX_FREQ 32
+
+// Doubly linked list of frames, through lruPrev and lruNext
+typedef struct BM_FrameList {
+    int head, tail;
+} BM_FrameList;
 
 typedef struct BM_StrategyInfo {
     // For FIFO
     int fifoLastFreeFrame;
-    // For LRU
-    LRU_Node *lru_head, *lru_tail;
+    // Frame numbers in lists below are of lru_frames[]
+    BM_PageFrame *lru_frames;
+    // For LRU, list of unpinned frames organized in a way that HEAD
+    // is the LRU frame and TAIL the MRU
+    BM_FrameList lru;
+    // For LFU, unpinned frames by reference count, LRU order in each.
+    // Aging halves all counts, merging buckets 2f and 2f+1 into f.
+    BM_FrameList lfuBuckets[LFU_MAX_FREQ];
+    unsigned int lfuNonEmpty; // Bit f set if lfuBuckets[f] has frames
+    unsigned int lfuEpoch;    // Times aged
+    int lfuMisses;            // Since last aging
     // For CLOCK
     int clockCurrentFrame;
+    // For LRU-K, see lru_k.c
+    struct BM_LRUK *lruK;
+    // For ARC, see arc.c
+    struct BM_ARC *arc;
+    // For CLOCK-Pro, see clock_pro.c
+    struct BM_ClockPro *clockPro;
 } BM_StrategyInfo;
 
+// Pools of 2*BM_PARTITION_FRAMES frames or more are split into up to
+// BM_MAX_PARTITIONS partitions (a power of 2), each with its own lock,
+// page table and replacement state. A page always goes to the partition
+// its number hashes to, so replacement picks the victim among that
+// partition's frames. Smaller pools are one partition.
+#define BM_PARTITION_FRAMES 64
+#define BM_MAX_PARTITIONS   16
+
+typedef struct BM_Partition {
+  // Gaurd's the frames of this partition and all below
+  pthread_mutex_t lock;
+  pthread_cond_t ioDone;  // A frame's read or write finished
+  BM_PageTable pt_head;   // Keeps mapping of page number to page frame.
+  BM_StrategyInfo stratData;
+  int firstFrame;         // Frames [firstFrame, firstFrame+numFrames) of pool
+  int numFrames;
+  int numPrefetching;     // Frames pinned by the prefetcher while read
+} __attribute__((aligned(64))) BM_Partition; // Own cache line
+
 // Additional per BM details
 typedef struct BM_Pool_MgmtData {
   SM_FileHandle fh;
   BM_PageFrame *pool;   // Heap mem = [numPages * sizeof(BM_PageFrame)] bytes
-  BM_PageTable pt_head; // Keeps mapping of page number to page frame.
-  int io_reads;
+  char *frameData;      // Page contents of all frames, [numPages * bm->pageSize]
+  BM_Partition *partitions;
+  int numPartitions;
+  int io_reads;         // Updated atomically
   int io_writes;
-  BM_StrategyInfo stratData;
-
-  // Gaurd's complete buffer manager
-  pthread_mutex_t bm_mutex;
+  int fg_writes;        // Of io_writes, dirty victims written by pinPage()
+  int bg_writes;        // Of io_writes, by the background writer
+  int numDirty;         // Frames with dirty set, updated atomically
+  SM_AsyncQueue *flushQueue; // Made by the first flush of several frames,
+                             // NULL before or if async I/O is not available
+  bool flushQueueTried;      // initAsyncQueue() was called
+  pthread_mutex_t flushLock; // One flush at a time uses flushQueue
+  // Background writer, see startBackgroundWriter()
+  pthread_mutex_t writerLock; // Guards the fields below
+  pthread_cond_t writerWake;
+  pthread_t writer;
+  bool writerRunning;
+  bool writerStop;
+  int writerHigh;       // Cleans when more frames than this are dirty,
+  int writerLow;        // down to this many
+  // Prefetcher, see prefetchRange()
+  pthread_mutex_t prefetchLock; // Guards the fields below
+  pthread_cond_t prefetchWake;
+  pthread_t prefetcher;
+  bool prefetcherRunning;
+  bool prefetchStop;
+  BM_PageFrame **prefetchRing;  // Frames to read, in order, numPages long
+  int prefetchHead;
+  int prefetchCount;
 } BM_Pool_MgmtData;
 
 // convenience macros
@@ -110,9 +205,6 @@ typedef struct BM_Pool_MgmtData {
 #define MAKE_POOL_MGMTDATA()	\
   ((BM_Pool_MgmtData*) malloc (sizeof(BM_Pool_MgmtData)))
 
-#define MAKE_LRU_NODE()         \
-    ((LRU_Node*) malloc (sizeof(LRU_Node)))
-
 #define MAKE_BUFFER_POOL(n)     \
     ((BM_PageFrame*) malloc (sizeof(BM_PageFrame) * n))
 
@@ -120,8 +212,20 @@ typedef struct BM_Pool_MgmtData {
 RC initBufferPool(BM_BufferPool *const bm, const char *const pageFileName, 
 		  const int numPages, ReplacementStrategy strategy, 
 		  void *stratData);
+// Same, with SM_OPEN_* flags for the page file, e.g. SM_OPEN_DIRECT to
+// keep pages out of the kernel page cache, or SM_OPEN_GROUP_COMMIT to
+// make forcePage() and forceFlushPool() durable.
+RC initBufferPoolWithFlags(BM_BufferPool *const bm, const char *const pageFileName,
+		  const int numPages, ReplacementStrategy strategy,
+		  void *stratData, int openFlags);
 RC shutdownBufferPool(BM_BufferPool *const bm);
 RC forceFlushPool(BM_BufferPool *const bm);
+// Background writer: when more than highPercent of the frames are dirty
+// it writes dirty unpinned ones, those next to be replaced first, until
+// lowPercent are, so pinPage() mostly finds a clean victim. Calling it
+// again while running changes the thresholds.
+RC startBackgroundWriter(BM_BufferPool *const bm, int highPercent, int lowPercent);
+RC stopBackgroundWriter(BM_BufferPool *const bm);
 
 // Buffer Manager Interface - Access Pages
 RC markDirty (BM_BufferPool *const bm, BM_PageHandle *const page);
@@ -129,6 +233,13 @@ RC unpinPage (BM_BufferPool *const bm, BM_PageHandle *const page);
 RC forcePage (BM_BufferPool *const bm, BM_PageHandle *const page);
 RC pinPage (BM_BufferPool *const bm, BM_PageHandle *const page, 
 	    const PageNumber pageNum);
+// Start reading pages into the pool without pinning them, a thread of
+// the pool does the reads. pinPage() of such a page waits for its read
+// if still going on. Pages in the pool already, past the end of the
+// file, or that would need a dirty page written first are skipped, as
+// are pages past half of a partition's frames being read ahead.
+RC prefetchPage (BM_BufferPool *const bm, const PageNumber pageNum);
+RC prefetchRange (BM_BufferPool *const bm, const PageNumber startPage, int count);
 
 // Statistics Interface
 PageNumber *getFrameContents (BM_BufferPool *const bm);
@@ -136,5 +247,7 @@ bool *getDirtyFlags (BM_BufferPool *const bm);
 int *getFixCounts (BM_BufferPool *const bm);
 int getNumReadIO (BM_BufferPool *const bm);
 int getNumWriteIO (BM_BufferPool *const bm);
+int getNumForegroundWriteIO (BM_BufferPool *const bm); // Dirty victims by pinPage()
+int getNumBackgroundWriteIO (BM_BufferPool *const bm);
 
 #endif
@@ -0,0 +1,409 @@
+#include <stdlib.h>
+#include "clock_pro.h"
+
+/*
+ * CLOCK-Pro replacement state of a partition, after Jiang, Chen and
+ * Zhang, "CLOCK-Pro: An Effective Improvement of the CLOCK
+ * Replacement", USENIX 2005.
+ *
+ * Resident pages are hot or cold. A page comes in cold and in its test
+ * period. Used again while in it, it turns hot, the page has a reuse
+ * distance shorter than a cold page's stay. Replaced while in it, its
+ * number is kept as a non-resident test page, and a page coming back
+ * while that lasts comes in hot. Hot pages not used since the hot
+ * hand passed them last turn cold. The number of cold frames aimed at,
+ * mc, grows by one each time a test period sees a reuse and shrinks by
+ * one each time one ends without.
+ *
+ * Per frame state is in bitmaps of the partition, one bit per frame:
+ * ref, hot, test and pinned. The hands go over them 64 frames at a
+ * time. Frames already passed, pinned or hot are skipped by masking,
+ * and a summary bitmap with a bit per word that has unpinned frames
+ * lets the cold hand skip 64 words of pinned frames at a time. So a
+ * miss reads a few words of bitmap rather than frames, however many
+ * of them are pinned. Only a frame chosen is looked at, if it is being
+ * written it is passed over.
+ *
+ * ref is set without the partition lock by pins of pinned pages, so it
+ * changes atomically. The other bitmaps are under the lock.
+ *
+ * Simplified from the paper: frames stand in for positions on the
+ * clock, so non-resident test pages are kept apart, in a ring of c
+ * page numbers with a hash index. A test period ends when the hot hand
+ * passes the frame, or for a non-resident page when its slot of the
+ * ring is reused.
+ */
+
+#define WORD_BITS 64
+#define BIT(i)    (1ULL << ((i) % WORD_BITS))
+#define WORD(i)   ((i) / WORD_BITS)
+
+typedef unsigned long long BM_Word;
+
+struct BM_ClockPro {
+  int c;                // Frames of the partition
+  int numWords;
+  int numSummary;       // Words of unpinned
+  int mc;               // Cold frames aimed at, 1..c-1
+  int hotCount;
+  int coldHand, hotHand;
+  BM_Word *ref, *hot, *test, *pinned;
+  BM_Word *unpinned;    // Bit w set if pinned[w] has a frame clear
+  BM_Word lastWord;     // Bits of frames in the last word
+  BM_Word *scratch;     // Room for a copy of the bitmaps, see peekClockProFrame()
+
+  // Non-resident test pages
+  PageNumber *ghosts;   // Ring of c, NO_PAGE if free
+  int nextGhost;
+  int *slots;           // Ring positions, -1 if empty
+  int mask;
+};
+
+static unsigned int hashGhost(PageNumber pn)
+{
+  return (unsigned int) (((unsigned long long) pn * 0xff51afd7ed558ccdULL) >> 32);
+}
+
+static int findGhost(struct BM_ClockPro *cp, PageNumber pn)
+{
+  int i;
+
+  for (i= hashGhost(pn) & cp->mask; cp->slots[i] >= 0; i= (i+1) & cp->mask)
+    if (cp->ghosts[cp->slots[i]] == pn)
+      return i;
+  return -1;
+}
+
+// Empty slot i of the index, moving back later entries of the run as
+// in page_table.c
+static void removeSlot(struct BM_ClockPro *cp, int i)
+{
+  int j, home;
+
+  cp->ghosts[cp->slots[i]]= NO_PAGE;
+  for (j= (i+1) & cp->mask; cp->slots[j] >= 0; j= (j+1) & cp->mask)
+  {
+    home= hashGhost(cp->ghosts[cp->slots[j]]) & cp->mask;
+    if (i <= j ? (i < home && home <= j) : (i < home || home <= j))
+      continue;
+    cp->slots[i]= cp->slots[j];
+    i= j;
+  }
+  cp->slots[i]= -1;
+}
+
+static void adaptCold(struct BM_ClockPro *cp, int delta)
+{
+  cp->mc+= delta;
+  if (cp->mc < 1)
+    cp->mc= 1;
+  if (cp->mc > cp->c-1)
+    cp->mc= cp->c > 1 ? cp->c-1 : 1;
+}
+
+// Keep pn as non-resident test page, the oldest one's test period ends
+static void addGhost(struct BM_ClockPro *cp, PageNumber pn)
+{
+  int i;
+
+  if (cp->ghosts[cp->nextGhost] != NO_PAGE)
+  {
+    removeSlot(cp, findGhost(cp, cp->ghosts[cp->nextGhost]));
+    adaptCold(cp, -1);
+  }
+  cp->ghosts[cp->nextGhost]= pn;
+  for (i= hashGhost(pn) & cp->mask; cp->slots[i] >= 0; i= (i+1) & cp->mask)
+    ;
+  cp->slots[i]= cp->nextGhost;
+  cp->nextGhost= (cp->nextGhost+1) % cp->c;
+}
+
+// Frames of word w that exist
+static BM_Word validBits(struct BM_ClockPro *cp, int w)
+{
+  return w == cp->numWords-1 ? cp->lastWord : ~0ULL;
+}
+
+static void setPinned(struct BM_ClockPro *cp, int i)
+{
+  int w= WORD(i);
+
+  cp->pinned[w]|= BIT(i);
+  if (cp->pinned[w] == validBits(cp, w))
+    cp->unpinned[WORD(w)]&= ~BIT(w);
+}
+
+// First word after w with an unpinned frame, around the end, -1 if none
+static int nextUnpinnedWord(struct BM_ClockPro *cp, int w)
+{
+  int start= (w+1) % cp->numWords, s, i;
+  BM_Word bits;
+
+  for (i=0; i <= cp->numSummary; i++)
+  {
+    s= (WORD(start) + i) % cp->numSummary;
+    bits= cp->unpinned[s];
+    if (i == 0)
+      bits&= ~(BIT(start) - 1);
+    if (bits)
+      return s*WORD_BITS + __builtin_ctzll(bits);
+  }
+  return -1;
+}
+
+/*
+ * Hot hand: hot frames used since it passed turn unused, the first
+ * one unused turns cold. Cold frames it passes end their test period.
+ * Runs until there are no more hot frames than c-mc.
+ */
+static void runHotHand(struct BM_ClockPro *cp)
+{
+  BM_Word hot, ref, passed, demote, ended;
+  int w, bit, steps;
+
+  for (steps= 0; cp->hotCount > cp->c - cp->mc && steps <= 2*cp->numWords+1; steps++)
+  {
+    w= WORD(cp->hotHand);
+    passed= validBits(cp, w) & ~(BIT(cp->hotHand) - 1);
+    hot= cp->hot[w];
+    ref= __atomic_load_n(&cp->ref[w], __ATOMIC_RELAXED);
+    demote= hot & ~ref & passed;
+    if (demote)
+    {
+      bit= __builtin_ctzll(demote);
+      passed&= (BIT(bit) << 1) - 1;
+      cp->hot[w]&= ~BIT(bit);
+      cp->hotCount--;
+      cp->hotHand= w*WORD_BITS + bit + 1;
+    }
+    else
+      cp->hotHand= (w+1)*WORD_BITS;
+    if (cp->hotHand >= cp->c)
+      cp->hotHand= 0;
+
+    __atomic_fetch_and(&cp->ref[w], ~(hot & passed), __ATOMIC_RELAXED);
+    ended= cp->test[w] & ~hot & passed;
+    if (ended)
+    {
+      cp->test[w]&= ~ended;
+      adaptCold(cp, -__builtin_popcountll(ended));
+    }
+  }
+}
+
+/*
+ * Cold hand: passes cold frames that were used, which turn hot if in
+ * their test period or else start one, and stops at the first cold
+ * unpinned frame not used.
+ */
+static int runColdHand(BM_StrategyInfo *si, struct BM_ClockPro *cp)
+{
+  BM_Word cold, ref, passed, victims, promote;
+  int w, next, bit, words, frame;
+
+  for (words= 0; words <= 2*cp->numWords; words++)
+  {
+    w= WORD(cp->coldHand);
+    if (!(cp->unpinned[WORD(w)] & BIT(w)))
+    {
+      // All pinned, on to the next word that is not
+      if ((next= nextUnpinnedWord(cp, w)) < 0)
+        return -1;
+      words+= (next - w + cp->numWords) % cp->numWords - 1;
+      cp->coldHand= next*WORD_BITS;
+      continue;
+    }
+    passed= validBits(cp, w) & ~(BIT(cp->coldHand) - 1);
+    cold= ~cp->hot[w] & ~cp->pinned[w] & passed;
+    ref= __atomic_load_n(&cp->ref[w], __ATOMIC_RELAXED);
+    victims= cold & ~ref;
+    frame= -1;
+    if (victims)
+    {
+      bit= __builtin_ctzll(victims);
+      passed&= BIT(bit) - 1;
+      frame= w*WORD_BITS + bit;
+      cp->coldHand= frame+1;
+    }
+    else
+      cp->coldHand= (w+1)*WORD_BITS;
+    if (cp->coldHand >= cp->c)
+      cp->coldHand= 0;
+
+    // Used cold frames passed
+    cold&= ref & passed;
+    if (cold)
+    {
+      __atomic_fetch_and(&cp->ref[w], ~cold, __ATOMIC_RELAXED);
+      promote= cold & cp->test[w];
+      cp->test[w]= (cp->test[w] & ~promote) | (cold & ~promote);
+      cp->hot[w]|= promote;
+      cp->hotCount+= __builtin_popcountll(promote);
+      adaptCold(cp, __builtin_popcountll(promote));
+      runHotHand(cp);
+    }
+
+    if (frame >= 0 && !si->lru_frames[frame].writing)
+      return frame;
+  }
+  return -1;
+}
+
+// Turn the first unpinned hot frame cold and unused, 0 if none
+static int demoteUnpinned(struct BM_ClockPro *cp)
+{
+  BM_Word found;
+  int w;
+
+  for (w=0; w<cp->numWords; w++)
+    if ((found= cp->hot[w] & ~cp->pinned[w]))
+    {
+      found&= -found;
+      cp->hot[w]&= ~found;
+      cp->hotCount--;
+      __atomic_fetch_and(&cp->ref[w], ~found, __ATOMIC_RELAXED);
+      return 1;
+    }
+  return 0;
+}
+
+void initClockPro(BM_StrategyInfo *si, int numFrames)
+{
+  struct BM_ClockPro *cp;
+  int i, numSlots;
+
+  cp= (struct BM_ClockPro*) calloc(1, sizeof(struct BM_ClockPro));
+  cp->c= numFrames;
+  cp->numWords= (numFrames + WORD_BITS-1) / WORD_BITS;
+  cp->mc= numFrames/2;
+  adaptCold(cp, 0);
+  cp->lastWord= numFrames % WORD_BITS ? BIT(numFrames) - 1 : ~0ULL;
+  cp->numSummary= (cp->numWords + WORD_BITS-1) / WORD_BITS;
+  cp->ref= (BM_Word*) calloc(2*(4*cp->numWords + cp->numSummary), sizeof(BM_Word));
+  cp->hot= cp->ref + cp->numWords;
+  cp->test= cp->hot + cp->numWords;
+  cp->pinned= cp->test + cp->numWords;
+  cp->unpinned= cp->pinned + cp->numWords;
+  cp->scratch= cp->unpinned + cp->numSummary;
+  for (i=0; i<cp->numWords; i++)
+    cp->unpinned[WORD(i)]|= BIT(i);
+
+  cp->ghosts= (PageNumber*) malloc(numFrames*sizeof(PageNumber));
+  for (i=0; i<numFrames; i++)
+    cp->ghosts[i]= NO_PAGE;
+  for (numSlots= 8; numSlots < 2*numFrames; numSlots*= 2)
+    ;
+  cp->slots= (int*) malloc(numSlots*sizeof(int));
+  for (i=0; i<numSlots; i++)
+    cp->slots[i]= -1;
+  cp->mask= numSlots-1;
+  si->clockPro= cp;
+}
+
+void freeClockPro(BM_StrategyInfo *si)
+{
+  struct BM_ClockPro *cp= si->clockPro;
+
+  if (!cp)
+    return;
+  free(cp->slots);
+  free(cp->ghosts);
+  free(cp->ref);
+  free(cp);
+  si->clockPro= NULL;
+}
+
+// Pin of a frame, may run without the lock if it is pinned already
+void touchClockProFrame(BM_StrategyInfo *si, BM_PageFrame *pf)
+{
+  struct BM_ClockPro *cp= si->clockPro;
+  int i= pf - si->lru_frames;
+
+  if (!(__atomic_load_n(&cp->ref[WORD(i)], __ATOMIC_RELAXED) & BIT(i)))
+    __atomic_fetch_or(&cp->ref[WORD(i)], BIT(i), __ATOMIC_RELAXED);
+}
+
+// Unpinned frame gets pinned for its page
+void pinClockProFrame(BM_StrategyInfo *si, BM_PageFrame *pf)
+{
+  struct BM_ClockPro *cp= si->clockPro;
+  int i= pf - si->lru_frames;
+
+  setPinned(cp, i);
+  touchClockProFrame(si, pf);
+}
+
+// Unpinned frame with oldPn gets pinned for newPn
+void claimClockProFrame(BM_StrategyInfo *si, BM_PageFrame *pf, PageNumber oldPn, PageNumber newPn)
+{
+  struct BM_ClockPro *cp= si->clockPro;
+  int i= pf - si->lru_frames, slot;
+  BM_Word bit= BIT(i);
+
+  // Replaced in its test period, keep it as non-resident
+  if (oldPn != NO_PAGE && (cp->test[WORD(i)] & bit) && !(cp->hot[WORD(i)] & bit))
+    addGhost(cp, oldPn);
+  if (cp->hot[WORD(i)] & bit)
+    cp->hotCount--;
+  cp->hot[WORD(i)]&= ~bit;
+  __atomic_fetch_and(&cp->ref[WORD(i)], ~bit, __ATOMIC_RELAXED);
+  setPinned(cp, i);
+
+  // Back in its test period, it is hot. Else cold, in test period.
+  slot= findGhost(cp, newPn);
+  if (slot >= 0)
+  {
+    removeSlot(cp, slot);
+    adaptCold(cp, 1);
+    cp->test[WORD(i)]&= ~bit;
+    cp->hot[WORD(i)]|= bit;
+    cp->hotCount++;
+    runHotHand(cp);
+  }
+  else
+    cp->test[WORD(i)]|= bit;
+}
+
+// Frame got unpinned
+void releaseClockProFrame(BM_StrategyInfo *si, BM_PageFrame *pf)
+{
+  struct BM_ClockPro *cp= si->clockPro;
+  int i= pf - si->lru_frames;
+
+  cp->pinned[WORD(i)]&= ~BIT(i);
+  cp->unpinned[WORD(WORD(i))]|= BIT(WORD(i));
+}
+
+// Cold frame to replace, not pinned nor being written, NULL if none
+BM_PageFrame* findClockProFrame(BM_StrategyInfo *si)
+{
+  struct BM_ClockPro *cp= si->clockPro;
+  int frame;
+
+  // Cold frames all pinned, turn a hot one cold
+  frame= runColdHand(si, cp);
+  if (frame < 0 && demoteUnpinned(cp))
+    frame= runColdHand(si, cp);
+  return frame >= 0 ? &si->lru_frames[frame] : NULL;
+}
+
+// Frame findClockProFrame() would return, the state left as it is. The
+// hands run on a copy of the bitmaps, a few words per 64 frames.
+BM_PageFrame* peekClockProFrame(BM_StrategyInfo *si)
+{
+  struct BM_ClockPro *cp= si->clockPro, copy= *cp;
+  int numBits= 4*cp->numWords + cp->numSummary, i, frame;
+
+  for (i=0; i<numBits; i++)
+    cp->scratch[i]= __atomic_load_n(&cp->ref[i], __ATOMIC_RELAXED);
+  copy.ref= cp->scratch;
+  copy.hot= copy.ref + cp->numWords;
+  copy.test= copy.hot + cp->numWords;
+  copy.pinned= copy.test + cp->numWords;
+  copy.unpinned= copy.pinned + cp->numWords;
+
+  frame= runColdHand(si, &copy);
+  if (frame < 0 && demoteUnpinned(&copy))
+    frame= runColdHand(si, &copy);
+  return frame >= 0 ? &si->lru_frames[frame] : NULL;
+}
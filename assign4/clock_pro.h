@@ -0,0 +1,16 @@
+#ifndef CLOCK_PRO_H
+#define CLOCK_PRO_H
+#include "buffer_mgr.h"
+
+// CLOCK-Pro state of a partition, see clock_pro.c. Caller holds the
+// partition lock, but for touchClockProFrame() on a pinned frame.
+void initClockPro         (BM_StrategyInfo *si, int numFrames);
+void freeClockPro         (BM_StrategyInfo *si);
+void touchClockProFrame   (BM_StrategyInfo *si, BM_PageFrame *pf);
+void pinClockProFrame     (BM_StrategyInfo *si, BM_PageFrame *pf);
+void claimClockProFrame   (BM_StrategyInfo *si, BM_PageFrame *pf,
+                           PageNumber oldPn, PageNumber newPn);
+void releaseClockProFrame (BM_StrategyInfo *si, BM_PageFrame *pf);
+BM_PageFrame* findClockProFrame (BM_StrategyInfo *si);
+BM_PageFrame* peekClockProFrame (BM_StrategyInfo *si);
+#endif
@@ -0,0 +1,154 @@
+#include <pthread.h>
+#include <string.h>
+#include "crc32c.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <nmmintrin.h>
+#define HAVE_SSE42_CRC 1
+#endif
+
+#define POLY 0x82f63b78 // Castagnoli, reflected
+
+// The crc32 instruction takes 3 cycles but can start one every cycle,
+// so 3 blocks of SHORT_BLOCK bytes are done at once. Their CRCs are
+// combined by appending SHORT_BLOCK zero bytes to one, that is linear
+// in its bits, so shortShift[k][b] does it for byte k being b.
+#define SHORT_BLOCK 256
+
+typedef unsigned int (*CrcFunc)(unsigned int crc, const void *buf, size_t len);
+
+// table[k][b] is the CRC of byte b followed by k zero bytes
+static unsigned int table[8][256];
+static unsigned int shortShift[4][256];
+static CrcFunc crcFunc;
+static pthread_once_t initOnce= PTHREAD_ONCE_INIT;
+
+static void initTables(void)
+{
+    unsigned int crc;
+    int b, k;
+
+    for (b=0; b<256; b++)
+    {
+        crc= b;
+        for (k=0; k<8; k++)
+            crc= (crc >> 1) ^ ((crc & 1) ? POLY : 0);
+        table[0][b]= crc;
+    }
+    for (b=0; b<256; b++)
+        for (k=1; k<8; k++)
+            table[k][b]= (table[k-1][b] >> 8) ^ table[0][table[k-1][b] & 0xff];
+}
+
+static void initShiftTables(void)
+{
+    unsigned int bits[32], crc;
+    int i, b, k;
+
+    // Each bit of the register, moved past SHORT_BLOCK zero bytes
+    for (i=0; i<32; i++)
+    {
+        crc= 1u << i;
+        for (k=0; k<SHORT_BLOCK*8; k++)
+            crc= (crc >> 1) ^ ((crc & 1) ? POLY : 0);
+        bits[i]= crc;
+    }
+    for (k=0; k<4; k++)
+        for (b=0; b<256; b++)
+        {
+            crc= 0;
+            for (i=0; i<8; i++)
+                if (b & (1 << i))
+                    crc^= bits[8*k + i];
+            shortShift[k][b]= crc;
+        }
+}
+
+static unsigned int shiftShort(unsigned int crc)
+{
+    return shortShift[0][crc & 0xff] ^ shortShift[1][(crc >> 8) & 0xff] ^
+           shortShift[2][(crc >> 16) & 0xff] ^ shortShift[3][crc >> 24];
+}
+
+// Slicing by 8: one lookup per byte, 8 of them independent
+static unsigned int crcSoftware(unsigned int crc, const void *buf, size_t len)
+{
+    const unsigned char *p= (const unsigned char*) buf;
+    unsigned int lo, hi;
+
+    crc= ~crc;
+    for (; len >= 8; len-= 8, p+= 8)
+    {
+        memcpy(&lo, p, 4);
+        memcpy(&hi, p + 4, 4);
+        lo^= crc;
+        crc= table[7][lo & 0xff] ^ table[6][(lo >> 8) & 0xff] ^
+             table[5][(lo >> 16) & 0xff] ^ table[4][lo >> 24] ^
+             table[3][hi & 0xff] ^ table[2][(hi >> 8) & 0xff] ^
+             table[1][(hi >> 16) & 0xff] ^ table[0][hi >> 24];
+    }
+    for (; len; len--, p++)
+        crc= (crc >> 8) ^ table[0][(crc ^ *p) & 0xff];
+    return ~crc;
+}
+
+#ifdef HAVE_SSE42_CRC
+// 8 bytes at any address, also in unoptimized builds a plain load
+typedef unsigned long long __attribute__((may_alias, aligned(1))) Unaligned64;
+
+__attribute__((target("sse4.2")))
+static unsigned int crcHardware(unsigned int crc, const void *buf, size_t len)
+{
+    const unsigned char *p= (const unsigned char*) buf, *end;
+    unsigned long long c= ~crc, c1, c2;
+
+    for (; len >= 3*SHORT_BLOCK; len-= 3*SHORT_BLOCK, p+= 2*SHORT_BLOCK)
+    {
+        c1= c2= 0;
+        for (end= p + SHORT_BLOCK; p < end; p+= 8)
+        {
+            c= _mm_crc32_u64(c, *(const Unaligned64*) p);
+            c1= _mm_crc32_u64(c1, *(const Unaligned64*) (p + SHORT_BLOCK));
+            c2= _mm_crc32_u64(c2, *(const Unaligned64*) (p + 2*SHORT_BLOCK));
+        }
+        c= shiftShort((unsigned int) c) ^ c1;
+        c= shiftShort((unsigned int) c) ^ c2;
+    }
+    for (; len >= 8; len-= 8, p+= 8)
+        c= _mm_crc32_u64(c, *(const Unaligned64*) p);
+    for (; len; len--, p++)
+        c= _mm_crc32_u8((unsigned int) c, *p);
+    return ~(unsigned int) c;
+}
+#endif
+
+static void init(void)
+{
+    initTables();
+    crcFunc= crcSoftware;
+#ifdef HAVE_SSE42_CRC
+    if (__builtin_cpu_supports("sse4.2"))
+    {
+        initShiftTables();
+        crcFunc= crcHardware;
+    }
+#endif
+}
+
+unsigned int crc32c (unsigned int crc, const void *buf, size_t len)
+{
+    pthread_once(&initOnce, init);
+    return crcFunc(crc, buf, len);
+}
+
+unsigned int crc32cSoftware (unsigned int crc, const void *buf, size_t len)
+{
+    pthread_once(&initOnce, init);
+    return crcSoftware(crc, buf, len);
+}
+
+int crc32cHardware (void)
+{
+    pthread_once(&initOnce, init);
+    return crcFunc != crcSoftware;
+}
@@ -0,0 +1,21 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>
+
+/*
+ * CRC32C (Castagnoli), the checksum of iSCSI, ext4 and btrfs. Uses
+ * the SSE4.2 crc32 instruction when the CPU has it, else a table
+ * driven version that handles 8 bytes per step. Both give the same
+ * result, crc32c(0, "123456789", 9) is 0xe3069283. Pass the result
+ * of a call as crc to continue a checksum over more bytes.
+ */
+extern unsigned int crc32c (unsigned int crc, const void *buf, size_t len);
+
+/* The table driven version, also where SSE4.2 is available */
+extern unsigned int crc32cSoftware (unsigned int crc, const void *buf, size_t len);
+
+/* 1 if crc32c() uses the crc32 instruction */
+extern int crc32cHardware (void);
+
+#endif
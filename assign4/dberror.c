@@ -3,7 +3,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 
-char *RC_message;
+__thread char *RC_message;
 typedef struct errMsg
 {
     int code;
@@ -29,6 +29,22 @@ static errMsg errMsgs[]= {
     { RC_PAGE_NOT_PINNED, "Page not pinned"},
     { RC_HAVE_PINNED_PAGE, "Cannot shutdown, page is pinned"},
 
+    { RC_PAGE_NOT_MAPPED, "Page is not memory mapped"},
+    { RC_ASYNC_INIT_FAILED, "Async I/O queue setup failed"},
+    { RC_ASYNC_QUEUE_FULL, "Async I/O queue is full"},
+    { RC_ASYNC_PENDING, "Async I/O request still in progress"},
+    { RC_ASYNC_INVALID_TICKET, "Unknown async I/O ticket"},
+    { RC_INVALID_PAGE_SIZE, "Unsupported page size"},
+    { RC_BAD_PAGE_FILE, "Not a page file, or bad file header"},
+    { RC_PAGE_ALREADY_FREE, "Page is already free"},
+    { RC_CHECKSUM_MISMATCH, "Page does not match its checksum"},
+    { RC_INVALID_ACCESS_PATTERN, "Unknown access pattern"},
+    { RC_INVALID_STRATEGY_DATA, "Invalid replacement strategy parameters"},
+    { RC_INVALID_WRITER_THRESHOLD, "Invalid background writer thresholds"},
+    { RC_WRITER_START_FAILED, "Cannot start background writer"},
+    { RC_PREFETCH_START_FAILED, "Cannot start prefetch thread"},
+    { RC_INVALID_DURABILITY, "Invalid durability mode or group window"},
+
     { RC_RM_COMPARE_VALUE_OF_DIFFERENT_DATATYPE, "Incompatible types"},
     { RC_RM_EXPR_RESULT_IS_NOT_BOOLEAN, "Result is not a boolean"},
     { RC_RM_BOOLEAN_EXPR_ARG_IS_NOT_BOOLEAN, "Not a boolean expression"},
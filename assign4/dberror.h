@@ -30,6 +30,23 @@ typedef int RC;
 #define RC_PAGE_NOT_PINNED 14
 #define RC_HAVE_PINNED_PAGE 15
 
+/* more error codes for storage engine */
+#define RC_PAGE_NOT_MAPPED 16
+#define RC_ASYNC_INIT_FAILED 17
+#define RC_ASYNC_QUEUE_FULL 18
+#define RC_ASYNC_PENDING 19
+#define RC_ASYNC_INVALID_TICKET 20
+#define RC_INVALID_PAGE_SIZE 21
+#define RC_BAD_PAGE_FILE 22
+#define RC_PAGE_ALREADY_FREE 23
+#define RC_CHECKSUM_MISMATCH 24
+#define RC_INVALID_ACCESS_PATTERN 25
+#define RC_INVALID_STRATEGY_DATA 26
+#define RC_INVALID_WRITER_THRESHOLD 27
+#define RC_WRITER_START_FAILED 28
+#define RC_PREFETCH_START_FAILED 29
+#define RC_INVALID_DURABILITY 30
+
 /* New error codes for Record manager */
 #define RC_RM_COMPARE_VALUE_OF_DIFFERENT_DATATYPE 200
 #define RC_RM_EXPR_RESULT_IS_NOT_BOOLEAN 201
@@ -50,8 +67,8 @@ typedef int RC;
 #define RC_IM_NO_MORE_ENTRIES 303
 #define RC_ORDER_TOO_HIGH_FOR_PAGE 304
 
-/* holder for error messages */
-extern char *RC_message;
+/* holder for error messages, one per thread */
+extern __thread char *RC_message;
 
 /* print a message to standard out describing the error */
 extern void printError (RC error);
@@ -0,0 +1,131 @@
+#include <assert.h>
+#include "lfu_buckets.h"
+#include "lru_linked_list.h"
+
+/*
+ * LFU replacement state of a partition
+ *
+ * Unpinned frames sit in lfuBuckets[f], f their reference count, with
+ * the least recently unpinned at HEAD. The victim is the HEAD of the
+ * lowest non empty bucket, found with one bit scan of lfuNonEmpty.
+ *
+ * Pinned frames are on no list, a pin only counts up lfuCount and
+ * the frame goes to its bucket when unpinned. So a hit on a pinned
+ * frame needs no lock, and moving a frame is O(1) however far its
+ * count went.
+ *
+ * Aging: each time the partition had LFU_AGE_MISSES misses per frame,
+ * all counts are halved, so a page hot long ago loses to ones hot now.
+ * Buckets 2f and 2f+1 are merged into f, the counts in the frames are
+ * halved lazily, lfuEpoch of a frame tells how often it still must be.
+ */
+
+// Fewer keep more of a changing hot set, more of a steady one
+#define LFU_AGE_MISSES 8
+
+// Count of frame as of now, capped
+static int currentCount(BM_StrategyInfo *si, BM_PageFrame *pf)
+{
+  unsigned int shift= si->lfuEpoch - pf->lfuEpoch;
+  int count= __atomic_load_n(&pf->lfuCount, __ATOMIC_RELAXED);
+
+  count= shift < 31 ? count >> shift : 0;
+  return count < LFU_MAX_FREQ ? count : LFU_MAX_FREQ-1;
+}
+
+static void ageBuckets(BM_StrategyInfo *si)
+{
+  int f;
+
+  for (f=0; f<LFU_MAX_FREQ/2; f++)
+  {
+    if (f > 0)
+      concatFrames(si->lru_frames, &si->lfuBuckets[f], &si->lfuBuckets[2*f]);
+    concatFrames(si->lru_frames, &si->lfuBuckets[f], &si->lfuBuckets[2*f+1]);
+  }
+  si->lfuNonEmpty= 0;
+  for (f=0; f<LFU_MAX_FREQ/2; f++)
+    if (si->lfuBuckets[f].head != LRU_NIL)
+      si->lfuNonEmpty|= 1u << f;
+  si->lfuEpoch++;
+}
+
+// All frames of lru_frames[0..numFrames-1] are unreferenced and free
+void initLFUbuckets(BM_StrategyInfo *si, int numFrames)
+{
+  int f, i;
+
+  for (f=0; f<LFU_MAX_FREQ; f++)
+    si->lfuBuckets[f].head= si->lfuBuckets[f].tail= LRU_NIL;
+  si->lfuNonEmpty= 0;
+  si->lfuEpoch= 0;
+  si->lfuMisses= 0;
+  for (i=0; i<numFrames; i++)
+  {
+    si->lru_frames[i].lfuCount= 0;
+    si->lru_frames[i].lfuEpoch= 0;
+    releaseLFUFrame(si, &si->lru_frames[i]);
+  }
+}
+
+// One more reference to a pinned frame, may run without the lock
+void touchLFUFrame(BM_PageFrame *pf)
+{
+  // Past the cap, counts stay as they are until halved
+  if (__atomic_load_n(&pf->lfuCount, __ATOMIC_RELAXED) < LFU_MAX_FREQ)
+    __atomic_add_fetch(&pf->lfuCount, 1, __ATOMIC_RELAXED);
+}
+
+// Frame got unpinned, into its bucket as most recent
+void releaseLFUFrame(BM_StrategyInfo *si, BM_PageFrame *pf)
+{
+  int f= currentCount(si, pf);
+
+  pf->lfuCount= f;
+  pf->lfuEpoch= si->lfuEpoch;
+  appendFrame(si->lru_frames, &si->lfuBuckets[f], pf);
+  si->lfuNonEmpty|= 1u << f;
+}
+
+// Frame gets pinned, off its bucket
+void reuseLFUFrame(BM_StrategyInfo *si, BM_PageFrame *pf)
+{
+  int f= currentCount(si, pf);
+
+  removeFrame(si->lru_frames, &si->lfuBuckets[f], pf);
+  if (si->lfuBuckets[f].head == LRU_NIL)
+    si->lfuNonEmpty&= ~(1u << f);
+  pf->lfuCount= f;
+  pf->lfuEpoch= si->lfuEpoch;
+}
+
+// Frame gets pinned for a new page, which starts with no references.
+// Every LFU_AGE_MISSES*numFrames of these, counts are halved.
+void claimLFUFrame(BM_StrategyInfo *si, BM_PageFrame *pf, int numFrames)
+{
+  reuseLFUFrame(si, pf);
+  pf->lfuCount= 0;
+  if (++si->lfuMisses >= LFU_AGE_MISSES*numFrames)
+  {
+    ageBuckets(si);
+    si->lfuMisses= 0;
+    pf->lfuEpoch= si->lfuEpoch;
+  }
+}
+
+// Least frequently used frame not being written, NULL if none
+BM_PageFrame* findLFUFrame(BM_StrategyInfo *si)
+{
+  unsigned int buckets= si->lfuNonEmpty;
+  int f, i;
+
+  while (buckets)
+  {
+    f= __builtin_ctz(buckets);
+    for (i= si->lfuBuckets[f].head; i != LRU_NIL; i= si->lru_frames[i].lruNext)
+      if (!si->lru_frames[i].writing)
+        return &si->lru_frames[i];
+    buckets&= buckets-1;
+  }
+  return NULL;
+}
@@ -0,0 +1,13 @@
+#ifndef LFU_BUCKETS_H
+#define LFU_BUCKETS_H
+#include "buffer_mgr.h"
+
+// LFU state of a partition, see lfu_buckets.c. Caller holds the
+// partition lock, but for touchLFUFrame().
+void initLFUbuckets  (BM_StrategyInfo *si, int numFrames);
+void touchLFUFrame   (BM_PageFrame *pf);
+void releaseLFUFrame (BM_StrategyInfo *si, BM_PageFrame *pf);
+void reuseLFUFrame   (BM_StrategyInfo *si, BM_PageFrame *pf);
+void claimLFUFrame   (BM_StrategyInfo *si, BM_PageFrame *pf, int numFrames);
+BM_PageFrame* findLFUFrame (BM_StrategyInfo *si);
+#endif
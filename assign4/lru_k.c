@@ -0,0 +1,277 @@
+#include <stdlib.h>
+#include "lru_k.h"
+#include "lru_linked_list.h"
+
+/*
+ * LRU-K replacement state of a partition
+ *
+ * Time is the partition's count of references, a pin of an unpinned
+ * page or of a page not in the pool. Pins of a pinned page belong to
+ * the reference already going on. Per frame we keep the times of the
+ * last k uncorrelated references to its page and the last time it was
+ * pinned or unpinned.
+ *
+ * Correlated references: a pin within period of the page's last
+ * unpin is the same reference, e.g. a record read and then updated.
+ * It does not add to the history, only moves on last.
+ *
+ * Unpinned frames within period of their last unpin are on the recent
+ * list, in order of last. After that they move to a heap ordered by
+ * time of their k-th latest reference, the victim being the one with
+ * the oldest (or none), then the least recently used. So a scan,
+ * referencing each page once, only replaces other pages seen once.
+ *
+ * History: the k reference times of replaced pages are kept in a
+ * direct mapped table, newer replacements overwrite older ones. A page
+ * read in again starts from them, rather than as never seen.
+ */
+
+// Reference times of a frame. 0 for none.
+typedef struct BM_LRUKFrame {
+  unsigned long long hist[LRU_K_MAX]; // [0] latest
+  unsigned long long last;
+  int heapPos;                        // -1 if not in heap
+} BM_LRUKFrame;
+
+typedef struct BM_LRUKHistory {
+  PageNumber pn;                      // NO_PAGE if unused
+  unsigned long long hist[LRU_K_MAX];
+} BM_LRUKHistory;
+
+struct BM_LRUK {
+  int k;
+  int period;
+  unsigned long long time;
+  BM_LRUKFrame *frames;   // Per frame of lru_frames
+  int *heap;              // Frame numbers, heap[0] the victim
+  int heapSize;
+  BM_FrameList recent;
+  BM_LRUKHistory *history;
+  int historyMask;        // -1 if no history
+};
+
+static unsigned int hashHistory(PageNumber pn)
+{
+  return (unsigned int) (((unsigned long long) pn * 0xff51afd7ed558ccdULL) >> 32);
+}
+
+// Frame a goes before frame b as victim
+static int before(struct BM_LRUK *lk, int a, int b)
+{
+  BM_LRUKFrame *fa= &lk->frames[a], *fb= &lk->frames[b];
+
+  if (fa->hist[lk->k-1] != fb->hist[lk->k-1])
+    return fa->hist[lk->k-1] < fb->hist[lk->k-1];
+  if (fa->last != fb->last)
+    return fa->last < fb->last;
+  return a < b;
+}
+
+static void heapSet(struct BM_LRUK *lk, int pos, int frame)
+{
+  lk->heap[pos]= frame;
+  lk->frames[frame].heapPos= pos;
+}
+
+static void siftUp(struct BM_LRUK *lk, int pos)
+{
+  int frame= lk->heap[pos];
+
+  while (pos > 0 && before(lk, frame, lk->heap[(pos-1)/2]))
+  {
+    heapSet(lk, pos, lk->heap[(pos-1)/2]);
+    pos= (pos-1)/2;
+  }
+  heapSet(lk, pos, frame);
+}
+
+static void siftDown(struct BM_LRUK *lk, int pos)
+{
+  int frame= lk->heap[pos], child;
+
+  while ((child= 2*pos+1) < lk->heapSize)
+  {
+    if (child+1 < lk->heapSize && before(lk, lk->heap[child+1], lk->heap[child]))
+      child++;
+    if (!before(lk, lk->heap[child], frame))
+      break;
+    heapSet(lk, pos, lk->heap[child]);
+    pos= child;
+  }
+  heapSet(lk, pos, frame);
+}
+
+static void heapInsert(struct BM_LRUK *lk, int frame)
+{
+  lk->heap[lk->heapSize]= frame;
+  siftUp(lk, lk->heapSize++);
+}
+
+static void heapRemove(struct BM_LRUK *lk, int frame)
+{
+  int pos= lk->frames[frame].heapPos;
+
+  lk->frames[frame].heapPos= -1;
+  if (pos == --lk->heapSize)
+    return;
+  heapSet(lk, pos, lk->heap[lk->heapSize]);
+  siftUp(lk, pos);
+  siftDown(lk, lk->frames[lk->heap[pos]].heapPos);
+}
+
+// Unpinned frame off the recent list or heap
+static void removeFree(BM_StrategyInfo *si, int frame)
+{
+  struct BM_LRUK *lk= si->lruK;
+
+  if (lk->frames[frame].heapPos >= 0)
+    heapRemove(lk, frame);
+  else
+    removeFrame(si->lru_frames, &lk->recent, &si->lru_frames[frame]);
+}
+
+// Pin of frame at a new time
+static void reference(struct BM_LRUK *lk, int frame, int correlated)
+{
+  BM_LRUKFrame *f= &lk->frames[frame];
+  int i;
+
+  f->last= ++lk->time;
+  if (correlated)
+    return;
+  for (i= lk->k-1; i > 0; i--)
+    f->hist[i]= f->hist[i-1];
+  f->hist[0]= f->last;
+}
+
+void initLRUK(BM_StrategyInfo *si, int numFrames, int k, int historySize, int period)
+{
+  struct BM_LRUK *lk;
+  int i, numSlots;
+
+  lk= (struct BM_LRUK*) calloc(1, sizeof(struct BM_LRUK));
+  lk->k= k;
+  lk->period= period;
+  lk->frames= (BM_LRUKFrame*) calloc(numFrames, sizeof(BM_LRUKFrame));
+  lk->heap= (int*) malloc(numFrames*sizeof(int));
+  lk->recent.head= lk->recent.tail= LRU_NIL;
+  lk->historyMask= -1;
+  if (historySize > 0)
+  {
+    for (numSlots= 1; numSlots < historySize; numSlots*= 2)
+      ;
+    lk->history= (BM_LRUKHistory*) malloc(numSlots*sizeof(BM_LRUKHistory));
+    for (i=0; i<numSlots; i++)
+      lk->history[i].pn= NO_PAGE;
+    lk->historyMask= numSlots-1;
+  }
+  si->lruK= lk;
+
+  // Free frames, to be used in order
+  for (i=0; i<numFrames; i++)
+  {
+    lk->frames[i].heapPos= -1;
+    heapInsert(lk, i);
+  }
+}
+
+void freeLRUK(BM_StrategyInfo *si)
+{
+  struct BM_LRUK *lk= si->lruK;
+
+  if (!lk)
+    return;
+  free(lk->history);
+  free(lk->heap);
+  free(lk->frames);
+  free(lk);
+  si->lruK= NULL;
+}
+
+// Unpinned frame gets pinned for its page
+void pinLRUKFrame(BM_StrategyInfo *si, BM_PageFrame *pf)
+{
+  struct BM_LRUK *lk= si->lruK;
+  int frame= pf - si->lru_frames;
+  int correlated= lk->frames[frame].heapPos < 0 &&
+                  lk->time - lk->frames[frame].last < (unsigned long long) lk->period;
+
+  removeFree(si, frame);
+  reference(lk, frame, correlated);
+}
+
+// Unpinned frame gets pinned for page newPn. History of the page it
+// had is kept, the one of newPn taken if there is.
+void claimLRUKFrame(BM_StrategyInfo *si, BM_PageFrame *pf, PageNumber oldPn, PageNumber newPn)
+{
+  struct BM_LRUK *lk= si->lruK;
+  int frame= pf - si->lru_frames;
+  BM_LRUKFrame *f= &lk->frames[frame];
+  BM_LRUKHistory *h;
+  int i;
+
+  removeFree(si, frame);
+  if (lk->historyMask >= 0 && oldPn != NO_PAGE)
+  {
+    h= &lk->history[hashHistory(oldPn) & lk->historyMask];
+    h->pn= oldPn;
+    for (i=0; i<lk->k; i++)
+      h->hist[i]= f->hist[i];
+  }
+
+  for (i=0; i<lk->k; i++)
+    f->hist[i]= 0;
+  if (lk->historyMask >= 0)
+  {
+    h= &lk->history[hashHistory(newPn) & lk->historyMask];
+    if (h->pn == newPn)
+    {
+      for (i=0; i<lk->k; i++)
+        f->hist[i]= h->hist[i];
+      h->pn= NO_PAGE;
+    }
+  }
+  reference(lk, frame, 0);
+}
+
+// Frame got unpinned
+void releaseLRUKFrame(BM_StrategyInfo *si, BM_PageFrame *pf)
+{
+  struct BM_LRUK *lk= si->lruK;
+
+  lk->frames[pf - si->lru_frames].last= lk->time;
+  appendFrame(si->lru_frames, &lk->recent, pf);
+}
+
+// Frame with the oldest k-th reference not being written, NULL if none
+BM_PageFrame* findLRUKFrame(BM_StrategyInfo *si)
+{
+  struct BM_LRUK *lk= si->lruK;
+  int frame, i, best;
+
+  // Frames past the correlated period are candidates now
+  while ((frame= lk->recent.head) != LRU_NIL &&
+         lk->time - lk->frames[frame].last >= (unsigned long long) lk->period)
+  {
+    removeFrame(si->lru_frames, &lk->recent, &si->lru_frames[frame]);
+    heapInsert(lk, frame);
+  }
+
+  if (lk->heapSize > 0 && !si->lru_frames[lk->heap[0]].writing)
+    return &si->lru_frames[lk->heap[0]];
+
+  // Top of heap being written, look at all
+  best= LRU_NIL;
+  for (i=0; i<lk->heapSize; i++)
+    if (!si->lru_frames[lk->heap[i]].writing &&
+        (best == LRU_NIL || before(lk, lk->heap[i], best)))
+      best= lk->heap[i];
+  if (best != LRU_NIL)
+    return &si->lru_frames[best];
+
+  // Only frames unpinned just now, least recently used first
+  for (frame= lk->recent.head; frame != LRU_NIL; frame= si->lru_frames[frame].lruNext)
+    if (!si->lru_frames[frame].writing)
+      return &si->lru_frames[frame];
+  return NULL;
+}
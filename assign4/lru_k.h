@@ -0,0 +1,15 @@
+#ifndef LRU_K_H
+#define LRU_K_H
+#include "buffer_mgr.h"
+
+// LRU-K state of a partition, see lru_k.c. Caller holds the
+// partition lock.
+void initLRUK         (BM_StrategyInfo *si, int numFrames, int k,
+                       int historySize, int period);
+void freeLRUK         (BM_StrategyInfo *si);
+void pinLRUKFrame     (BM_StrategyInfo *si, BM_PageFrame *pf);
+void claimLRUKFrame   (BM_StrategyInfo *si, BM_PageFrame *pf,
+                       PageNumber oldPn, PageNumber newPn);
+void releaseLRUKFrame (BM_StrategyInfo *si, BM_PageFrame *pf);
+BM_PageFrame* findLRUKFrame (BM_StrategyInfo *si);
+#endif
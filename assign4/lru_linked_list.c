@@ -1,59 +1,78 @@
-#include <malloc.h>
 #include <assert.h>
 #include "lru_linked_list.h"
 
 // Just to make code look clean
-#define HEAD (si->lru_head)
-#define TAIL (si->lru_tail)
+#define HEAD (l->head)
+#define TAIL (l->tail)
+#define FRAME(i) (&frames[i])
+
+// Add frame at TAIL of list
+void appendFrame(BM_PageFrame *frames, BM_FrameList *l, BM_PageFrame *pf)
+{
+  int i= pf - frames;
+
+  pf->lruPrev= TAIL;
+  pf->lruNext= LRU_NIL;
+  if (TAIL == LRU_NIL)
+    HEAD= i;
+  else
+    FRAME(TAIL)->lruNext= i;
+  TAIL= i;
+}
+
+// Remove frame from anywhere in list
+void removeFrame(BM_PageFrame *frames, BM_FrameList *l, BM_PageFrame *pf)
+{
+  int i= pf - frames;
+
+  assert(pf->lruPrev != LRU_NIL || HEAD == i);
+
+  if (pf->lruPrev == LRU_NIL)
+    HEAD= pf->lruNext;
+  else
+    FRAME(pf->lruPrev)->lruNext= pf->lruNext;
+  if (pf->lruNext == LRU_NIL)
+    TAIL= pf->lruPrev;
+  else
+    FRAME(pf->lruNext)->lruPrev= pf->lruPrev;
+
+  pf->lruPrev= pf->lruNext= LRU_NIL;
+}
+
+// Move all frames of src to the TAIL of l, src is left empty
+void concatFrames(BM_PageFrame *frames, BM_FrameList *l, BM_FrameList *src)
+{
+  if (src->head == LRU_NIL)
+    return;
+  if (TAIL == LRU_NIL)
+    HEAD= src->head;
+  else
+  {
+    FRAME(TAIL)->lruNext= src->head;
+    FRAME(src->head)->lruPrev= TAIL;
+  }
+  TAIL= src->tail;
+  src->head= src->tail= LRU_NIL;
+}
 
 // Added at TAIL of list, representing
 // most recently used frame.
 void appendMRUFrame(BM_StrategyInfo *si, BM_PageFrame *pf)
 {
-  LRU_Node *node; 
-  node= MAKE_LRU_NODE();
-  node->next = NULL;
-  node->prev = NULL;
-  node->frame= pf;
-  pf->lru_node= node;
-
-  if(si->lru_head == NULL)
-    HEAD= TAIL= node;
-  else if(HEAD == TAIL)
-  { 
-    TAIL= node;
-    HEAD->next= TAIL;
-    TAIL->prev= HEAD;
-  } else 
-  {
-    TAIL->next= node;
-    node= TAIL->next;
-    node->prev= TAIL;
-    TAIL= node;
-  } 
+  appendFrame(si->lru_frames, &si->lru, pf);
 }
 
 // Returns least resently used frame
 // from HEAD of the list.
 BM_PageFrame* retriveLRUFrame(BM_StrategyInfo *si)
 {
-  LRU_Node *temp;
   BM_PageFrame *pf;
 
-  if(HEAD == NULL)
+  if (si->lru.head == LRU_NIL)
     return NULL;
 
-  // Read frame and Remove LRU node
-  pf= HEAD->frame;
-  pf->lru_node= NULL;
-  temp= HEAD->next;
-  free(HEAD);
-  if (temp)
-    temp->prev = NULL;
-  else
-    TAIL= NULL;
-  HEAD= temp;
-  
+  pf= &si->lru_frames[si->lru.head];
+  reuseLRUFrame(si, pf);
   return pf;
 }
 
@@ -61,44 +80,12 @@ BM_PageFrame* retriveLRUFrame(BM_StrategyInfo *si)
 // representing frame/page is in use now.
 void reuseLRUFrame(BM_StrategyInfo *si, BM_PageFrame *pf)
 {
-  LRU_Node *node;
-  LRU_Node *temp;
-
-  assert(pf->lru_node->frame == pf);
-  node= pf->lru_node;
-  pf->lru_node= NULL;
-
-  if (node == HEAD && node == TAIL)
-  {
-    free(node);
-    HEAD= TAIL= NULL;
-  } else if(node == HEAD)
-  {
-    HEAD= HEAD->next;
-    HEAD->prev= NULL;
-  } else if(node == TAIL)
-  {
-    TAIL= node->prev;
-    TAIL->next= NULL;
-  } else
-  {
-    temp= node->prev;
-    temp->next= node->next;
-    (temp->next)->prev= temp;
-  }
-
-  free(node);
+  removeFrame(si->lru_frames, &si->lru, pf);
 }
 
-// Remove all nodes
-void cleanLRUlist(BM_StrategyInfo *si)
+// Empty the list, frames are for lru_frames..lru_frames+numFrames-1
+void initLRUlist(BM_StrategyInfo *si, BM_PageFrame *frames)
 {
-  LRU_Node *temp;
-  while (HEAD != NULL)
-  {
-    temp= HEAD->next;
-    free(HEAD);
-    HEAD= temp;
-  }
-  HEAD= TAIL= NULL;
-} 
+  si->lru_frames= frames;
+  si->lru.head= si->lru.tail= LRU_NIL;
+}
@@ -2,8 +2,13 @@
 #define LRU
 #include "buffer_mgr.h"
 
+// Frame lists, frame numbers are of frames[]
+void appendFrame  (BM_PageFrame *frames, BM_FrameList *l, BM_PageFrame *pf);
+void removeFrame  (BM_PageFrame *frames, BM_FrameList *l, BM_PageFrame *pf);
+void concatFrames (BM_PageFrame *frames, BM_FrameList *l, BM_FrameList *src);
+
+void initLRUlist    (BM_StrategyInfo *si, BM_PageFrame *frames);
 BM_PageFrame* retriveLRUFrame(BM_StrategyInfo *si);
 void appendMRUFrame (BM_StrategyInfo *si, BM_PageFrame *pf);
 void reuseLRUFrame(BM_StrategyInfo *si, BM_PageFrame *pf);
-void cleanLRUlist   (BM_StrategyInfo *si);
 #endif
@@ -0,0 +1,183 @@
+#include <string.h>
+#include "lz_codec.h"
+
+/*
+ * LZ4 block format. Each sequence is
+ *   token           literal length (high 4 bits), match length - 4
+ *                   (low 4 bits), 15 means more length bytes follow
+ *   [length bytes]  255 each, until one is less
+ *   literals
+ *   offset          2 bytes little endian, back from the current output
+ *   [length bytes]  of the match
+ * The last sequence has literals only. As in LZ4, matches start at
+ * least MF_LIMIT bytes before the end and end LAST_LITERALS before it.
+ */
+#define HASH_BITS       12
+#define MIN_MATCH       4
+#define MF_LIMIT        12
+#define LAST_LITERALS   5
+#define MAX_OFFSET      65535
+#define SKIP_SHIFT      6   // Step up in incompressible data
+
+typedef unsigned char byte;
+
+static unsigned int read32(const byte *p)
+{
+    unsigned int v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static int hash4(unsigned int v)
+{
+    return (int) ((v * 2654435761U) >> (32 - HASH_BITS));
+}
+
+// Length bytes past the 15 in the token, NULL if out of room
+static byte* putLength(byte *op, byte *oend, int len)
+{
+    for (; len >= 255; len-= 255)
+    {
+        if (op >= oend)
+            return NULL;
+        *op++= 255;
+    }
+    if (op >= oend)
+        return NULL;
+    *op++= (byte) len;
+    return op;
+}
+
+// Sequence of litLen literals, then a match unless matchLen is 0
+static byte* putSequence(byte *op, byte *oend, const byte *lit, int litLen,
+                         int offset, int matchLen)
+{
+    byte *token;
+
+    if (op >= oend)
+        return NULL;
+    token= op++;
+    *token= (byte) ((litLen >= 15 ? 15 : litLen) << 4);
+    if (litLen >= 15 && !(op= putLength(op, oend, litLen - 15)))
+        return NULL;
+    if (litLen > oend - op)
+        return NULL;
+    memcpy(op, lit, litLen);
+    op+= litLen;
+    if (!matchLen)
+        return op;
+
+    if (oend - op < 2)
+        return NULL;
+    *op++= (byte) (offset & 0xff);
+    *op++= (byte) (offset >> 8);
+    matchLen-= MIN_MATCH;
+    *token|= (byte) (matchLen >= 15 ? 15 : matchLen);
+    if (matchLen >= 15 && !(op= putLength(op, oend, matchLen - 15)))
+        return NULL;
+    return op;
+}
+
+int lzCompress (const char *src, int srcLen, char *dst, int dstCapacity)
+{
+    const byte *s= (const byte*) src;
+    byte *op= (byte*) dst, *oend= (byte*) dst + dstCapacity;
+    int table[1 << HASH_BITS]; // Last position of each hash, -1 if none
+    int ip= 0, anchor= 0, ref, len, h;
+    int mfLimit= srcLen - MF_LIMIT, matchEnd= srcLen - LAST_LITERALS;
+    unsigned int seq;
+
+    if (srcLen < 0 || srcLen > LZ_MAX_INPUT)
+        return 0;
+    memset(table, 0xff, sizeof(table));
+
+    while (ip < mfLimit)
+    {
+        seq= read32(s + ip);
+        h= hash4(seq);
+        ref= table[h];
+        table[h]= ip;
+        if (ref < 0 || ip - ref > MAX_OFFSET || read32(s + ref) != seq)
+        {
+            ip+= 1 + ((ip - anchor) >> SKIP_SHIFT);
+            continue;
+        }
+
+        for (len= MIN_MATCH; ip + len < matchEnd && s[ref + len] == s[ip + len]; len++)
+            ;
+        if (!(op= putSequence(op, oend, s + anchor, ip - anchor, ip - ref, len)))
+            return 0;
+        ip+= len;
+        anchor= ip;
+
+        // Remember a position inside the match, helps runs
+        if (ip < mfLimit)
+            table[hash4(read32(s + ip - 2))]= ip - 2;
+    }
+
+    if (!(op= putSequence(op, oend, s + anchor, srcLen - anchor, 0, 0)))
+        return 0;
+    return (int) (op - (byte*) dst);
+}
+
+int lzDecompress (const char *src, int srcLen, char *dst, int dstCapacity)
+{
+    const byte *ip= (const byte*) src, *iend= ip + srcLen;
+    byte *op= (byte*) dst, *oend= op + dstCapacity;
+    const byte *match;
+    int litLen, matchLen, offset, b;
+
+    while (ip < iend)
+    {
+        b= *ip++;
+        litLen= b >> 4;
+        matchLen= b & 15;
+        if (litLen == 15)
+            do {
+                if (ip >= iend)
+                    return -1;
+                b= *ip++;
+                litLen+= b;
+            } while (b == 255);
+        if (litLen > iend - ip || litLen > oend - op)
+            return -1;
+        memcpy(op, ip, litLen);
+        ip+= litLen;
+        op+= litLen;
+
+        // Last sequence, literals only
+        if (ip == iend)
+            break;
+
+        if (iend - ip < 2)
+            return -1;
+        offset= ip[0] | (ip[1] << 8);
+        ip+= 2;
+        if (offset == 0 || offset > op - (byte*) dst)
+            return -1;
+        if (matchLen == 15)
+            do {
+                if (ip >= iend)
+                    return -1;
+                b= *ip++;
+                matchLen+= b;
+            } while (b == 255);
+        matchLen+= MIN_MATCH;
+        if (matchLen > oend - op)
+            return -1;
+
+        // Overlapping match repeats the last 'offset' bytes, copied
+        // in chunks that double, each a whole number of repeats
+        match= op - offset;
+        if (offset >= matchLen)
+            memcpy(op, match, matchLen);
+        else
+        {
+            memcpy(op, match, offset);
+            for (b= offset; b < matchLen; b*= 2)
+                memcpy(op + b, op, b < matchLen - b ? b : matchLen - b);
+        }
+        op+= matchLen;
+    }
+    return (int) (op - (byte*) dst);
+}
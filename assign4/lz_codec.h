@@ -0,0 +1,21 @@
+#ifndef LZ_CODEC_H
+#define LZ_CODEC_H
+
+/*
+ * Small LZ77 codec producing the LZ4 block format: sequences of
+ * literals and (offset, length) back references, no entropy coding.
+ * Greedy matching through a hash of 4 byte groups, so compression is
+ * fast and decompression is little more than memcpy. Inputs are
+ * limited to 64KB, the largest page size.
+ */
+#define LZ_MAX_INPUT 65536
+
+/* Compress srcLen bytes of src into dst. Returns the compressed size,
+ * or 0 if it does not fit in dstCapacity bytes. */
+extern int lzCompress (const char *src, int srcLen, char *dst, int dstCapacity);
+
+/* Decompress srcLen bytes of src into dst, which holds dstCapacity
+ * bytes. Returns the decompressed size, or -1 if src is corrupt. */
+extern int lzDecompress (const char *src, int srcLen, char *dst, int dstCapacity);
+
+#endif
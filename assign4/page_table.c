@@ -1,151 +1,140 @@
 #include <page_table.h>
+#include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 
 /*
  * Page to frame mapping
  *
- * This concept is very similar to how OS maps virtual
- * pages to physical page frames in RAM.
+ * An open addressing hash table with linear probing, keyed by page
+ * number. A pool never holds more pages than it has frames, so the
+ * table is sized once for numFrames at load 1/2 or less. A slot is
+ * 16 bytes, 4 to a cache line, and a lookup mostly ends within the
+ * line it starts in.
  *
- * We use similar concept. We use 4 level of page tables,
- * Following is bit map of integer that represents page number.
- * | Level4 8bit | Level3 8bit | Level2 8bit | Level1 8bit | 
- *
- * We initially have 2^16 integers pointed to by pt_head;
  * Finding frame with given offset: BM_PageFrame* findPageFrame(PageNumber pn);
  * -------------------------------
- * 1) Read Level1 offset and use it as offset to pt_head.
- *    Value in pt_head at this offset is ptr to level2 page table.
- *
- * 2) Read Level2 offset and use it as offset to pt_head_level2.
- *    Value in pt_head_level2 at this offset is ptr to level3 page table.
- *
- * 3) Read Level3 offset and use it as offset to pt_head_level3.
- *    Value in pt_head_level3 at this offset is ptr to level3 page table.
- *
- * 4) Read Level4 offset and use it as offset to pt_head_level4.
- *    Value in pt_head_level4 at this offset is ptr to page frame.
+ *  Hash pn to its home slot, then walk forward until the slot with pn
+ *  or an empty one.
  *
  * Add entries in page table: setPageFrame(PageNumber pn, BM_PageFrame *frame);
  * ----------------------------
- *  1) Use level1 offset from pn.
- *     check if value at offset in pt_head is NULL, then create new page table.
- *  2) Use level2 offset from pn.
- *     check if value at offset in pt_head is NULL, then create new page table.
- *  3) Use level3 offset from pn.
- *     check if value at offset in pt_head is NULL, then create new page table.
- *  4) Use level4 offset from pn.
- *     Give error if value at this offset is not null;
- *     check if value at offset is NULL, then store *frame here.
+ *  Walk from the home slot as above, store pn and frame in the first
+ *  empty slot. The frame goes last, a lookup seeing it also sees pn.
+ *
+ * Remove entries: resetPageFrame(PageNumber pn);
+ * ---------------
+ *  Later entries of the run that may sit in the freed slot are moved
+ *  back, so no tombstones pile up and lookups stay short.
  *
+ * Writers are serialized by the caller. Lookups take no lock: a
+ * removal makes seq odd while it moves entries, a lookup that saw seq
+ * change runs again.
  */
 
-#define OFFSET_OF_LEVEL(pn, lvl) ( (pn>>((4-lvl)*BITS_PER_LEVEL)) & 0x000000FF );
+#define MIN_PT_SLOTS  8
 
-#define MAKE_PAGE_TABLE()				\
-  ((BM_PageTable *) malloc (sizeof(BM_PageTable)))
+// Mix all bits of pn into the low ones. Pages of one buffer pool
+// partition share some hash bits, so this is not the partition hash.
+static unsigned int hashPage(PageNumber pn)
+{
+  unsigned long long h= (unsigned long long) pn;
+  h^= h >> 33;
+  h*= 0xc4ceb9fe1a85ec53ULL;
+  h^= h >> 33;
+  return (unsigned int) h;
+}
 
-// Not a interface
-static void setPageFrameRecursive(BM_PageTable *pt, PageNumber pn,
-                         BM_PageFrame *frame, int startlevel);
-static BM_PageFrame* findPageFrameRecursive(BM_PageTable *pt, PageNumber pn,
-                                   int startlevel);
-static void resetPageFrameRecursive(BM_PageTable *pt, PageNumber pn, int startlevel);
+// Initialize empty page table for up to numFrames pages
+void initPageTable(BM_PageTable *pt, int numFrames)
+{
+  int numSlots= MIN_PT_SLOTS;
+
+  while (numSlots < 2*numFrames)
+    numSlots*= 2;
+  pt->refCount= 0;
+  pt->mask= numSlots-1;
+  pt->seq= 0;
+  pt->slots= (BM_PageTableSlot*) calloc(numSlots, sizeof(BM_PageTableSlot));
+}
 
-// Initialize complete page table to 0
-void initPageTable(BM_PageTable *pt)
+void freePageTable(BM_PageTable *pt)
 {
-  memset((void*)pt, 0, sizeof(BM_PageTable));
+  free(pt->slots);
+  pt->slots= NULL;
 }
 
 // Map: Set page with a frame
 void setPageFrame(BM_PageTable *pt, PageNumber pn, BM_PageFrame *frame)
-{ setPageFrameRecursive(pt, pn, frame, 1); }
-void setPageFrameRecursive(BM_PageTable *pt, PageNumber pn,
-                  BM_PageFrame *frame, int startlevel)
 {
-  PageNumber offset= OFFSET_OF_LEVEL(pn, startlevel);
-  BM_PageTable* pt_ptr= pt->entry[offset];
-
-  if (startlevel==4)
-  {
-    // Map it now
-    if (pt_ptr==NULL)
-    {
-      pt->entry[offset]= (void*) frame;
-      pt->refCount++;
-    }
-    else
-      assert(!"We should not hit here"); 
-      // We should reset entries when removing mapping properly.
-    return;
-  }
-
-  if (pt_ptr==NULL)
-  {
-    pt_ptr= MAKE_PAGE_TABLE();
-    initPageTable(pt_ptr);
-    pt->entry[offset]= pt_ptr;
-    pt->refCount++;
-  }
-
-  setPageFrameRecursive(pt_ptr, pn, frame, startlevel+1);
+  BM_PageTableSlot *slot;
+  int i;
+
+  assert((pt->refCount+1)*2 <= pt->mask+1);
+  for (i= hashPage(pn) & pt->mask; pt->slots[i].frame; i= (i+1) & pt->mask)
+    assert(pt->slots[i].pn != pn);
+
+  // Map it now
+  slot= &pt->slots[i];
+  __atomic_store_n(&slot->pn, pn, __ATOMIC_RELAXED);
+  __atomic_store_n(&slot->frame, frame, __ATOMIC_RELEASE);
+  pt->refCount++;
 }
 
 // Finding frame with given offset
 BM_PageFrame* findPageFrame(BM_PageTable *pt, PageNumber pn)
-{ return findPageFrameRecursive(pt, pn, 1); }
-BM_PageFrame* findPageFrameRecursive(BM_PageTable *pt, PageNumber pn, int startlevel)
 {
-  PageNumber offset= OFFSET_OF_LEVEL(pn, startlevel);
-  BM_PageTable* pt_ptr= pt->entry[offset];
-
-  // At level 4 pt_ptr is actually frame pointer
-  if (startlevel==4)
-    return (BM_PageFrame*) pt_ptr;
-
-  if (pt_ptr==NULL)
-    return NULL;
-
-  return findPageFrameRecursive(pt_ptr, pn, startlevel+1);
+  BM_PageTableSlot *slots= pt->slots;
+  BM_PageFrame *frame, *found;
+  unsigned int seq;
+  int i;
+
+  do {
+    seq= __atomic_load_n(&pt->seq, __ATOMIC_ACQUIRE);
+    found= NULL;
+    for (i= hashPage(pn) & pt->mask;
+         (frame= __atomic_load_n(&slots[i].frame, __ATOMIC_ACQUIRE));
+         i= (i+1) & pt->mask)
+      if (__atomic_load_n(&slots[i].pn, __ATOMIC_RELAXED) == pn)
+      {
+        found= frame;
+        break;
+      }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  } while ((seq & 1) || __atomic_load_n(&pt->seq, __ATOMIC_RELAXED) != seq);
+
+  return found;
 }
 
 // Removes the mapping of page and frame.
 void resetPageFrame(BM_PageTable *pt, PageNumber pn)
-{ resetPageFrameRecursive(pt, pn, 1); }
-void resetPageFrameRecursive(BM_PageTable *pt, PageNumber pn, int startlevel)
 {
-  short offset= OFFSET_OF_LEVEL(pn, startlevel);
-  BM_PageTable* pt_ptr= pt->entry[offset];
+  BM_PageTableSlot *slots= pt->slots;
+  int i, j, home;
 
-  // You are at the last level of page table, which points
-  // to page frame.
-  if (startlevel==4)
-  {
-    // Remove mapping and reduce refCount.
-    if (pt_ptr!=NULL)
-    {
-      pt->entry[offset]= NULL;
-      pt->refCount--;
-      return;
-    }
-  }
+  for (i= hashPage(pn) & pt->mask; slots[i].frame; i= (i+1) & pt->mask)
+    if (slots[i].pn == pn)
+      break;
 
   // There is no frame associated with pn.
-  if (pt_ptr==NULL)
+  if (!slots[i].frame)
     return;
 
-  // Recursively try and find frame.
-  resetPageFrameRecursive(pt_ptr, pn, startlevel+1);
+  __atomic_store_n(&pt->seq, pt->seq+1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
 
-  // Remove page table if no entries are in use.
-  if (pt_ptr->refCount==0)
+  // Move back each later entry of the run whose home is not in (i, j]
+  for (j= (i+1) & pt->mask; slots[j].frame; j= (j+1) & pt->mask)
   {
-      free (pt_ptr);
-      pt->entry[offset]= NULL;
-      pt->refCount--;
+    home= hashPage(slots[j].pn) & pt->mask;
+    if (i <= j ? (i < home && home <= j) : (i < home || home <= j))
+      continue;
+    __atomic_store_n(&slots[i].pn, slots[j].pn, __ATOMIC_RELAXED);
+    __atomic_store_n(&slots[i].frame, slots[j].frame, __ATOMIC_RELAXED);
+    i= j;
   }
+  __atomic_store_n(&slots[i].frame, NULL, __ATOMIC_RELAXED);
 
-  return;
+  __atomic_store_n(&pt->seq, pt->seq+1, __ATOMIC_RELEASE);
+  pt->refCount--;
 }
@@ -3,13 +3,17 @@
 #include <math.h>
 #include "buffer_mgr.h"
 
-// Initialize complete page table to 0
-void initPageTable(BM_PageTable *pt);
+// Initialize empty page table for up to numFrames pages
+void initPageTable(BM_PageTable *pt, int numFrames);
+
+// Free the slots, the table must be empty or no longer used
+void freePageTable(BM_PageTable *pt);
 
 // Map: Set page with a frame
 void setPageFrame(BM_PageTable *pt, PageNumber pn, BM_PageFrame *frame);
 
-// Finding frame with given offset
+// Finding frame with given offset. Safe to call while another
+// thread sets or resets pages.
 BM_PageFrame* findPageFrame(BM_PageTable *pt, PageNumber pn);
 
 // Remove mapping page to frame.
@@ -6,8 +6,8 @@
 // Static structures
 typedef struct RM_DataPage
 {
-  int next;
-  int prev;
+  PageNumber next;
+  PageNumber prev;
   int prefix_bytes; // Bytes that are due to spanned row - TODO
   char data;        // To access remaining bytes in page
                     // This should be last member
@@ -15,8 +15,9 @@ typedef struct RM_DataPage
 
 // -1 to ignore space and end of page that is less thatn record size.
 // This space shall be used when we implement record spanning
-#define DATA_SIZE ((int)(PAGE_SIZE - ((&((RM_DataPage*)0)->data) - ((char*)0)) ))
-#define SLOTS_PER_PAGE(sch) ( (DATA_SIZE/getActualRecordSize(sch)) )
+// Page size is per table, chosen at createTableWithPageSize()
+#define DATA_SIZE(ps) ((int)((ps) - ((&((RM_DataPage*)0)->data) - ((char*)0)) ))
+#define SLOTS_PER_PAGE(ps,sch) ( (DATA_SIZE(ps)/getActualRecordSize(sch)) )
 #define FIRST_SLOT_ADDR(dp)   ((char*) &dp->data)
 #define SLOT_ADDR(dp,s,sch)   (((char*) &dp->data) + (s*getActualRecordSize(sch)))
 
@@ -26,13 +27,17 @@ typedef struct RM_DataPage
 
 #define MAX_FIELDNAME_LEN 64
 
+// Scans have the pool read this many pages ahead
+#define SCAN_PREFETCH_PAGES 8
+
 typedef struct RM_TableMgmtData
 {
     int numTuples;
-    int first_free_page;
+    PageNumber first_free_page;
 
     BM_BufferPool bm;
     BM_PageHandle ph;
+    int numScans; // Open scans, the file is read sequentially while > 0
 } RM_TableMgmtData;
 
 typedef struct RM_ScanMgmtData
@@ -49,10 +54,12 @@ typedef struct RM_ScanMgmtData
 static Schema* allocSchema(int numAttr, int keySize);
 static void writeRecordToSlot(Schema *sch, char *slotAddr, Record *record);
 static void readRecordFromSlot(Schema *sch, char *slotAddr, Record *record);
-static void updateFreePageLinks(RM_TableMgmtData *tmd, RM_DataPage *dp, Schema *sch, int pageno);
-static void removeFromFreePageList(RM_TableMgmtData *tmd, RM_DataPage *dp, int pageno);
-static void addToFreePageList(RM_TableMgmtData *tmd, RM_DataPage *dp, int pageno);
-static int searchFreeSlot(RM_DataPage *dp, Schema *sch);
+static void updateFreePageLinks(RM_TableMgmtData *tmd, RM_DataPage *dp, Schema *sch, PageNumber pageno);
+static void removeFromFreePageList(RM_TableMgmtData *tmd, RM_DataPage *dp, PageNumber pageno);
+static void addToFreePageList(RM_TableMgmtData *tmd, RM_DataPage *dp, PageNumber pageno);
+static int searchFreeSlot(RM_DataPage *dp, Schema *sch, int pageSize);
+static int isPageEmpty(RM_DataPage *dp, Schema *sch, int pageSize);
+static PageNumber skipFreePages(RM_TableMgmtData *tmd, PageNumber pageno);
 static int getActualRecordSize (Schema *schema);
 
 // Record manager
@@ -148,10 +155,15 @@ RC freeSchema(Schema *schema)
 
 // Table management
 RC createTable (char *name, Schema *schema)
+{
+    return createTableWithPageSize(name, schema, PAGE_SIZE);
+}
+
+RC createTableWithPageSize (char *name, Schema *schema, int pageSize)
 {
     SM_FileHandle fh;
-    char data[PAGE_SIZE];
-    char *offset= data;
+    char *data;
+    char *offset;
     int recLen,i;
     RC rc;
 
@@ -159,24 +171,27 @@ RC createTable (char *name, Schema *schema)
     if ((rc=isStorageManagerInitialized()) != RC_OK)
         return(rc);
 
+    if (pageSize < SM_MIN_PAGE_SIZE || pageSize > SM_MAX_PAGE_SIZE)
+        RETURN(RC_INVALID_PAGE_SIZE);
+
     // Check limit - schema should fit in 1 page
-    recLen= (4 * sizeof(int)); // numTuples, first_free_page, numAttrs, keySize
+    recLen= (3 * sizeof(int)) + sizeof(PageNumber); // numTuples, first_free_page, numAttrs, keySize
     recLen+= (schema->numAttr * (64+4+4+4)); // Name+type+len+keyAttr. Max4 for keyAttr for now.
-    if (recLen > PAGE_SIZE)
+    if (recLen > pageSize)
         RETURN(RC_TOO_LARGE_SCHEMA);
 
     // Stop if record size huge
     recLen= getActualRecordSize(schema);
-    if (recLen > DATA_SIZE)
+    if (recLen > DATA_SIZE(pageSize))
         RETURN(RC_TOO_LARGE_RECORD);
 
     // numTuples, numattrs, keysize, freePageNo
-    memset(offset, 0, PAGE_SIZE);
+    offset= data= (char*) calloc(1, pageSize);
     *(int*)offset = 0; // For number of tuples
     offset+= sizeof(int);
 
-    *(int*)offset = 0; // For first_free_page
-    offset+= sizeof(int);
+    *(PageNumber*)offset = 0; // For first_free_page
+    offset+= sizeof(PageNumber);
 
     *(int*)offset = schema->numAttr;
     offset+= sizeof(int);
@@ -203,19 +218,17 @@ RC createTable (char *name, Schema *schema)
 
     // No need of buffer during creation
     // Create a file with 1 page table data
-    if ((rc=createPageFile(name)) != RC_OK)
-        return rc;
-
-    if ((rc=openPageFile(name, &fh)) != RC_OK)
-        return rc;
-
-    if ((rc=writeBlock(0, &fh, data)) != RC_OK)
-        return rc;
-
-    if ((rc=closePageFile(&fh)) != RC_OK)
-        return rc;
+    if ((rc=createPageFileWithPageSize(name, pageSize)) == RC_OK &&
+        (rc=openPageFile(name, &fh)) == RC_OK)
+    {
+        if ((rc=writeBlock(0, &fh, data)) == RC_OK)
+            rc=closePageFile(&fh);
+        else
+            closePageFile(&fh);
+    }
+    free(data);
 
-    RETURN(RC_OK);
+    return rc;
 }
 
 RC openTable (RM_TableData *rel, char *name)
@@ -233,6 +246,7 @@ RC openTable (RM_TableData *rel, char *name)
     tmd= (RM_TableMgmtData*) malloc( sizeof(RM_TableMgmtData) );
     rel->mgmtData= tmd;
     rel->name= strdup(name);
+    tmd->numScans= 0;
 
     // Setup BM
     if ( (rc=initBufferPool(&tmd->bm, rel->name, 1000, 
@@ -246,8 +260,8 @@ RC openTable (RM_TableData *rel, char *name)
 
     tmd->numTuples= *(int*)offset;
     offset+= sizeof(int);
-    tmd->first_free_page= *(int*)offset;
-    offset+= sizeof(int);
+    tmd->first_free_page= *(PageNumber*)offset;
+    offset+= sizeof(PageNumber);
     numAttrs= *(int*)offset;
     offset+= sizeof(int);
     keySize= *(int*)offset;
@@ -298,6 +312,8 @@ RC closeTable (RM_TableData *rel)
 
     markDirty(&tmd->bm, &tmd->ph);
     *(int*)offset= tmd->numTuples;
+    offset+= sizeof(int);
+    *(PageNumber*)offset= tmd->first_free_page;
     unpinPage(&tmd->bm, &tmd->ph);
 
     // CloseBM
@@ -358,12 +374,11 @@ RC insertRecord (RM_TableData *rel, Record *record)
 
     if (tmd->first_free_page == 0)
     {
-        // add new page
-        if (appendEmptyBlock(&pmd->fh) != RC_OK)
+        // add new page, or reuse a freed one
+        if (allocatePage(&pmd->fh, &rid->page) != RC_OK)
             RETURN(RC_RM_INSERT_FAILED);
         
         // Read the block and get a slot
-        rid->page= pmd->fh.totalNumPages-1;
 
         pinPage(&tmd->bm, &tmd->ph, (PageNumber)rid->page); // Pin fails? TODO
         dp= (RM_DataPage*) tmd->ph.data;
@@ -376,15 +391,14 @@ RC insertRecord (RM_TableData *rel, Record *record)
         rid->page= tmd->first_free_page;
         pinPage(&tmd->bm, &tmd->ph, (PageNumber)rid->page);
         dp= (RM_DataPage*) tmd->ph.data;
-        rid->slot= searchFreeSlot(dp, rel->schema);
+        rid->slot= searchFreeSlot(dp, rel->schema, tmd->bm.pageSize);
         if (rid->slot==-1)
         {
             unpinPage(&tmd->bm, &tmd->ph);
 
-            // add new page
-            if (appendEmptyBlock(&pmd->fh) != RC_OK)
+            // add new page, or reuse a freed one
+            if (allocatePage(&pmd->fh, &rid->page) != RC_OK)
                 RETURN(RC_RM_INSERT_FAILED);
-            rid->page= pmd->fh.totalNumPages-1;
             pinPage(&tmd->bm, &tmd->ph, (PageNumber)rid->page);
             dp= (RM_DataPage*) tmd->ph.data;
             rid->slot= 0;
@@ -408,6 +422,7 @@ RC deleteRecord (RM_TableData *rel, RID id)
 {
     char *slotAddr;
     RM_TableMgmtData *tmd= rel->mgmtData;
+    BM_Pool_MgmtData *pmd= tmd->bm.mgmtData;
     RM_DataPage *dp;
     RC rc;
 
@@ -425,9 +440,21 @@ RC deleteRecord (RM_TableData *rel, RID id)
 
     markDirty(&tmd->bm, &tmd->ph);
     RESET_TOMBSTONE(slotAddr);
-    // Mark free page links
-    addToFreePageList(tmd, dp, id.page);
-    unpinPage(&tmd->bm, &tmd->ph);
+    if (isPageEmpty(dp, rel->schema, tmd->bm.pageSize))
+    {
+        // Give empty page back. Cached copy is cleared, so it matches
+        // the zeroed page allocatePage() hands out when reusing it.
+        removeFromFreePageList(tmd, dp, id.page);
+        memset(dp, 0, tmd->bm.pageSize);
+        unpinPage(&tmd->bm, &tmd->ph);
+        freePage(id.page, &pmd->fh);
+    }
+    else
+    {
+        // Mark free page links
+        addToFreePageList(tmd, dp, id.page);
+        unpinPage(&tmd->bm, &tmd->ph);
+    }
 
     tmd->numTuples--;
 
@@ -490,6 +517,8 @@ RC getRecord (RM_TableData *rel, RID id, Record *record)
 // scans
 RC startScan (RM_TableData *rel, RM_ScanHandle *scan, Expr *cond)
 {
+    RM_TableMgmtData *tmd= (RM_TableMgmtData*) rel->mgmtData;
+    BM_Pool_MgmtData *pmd= tmd->bm.mgmtData;
     RM_ScanMgmtData *smd;
     RC rc;
 
@@ -506,6 +535,10 @@ RC startScan (RM_TableData *rel, RM_ScanHandle *scan, Expr *cond)
     smd->cond= cond; // TODO
     scan->rel= rel;
 
+    // Data pages are read in order, let the kernel read ahead
+    if (tmd->numScans++ == 0)
+        setAccessPattern(&pmd->fh, SM_ACCESS_SEQUENTIAL);
+
     RETURN(RC_OK);
 }
 RC next (RM_ScanHandle *scan, Record *record)
@@ -528,8 +561,9 @@ RC next (RM_ScanHandle *scan, Record *record)
     {
         if (smd->scanCount == 0)
         {
-            smd->rid.page= 1;
+            smd->rid.page= skipFreePages(tmd, 1);
             smd->rid.slot= 0;
+            prefetchRange(&tmd->bm, smd->rid.page+1, SCAN_PREFETCH_PAGES);
             pinPage(&tmd->bm, &smd->ph, (PageNumber)smd->rid.page);
             smd->dp= (RM_DataPage*) smd->ph.data;
         }
@@ -544,12 +578,13 @@ RC next (RM_ScanHandle *scan, Record *record)
         }
         else
         {
-            int totSlots= SLOTS_PER_PAGE(scan->rel->schema);
+            int totSlots= SLOTS_PER_PAGE(tmd->bm.pageSize, scan->rel->schema);
             smd->rid.slot++;
             if (smd->rid.slot== totSlots)
             {
-                smd->rid.page++;
+                smd->rid.page= skipFreePages(tmd, smd->rid.page+1);
                 smd->rid.slot= 0;
+                prefetchPage(&tmd->bm, smd->rid.page+SCAN_PREFETCH_PAGES);
                 pinPage(&tmd->bm, &smd->ph, (PageNumber)smd->rid.page);
                 smd->dp= (RM_DataPage*) smd->ph.data;
             }
@@ -582,6 +617,10 @@ RC closeScan (RM_ScanHandle *scan)
     if (smd->scanCount > 0)
         unpinPage(&tmd->bm, &smd->ph);
 
+    // Back to getRecord() lookups
+    if (--tmd->numScans == 0)
+        setAccessPattern(&((BM_Pool_MgmtData*) tmd->bm.mgmtData)->fh, SM_ACCESS_NORMAL);
+
     // Reset mgmtData
     free(scan->mgmtData);
     scan->mgmtData= NULL;
@@ -683,11 +722,11 @@ RC setAttr (Record *record, Schema *schema, int attrNum, Value *value)
  */
 
 // Returns -1 if there are no free slots
-int searchFreeSlot(RM_DataPage *dp, Schema *sch)
+int searchFreeSlot(RM_DataPage *dp, Schema *sch, int pageSize)
 {
     int i;
     char *slotAddr= FIRST_SLOT_ADDR(dp);
-    int totalSlots= SLOTS_PER_PAGE(sch);
+    int totalSlots= SLOTS_PER_PAGE(pageSize, sch);
     int recordSize= getActualRecordSize(sch);
 
     for (i=0; i<totalSlots; i++)
@@ -699,23 +738,51 @@ int searchFreeSlot(RM_DataPage *dp, Schema *sch)
     return -1;
 }
 
-void addToFreePageList(RM_TableMgmtData *tmd, RM_DataPage *dp, int pageno)
+// No record left in the page?
+int isPageEmpty(RM_DataPage *dp, Schema *sch, int pageSize)
 {
-    // return if already marked has having free space
-    if (dp->next!=0)
-        return;
+    int i;
+    char *slotAddr= FIRST_SLOT_ADDR(dp);
+    int totalSlots= SLOTS_PER_PAGE(pageSize, sch);
+    int recordSize= getActualRecordSize(sch);
 
-    // I am the first page having free space
-    if (tmd->first_free_page == 0)
+    for (i=0; i<totalSlots; i++)
     {
-        dp->next=dp->prev= pageno;
-        tmd->first_free_page= pageno;
+        if (GET_TOMBSTONE(slotAddr))
+            return 0;
+        slotAddr+= recordSize;
     }
-    else // Add this page to head of list
-    {
-        BM_PageHandle ph;
-        RM_DataPage *head_page;
+    return 1;
+}
+
+// First page from pageno on that is not freed, scans skip freed pages
+PageNumber skipFreePages(RM_TableMgmtData *tmd, PageNumber pageno)
+{
+    BM_Pool_MgmtData *pmd= tmd->bm.mgmtData;
+
+    while (isPageFree(pageno, &pmd->fh))
+        pageno++;
+    return pageno;
+}
+
+// Page is in the list if it is linked or is the only page in it
+static int isInFreePageList(RM_TableMgmtData *tmd, RM_DataPage *dp, PageNumber pageno)
+{
+    return dp->next!=0 || dp->prev!=0 || tmd->first_free_page==pageno;
+}
 
+void addToFreePageList(RM_TableMgmtData *tmd, RM_DataPage *dp, PageNumber pageno)
+{
+    BM_PageHandle ph;
+    RM_DataPage *head_page;
+
+    // return if already marked has having free space
+    if (isInFreePageList(tmd, dp, pageno))
+        return;
+
+    // Add this page to head of list
+    if (tmd->first_free_page != 0)
+    {
         // Read head block and link this page
         pinPage(&tmd->bm, &ph, (PageNumber)tmd->first_free_page);
         head_page= (RM_DataPage*) ph.data;
@@ -723,87 +790,51 @@ void addToFreePageList(RM_TableMgmtData *tmd, RM_DataPage *dp, int pageno)
         markDirty(&tmd->bm, &ph);
         head_page->prev= pageno;
         unpinPage(&tmd->bm, &ph);
-
-        dp->next= tmd->first_free_page;
-        tmd->first_free_page= pageno;
-        dp->prev= 0;
     }
+
+    dp->next= tmd->first_free_page;
+    dp->prev= 0;
+    tmd->first_free_page= pageno;
 }
 
-void removeFromFreePageList(RM_TableMgmtData *tmd, RM_DataPage *dp, int pageno)
+void removeFromFreePageList(RM_TableMgmtData *tmd, RM_DataPage *dp, PageNumber pageno)
 {
     BM_PageHandle ph;
     RM_DataPage *tmp_dp;
 
     // Already removed.
-    if (dp->prev==0 && dp->next==0)
+    if (!isInFreePageList(tmd, dp, pageno))
         return;
 
-    // Remove from head
-    if (pageno == tmd->first_free_page)
+    // Unlink from previous block, or from head
+    if (dp->prev != 0)
     {
-        // Single node in list
-        if (dp->next == 0)
-        {
-            dp->prev= 0;
-            tmd->first_free_page= 0;
-        }
-        else
-        {
-            // Read head block and link this page
-            pinPage(&tmd->bm, &ph, (PageNumber)dp->next);
-            tmp_dp= (RM_DataPage*) ph.data;
-            markDirty(&tmd->bm, &ph);
-            tmp_dp->prev= 0;
-            unpinPage(&tmd->bm, &ph);
-
-            tmd->first_free_page= dp->next;
-            dp->next=dp->prev= 0;
-        }
-    }
-    // Remove from tail
-    else if (dp->next == 0)
-    {
-        // Read previous block and remove myself
         pinPage(&tmd->bm, &ph, (PageNumber)dp->prev);
         tmp_dp= (RM_DataPage*) ph.data;
         markDirty(&tmd->bm, &ph);
-        tmp_dp->next= 0;
+        tmp_dp->next= dp->next;
         unpinPage(&tmd->bm, &ph);
-
-        dp->next=dp->prev= 0;
     }
-    else if (dp->next != 0 && dp->prev != 0)// Read from middle
-    {
-        BM_PageHandle ph2;
-        RM_DataPage *tmp_dp2;
+    else
+        tmd->first_free_page= dp->next;
 
-        // Read next block and prev block and 
-        // adjust link
-        pinPage(&tmd->bm, &ph, (PageNumber)dp->prev);
-        pinPage(&tmd->bm, &ph2, (PageNumber)dp->next);
+    // Unlink from next block
+    if (dp->next != 0)
+    {
+        pinPage(&tmd->bm, &ph, (PageNumber)dp->next);
         tmp_dp= (RM_DataPage*) ph.data;
-        tmp_dp2= (RM_DataPage*) ph2.data;
-
         markDirty(&tmd->bm, &ph);
-        markDirty(&tmd->bm, &ph2);
-
-        tmp_dp->next= dp->next;
-        tmp_dp2->prev= dp->prev;
-
+        tmp_dp->prev= dp->prev;
         unpinPage(&tmd->bm, &ph);
-        unpinPage(&tmd->bm, &ph2);
-
-        dp->next=dp->prev= 0;
     }
-    else
-        assert(!"Should never hit here");
+
+    dp->next=dp->prev= 0;
 }
 
-void updateFreePageLinks(RM_TableMgmtData *tmd, RM_DataPage *dp, Schema *sch, int pageno)
+void updateFreePageLinks(RM_TableMgmtData *tmd, RM_DataPage *dp, Schema *sch, PageNumber pageno)
 {
     // Search if there are any TOMBSTONES which are free.
-    if (searchFreeSlot(dp, sch) != -1)
+    if (searchFreeSlot(dp, sch, tmd->bm.pageSize) != -1)
         addToFreePageList(tmd, dp, pageno);
     else // No free space
         removeFromFreePageList(tmd, dp, pageno);
@@ -1,62 +1,372 @@
+#define _GNU_SOURCE
 #include <storage_mgr.h>
+#include <storage_mgr_io.h>
 //#include <linux/limits.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <stddef.h>
 #include <unistd.h>
-
-#define MAX_FILE_HANDLE 256 // This can be = max fd's per process
-#define BYTES_TO_PAGE(bytes) ((bytes-1) / PAGE_SIZE)
-#define PAGE_OFFSET(pageNo)  (pageNo * PAGE_SIZE)
-
-// Management information
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <errno.h>
+#include "crc32c.h"
+
+// Page file layout: SM_HEADER_SIZE bytes of header, then slots of
+// pageSize bytes. Pages are grouped, GROUP_PAGES() at a time, each group
+// preceded by a free space map page with 1 bit per page of the group:
+//   [header][map 0][pages 0..G-1][map 1][pages G..2G-1]...
+// Map pages are not visible to callers, page numbers skip them.
+// Page size is per file, so offsets go through the handle's mgmtInfo.
+// Files with SM_FILE_CHECKSUMS keep the CRC32C of each page of the
+// group in its map page too, after the bits, so their groups are
+// smaller: 33 bits per page, rounded down to whole extents.
+#define GROUP_PAGES(info)        ((info)->groupPages)
+#define PLAIN_GROUP_PAGES(pageSize) ((PageNumber) (pageSize) * 8)
+#define CHECKSUM_GROUP_PAGES(pageSize) \
+    ((PageNumber) (pageSize) * 8 / 33 / SM_SEGMENT_EXTENT_PAGES * SM_SEGMENT_EXTENT_PAGES)
+#define PAGE_SLOT(info, pageNo)  ((pageNo) + (pageNo) / GROUP_PAGES(info) + 1)
+#define MAP_PAGE_SLOT(info, g)   ((PageNumber) (g) * (GROUP_PAGES(info) + 1))
+#define SLOTS_END(info, n)       ((n) ? PAGE_SLOT(info, (n)-1) + 1 : 0)
+#define SLOT_OFFSET(info, slot)  (SM_HEADER_SIZE + (off_t)(slot) * (info)->pageSize)
+#define PAGE_OFFSET(info, pageNo) SLOT_OFFSET(info, PAGE_SLOT(info, pageNo))
+#define FILE_END(info, n)        SLOT_OFFSET(info, SLOTS_END(info, n))
+// Offsets in the mapping of a SM_OPEN_MMAP handle, which starts at slot 0
+#define MAP_OFFSET(info, pageNo) ((off_t) PAGE_SLOT(info, pageNo) * (info)->pageSize)
+#define MAP_END(info, n)         ((off_t) SLOTS_END(info, n) * (info)->pageSize)
+
+// Header, at the start of the first SM_HEADER_SIZE bytes
+#define SM_FILE_MAGIC        "DBPAGEF"
+#define SM_FILE_VERSION      2
+#define SM_FILE_COMPRESSED   0x1 // Slots in a SM_SlotStore
+#define SM_FILE_CHECKSUMS    0x2 // Page checksums in the map pages
+typedef struct SM_FileHeader {
+  char magic[8];
+  int version;
+  int pageSize;
+  int flags;           // SM_FILE_*
+  int unused;
+  PageNumber numPages; // Compressed files only, their length tells nothing
+} SM_FileHeader;
+
+// Tablespace: a page file holding many segments. Page 0 starts the
+// segment directory, a chain of directory pages. A segment owns
+// extents of SM_SEGMENT_EXTENT_PAGES tablespace pages, aligned to
+// their size, listed in a chain of extent list pages. Inside its
+// extents a segment is laid out like a page file without header, map
+// pages included: slot s is page s % SM_SEGMENT_EXTENT_PAGES of
+// extent s / SM_SEGMENT_EXTENT_PAGES. Page 0 is always the directory,
+// so 0 also ends a chain.
+#define SM_DIR_MAGIC         "DBTSDIR"
+typedef struct SM_DirPageHeader {
+  char magic[8];
+  PageNumber nextPage;
+} SM_DirPageHeader;
+
+typedef struct SM_SegmentEntry {
+  char name[SM_MAX_SEGMENT_NAME]; // "" if unused
+  PageNumber numPages;   // totalNumPages, saved on close
+  PageNumber numExtents;
+  PageNumber extentList; // First extent list page
+} SM_SegmentEntry;
+
+#define DIR_ENTRIES(pageSize) \
+    ((int) (((pageSize) - sizeof(SM_DirPageHeader)) / sizeof(SM_SegmentEntry)))
+#define DIR_ENTRY(page, i) \
+    ((SM_SegmentEntry*) ((page) + sizeof(SM_DirPageHeader)) + (i))
+// Extent list page: next page, then the first page of each extent
+#define LIST_EXTENTS(pageSize) ((PageNumber) ((pageSize) / sizeof(PageNumber)) - 1)
+
+// Handle registry sizing. Registry is a hash set, so the number of
+// open handles is only limited by memory and fd's per process. It is
+// split in shards by handle hash, so threads opening and closing
+// different files rarely take the same lock.
+#define REGISTRY_SHARDS      16 // Must be power of 2
+#define MIN_REGISTRY_SLOTS   64 // Per shard, must be power of 2
+
+// Mapped page files (SM_OPEN_MMAP) grow the mapping this many pages at
+// a time. Each handle reserves address space up front, so the mapping
+// never moves and pointers from getBlockPtr() stay valid while the file
+// grows. Pages past the reservation fall back to pread/pwrite.
+#define MMAP_EXTENT_PAGES    1024 // 4MB
+#define MMAP_RESERVE_BYTES   (16LL*1024*1024*1024)
+#define ROUND_UP(n, m)       ((((n)+(m)-1) / (m)) * (m))
+
+// Files grow by whole extents, preallocated with fallocate(), so
+// appending a page only bumps totalNumPages. closePageFile() trims the
+// unused tail of the last extent.
+#define MIN_EXTENT_PAGES     1
+#define MAX_EXTENT_PAGES     (1 << 18) // 1GB
+
+// Max pages moved by one preadv()/pwritev() call (IOV_MAX is 1024)
+#define MAX_IOV_PAGES        256
+
+#define IS_IO_ALIGNED(p)     ((((unsigned long) (p)) & (SM_IO_ALIGN-1)) == 0)
+
+// First tablespace page of each extent of a segment. Slots are looked
+// up without a lock, so a full array is replaced, not realloc'ed, and
+// kept until the segment is closed.
+typedef struct SM_ExtentArray {
+  struct SM_ExtentArray *retired; // Array this one replaced
+  PageNumber count;
+  PageNumber capacity;
+  PageNumber start[];
+} SM_ExtentArray;
+
+// Open tablespace, shared by its open segments
+typedef struct SM_Tablespace {
+  char *fileName;
+  SM_FileHandle fh;      // The tablespace page file
+  int refCount;          // Open segments, +1 while kept open
+  int keptOpen;          // By openTablespace()
+  // Guards the directory and the list of open segments
+  pthread_mutex_t lock;
+  char *dir;             // Directory pages back to back, aligned
+  PageNumber *dirPageNums;
+  int numDirPages;
+  struct SM_FileMgmtInfo *segments;
+  struct SM_Tablespace *next;
+} SM_Tablespace;
+
+// All block I/O on fd is positional (pread/pwrite), so the kernel file
+// offset is never used and many threads can read/write one handle at once.
 typedef struct SM_FileMgmtInfo {
   int fd;
+  // Guards growth of fHandle->totalNumPages by concurrent writers.
+  pthread_mutex_t lock;
+  int flags; // SM_OPEN_*
+  int pageSize; // From the file header
+  PageNumber groupPages; // Pages per map page, see GROUP_PAGES()
+
+  // Physical size, pages [0, allocPages) exist in the file. The
+  // logical size is fHandle->totalNumPages.
+  PageNumber allocPages;
+  int extentPages;     // Growth step, see setExtentSize()
+
+  // SM_OPEN_MMAP only
+  char *map;           // Start of reserved address space
+  long long mapReserve;// Bytes reserved at map
+  PageNumber mapPages; // Pages [0, mapPages) are mapped
+
+  // Free space map, loaded on first use. Bit set = page is free,
+  // so pages of a new extent or a hole are in use.
+  unsigned char *freeMap; // freeMapGroups map pages, SM_IO_ALIGN aligned
+  PageNumber freeMapGroups;
+  PageNumber freeCount;   // Set bits in freeMap
+  PageNumber freeHint;    // No free page below this one
+
+  // SM_FILE_CHECKSUMS only. A page's checksum is 0, none, while
+  // writes of it are in flight, so a mismatch seen under lock is real.
+  // Checksums are kept in freeMap, map pages go to disk on sync and
+  // close, see saveChecksums().
+  int checksums;
+  unsigned char *writesInFlight; // Per page of freeMap, see beginChecksums()
+  unsigned char *dirtyMaps;      // Per group, map page changed since written
+  long long checksumFailures;
+
+  // Durability, see syncPageFile(). A segment syncs through the
+  // group commit state of its tablespace's handle, the fd owner.
+  int durability;         // SM_DURABILITY_*
+  int groupWindowUsec;
+  pthread_mutex_t syncLock;
+  pthread_cond_t syncCond;  // A group sync finished
+  int syncing;              // A group sync leader is at work
+  long long syncRequests;   // Callers so far, each takes a ticket
+  long long syncedRequests; // Tickets up to this one are durable
+  long long lastGroupSize;  // Tickets covered by the last group sync
+  long long numSyncs;
+
+  int accessPattern;      // SM_ACCESS_*, see setAccessPattern()
+
+  // Compressed page files only, slots are stored here
+  SM_SlotStore *slotStore;
+
+  // Segments of a tablespace only, fd is the tablespace's
+  SM_Tablespace *tablespace;
+  int dirPage, dirSlot;   // Directory entry, tablespace->dir index
+  SM_ExtentArray *extents;
+  char *extentList;       // Last extent list page, aligned
+  PageNumber extentListPage;
+  struct SM_FileMgmtInfo *nextSegment;
   // we can add some new elements as required, in future.
 }SM_FileMgmtInfo;
 
+// One shard of the handle registry: an open addressing hash set keyed
+// by handle address. Every block access validates its handle here, so
+// lookup is O(1) no matter how many files are open, and takes no lock.
+// Writers hold lock. A full table is replaced, not realloc'ed, and the
+// old one kept until shutdown for lookups still probing it; tables only
+// grow, so that is less memory than the current one. Deletes shift
+// later entries back instead of leaving tombstones, and bump seq around
+// it so a lookup that missed while entries moved probes again.
+typedef struct SM_HandleTable {
+  struct SM_HandleTable *retired;
+  int numSlots;             // Power of 2
+  SM_FileHandle *slots[];
+} SM_HandleTable;
+
+typedef struct SM_RegistryShard {
+  pthread_mutex_t lock;
+  SM_HandleTable *table;
+  unsigned int seq;         // Odd while a delete moves entries
+  int handleCount;
+} __attribute__((aligned(64))) SM_RegistryShard; // Own cache line
+
 // Storage manager
 typedef struct SM {
-   SM_FileHandle* openHandles[MAX_FILE_HANDLE];
-   int handleCount;
+   SM_RegistryShard shards[REGISTRY_SHARDS];
+   // Guards the list and the reference counts in it
+   pthread_mutex_t tablespacesLock;
+   SM_Tablespace *tablespaces; // Open tablespaces
+   long long checksumFailures; // Of all files
    int init;
 }SM;
-static SM storageManager; // As it is static it will be initialized
+static SM storageManager= {
+    .shards= { [0 ... REGISTRY_SHARDS-1]= { .lock= PTHREAD_MUTEX_INITIALIZER } },
+    .tablespacesLock= PTHREAD_MUTEX_INITIALIZER,
+};
+
+// Segments, see tablespaces below
+static int isSegmentName(char *fileName);
+static RC createSegment(char *fileName, int pageSize);
+static RC openSegment(char *fileName, SM_FileHandle *fHandle, int flags);
+static RC closeSegment(SM_FileHandle *fHandle);
+static RC dropSegment(char *fileName);
+static RC growSegment(SM_FileMgmtInfo *mgmtInfo, PageNumber numPages);
+static RC saveSegmentSize(SM_FileHandle *fHandle);
+
+// Page checksums, see below
+static RC beginChecksums(SM_FileMgmtInfo *mgmtInfo, PageNumber startPage, int count);
+static void finishChecksums(SM_FileMgmtInfo *mgmtInfo, PageNumber startPage, int count,
+                            SM_PageHandle *memPages, int failed);
+static RC dropChecksum(SM_FileMgmtInfo *mgmtInfo, PageNumber pageNum);
+static RC saveChecksums(SM_FileMgmtInfo *mgmtInfo);
+static RC verifyChecksums(SM_FileMgmtInfo *mgmtInfo, PageNumber startPage, int count,
+                          SM_PageHandle *memPages);
 
 // STATIC FUNCTIONS
 // Is storage manager initialized?
 RC isStorageManagerInitialized()
 {
-    if (storageManager.init)
+    if (__atomic_load_n(&storageManager.init, __ATOMIC_ACQUIRE))
         RETURN(RC_OK);
     RETURN(RC_SM_NOT_INIT);
 }
 
 RC shutdownStorageManager()
 {
-    if (storageManager.handleCount>0)
-        RETURN(RC_FILE_HANDLE_IN_USE);
+    SM_RegistryShard *shard;
+    SM_HandleTable *table, *retired;
+    int i;
+
+    for (i=0; i<REGISTRY_SHARDS; i++)
+        if (__atomic_load_n(&storageManager.shards[i].handleCount, __ATOMIC_RELAXED) > 0)
+            RETURN(RC_FILE_HANDLE_IN_USE);
+
+    __atomic_store_n(&storageManager.init, 0, __ATOMIC_RELEASE);
+    for (i=0; i<REGISTRY_SHARDS; i++)
+    {
+        shard= &storageManager.shards[i];
+        pthread_mutex_lock(&shard->lock);
+        for (table= shard->table; table; table= retired)
+        {
+            retired= table->retired;
+            free(table);
+        }
+        shard->table= NULL;
+        pthread_mutex_unlock(&shard->lock);
+    }
+
+    RETURN(RC_OK);
+}
+
+// Hash handle address into registry, mixing the low bits that
+// are always 0 due to alignment.
+static unsigned int hashFileHandle(SM_FileHandle *fHandle)
+{
+    unsigned long long h= (unsigned long long) (size_t) fHandle;
+    h^= h >> 33;
+    h*= 0xff51afd7ed558ccdULL;
+    h^= h >> 33;
+    return (unsigned int) h;
+}
+
+// Top bits pick the shard, low bits the slot in it
+static SM_RegistryShard* handleShard(unsigned int hash)
+{
+    return &storageManager.shards[hash >> 28 & (REGISTRY_SHARDS-1)];
+}
+
+// Slot holding fHandle, or -1. Linear probe until an empty slot.
+static int findHandleSlot(SM_HandleTable *table, SM_FileHandle *fHandle,
+                          unsigned int hash)
+{
+    int mask, i;
+    SM_FileHandle *slot;
+
+    if (!table)
+        return -1;
+    mask= table->numSlots-1;
+    for (i= hash & mask;
+         (slot= __atomic_load_n(&table->slots[i], __ATOMIC_RELAXED));
+         i= (i+1) & mask)
+        if (slot == fHandle)
+            return i;
+
+    return -1;
+}
+
+// Put fHandle in the first empty slot of its chain. Caller holds the
+// shard lock, or owns table.
+static void insertHandle(SM_HandleTable *table, SM_FileHandle *fHandle)
+{
+    int mask= table->numSlots-1;
+    int i;
+
+    for (i= hashFileHandle(fHandle) & mask; table->slots[i]; i= (i+1) & mask)
+        ;
+    __atomic_store_n(&table->slots[i], fHandle, __ATOMIC_RELEASE);
+}
+
+// Replace the shard's table with one of numSlots slots
+static RC resizeRegistry(SM_RegistryShard *shard, int numSlots)
+{
+    SM_HandleTable *old= shard->table, *table;
+    int i;
+
+    table= (SM_HandleTable*) calloc(1, sizeof(SM_HandleTable) +
+                                       numSlots * sizeof(SM_FileHandle*));
+    if (!table)
+        RETURN(RC_MAX_FILE_HANDLE_OPEN);
+    table->numSlots= numSlots;
+    table->retired= old;
 
-    storageManager.init= 0;
+    for (i=0; old && i<old->numSlots; i++)
+        if (old->slots[i])
+            insertHandle(table, old->slots[i]);
 
+    __atomic_store_n(&shard->table, table, __ATOMIC_RELEASE);
     RETURN(RC_OK);
 }
 
 // Is fHandle know to Storage Engine ?
 static RC isFileHandleOpen(SM_FileHandle *fHandle)
 {
-    int i;
-    int handleCount= storageManager.handleCount;
-    for(i=0; i<MAX_FILE_HANDLE && handleCount; i++)
-    {
-        if (storageManager.openHandles[i] == 0)
-            continue;
-        handleCount--;
-        if (storageManager.openHandles[i] == fHandle)
+    unsigned int hash= hashFileHandle(fHandle);
+    SM_RegistryShard *shard= handleShard(hash);
+    SM_HandleTable *table;
+    unsigned int seq;
+
+    do {
+        seq= __atomic_load_n(&shard->seq, __ATOMIC_ACQUIRE);
+        table= __atomic_load_n(&shard->table, __ATOMIC_ACQUIRE);
+        if (findHandleSlot(table, fHandle, hash) >= 0)
             RETURN(RC_OK);
-    }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || __atomic_load_n(&shard->seq, __ATOMIC_RELAXED) != seq);
 
     RETURN(RC_FILE_HANDLE_NOT_INIT);
 }
@@ -64,46 +374,152 @@ static RC isFileHandleOpen(SM_FileHandle *fHandle)
 // Register the fHandle with Storage Engine
 static RC registerFileHandle(SM_FileHandle *fHandle)
 {
-    int i;
-    for(i=0; i<MAX_FILE_HANDLE; i++)
-        if (storageManager.openHandles[i] == 0)
-        {
-            storageManager.openHandles[i]= fHandle;
-            storageManager.handleCount++;
-            RETURN(RC_OK);
-        }
+    SM_RegistryShard *shard= handleShard(hashFileHandle(fHandle));
+    SM_HandleTable *table;
+    RC rc= RC_OK;
+
+    pthread_mutex_lock(&shard->lock);
+    table= shard->table;
+    // Keep load under 1/2, so probes stay short
+    if (!table || (shard->handleCount+1)*2 > table->numSlots)
+        rc= resizeRegistry(shard, table ? table->numSlots*2 : MIN_REGISTRY_SLOTS);
+    if (rc == RC_OK)
+    {
+        insertHandle(shard->table, fHandle);
+        __atomic_store_n(&shard->handleCount, shard->handleCount+1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&shard->lock);
 
-    RETURN(RC_MAX_FILE_HANDLE_OPEN);
+    return rc;
 }
 
 // De-register the fHandle with Storage Engine
 static RC deregisterFileHandle(SM_FileHandle *fHandle)
 {
-    int i;
-    int handleCount= storageManager.handleCount;
-    for(i=0; i<MAX_FILE_HANDLE && handleCount; i++)
+    unsigned int hash= hashFileHandle(fHandle);
+    SM_RegistryShard *shard= handleShard(hash);
+    SM_HandleTable *table;
+    SM_FileHandle *moved;
+    int mask, i, j, home;
+
+    pthread_mutex_lock(&shard->lock);
+    table= shard->table;
+    if ((i= findHandleSlot(table, fHandle, hash)) < 0)
+    {
+        pthread_mutex_unlock(&shard->lock);
+        RETURN(RC_FILE_HANDLE_NOT_INIT);
+    }
+
+    __atomic_store_n(&shard->seq, shard->seq+1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    // Move back each later entry of the run that may sit in slot i,
+    // i.e. whose home is not in (i, j], then empty the slot left over.
+    mask= table->numSlots-1;
+    for (j= (i+1) & mask; (moved= table->slots[j]); j= (j+1) & mask)
     {
-        if (!storageManager.openHandles[i])
+        home= hashFileHandle(moved) & mask;
+        if (i <= j ? (i < home && home <= j) : (i < home || home <= j))
             continue;
-        handleCount--;
-        if (storageManager.openHandles[i] == fHandle)
-        {
-            storageManager.openHandles[i]= 0;
-            RETURN(RC_OK);
-        }
+        __atomic_store_n(&table->slots[i], moved, __ATOMIC_RELAXED);
+        i= j;
     }
+    __atomic_store_n(&table->slots[i], NULL, __ATOMIC_RELAXED);
 
-    RETURN(RC_FILE_HANDLE_NOT_INIT);
+    __atomic_store_n(&shard->seq, shard->seq+1, __ATOMIC_RELEASE);
+    __atomic_store_n(&shard->handleCount, shard->handleCount-1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&shard->lock);
+
+    RETURN(RC_OK);
 }
 
-// Get the last page number based on file size.
-// We can alternatively store last page number within
-// the page file, but it is not necessary for now.
-static int getLastPageNo(char* fileName)
+// Is pageSize one we support? Powers of 2 from SM_MIN_PAGE_SIZE
+// to SM_MAX_PAGE_SIZE.
+static int isValidPageSize(int pageSize)
 {
-    struct stat st;
-    stat(fileName, &st);
-    return BYTES_TO_PAGE(st.st_size); 
+    return pageSize >= SM_MIN_PAGE_SIZE && pageSize <= SM_MAX_PAGE_SIZE &&
+           (pageSize & (pageSize-1)) == 0;
+}
+
+// Pages in the first 'slots' slots after the header, map pages excluded
+static PageNumber slotsToPages(SM_FileMgmtInfo *mgmtInfo, PageNumber slots)
+{
+    PageNumber groupSlots= GROUP_PAGES(mgmtInfo) + 1;
+    return slots - (slots + groupSlots - 1) / groupSlots;
+}
+
+// Pages in a file of 'bytes', a partial last page counts
+static PageNumber bytesToPages(SM_FileMgmtInfo *mgmtInfo, off_t bytes)
+{
+    if (bytes <= SM_HEADER_SIZE)
+        return 0;
+    return slotsToPages(mgmtInfo, (bytes - SM_HEADER_SIZE +
+                                   mgmtInfo->pageSize - 1) / mgmtInfo->pageSize);
+}
+
+// Pages from pageNum on that are contiguous on disk: up to the next
+// map page, in a segment also up to the end of the extent
+static PageNumber contiguousPages(SM_FileMgmtInfo *mgmtInfo, PageNumber pageNum)
+{
+    PageNumber n= GROUP_PAGES(mgmtInfo) - pageNum % GROUP_PAGES(mgmtInfo);
+    PageNumber slot= PAGE_SLOT(mgmtInfo, pageNum);
+
+    if (mgmtInfo->tablespace &&
+        n > SM_SEGMENT_EXTENT_PAGES - slot % SM_SEGMENT_EXTENT_PAGES)
+        n= SM_SEGMENT_EXTENT_PAGES - slot % SM_SEGMENT_EXTENT_PAGES;
+    return n;
+}
+
+// File offset of a slot, segment slots are found through the extents
+static off_t slotOffset(SM_FileMgmtInfo *mgmtInfo, PageNumber slot)
+{
+    SM_ExtentArray *extents;
+
+    if (!mgmtInfo->tablespace)
+        return SLOT_OFFSET(mgmtInfo, slot);
+
+    extents= __atomic_load_n(&mgmtInfo->extents, __ATOMIC_ACQUIRE);
+    return PAGE_OFFSET((SM_FileMgmtInfo*) mgmtInfo->tablespace->fh.mgmtInfo,
+                       extents->start[slot / SM_SEGMENT_EXTENT_PAGES] +
+                       slot % SM_SEGMENT_EXTENT_PAGES);
+}
+
+static off_t pageOffset(SM_FileMgmtInfo *mgmtInfo, PageNumber pageNum)
+{
+    return slotOffset(mgmtInfo, PAGE_SLOT(mgmtInfo, pageNum));
+}
+
+// Durability mode from SM_OPEN_* flags
+static void initSyncState(SM_FileMgmtInfo *mgmtInfo, int flags)
+{
+    mgmtInfo->durability= (flags & SM_OPEN_GROUP_COMMIT) ? SM_DURABILITY_GROUP :
+                          (flags & SM_OPEN_SYNC) ? SM_DURABILITY_SYNC :
+                          SM_DURABILITY_NONE;
+    mgmtInfo->groupWindowUsec= SM_DEFAULT_GROUP_WINDOW_USEC;
+    pthread_mutex_init(&mgmtInfo->syncLock, NULL);
+    pthread_cond_init(&mgmtInfo->syncCond, NULL);
+}
+
+static void destroySyncState(SM_FileMgmtInfo *mgmtInfo)
+{
+    pthread_cond_destroy(&mgmtInfo->syncCond);
+    pthread_mutex_destroy(&mgmtInfo->syncLock);
+}
+
+// Read and check the file header into 'header', returns the page size
+// or -1. Buffer is aligned, fd may be opened with O_DIRECT.
+static int readFileHeader(int fd, SM_FileHeader *header)
+{
+    char block[SM_HEADER_SIZE] __attribute__((aligned(SM_IO_ALIGN)));
+
+    if (pread(fd, block, SM_HEADER_SIZE, 0) != SM_HEADER_SIZE)
+        return -1;
+    memcpy(header, block, sizeof(SM_FileHeader));
+    if (memcmp(header->magic, SM_FILE_MAGIC, sizeof(header->magic)) ||
+        header->version != SM_FILE_VERSION ||
+        !isValidPageSize(header->pageSize))
+        return -1;
+    return header->pageSize;
 }
 
 /************************************************************
@@ -112,41 +528,291 @@ static int getLastPageNo(char* fileName)
 /* manipulating page files */
 void initStorageManager (void)
 {
-    if (isStorageManagerInitialized() != RC_OK)
-        storageManager.init= 1;
+    __atomic_store_n(&storageManager.init, 1, __ATOMIC_RELEASE);
 }
 
 /* Create page file */
 RC createPageFile (char *fileName)
 {
-    int fd;
+    // A segment takes the page size of its tablespace
+    if (isSegmentName(fileName))
+        return createPageFileWithPageSize(fileName, 0);
+    return createPageFileWithPageSize(fileName, PAGE_SIZE);
+}
 
-    // Is storage manager initialized?
-    if (isStorageManagerInitialized() != RC_OK)
-        RETURN(RC_SM_NOT_INIT);
+/* Create page file, fileFlags are SM_FILE_* */
+static RC createFile(char *fileName, int pageSize, int fileFlags)
+{
+    SM_FileHeader *header;
+    char *block;
+    int fd, rc, size;
+
+    if (!isValidPageSize(pageSize))
+        RETURN(RC_INVALID_PAGE_SIZE);
 
     // Create file if not exists
     if ((fd= open(fileName, O_CREAT|O_EXCL|O_RDWR, S_IRWXU)) > 0 )
     //if ((fd= open(fileName, O_CREAT|O_RDWR, S_IRWXU)) > 0 )
     {
-        // Add 1 page with zerobytes of page size
-        char zeropage[PAGE_SIZE];
-        memset(zeropage, 0, PAGE_SIZE);
-        if (write(fd, zeropage, PAGE_SIZE) < PAGE_SIZE)
-        {
-          close(fd);
-          RETURN(RC_WRITE_FAILED);
-        }
+        // Header, empty free space map, then 1 page with zerobytes
+        // of page size. A compressed file has them as unwritten
+        // slots, they read as zeros.
+        size= (fileFlags & SM_FILE_COMPRESSED) ? SM_HEADER_SIZE :
+                                                 SM_HEADER_SIZE + 2*pageSize;
+        block= (char*) calloc(1, size);
+        header= (SM_FileHeader*) block;
+        memcpy(header->magic, SM_FILE_MAGIC, sizeof(header->magic));
+        header->version= SM_FILE_VERSION;
+        header->pageSize= pageSize;
+        header->flags= fileFlags;
+        header->numPages= 1;
+
+        rc= write(fd, block, size) < size ? RC_WRITE_FAILED : RC_OK;
+        if (rc == RC_OK && (fileFlags & SM_FILE_COMPRESSED))
+            rc= createSlotStore(fd, pageSize);
+        free(block);
+        close(fd);
+        RETURN(rc);
+    }
+    RETURN(RC_FILE_CREATE_FAILED);
+}
+
+/* Create page file with pages of 'pageSize' bytes, see SM_*_PAGE_SIZE */
+RC createPageFileWithPageSize (char *fileName, int pageSize)
+{
+    // Is storage manager initialized?
+    if (isStorageManagerInitialized() != RC_OK)
+        RETURN(RC_SM_NOT_INIT);
+
+    if (isSegmentName(fileName))
+        return createSegment(fileName, pageSize);
+
+    return createFile(fileName, pageSize, SM_FILE_CHECKSUMS);
+}
+
+/* Create compressed page file, see storage_mgr_compress.c */
+RC createCompressedPageFile (char *fileName, int pageSize)
+{
+    // Is storage manager initialized?
+    if (isStorageManagerInitialized() != RC_OK)
+        RETURN(RC_SM_NOT_INIT);
+
+    // Segments live in their tablespace's slots
+    if (isSegmentName(fileName))
+        RETURN(RC_FILE_CREATE_FAILED);
+
+    return createFile(fileName, pageSize, SM_FILE_COMPRESSED | SM_FILE_CHECKSUMS);
+}
+
+/* Bytes of compressed page data in the file, -1 if it is not a
+ * compressed page file */
+long long getStoredBytes (SM_FileHandle *fHandle)
+{
+    SM_FileMgmtInfo *mgmtInfo;
+
+    // Is storage manager initialized?
+    if (isStorageManagerInitialized() != RC_OK)
+        return -1;
+
+    // Is this handle already in use?
+    if (isFileHandleOpen(fHandle) != RC_OK)
+        return -1;
+
+    mgmtInfo= (SM_FileMgmtInfo*) fHandle->mgmtInfo;
+    return mgmtInfo->slotStore ? getStoredSlotBytes(mgmtInfo->slotStore) : -1;
+}
+
+/* Total pages, safe to read while other threads grow the file */
+static PageNumber getTotalNumPages(SM_FileHandle *fHandle)
+{
+    return __atomic_load_n(&fHandle->totalNumPages, __ATOMIC_ACQUIRE);
+}
+
+/* Make the file at least 'numPages' long, in whole extents. Caller
+ * holds mgmtInfo->lock, or is the only user of the handle. */
+static RC growFile(SM_FileMgmtInfo *mgmtInfo, PageNumber numPages)
+{
+    PageNumber allocPages= ROUND_UP(numPages, (PageNumber) mgmtInfo->extentPages);
+    struct stat st;
+    off_t start;
+
+    if (numPages <= mgmtInfo->allocPages)
+        RETURN(RC_OK);
+    if (mgmtInfo->tablespace)
+        return growSegment(mgmtInfo, numPages);
 
+    // Slots of a compressed file take no space until written
+    if (mgmtInfo->slotStore)
+    {
+        __atomic_store_n(&mgmtInfo->allocPages, numPages, __ATOMIC_RELEASE);
         RETURN(RC_OK);
     }
-    RETURN(RC_FILE_CREATE_FAILED);
+
+    // Never shrink, the file may be longer than this handle knows
+    if (fstat(mgmtInfo->fd, &st) < 0)
+        RETURN(RC_WRITE_FAILED);
+    if (st.st_size < FILE_END(mgmtInfo, allocPages))
+    {
+        // Reserve real blocks, so the file does not fragment. Without
+        // fallocate() support the extent is left sparse. So is the
+        // gap of a jump far past the end, only its last extent is
+        // reserved.
+        start= st.st_size;
+        if (start < FILE_END(mgmtInfo, allocPages - mgmtInfo->extentPages))
+            start= FILE_END(mgmtInfo, allocPages - mgmtInfo->extentPages);
+        if (fallocate(mgmtInfo->fd, 0, start,
+                      FILE_END(mgmtInfo, allocPages) - start) < 0 &&
+            (errno != EOPNOTSUPP ||
+             ftruncate(mgmtInfo->fd, FILE_END(mgmtInfo, allocPages)) < 0))
+            RETURN(RC_WRITE_FAILED);
+    }
+    else
+        allocPages= bytesToPages(mgmtInfo, st.st_size);
+
+    __atomic_store_n(&mgmtInfo->allocPages, allocPages, __ATOMIC_RELEASE);
+    RETURN(RC_OK);
+}
+
+/* growFile(), taking the lock. Cheap when pages are already there. */
+static RC reservePages(SM_FileMgmtInfo *mgmtInfo, PageNumber numPages)
+{
+    RC rc;
+
+    if (numPages <= __atomic_load_n(&mgmtInfo->allocPages, __ATOMIC_ACQUIRE))
+        RETURN(RC_OK);
+    pthread_mutex_lock(&mgmtInfo->lock);
+    rc= growFile(mgmtInfo, numPages);
+    pthread_mutex_unlock(&mgmtInfo->lock);
+    return rc;
+}
+
+/* Logical size grows to at least 'numPages', never shrinks */
+static void publishNumPages(SM_FileHandle *fHandle, PageNumber numPages)
+{
+    SM_FileMgmtInfo *mgmtInfo= (SM_FileMgmtInfo*) fHandle->mgmtInfo;
+
+    if (numPages > getTotalNumPages(fHandle))
+    {
+        pthread_mutex_lock(&mgmtInfo->lock);
+        if (numPages > fHandle->totalNumPages)
+            __atomic_store_n(&fHandle->totalNumPages, numPages, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&mgmtInfo->lock);
+    }
+}
+
+// Kernel advice for each SM_ACCESS_* pattern
+static const struct {
+    int fadvise, madvise;
+} accessAdvice[]= {
+    { POSIX_FADV_NORMAL,     MADV_NORMAL },
+    { POSIX_FADV_SEQUENTIAL, MADV_SEQUENTIAL },
+    { POSIX_FADV_RANDOM,     MADV_RANDOM },
+    { POSIX_FADV_WILLNEED,   MADV_WILLNEED },
+    { POSIX_FADV_DONTNEED,   MADV_DONTNEED },
+};
+
+/* Map file in extents up to 'numPages'. Caller holds mgmtInfo->lock,
+ * or is the only user of the handle. The file is extended to cover
+ * the mapping, closePageFile() trims it back to totalNumPages. */
+static RC growMapping(SM_FileMgmtInfo *mgmtInfo, PageNumber numPages)
+{
+    PageNumber mapPages= ROUND_UP(numPages, MMAP_EXTENT_PAGES);
+    PageNumber maxPages= slotsToPages(mgmtInfo, mgmtInfo->mapReserve / mgmtInfo->pageSize);
+    RC rc;
+
+    if (mapPages > maxPages)
+        mapPages= maxPages;
+    if (mapPages <= mgmtInfo->mapPages)
+        RETURN(RC_OK);
+
+    if ((rc= growFile(mgmtInfo, mapPages)) != RC_OK)
+        return rc;
+
+    // Map only the new extents, right after the existing ones
+    if (mmap(mgmtInfo->map + MAP_END(mgmtInfo, mgmtInfo->mapPages),
+             MAP_END(mgmtInfo, mapPages) - MAP_END(mgmtInfo, mgmtInfo->mapPages),
+             PROT_READ|PROT_WRITE, MAP_SHARED|MAP_FIXED, mgmtInfo->fd,
+             FILE_END(mgmtInfo, mgmtInfo->mapPages)) == MAP_FAILED)
+        RETURN(RC_WRITE_FAILED);
+    if (mgmtInfo->accessPattern != SM_ACCESS_NORMAL)
+        madvise(mgmtInfo->map + MAP_END(mgmtInfo, mgmtInfo->mapPages),
+                MAP_END(mgmtInfo, mapPages) - MAP_END(mgmtInfo, mgmtInfo->mapPages),
+                accessAdvice[mgmtInfo->accessPattern].madvise);
+
+    __atomic_store_n(&mgmtInfo->mapPages, mapPages, __ATOMIC_RELEASE);
+    RETURN(RC_OK);
+}
+
+/* Reserve address space and map existing pages of the file */
+static RC mapPageFile(SM_FileHandle *fHandle)
+{
+    SM_FileMgmtInfo *mgmtInfo= (SM_FileMgmtInfo*) fHandle->mgmtInfo;
+    long long reserve= MAP_END(mgmtInfo, fHandle->totalNumPages) * 2;
+
+    if (reserve < MMAP_RESERVE_BYTES)
+        reserve= MMAP_RESERVE_BYTES;
+    mgmtInfo->map= mmap(NULL, reserve, PROT_NONE,
+                        MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+    if (mgmtInfo->map == MAP_FAILED)
+    {
+        mgmtInfo->map= NULL;
+        RETURN(RC_FILE_NOT_FOUND);
+    }
+    mgmtInfo->mapReserve= reserve;
+    mgmtInfo->mapPages= 0;
+
+    return growMapping(mgmtInfo, fHandle->totalNumPages);
+}
+
+/* Open the slot store of a compressed page file. Its size is the saved
+ * one, or more if pages were written after that. */
+static RC openCompressed(SM_FileHandle *fHandle, SM_FileHeader *header)
+{
+    SM_FileMgmtInfo *mgmtInfo= (SM_FileMgmtInfo*) fHandle->mgmtInfo;
+    PageNumber usedPages;
+    RC rc;
+
+    if ((rc= openSlotStore(mgmtInfo->fd, mgmtInfo->pageSize,
+                           &mgmtInfo->slotStore)) != RC_OK)
+        return rc;
+    usedPages= slotsToPages(mgmtInfo, getUsedSlots(mgmtInfo->slotStore));
+    fHandle->totalNumPages= header->numPages > usedPages ? header->numPages : usedPages;
+    mgmtInfo->allocPages= fHandle->totalNumPages;
+    RETURN(RC_OK);
+}
+
+/* Write the size of a compressed page file to its header */
+static RC saveCompressedSize(SM_FileHandle *fHandle)
+{
+    SM_FileMgmtInfo *mgmtInfo= (SM_FileMgmtInfo*) fHandle->mgmtInfo;
+    PageNumber numPages= getTotalNumPages(fHandle);
+
+    if (pwrite(mgmtInfo->fd, &numPages, sizeof(numPages),
+               offsetof(SM_FileHeader, numPages)) != sizeof(numPages))
+        RETURN(RC_WRITE_FAILED);
+    RETURN(RC_OK);
+}
+
+/* Page is within the mapping of a SM_OPEN_MMAP handle? */
+static char* mappedPageAddr(SM_FileMgmtInfo *mgmtInfo, PageNumber pageNum)
+{
+    if (!(mgmtInfo->flags & SM_OPEN_MMAP) ||
+        pageNum >= __atomic_load_n(&mgmtInfo->mapPages, __ATOMIC_ACQUIRE))
+        return NULL;
+    return mgmtInfo->map + MAP_OFFSET(mgmtInfo, pageNum);
 }
 
 /* Open the page file and register it with Storage Engine */
 RC openPageFile (char *fileName, SM_FileHandle *fHandle)
+{
+    return openPageFileWithFlags(fileName, fHandle, SM_OPEN_DEFAULT);
+}
+
+/* Open the page file in given mode(s), see SM_OPEN_* */
+RC openPageFileWithFlags (char *fileName, SM_FileHandle *fHandle, int flags)
 {
     int fd;
+    RC rc;
 
     // Is storage manager initialized?
     if (isStorageManagerInitialized() != RC_OK)
@@ -156,22 +822,85 @@ RC openPageFile (char *fileName, SM_FileHandle *fHandle)
     if (isFileHandleOpen(fHandle) == RC_OK)
         RETURN(RC_FILE_HANDLE_IN_USE);
 
-    if ((fd= open(fileName, O_RDWR, S_IRWXU)) > 0)
+    if (isSegmentName(fileName))
+        return openSegment(fileName, fHandle, flags);
+
+    // A mapping is page cache, so direct I/O makes no sense with it
+    if (flags & SM_OPEN_MMAP)
+        flags&= ~SM_OPEN_DIRECT;
+
+    if ((fd= open(fileName, O_RDWR | ((flags & SM_OPEN_DIRECT) ? O_DIRECT : 0),
+                  S_IRWXU)) > 0)
     {
+        struct stat st;
+        SM_FileHeader header;
+        int pageSize= readFileHeader(fd, &header);
+
+        // Is it a page file?
+        if (pageSize < 0 || fstat(fd, &st) < 0)
+        {
+            close(fd);
+            RETURN(RC_BAD_PAGE_FILE);
+        }
+
+        // Compressed slots are records of any size, so neither mapped
+        // nor aligned
+        if (header.flags & SM_FILE_COMPRESSED)
+        {
+            if ((flags & SM_OPEN_DIRECT) &&
+                fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT) < 0)
+            {
+                close(fd);
+                RETURN(RC_FILE_NOT_FOUND);
+            }
+            flags&= ~(SM_OPEN_MMAP | SM_OPEN_DIRECT);
+        }
+
         // Initialize the fHandle
         fHandle->fileName= (char*) malloc(strlen(fileName)+1);
         strcpy(fHandle->fileName, fileName);
         fHandle->curPagePos= 0;
-        
-        fHandle->totalNumPages= getLastPageNo(fHandle->fileName)+1;
+        fHandle->pageSize= pageSize;
 
         SM_FileMgmtInfo *mgmtInfo= (SM_FileMgmtInfo*) 
                                      malloc(sizeof(SM_FileMgmtInfo));
+        memset(mgmtInfo, 0, sizeof(SM_FileMgmtInfo));
         mgmtInfo->fd= fd;
+        mgmtInfo->flags= flags;
+        mgmtInfo->pageSize= pageSize;
+        mgmtInfo->checksums= (header.flags & SM_FILE_CHECKSUMS) != 0;
+        mgmtInfo->groupPages= mgmtInfo->checksums ? CHECKSUM_GROUP_PAGES(pageSize) :
+                                                    PLAIN_GROUP_PAGES(pageSize);
+        fHandle->totalNumPages= bytesToPages(mgmtInfo, st.st_size);
+        mgmtInfo->allocPages= fHandle->totalNumPages;
+        mgmtInfo->extentPages= SM_DEFAULT_EXTENT_PAGES;
+        pthread_mutex_init(&mgmtInfo->lock, NULL);
+        initSyncState(mgmtInfo, flags);
         fHandle->mgmtInfo= mgmtInfo;
 
+        // Map the file, or load the slot table of a compressed one
+        rc= RC_OK;
+        if (header.flags & SM_FILE_COMPRESSED)
+            rc= openCompressed(fHandle, &header);
+        else if (flags & SM_OPEN_MMAP)
+            rc= mapPageFile(fHandle);
+
         // Register the fHandle
-        registerFileHandle(fHandle);
+        if (rc != RC_OK || (rc= registerFileHandle(fHandle)) != RC_OK)
+        {
+            if (mgmtInfo->map)
+                munmap(mgmtInfo->map, mgmtInfo->mapReserve);
+            if (mgmtInfo->slotStore)
+                closeSlotStore(mgmtInfo->slotStore);
+            close(fd);
+            pthread_mutex_destroy(&mgmtInfo->lock);
+            destroySyncState(mgmtInfo);
+            free(mgmtInfo);
+            fHandle->mgmtInfo= NULL;
+            free(fHandle->fileName);
+            fHandle->fileName= NULL;
+            return rc;
+        }
 
         RETURN(RC_OK);
     }
@@ -181,6 +910,9 @@ RC openPageFile (char *fileName, SM_FileHandle *fHandle)
 /* Close the page file and de-register it from Storage Engine */
 RC closePageFile (SM_FileHandle *fHandle)
 {
+    SM_FileMgmtInfo *mgmtInfo;
+    RC rc= RC_OK, closeRc;
+
     // Is storage manager initialized?
     if (isStorageManagerInitialized() != RC_OK)
         RETURN(RC_SM_NOT_INIT);
@@ -188,10 +920,39 @@ RC closePageFile (SM_FileHandle *fHandle)
     // Is this handle already in use?
     if (isFileHandleOpen(fHandle) != RC_OK)
         RETURN(RC_FILE_HANDLE_NOT_INIT);
+    mgmtInfo= (SM_FileMgmtInfo*) fHandle->mgmtInfo;
+
+    // Checksums not on disk yet, the file closes anyway
+    if (mgmtInfo->checksums)
+        rc= saveChecksums(mgmtInfo);
 
-    // Close the file
-    if (close(((SM_FileMgmtInfo*)fHandle->mgmtInfo)->fd) < 0 )
-        RETURN(RC_FILE_CLOSE_FAILED);
+    // Segment shares the fd and extents of its tablespace
+    if (mgmtInfo->tablespace)
+    {
+        if ((closeRc= closeSegment(fHandle)) != RC_OK)
+            rc= closeRc;
+    }
+    else if (mgmtInfo->slotStore)
+    {
+        if ((closeRc= saveCompressedSize(fHandle)) != RC_OK)
+            rc= closeRc;
+        closeSlotStore(mgmtInfo->slotStore);
+        if (close(mgmtInfo->fd) < 0)
+            RETURN(RC_FILE_CLOSE_FAILED);
+    }
+    else
+    {
+        // Unmap, and drop extent space beyond the last page
+        if (mgmtInfo->map)
+            munmap(mgmtInfo->map, mgmtInfo->mapReserve);
+        if (mgmtInfo->allocPages > fHandle->totalNumPages &&
+            ftruncate(mgmtInfo->fd, FILE_END(mgmtInfo, fHandle->totalNumPages)) < 0)
+            RETURN(RC_FILE_CLOSE_FAILED);
+
+        // Close the file
+        if (close(mgmtInfo->fd) < 0 )
+            RETURN(RC_FILE_CLOSE_FAILED);
+    }
 
     // Deregister handle from storage manager
     deregisterFileHandle(fHandle);
@@ -199,10 +960,15 @@ RC closePageFile (SM_FileHandle *fHandle)
     // Free mem allocated for fHandle
     free(fHandle->fileName);
     fHandle->fileName= NULL;
+    pthread_mutex_destroy(&mgmtInfo->lock);
+    destroySyncState(mgmtInfo);
+    free(mgmtInfo->freeMap);
+    free(mgmtInfo->writesInFlight);
+    free(mgmtInfo->dirtyMaps);
     free(fHandle->mgmtInfo);
     fHandle->mgmtInfo= NULL;
 
-    RETURN(RC_OK);
+    RETURN(rc);
 }
 
 /* Remove the file from file-system */
@@ -212,6 +978,9 @@ RC destroyPageFile (char *fileName)
     if (isStorageManagerInitialized() != RC_OK)
         RETURN(RC_SM_NOT_INIT);
 
+    if (isSegmentName(fileName))
+        return dropSegment(fileName);
+
     // Remove the file
     if (unlink(fileName) < 0)
         RETURN(RC_FILE_DESTROY_FAILED);
@@ -219,67 +988,382 @@ RC destroyPageFile (char *fileName)
     RETURN(RC_OK);
 }
 
-/* Read bytes from file-system. This is not exposed, called by API's */
-static RC readBytes(int pageNum, SM_FileHandle *fHandle, SM_PageHandle memPage)
+/* Transfer all of iov at offset with preadv/pwritev, resuming
+ * after short transfers. Returns 0 on success. */
+static int transferVector(int fd, struct iovec *iov, int iovcnt,
+                          off_t offset, int write)
 {
-    int fd;
-    // Do we have this page?
-    if (pageNum >= fHandle->totalNumPages || pageNum < 0)
-        RETURN(RC_READ_NON_EXISTING_PAGE);
+    ssize_t done;
 
-    // Read the block
-    fd= (int) ((SM_FileMgmtInfo*) fHandle->mgmtInfo)->fd;
-    lseek(fd, PAGE_OFFSET(pageNum), SEEK_SET);
-    if (read(fd, memPage, PAGE_SIZE) < PAGE_SIZE)
-        RETURN(RC_READ_FAILED);
+    while (iovcnt > 0)
+    {
+        done= write ? pwritev(fd, iov, iovcnt, offset)
+                    : preadv(fd, iov, iovcnt, offset);
+        if (done < 0 && errno == EINTR)
+            continue;
+        if (done <= 0)
+            return -1;
 
-    fHandle->curPagePos= pageNum;
-    RETURN(RC_OK);
+        // Skip fully transferred buffers, trim a partial one
+        offset+= done;
+        while (iovcnt && done >= (ssize_t) iov->iov_len)
+        {
+            done-= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt)
+        {
+            iov->iov_base= (char*) iov->iov_base + done;
+            iov->iov_len-= done;
+        }
+    }
+    return 0;
 }
 
-/* Write bytes to file-system. This is not exposed, called by API's */
-static RC writeBytes(int pageNum, SM_FileHandle *fHandle, SM_PageHandle memPage)
+/* Direct I/O (SM_OPEN_DIRECT) needs aligned buffers. Other buffers are
+ * moved one page at a time through an aligned bounce page. */
+static int needsBounce(SM_FileMgmtInfo *mgmtInfo, SM_PageHandle memPage)
 {
-    int fd;
-    // Do we have this page?
-    if(pageNum < 0)
-        RETURN(RC_READ_NON_EXISTING_PAGE);
-
-    // Read the block
-    fd= (int) ((SM_FileMgmtInfo*) fHandle->mgmtInfo)->fd;
-    lseek(fd, PAGE_OFFSET(pageNum), SEEK_SET);
-    if (pageNum >= fHandle->totalNumPages)
-        fHandle->totalNumPages= pageNum+1;
-    if (write(fd, memPage, PAGE_SIZE) < PAGE_SIZE)
-        RETURN(RC_WRITE_FAILED);
+    return (mgmtInfo->flags & SM_OPEN_DIRECT) && !IS_IO_ALIGNED(memPage);
+}
 
-    RETURN(RC_OK);
+static int transferBounced(SM_FileMgmtInfo *mgmtInfo, SM_PageHandle memPage,
+                           off_t offset, int write)
+{
+    char bounce[SM_MAX_PAGE_SIZE] __attribute__((aligned(SM_IO_ALIGN)));
+    struct iovec iov= { bounce, mgmtInfo->pageSize };
+
+    if (write)
+        memcpy(bounce, memPage, mgmtInfo->pageSize);
+    if (transferVector(mgmtInfo->fd, &iov, 1, offset, write))
+        return -1;
+    if (!write)
+        memcpy(memPage, bounce, mgmtInfo->pageSize);
+    return 0;
 }
 
-/* Reading specific page from disk */
-RC readBlock (int pageNum, SM_FileHandle *fHandle, SM_PageHandle memPage)
+/* Read 'count' pages from 'startPage' into memPages[0..count-1].
+ * Runs of pages go to the kernel as one preadv() each.
+ * This is not exposed, called by API's */
+static RC readRun(PageNumber startPage, int count, SM_FileHandle *fHandle,
+                  SM_PageHandle *memPages)
 {
-    // Is storage manager initialized?
-    if (isStorageManagerInitialized() != RC_OK)
-        RETURN(RC_SM_NOT_INIT);
+    SM_FileMgmtInfo *mgmtInfo= (SM_FileMgmtInfo*) fHandle->mgmtInfo;
+    struct iovec iov[MAX_IOV_PAGES];
+    char *mapAddr;
+    int i, j, n;
+    RC rc;
+
+    // Do we have these pages?
+    if (startPage < 0 || count < 1 ||
+        startPage > getTotalNumPages(fHandle)-count)
+        RETURN(RC_READ_NON_EXISTING_PAGE);
 
-    // Is this handle already in use?
-    if (isFileHandleOpen(fHandle) != RC_OK)
-        RETURN(RC_FILE_HANDLE_NOT_INIT);
+    for (i=0; i<count; i+=n)
+    {
+        // Compressed slots one by one
+        if (mgmtInfo->slotStore)
+        {
+            if ((rc= readSlot(mgmtInfo->slotStore, PAGE_SLOT(mgmtInfo, startPage+i),
+                              memPages[i])) != RC_OK)
+                return rc;
+            n= 1;
+            continue;
+        }
 
-    return readBytes(pageNum, fHandle, memPage);
-}
+        // Mapped page is just a copy
+        if ((mapAddr= mappedPageAddr(mgmtInfo, startPage+i)))
+        {
+            memcpy(memPages[i], mapAddr, mgmtInfo->pageSize);
+            n= 1;
+            continue;
+        }
 
-/* Read current page position */
-int getBlockPos (SM_FileHandle *fHandle)
-{
-    return (fHandle->curPagePos);
+        if (needsBounce(mgmtInfo, memPages[i]))
+        {
+            if (transferBounced(mgmtInfo, memPages[i],
+                                pageOffset(mgmtInfo, startPage+i), 0))
+                RETURN(RC_READ_FAILED);
+            n= 1;
+            continue;
+        }
+
+        // Read the block(s), without touching the shared file offset
+        n= (count-i < MAX_IOV_PAGES) ? count-i : MAX_IOV_PAGES;
+        if (n > contiguousPages(mgmtInfo, startPage+i))
+            n= contiguousPages(mgmtInfo, startPage+i);
+        for (j=0; j<n && !needsBounce(mgmtInfo, memPages[i+j]); j++)
+        {
+            iov[j].iov_base= memPages[i+j];
+            iov[j].iov_len= mgmtInfo->pageSize;
+        }
+        n= j;
+        if (transferVector(mgmtInfo->fd, iov, n, pageOffset(mgmtInfo, startPage+i), 0))
+            RETURN(RC_READ_FAILED);
+    }
+
+    if (mgmtInfo->checksums && !(mgmtInfo->flags & SM_OPEN_NO_VERIFY) &&
+        (rc= verifyChecksums(mgmtInfo, startPage, count, memPages)) != RC_OK)
+        return rc;
+
+    // Cursor is per handle. Callers sharing a handle across threads
+    // should use readBlock() with explicit page numbers.
+    fHandle->curPagePos= startPage+count-1;
+    RETURN(RC_OK);
 }
 
-/* Reading first page from disk */
-RC readFirstBlock (SM_FileHandle *fHandle, SM_PageHandle memPage)
+/* Write 'count' allocated pages from memPages[0..count-1] at
+ * 'startPage', through the mapping, slot store or fd */
+static RC writePages(SM_FileMgmtInfo *mgmtInfo, PageNumber startPage, int count,
+                     SM_PageHandle *memPages)
 {
-    // Is storage manager initialized?
+    struct iovec iov[MAX_IOV_PAGES];
+    char *mapAddr;
+    int i, j, n;
+    RC rc;
+
+    for (i=0; i<count; i+=n)
+    {
+        if (mgmtInfo->slotStore)
+        {
+            if ((rc= writeSlot(mgmtInfo->slotStore, PAGE_SLOT(mgmtInfo, startPage+i),
+                               memPages[i])) != RC_OK)
+                return rc;
+            n= 1;
+            continue;
+        }
+
+        if ((mapAddr= mappedPageAddr(mgmtInfo, startPage+i)))
+        {
+            memcpy(mapAddr, memPages[i], mgmtInfo->pageSize);
+            n= 1;
+            continue;
+        }
+
+        if (needsBounce(mgmtInfo, memPages[i]))
+        {
+            if (transferBounced(mgmtInfo, memPages[i],
+                                pageOffset(mgmtInfo, startPage+i), 1))
+                RETURN(RC_WRITE_FAILED);
+            n= 1;
+            continue;
+        }
+
+        // Write the block(s), without touching the shared file offset
+        n= (count-i < MAX_IOV_PAGES) ? count-i : MAX_IOV_PAGES;
+        if (n > contiguousPages(mgmtInfo, startPage+i))
+            n= contiguousPages(mgmtInfo, startPage+i);
+        for (j=0; j<n && !needsBounce(mgmtInfo, memPages[i+j]); j++)
+        {
+            iov[j].iov_base= memPages[i+j];
+            iov[j].iov_len= mgmtInfo->pageSize;
+        }
+        n= j;
+        if (transferVector(mgmtInfo->fd, iov, n, pageOffset(mgmtInfo, startPage+i), 1))
+            RETURN(RC_WRITE_FAILED);
+    }
+    RETURN(RC_OK);
+}
+
+/* Write 'count' pages from memPages[0..count-1] at 'startPage'.
+ * This is not exposed, called by API's */
+static RC writeRun(PageNumber startPage, int count, SM_FileHandle *fHandle,
+                   SM_PageHandle *memPages)
+{
+    SM_FileMgmtInfo *mgmtInfo= (SM_FileMgmtInfo*) fHandle->mgmtInfo;
+    PageNumber lastPage= startPage+count-1;
+    RC rc;
+
+    // Do we have this page?
+    if(startPage < 0 || count < 1)
+        RETURN(RC_READ_NON_EXISTING_PAGE);
+
+    // Grow the mapping first, if the pages are past it
+    if ((mgmtInfo->flags & SM_OPEN_MMAP) && !mappedPageAddr(mgmtInfo, lastPage))
+    {
+        pthread_mutex_lock(&mgmtInfo->lock);
+        rc= growMapping(mgmtInfo, lastPage+1);
+        pthread_mutex_unlock(&mgmtInfo->lock);
+        if (rc != RC_OK)
+            return rc;
+    }
+    else if ((rc= reservePages(mgmtInfo, lastPage+1)) != RC_OK)
+        return rc;
+
+    // Pages have no checksum while they are written, see verifyChecksums()
+    if (mgmtInfo->checksums && (rc= beginChecksums(mgmtInfo, startPage, count)) != RC_OK)
+        return rc;
+    rc= writePages(mgmtInfo, startPage, count, memPages);
+    if (mgmtInfo->checksums)
+        finishChecksums(mgmtInfo, startPage, count, memPages, rc != RC_OK);
+    if (rc != RC_OK)
+        return rc;
+
+    // Pages are on disk now, so publish the new size
+    publishNumPages(fHandle, lastPage+1);
+
+    RETURN(RC_OK);
+}
+
+/* Validate a run for raw I/O by another storage module (async queue).
+ * Sets fd and offset if pages can move straight between memPages and
+ * disk, or *fd= -1 if the caller must use readBlocks/writeBlocks. */
+RC startRawIO (SM_FileHandle *fHandle, PageNumber startPage, int count, int write,
+               SM_PageHandle memPages[], int *fd, off_t *offset)
+{
+    SM_FileMgmtInfo *mgmtInfo;
+    int i;
+    RC rc;
+
+    // Is storage manager initialized?
+    if (isStorageManagerInitialized() != RC_OK)
+        RETURN(RC_SM_NOT_INIT);
+
+    // Is this handle already in use?
+    if (isFileHandleOpen(fHandle) != RC_OK)
+        RETURN(RC_FILE_HANDLE_NOT_INIT);
+
+    // Do we have these pages?
+    if (startPage < 0 || count < 1 ||
+        (!write && startPage > getTotalNumPages(fHandle)-count))
+        RETURN(RC_READ_NON_EXISTING_PAGE);
+
+    // Mapped pages must go through the mapping, compressed ones
+    // through the slot store, unaligned pages of direct handles
+    // through a bounce page, runs across a map page or extent are split.
+    mgmtInfo= (SM_FileMgmtInfo*) fHandle->mgmtInfo;
+    *fd= ((mgmtInfo->flags & SM_OPEN_MMAP) || mgmtInfo->slotStore) ? -1 : mgmtInfo->fd;
+    if (count > contiguousPages(mgmtInfo, startPage))
+        *fd= -1;
+    for (i=0; i<count && *fd >= 0; i++)
+        if (needsBounce(mgmtInfo, memPages[i]))
+            *fd= -1;
+    *offset= pageOffset(mgmtInfo, startPage);
+
+    // Writes land in preallocated extents, pages have no checksum
+    // until finishRawIO()
+    if (write && *fd >= 0)
+    {
+        if ((rc= reservePages(mgmtInfo, startPage+count)) != RC_OK)
+            return rc;
+        if (mgmtInfo->checksums)
+            return beginChecksums(mgmtInfo, startPage, count);
+    }
+
+    RETURN(RC_OK);
+}
+
+/* Raw I/O started by startRawIO() is over, 'failed' if the transfer
+ * failed, then that is the result */
+RC finishRawIO (SM_FileHandle *fHandle, PageNumber startPage, int count, int write,
+                SM_PageHandle memPages[], int failed)
+{
+    SM_FileMgmtInfo *mgmtInfo= (SM_FileMgmtInfo*) fHandle->mgmtInfo;
+    PageNumber lastPage= startPage+count-1;
+    RC rc;
+
+    if (write && mgmtInfo->checksums)
+        finishChecksums(mgmtInfo, startPage, count, memPages, failed);
+    if (failed)
+        RETURN(write ? RC_WRITE_FAILED : RC_READ_FAILED);
+
+    if (!write)
+    {
+        if (mgmtInfo->checksums && !(mgmtInfo->flags & SM_OPEN_NO_VERIFY) &&
+            (rc= verifyChecksums(mgmtInfo, startPage, count, memPages)) != RC_OK)
+            return rc;
+        fHandle->curPagePos= lastPage;
+        RETURN(RC_OK);
+    }
+
+    // Pages are on disk now, so publish the new size
+    publishNumPages(fHandle, lastPage+1);
+
+    RETURN(RC_OK);
+}
+
+/* Single page read/write, called by API's */
+static RC readBytes(PageNumber pageNum, SM_FileHandle *fHandle, SM_PageHandle memPage)
+{
+    return readRun(pageNum, 1, fHandle, &memPage);
+}
+
+static RC writeBytes(PageNumber pageNum, SM_FileHandle *fHandle, SM_PageHandle memPage)
+{
+    return writeRun(pageNum, 1, fHandle, &memPage);
+}
+
+/* Reading specific page from disk */
+RC readBlock (PageNumber pageNum, SM_FileHandle *fHandle, SM_PageHandle memPage)
+{
+    // Is storage manager initialized?
+    if (isStorageManagerInitialized() != RC_OK)
+        RETURN(RC_SM_NOT_INIT);
+
+    // Is this handle already in use?
+    if (isFileHandleOpen(fHandle) != RC_OK)
+        RETURN(RC_FILE_HANDLE_NOT_INIT);
+
+    return readBytes(pageNum, fHandle, memPage);
+}
+
+/* Read a run of pages into separate buffers, memPages[count] */
+RC readBlocks (PageNumber startPage, int count, SM_FileHandle *fHandle,
+               SM_PageHandle memPages[])
+{
+    // Is storage manager initialized?
+    if (isStorageManagerInitialized() != RC_OK)
+        RETURN(RC_SM_NOT_INIT);
+
+    // Is this handle already in use?
+    if (isFileHandleOpen(fHandle) != RC_OK)
+        RETURN(RC_FILE_HANDLE_NOT_INIT);
+
+    return readRun(startPage, count, fHandle, memPages);
+}
+
+/* Zero-copy access to a page of a SM_OPEN_MMAP page file. *pagePtr
+ * points into the file mapping, and stays valid until the file is
+ * closed. Writes through it update the page file in place, so the
+ * page has no checksum from now on. */
+RC getBlockPtr (PageNumber pageNum, SM_FileHandle *fHandle, SM_PageHandle *pagePtr)
+{
+    RC rc;
+
+    // Is storage manager initialized?
+    if (isStorageManagerInitialized() != RC_OK)
+        RETURN(RC_SM_NOT_INIT);
+
+    // Is this handle already in use?
+    if (isFileHandleOpen(fHandle) != RC_OK)
+        RETURN(RC_FILE_HANDLE_NOT_INIT);
+
+    // Do we have this page?
+    if (pageNum >= getTotalNumPages(fHandle) || pageNum < 0)
+        RETURN(RC_READ_NON_EXISTING_PAGE);
+
+    if (!(*pagePtr= mappedPageAddr(fHandle->mgmtInfo, pageNum)))
+        RETURN(RC_PAGE_NOT_MAPPED);
+
+    if (((SM_FileMgmtInfo*) fHandle->mgmtInfo)->checksums &&
+        (rc= dropChecksum(fHandle->mgmtInfo, pageNum)) != RC_OK)
+        return rc;
+
+    fHandle->curPagePos= pageNum;
+    RETURN(RC_OK);
+}
+
+/* Read current page position */
+PageNumber getBlockPos (SM_FileHandle *fHandle)
+{
+    return (fHandle->curPagePos);
+}
+
+/* Reading first page from disk */
+RC readFirstBlock (SM_FileHandle *fHandle, SM_PageHandle memPage)
+{
+    // Is storage manager initialized?
     if (isStorageManagerInitialized() != RC_OK)
         RETURN(RC_SM_NOT_INIT);
 
@@ -347,7 +1431,7 @@ RC readLastBlock (SM_FileHandle *fHandle, SM_PageHandle memPage)
 }
 
 /* writing blocks to a specified page number */
-RC writeBlock (int pageNum, SM_FileHandle *fHandle, SM_PageHandle memPage)
+RC writeBlock (PageNumber pageNum, SM_FileHandle *fHandle, SM_PageHandle memPage)
 {
     // Is storage manager initialized?
     if (isStorageManagerInitialized() != RC_OK)
@@ -360,6 +1444,21 @@ RC writeBlock (int pageNum, SM_FileHandle *fHandle, SM_PageHandle memPage)
     return writeBytes (pageNum, fHandle, memPage);
 }
 
+/* writing a run of pages from separate buffers, memPages[count] */
+RC writeBlocks (PageNumber startPage, int count, SM_FileHandle *fHandle,
+                SM_PageHandle memPages[])
+{
+    // Is storage manager initialized?
+    if (isStorageManagerInitialized() != RC_OK)
+        RETURN(RC_SM_NOT_INIT);
+
+    // Is this handle already in use?
+    if (isFileHandleOpen(fHandle) != RC_OK)
+        RETURN(RC_FILE_HANDLE_NOT_INIT);
+
+    return writeRun(startPage, count, fHandle, memPages);
+}
+
 /* writing blocks to current page number */
 RC writeCurrentBlock (SM_FileHandle *fHandle, SM_PageHandle memPage)
 {
@@ -374,10 +1473,68 @@ RC writeCurrentBlock (SM_FileHandle *fHandle, SM_PageHandle memPage)
     return writeBytes (fHandle->curPagePos, fHandle, memPage);
 }
 
-/* Append a new block to page file */
-RC appendEmptyBlock (SM_FileHandle *fHandle)
+/* Handle owning the fd, whose sync state is shared */
+static SM_FileMgmtInfo* syncOwner(SM_FileMgmtInfo *mgmtInfo)
+{
+    if (mgmtInfo->tablespace)
+        return (SM_FileMgmtInfo*) mgmtInfo->tablespace->fh.mgmtInfo;
+    return mgmtInfo;
+}
+
+/* Group commit. Each caller takes a ticket, and is done once a sync
+ * started after that covered it. With no sync running the caller
+ * leads: it waits windowUsec for more callers, then one fdatasync()
+ * covers all tickets taken so far. Others wait for the leader. A lone
+ * caller does not wait, the last group tells if others are around. */
+static RC groupSync(SM_FileMgmtInfo *owner, int windowUsec)
+{
+    long long ticket, covered;
+    int failed= 0;
+
+    pthread_mutex_lock(&owner->syncLock);
+    ticket= ++owner->syncRequests;
+    while (owner->syncedRequests < ticket && !failed)
+    {
+        if (owner->syncing)
+        {
+            pthread_cond_wait(&owner->syncCond, &owner->syncLock);
+            continue;
+        }
+
+        owner->syncing= 1;
+        pthread_mutex_unlock(&owner->syncLock);
+        if (windowUsec > 0 && owner->lastGroupSize > 1)
+            usleep(windowUsec);
+        pthread_mutex_lock(&owner->syncLock);
+        covered= owner->syncRequests;
+        pthread_mutex_unlock(&owner->syncLock);
+
+        failed= fdatasync(owner->fd) < 0;
+
+        pthread_mutex_lock(&owner->syncLock);
+        __atomic_add_fetch(&owner->numSyncs, 1, __ATOMIC_RELAXED);
+        owner->syncing= 0;
+        if (!failed)
+        {
+            owner->lastGroupSize= covered - owner->syncedRequests;
+            owner->syncedRequests= covered;
+        }
+        // Waiters of a failed sync retry with a sync of their own
+        pthread_cond_broadcast(&owner->syncCond);
+    }
+    pthread_mutex_unlock(&owner->syncLock);
+
+    if (failed)
+        RETURN(RC_WRITE_FAILED);
+    RETURN(RC_OK);
+}
+
+/* Set durability mode, SM_DURABILITY_*. groupWindowUsec is for
+ * SM_DURABILITY_GROUP, 0 only shares syncs already under way. */
+RC setDurability (SM_FileHandle *fHandle, int mode, int groupWindowUsec)
 {
-    char zeropage[PAGE_SIZE];
+    SM_FileMgmtInfo *mgmtInfo;
+
     // Is storage manager initialized?
     if (isStorageManagerInitialized() != RC_OK)
         RETURN(RC_SM_NOT_INIT);
@@ -386,14 +1543,22 @@ RC appendEmptyBlock (SM_FileHandle *fHandle)
     if (isFileHandleOpen(fHandle) != RC_OK)
         RETURN(RC_FILE_HANDLE_NOT_INIT);
 
-    memset(zeropage, 0, PAGE_SIZE);
-	return writeBytes (fHandle->totalNumPages, fHandle, (SM_PageHandle) &zeropage);
+    if (mode < SM_DURABILITY_NONE || mode > SM_DURABILITY_GROUP ||
+        groupWindowUsec < 0)
+        RETURN(RC_INVALID_DURABILITY);
+
+    mgmtInfo= (SM_FileMgmtInfo*) fHandle->mgmtInfo;
+    mgmtInfo->durability= mode;
+    mgmtInfo->groupWindowUsec= groupWindowUsec;
+    RETURN(RC_OK);
 }
 
-/* Make sure that page file has specified number of pages */
-RC ensureCapacity (int numberOfPages, SM_FileHandle *fHandle)
+/* Make all pages written so far durable, as the mode says */
+RC syncPageFile (SM_FileHandle *fHandle)
 {
-    char zeropage[PAGE_SIZE];
+    SM_FileMgmtInfo *mgmtInfo, *owner;
+    RC rc;
+
     // Is storage manager initialized?
     if (isStorageManagerInitialized() != RC_OK)
         RETURN(RC_SM_NOT_INIT);
@@ -402,11 +1567,1443 @@ RC ensureCapacity (int numberOfPages, SM_FileHandle *fHandle)
     if (isFileHandleOpen(fHandle) != RC_OK)
         RETURN(RC_FILE_HANDLE_NOT_INIT);
 
-    if (numberOfPages > fHandle->totalNumPages)
+    // Checksums of the pages written so far go with them
+    mgmtInfo= (SM_FileMgmtInfo*) fHandle->mgmtInfo;
+    if (mgmtInfo->checksums && (rc= saveChecksums(mgmtInfo)) != RC_OK)
+        return rc;
+    if (mgmtInfo->durability == SM_DURABILITY_NONE)
+        RETURN(RC_OK);
+
+    // Pages past the saved size of a segment would be lost, not so
+    // for a compressed file, but zero pages at its end would
+    if (mgmtInfo->tablespace && (rc= saveSegmentSize(fHandle)) != RC_OK)
+        return rc;
+    if (mgmtInfo->slotStore && (rc= saveCompressedSize(fHandle)) != RC_OK)
+        return rc;
+
+    owner= syncOwner(mgmtInfo);
+    if (mgmtInfo->durability == SM_DURABILITY_GROUP)
+        return groupSync(owner, mgmtInfo->groupWindowUsec);
+
+    rc= fdatasync(owner->fd) < 0 ? RC_WRITE_FAILED : RC_OK;
+    __atomic_add_fetch(&owner->numSyncs, 1, __ATOMIC_RELAXED);
+    RETURN(rc);
+}
+
+/* fdatasync() calls made for the handle's file */
+long long getNumSyncs (SM_FileHandle *fHandle)
+{
+    // Is storage manager initialized?
+    if (isStorageManagerInitialized() != RC_OK)
+        return 0;
+
+    // Is this handle already in use?
+    if (isFileHandleOpen(fHandle) != RC_OK)
+        return 0;
+
+    return __atomic_load_n(&syncOwner((SM_FileMgmtInfo*) fHandle->mgmtInfo)->numSyncs,
+                           __ATOMIC_RELAXED);
+}
+
+/* Tell the kernel how the file will be read, see SM_ACCESS_*. The
+ * kernel keeps this per fd, segments share it with their tablespace. */
+RC setAccessPattern (SM_FileHandle *fHandle, int pattern)
+{
+    SM_FileMgmtInfo *mgmtInfo;
+    PageNumber mapPages;
+
+    // Is storage manager initialized?
+    if (isStorageManagerInitialized() != RC_OK)
+        RETURN(RC_SM_NOT_INIT);
+
+    // Is this handle already in use?
+    if (isFileHandleOpen(fHandle) != RC_OK)
+        RETURN(RC_FILE_HANDLE_NOT_INIT);
+
+    if (pattern < SM_ACCESS_NORMAL || pattern > SM_ACCESS_RANDOM)
+        RETURN(RC_INVALID_ACCESS_PATTERN);
+
+    // Advice only, the kernel may ignore it, so errors are too.
+    // Extents mapped later get it in growMapping().
+    mgmtInfo= (SM_FileMgmtInfo*) fHandle->mgmtInfo;
+    pthread_mutex_lock(&mgmtInfo->lock);
+    mgmtInfo->accessPattern= pattern;
+    posix_fadvise(mgmtInfo->fd, 0, 0, accessAdvice[pattern].fadvise);
+    if ((mapPages= mgmtInfo->mapPages))
+        madvise(mgmtInfo->map, MAP_END(mgmtInfo, mapPages), accessAdvice[pattern].madvise);
+    pthread_mutex_unlock(&mgmtInfo->lock);
+
+    RETURN(RC_OK);
+}
+
+/* Advise the kernel about 'count' pages from startPage, usually
+ * SM_ACCESS_WILLNEED to start reading them in the background, or
+ * SM_ACCESS_DONTNEED. Each run of pages contiguous on disk is one
+ * call. Compressed pages have no fixed place, advice on them is
+ * ignored. */
+RC adviseBlocks (PageNumber startPage, int count, SM_FileHandle *fHandle, int pattern)
+{
+    SM_FileMgmtInfo *mgmtInfo;
+    char *mapAddr;
+    off_t offset;
+    size_t len;
+    int i, n;
+
+    // Is storage manager initialized?
+    if (isStorageManagerInitialized() != RC_OK)
+        RETURN(RC_SM_NOT_INIT);
+
+    // Is this handle already in use?
+    if (isFileHandleOpen(fHandle) != RC_OK)
+        RETURN(RC_FILE_HANDLE_NOT_INIT);
+
+    if (pattern < SM_ACCESS_NORMAL || pattern > SM_ACCESS_DONTNEED)
+        RETURN(RC_INVALID_ACCESS_PATTERN);
+
+    // Do we have these pages?
+    if (startPage < 0 || count < 1 ||
+        startPage > getTotalNumPages(fHandle)-count)
+        RETURN(RC_READ_NON_EXISTING_PAGE);
+
+    mgmtInfo= (SM_FileMgmtInfo*) fHandle->mgmtInfo;
+    if (mgmtInfo->slotStore)
+        RETURN(RC_OK);
+
+    for (i=0; i<count; i+=n)
     {
-        memset(zeropage, 0, PAGE_SIZE);
-        return writeBytes (numberOfPages-1, fHandle, (SM_PageHandle) &zeropage);
+        n= contiguousPages(mgmtInfo, startPage+i);
+        if (n > count-i)
+            n= count-i;
+        offset= pageOffset(mgmtInfo, startPage+i);
+        len= (size_t) n * mgmtInfo->pageSize;
+
+        // Mapped pages are advised through the mapping as well, the
+        // mapping of the run ends on a map page too
+        if ((mapAddr= mappedPageAddr(mgmtInfo, startPage+i)) &&
+            mappedPageAddr(mgmtInfo, startPage+i+n-1))
+            madvise(mapAddr, len, accessAdvice[pattern].madvise);
+
+        if (pattern == SM_ACCESS_WILLNEED)
+            readahead(mgmtInfo->fd, offset, len);
+        else
+            posix_fadvise(mgmtInfo->fd, offset, len, accessAdvice[pattern].fadvise);
     }
+
     RETURN(RC_OK);
 }
 
+/* Grow the logical size to 'numberOfPages'. New pages come from
+ * preallocated extents, which read back as zeros, so nothing is
+ * written unless a new extent is needed. */
+/* extendPages(), caller holds mgmtInfo->lock */
+static RC extendPagesLocked(PageNumber numberOfPages, SM_FileHandle *fHandle)
+{
+    SM_FileMgmtInfo *mgmtInfo= (SM_FileMgmtInfo*) fHandle->mgmtInfo;
+    RC rc= RC_OK;
+
+    if (numberOfPages > fHandle->totalNumPages)
+    {
+        if (mgmtInfo->flags & SM_OPEN_MMAP)
+            rc= growMapping(mgmtInfo, numberOfPages);
+        else
+            rc= growFile(mgmtInfo, numberOfPages);
+        if (rc == RC_OK)
+            __atomic_store_n(&fHandle->totalNumPages, numberOfPages, __ATOMIC_RELEASE);
+    }
+    return rc;
+}
+
+static RC extendPages(PageNumber numberOfPages, SM_FileHandle *fHandle)
+{
+    SM_FileMgmtInfo *mgmtInfo= (SM_FileMgmtInfo*) fHandle->mgmtInfo;
+    RC rc;
+
+    pthread_mutex_lock(&mgmtInfo->lock);
+    rc= extendPagesLocked(numberOfPages, fHandle);
+    pthread_mutex_unlock(&mgmtInfo->lock);
+
+    return rc;
+}
+
+/* Append a new block to page file */
+RC appendEmptyBlock (SM_FileHandle *fHandle)
+{
+    SM_FileMgmtInfo *mgmtInfo;
+    RC rc;
+
+    // Is storage manager initialized?
+    if (isStorageManagerInitialized() != RC_OK)
+        RETURN(RC_SM_NOT_INIT);
+
+    // Is this handle already in use?
+    if (isFileHandleOpen(fHandle) != RC_OK)
+        RETURN(RC_FILE_HANDLE_NOT_INIT);
+
+    // Size read under the lock, so concurrent appends add a page each
+    mgmtInfo= (SM_FileMgmtInfo*) fHandle->mgmtInfo;
+    pthread_mutex_lock(&mgmtInfo->lock);
+    rc= extendPagesLocked(fHandle->totalNumPages+1, fHandle);
+    pthread_mutex_unlock(&mgmtInfo->lock);
+
+    return rc;
+}
+
+/* Make sure that page file has specified number of pages */
+RC ensureCapacity (PageNumber numberOfPages, SM_FileHandle *fHandle)
+{
+    // Is storage manager initialized?
+    if (isStorageManagerInitialized() != RC_OK)
+        RETURN(RC_SM_NOT_INIT);
+
+    // Is this handle already in use?
+    if (isFileHandleOpen(fHandle) != RC_OK)
+        RETURN(RC_FILE_HANDLE_NOT_INIT);
+
+    return extendPages(numberOfPages, fHandle);
+}
+
+/* Read or write the whole slot, also of a compressed file. Returns 0
+ * on success. */
+static int transferSlot(SM_FileMgmtInfo *mgmtInfo, PageNumber slot, char *buf,
+                        int write)
+{
+    if (mgmtInfo->slotStore)
+        return (write ? writeSlot(mgmtInfo->slotStore, slot, buf)
+                      : readSlot(mgmtInfo->slotStore, slot, buf)) != RC_OK;
+    if (write)
+        return pwrite(mgmtInfo->fd, buf, mgmtInfo->pageSize,
+                      slotOffset(mgmtInfo, slot)) != mgmtInfo->pageSize;
+    return pread(mgmtInfo->fd, buf, mgmtInfo->pageSize, slotOffset(mgmtInfo, slot)) < 0;
+}
+
+// Map page of group g in freeMap, free bits first, then checksums
+#define GROUP_MAP(info, g)       ((info)->freeMap + (size_t) (g) * (info)->pageSize)
+#define GROUP_MAP_BYTES(info)    ((size_t) GROUP_PAGES(info) / 8)
+#define GROUP_CHECKSUMS(info, g) ((unsigned int*) (GROUP_MAP(info, g) + GROUP_MAP_BYTES(info)))
+// Byte 'byte' of the free bits of all groups back to back, so bit i
+// of it is page byte*8 + i
+#define FREE_MAP_BYTE(info, byte) \
+    GROUP_MAP(info, (byte) / GROUP_MAP_BYTES(info))[(byte) % GROUP_MAP_BYTES(info)]
+
+/* Make the free space map cover pages [0, numPages). Map pages of
+ * groups already in the file are read, newer groups start empty.
+ * Caller holds mgmtInfo->lock. */
+static RC loadFreeMap(SM_FileMgmtInfo *mgmtInfo, PageNumber numPages)
+{
+    PageNumber groups= (numPages + GROUP_PAGES(mgmtInfo) - 1) / GROUP_PAGES(mgmtInfo);
+    PageNumber allocGroups= (mgmtInfo->allocPages + GROUP_PAGES(mgmtInfo) - 1) /
+                            GROUP_PAGES(mgmtInfo);
+    unsigned char *freeMap, *groupMap, *writes= NULL, *dirty= NULL;
+    PageNumber g;
+    int i;
+
+    if (groups <= mgmtInfo->freeMapGroups)
+        RETURN(RC_OK);
+
+    // Aligned, map pages go to disk as they are, also with O_DIRECT
+    if (posix_memalign((void**) &freeMap, SM_IO_ALIGN,
+                       (size_t) groups * mgmtInfo->pageSize))
+        RETURN(RC_READ_FAILED);
+    if (mgmtInfo->freeMap)
+        memcpy(freeMap, mgmtInfo->freeMap,
+               (size_t) mgmtInfo->freeMapGroups * mgmtInfo->pageSize);
+
+    // Checksum bookkeeping, in memory only
+    if (mgmtInfo->checksums)
+    {
+        writes= (unsigned char*) calloc((size_t) groups * GROUP_PAGES(mgmtInfo), 1);
+        dirty= (unsigned char*) calloc(groups, 1);
+        if (!writes || !dirty)
+        {
+            free(writes);
+            free(dirty);
+            free(freeMap);
+            RETURN(RC_READ_FAILED);
+        }
+        if (mgmtInfo->writesInFlight)
+        {
+            memcpy(writes, mgmtInfo->writesInFlight,
+                   (size_t) mgmtInfo->freeMapGroups * GROUP_PAGES(mgmtInfo));
+            memcpy(dirty, mgmtInfo->dirtyMaps, mgmtInfo->freeMapGroups);
+        }
+    }
+
+    for (g= mgmtInfo->freeMapGroups; g < groups; g++)
+    {
+        groupMap= freeMap + (size_t) g * mgmtInfo->pageSize;
+        memset(groupMap, 0, mgmtInfo->pageSize);
+        if (g < allocGroups &&
+            transferSlot(mgmtInfo, MAP_PAGE_SLOT(mgmtInfo, g), (char*) groupMap, 0))
+        {
+            free(writes);
+            free(dirty);
+            free(freeMap);
+            RETURN(RC_READ_FAILED);
+        }
+        for (i=0; i<GROUP_MAP_BYTES(mgmtInfo); i++)
+            mgmtInfo->freeCount+= __builtin_popcount(groupMap[i]);
+    }
+
+    free(mgmtInfo->freeMap);
+    mgmtInfo->freeMap= freeMap;
+    if (mgmtInfo->checksums)
+    {
+        free(mgmtInfo->writesInFlight);
+        free(mgmtInfo->dirtyMaps);
+        mgmtInfo->writesInFlight= writes;
+        mgmtInfo->dirtyMaps= dirty;
+    }
+    mgmtInfo->freeMapGroups= groups;
+    RETURN(RC_OK);
+}
+
+/* Set or clear the free bits of 'count' pages from pageNum, all in
+ * one group, and write their map page. Caller holds mgmtInfo->lock,
+ * the map covers the pages. */
+static RC setPagesFree(SM_FileMgmtInfo *mgmtInfo, PageNumber pageNum, int count,
+                       int isFree)
+{
+    PageNumber g= pageNum / GROUP_PAGES(mgmtInfo);
+    unsigned char *groupMap= GROUP_MAP(mgmtInfo, g);
+    PageNumber bit, first= pageNum % GROUP_PAGES(mgmtInfo);
+
+    for (bit= first; bit < first+count; bit++)
+        if (isFree)
+            groupMap[bit / 8]|= 1 << (bit % 8);
+        else
+            groupMap[bit / 8]&= ~(1 << (bit % 8));
+
+    if (isFree)
+    {
+        mgmtInfo->freeCount+= count;
+        if (pageNum < mgmtInfo->freeHint)
+            mgmtInfo->freeHint= pageNum;
+    }
+    else
+        mgmtInfo->freeCount-= count;
+
+    // Map page goes straight to disk, also for mapped handles, their
+    // mapping shares the page cache. Checksums in it go along.
+    if (transferSlot(mgmtInfo, MAP_PAGE_SLOT(mgmtInfo, g), (char*) groupMap, 1))
+        RETURN(RC_WRITE_FAILED);
+    if (mgmtInfo->checksums)
+        mgmtInfo->dirtyMaps[g]= 0;
+    RETURN(RC_OK);
+}
+
+static int isPageFreeLocked(SM_FileMgmtInfo *mgmtInfo, PageNumber pageNum)
+{
+    PageNumber bit= pageNum % GROUP_PAGES(mgmtInfo);
+    unsigned char *groupMap= GROUP_MAP(mgmtInfo, pageNum / GROUP_PAGES(mgmtInfo));
+
+    return (groupMap[bit / 8] >> (bit % 8)) & 1;
+}
+
+/* Lowest free page, or -1. Caller holds mgmtInfo->lock. */
+static PageNumber findFreePage(SM_FileMgmtInfo *mgmtInfo, PageNumber numPages)
+{
+    size_t byte, bytes;
+    PageNumber pageNum;
+
+    if (!mgmtInfo->freeCount)
+        return -1;
+
+    bytes= (size_t) mgmtInfo->freeMapGroups * GROUP_MAP_BYTES(mgmtInfo);
+    for (byte= mgmtInfo->freeHint / 8; byte < bytes; byte++)
+        if (FREE_MAP_BYTE(mgmtInfo, byte))
+        {
+            pageNum= byte*8 + __builtin_ctz(FREE_MAP_BYTE(mgmtInfo, byte));
+            mgmtInfo->freeHint= pageNum;
+            return (pageNum < numPages) ? pageNum : -1;
+        }
+    return -1;
+}
+
+/* Get a page for new data. Reuses the lowest free page, else appends
+ * one. The page reads as zeros. */
+RC allocatePage (SM_FileHandle *fHandle, PageNumber *pageNum)
+{
+    SM_FileMgmtInfo *mgmtInfo;
+    SM_PageHandle zeroPage;
+    RC rc;
+
+    // Is storage manager initialized?
+    if (isStorageManagerInitialized() != RC_OK)
+        RETURN(RC_SM_NOT_INIT);
+
+    // Is this handle already in use?
+    if (isFileHandleOpen(fHandle) != RC_OK)
+        RETURN(RC_FILE_HANDLE_NOT_INIT);
+
+    mgmtInfo= (SM_FileMgmtInfo*) fHandle->mgmtInfo;
+    pthread_mutex_lock(&mgmtInfo->lock);
+    if ((rc= loadFreeMap(mgmtInfo, fHandle->totalNumPages)) == RC_OK)
+    {
+        // Append, the new page is in use already
+        if ((*pageNum= findFreePage(mgmtInfo, fHandle->totalNumPages)) < 0)
+        {
+            *pageNum= fHandle->totalNumPages;
+            rc= extendPagesLocked(*pageNum+1, fHandle);
+            pthread_mutex_unlock(&mgmtInfo->lock);
+            return rc;
+        }
+        rc= setPagesFree(mgmtInfo, *pageNum, 1, 0);
+    }
+    pthread_mutex_unlock(&mgmtInfo->lock);
+    if (rc != RC_OK)
+        return rc;
+
+    // Reused page still has its old contents
+    if (posix_memalign((void**) &zeroPage, SM_IO_ALIGN, mgmtInfo->pageSize))
+        RETURN(RC_WRITE_FAILED);
+    memset(zeroPage, 0, mgmtInfo->pageSize);
+    rc= writeBytes(*pageNum, fHandle, zeroPage);
+    free(zeroPage);
+    return rc;
+}
+
+/* Give a page back, allocatePage() can reuse it */
+RC freePage (PageNumber pageNum, SM_FileHandle *fHandle)
+{
+    SM_FileMgmtInfo *mgmtInfo;
+    RC rc;
+
+    // Is storage manager initialized?
+    if (isStorageManagerInitialized() != RC_OK)
+        RETURN(RC_SM_NOT_INIT);
+
+    // Is this handle already in use?
+    if (isFileHandleOpen(fHandle) != RC_OK)
+        RETURN(RC_FILE_HANDLE_NOT_INIT);
+
+    // Do we have this page?
+    if (pageNum < 0 || pageNum >= getTotalNumPages(fHandle))
+        RETURN(RC_READ_NON_EXISTING_PAGE);
+
+    mgmtInfo= (SM_FileMgmtInfo*) fHandle->mgmtInfo;
+    pthread_mutex_lock(&mgmtInfo->lock);
+    if ((rc= loadFreeMap(mgmtInfo, fHandle->totalNumPages)) == RC_OK)
+    {
+        if (isPageFreeLocked(mgmtInfo, pageNum))
+            rc= set_errormsg(RC_PAGE_ALREADY_FREE);
+        else
+            rc= setPagesFree(mgmtInfo, pageNum, 1, 1);
+    }
+    pthread_mutex_unlock(&mgmtInfo->lock);
+
+    return rc;
+}
+
+/* Is the page freed and not allocated again? */
+int isPageFree (PageNumber pageNum, SM_FileHandle *fHandle)
+{
+    SM_FileMgmtInfo *mgmtInfo;
+    int isFree= 0;
+
+    if (isFileHandleOpen(fHandle) != RC_OK ||
+        pageNum < 0 || pageNum >= getTotalNumPages(fHandle))
+        return 0;
+
+    mgmtInfo= (SM_FileMgmtInfo*) fHandle->mgmtInfo;
+    pthread_mutex_lock(&mgmtInfo->lock);
+    if (loadFreeMap(mgmtInfo, fHandle->totalNumPages) == RC_OK)
+        isFree= isPageFreeLocked(mgmtInfo, pageNum);
+    pthread_mutex_unlock(&mgmtInfo->lock);
+
+    return isFree;
+}
+
+/************************************************************
+ *                    page checksums                        *
+ ************************************************************/
+// CRC32C of a page. 0 means none, pages never written through a
+// checksummed handle have it, e.g. new pages that read as zeros.
+static unsigned int pageChecksum(SM_FileMgmtInfo *mgmtInfo, SM_PageHandle page)
+{
+    unsigned int crc= crc32c(0, page, mgmtInfo->pageSize);
+    return crc ? crc : 1;
+}
+
+static unsigned int* storedChecksum(SM_FileMgmtInfo *mgmtInfo, PageNumber pageNum)
+{
+    return GROUP_CHECKSUMS(mgmtInfo, pageNum / GROUP_PAGES(mgmtInfo)) +
+           pageNum % GROUP_PAGES(mgmtInfo);
+}
+
+// writesInFlight of a page: writes of it under way, and flags
+#define WRITES_MASK      0x3f
+#define WRITES_RACED     0x40 // Two overlapped, which landed last is unknown
+#define WRITES_POINTER   0x80 // Written through getBlockPtr()
+#define CHECKSUM_BATCH   64   // Checksums computed per lock
+
+/* Writes of 'count' pages from startPage start. The pages have no
+ * checksum until finishChecksums(), so the lock need not be held
+ * across the writes. */
+static RC beginChecksums(SM_FileMgmtInfo *mgmtInfo, PageNumber startPage, int count)
+{
+    unsigned char *writes;
+    RC rc;
+    int i;
+
+    pthread_mutex_lock(&mgmtInfo->lock);
+    if ((rc= loadFreeMap(mgmtInfo, startPage+count)) == RC_OK)
+        for (i=0; i<count; i++)
+        {
+            *storedChecksum(mgmtInfo, startPage+i)= 0;
+            writes= &mgmtInfo->writesInFlight[startPage+i];
+            if (*writes & WRITES_MASK)
+                *writes|= WRITES_RACED;
+            (*writes)++;
+        }
+    pthread_mutex_unlock(&mgmtInfo->lock);
+    return rc;
+}
+
+/* Writes begun by beginChecksums() are over. A page gets the checksum
+ * of its memPage once no other write of it is under way, unless the
+ * write failed or others overlapped it. Then it has none until it is
+ * written again. Map pages follow in saveChecksums(). */
+static void finishChecksums(SM_FileMgmtInfo *mgmtInfo, PageNumber startPage, int count,
+                            SM_PageHandle *memPages, int failed)
+{
+    unsigned int crcs[CHECKSUM_BATCH];
+    unsigned char *writes;
+    PageNumber pageNum;
+    int i, j, n;
+
+    for (i=0; i<count; i+=n)
+    {
+        n= (count-i < CHECKSUM_BATCH) ? count-i : CHECKSUM_BATCH;
+        for (j=0; j<n && !failed; j++)
+            crcs[j]= pageChecksum(mgmtInfo, memPages[i+j]);
+
+        pthread_mutex_lock(&mgmtInfo->lock);
+        for (j=0; j<n; j++)
+        {
+            pageNum= startPage+i+j;
+            writes= &mgmtInfo->writesInFlight[pageNum];
+            if (--(*writes) & WRITES_MASK)
+                continue;
+            if (!failed && !(*writes & (WRITES_RACED | WRITES_POINTER)))
+                *storedChecksum(mgmtInfo, pageNum)= crcs[j];
+            *writes&= WRITES_POINTER;
+            mgmtInfo->dirtyMaps[pageNum / GROUP_PAGES(mgmtInfo)]= 1;
+        }
+        pthread_mutex_unlock(&mgmtInfo->lock);
+    }
+}
+
+/* Page is handed out by getBlockPtr(), writes through the pointer are
+ * not seen, so it has no checksum until the handle is closed */
+static RC dropChecksum(SM_FileMgmtInfo *mgmtInfo, PageNumber pageNum)
+{
+    RC rc;
+
+    pthread_mutex_lock(&mgmtInfo->lock);
+    if ((rc= loadFreeMap(mgmtInfo, pageNum+1)) == RC_OK &&
+        !(mgmtInfo->writesInFlight[pageNum] & WRITES_POINTER))
+    {
+        mgmtInfo->writesInFlight[pageNum]|= WRITES_POINTER;
+        *storedChecksum(mgmtInfo, pageNum)= 0;
+        mgmtInfo->dirtyMaps[pageNum / GROUP_PAGES(mgmtInfo)]= 1;
+    }
+    pthread_mutex_unlock(&mgmtInfo->lock);
+    return rc;
+}
+
+/* Write the map pages whose checksums changed, called on sync and
+ * close. They only hold checksums of writes that are done. After a
+ * crash pages written since the last sync may fail their check, like
+ * a torn write would. */
+static RC saveChecksums(SM_FileMgmtInfo *mgmtInfo)
+{
+    PageNumber g;
+    RC rc= RC_OK;
+
+    pthread_mutex_lock(&mgmtInfo->lock);
+    for (g= 0; g < mgmtInfo->freeMapGroups && rc == RC_OK; g++)
+        if (mgmtInfo->dirtyMaps[g])
+        {
+            if (transferSlot(mgmtInfo, MAP_PAGE_SLOT(mgmtInfo, g),
+                             (char*) GROUP_MAP(mgmtInfo, g), 1))
+                rc= set_errormsg(RC_WRITE_FAILED);
+            else
+                mgmtInfo->dirtyMaps[g]= 0;
+        }
+    pthread_mutex_unlock(&mgmtInfo->lock);
+    return rc;
+}
+
+/* Page failed its check, read it again. Caller holds mgmtInfo->lock,
+ * and the page has a checksum, so no writer of this handle is
+ * halfway. Another handle of the file may have written the page, then
+ * its checksum is in the map page on disk once that handle synced or
+ * closed. A mismatch with both means corruption. */
+static RC recheckPage(SM_FileMgmtInfo *mgmtInfo, PageNumber pageNum,
+                      SM_PageHandle memPage, unsigned int stored)
+{
+    char mapPage[SM_MAX_PAGE_SIZE] __attribute__((aligned(SM_IO_ALIGN)));
+    unsigned int crc, *onDisk;
+    char *mapAddr;
+    int failed= 0;
+
+    if (mgmtInfo->slotStore)
+        failed= readSlot(mgmtInfo->slotStore, PAGE_SLOT(mgmtInfo, pageNum),
+                         memPage) != RC_OK;
+    else if ((mapAddr= mappedPageAddr(mgmtInfo, pageNum)))
+        memcpy(memPage, mapAddr, mgmtInfo->pageSize);
+    else
+        failed= transferBounced(mgmtInfo, memPage, pageOffset(mgmtInfo, pageNum), 0);
+    if (failed)
+        RETURN(RC_READ_FAILED);
+
+    if ((crc= pageChecksum(mgmtInfo, memPage)) == stored)
+        RETURN(RC_OK);
+
+    if (transferSlot(mgmtInfo, MAP_PAGE_SLOT(mgmtInfo, pageNum / GROUP_PAGES(mgmtInfo)),
+                     mapPage, 0))
+        RETURN(RC_READ_FAILED);
+    onDisk= (unsigned int*) (mapPage + GROUP_MAP_BYTES(mgmtInfo)) +
+            pageNum % GROUP_PAGES(mgmtInfo);
+    if (*onDisk == crc)
+    {
+        *storedChecksum(mgmtInfo, pageNum)= crc;
+        RETURN(RC_OK);
+    }
+
+    __atomic_add_fetch(&mgmtInfo->checksumFailures, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&storageManager.checksumFailures, 1, __ATOMIC_RELAXED);
+    RETURN(RC_CHECKSUM_MISMATCH);
+}
+
+/* Check 'count' pages just read from startPage against their stored
+ * checksums. They are computed without the lock, readers only take
+ * it to look up the stored ones. */
+static RC verifyChecksums(SM_FileMgmtInfo *mgmtInfo, PageNumber startPage, int count,
+                          SM_PageHandle *memPages)
+{
+    unsigned int crc, stored;
+    RC rc= RC_OK;
+    int i;
+
+    for (i=0; i<count && rc == RC_OK; i++)
+    {
+        crc= pageChecksum(mgmtInfo, memPages[i]);
+        pthread_mutex_lock(&mgmtInfo->lock);
+        if ((rc= loadFreeMap(mgmtInfo, startPage+count)) == RC_OK)
+        {
+            stored= *storedChecksum(mgmtInfo, startPage+i);
+            if (stored && stored != crc)
+                rc= recheckPage(mgmtInfo, startPage+i, memPages[i], stored);
+        }
+        pthread_mutex_unlock(&mgmtInfo->lock);
+    }
+    return rc;
+}
+
+/* Pages that failed their checksum on read, of one file or with a
+ * NULL fHandle of all files since the program started */
+long long getChecksumFailures (SM_FileHandle *fHandle)
+{
+    if (!fHandle)
+        return __atomic_load_n(&storageManager.checksumFailures, __ATOMIC_RELAXED);
+
+    // Is this handle already in use?
+    if (isFileHandleOpen(fHandle) != RC_OK)
+        return -1;
+
+    return __atomic_load_n(&((SM_FileMgmtInfo*) fHandle->mgmtInfo)->checksumFailures,
+                           __ATOMIC_RELAXED);
+}
+
+/* Lowest free extent, SM_SEGMENT_EXTENT_PAGES free pages aligned to
+ * their number, or -1. Caller holds mgmtInfo->lock. */
+static PageNumber findFreeExtent(SM_FileMgmtInfo *mgmtInfo, PageNumber numPages)
+{
+    size_t byte, bytes= (size_t) mgmtInfo->freeMapGroups * GROUP_MAP_BYTES(mgmtInfo);
+    int i, extentBytes= SM_SEGMENT_EXTENT_PAGES / 8;
+
+    if (mgmtInfo->freeCount < SM_SEGMENT_EXTENT_PAGES)
+        return -1;
+
+    for (byte= mgmtInfo->freeHint / SM_SEGMENT_EXTENT_PAGES * extentBytes;
+         byte + extentBytes <= bytes; byte+= extentBytes)
+    {
+        for (i=0; i<extentBytes && FREE_MAP_BYTE(mgmtInfo, byte+i) == 0xff; i++)
+            ;
+        if (i == extentBytes)
+            return (byte*8 + SM_SEGMENT_EXTENT_PAGES <= numPages) ? byte*8 : -1;
+    }
+    return -1;
+}
+
+/* Zero 'count' pages from 'start', all in one group */
+static RC zeroPages(SM_FileMgmtInfo *mgmtInfo, PageNumber start, int count)
+{
+    off_t offset= PAGE_OFFSET(mgmtInfo, start);
+    char *zeroPage;
+    int i;
+
+    if (fallocate(mgmtInfo->fd, FALLOC_FL_ZERO_RANGE, offset,
+                  (off_t) count * mgmtInfo->pageSize) == 0)
+        RETURN(RC_OK);
+
+    if (posix_memalign((void**) &zeroPage, SM_IO_ALIGN, mgmtInfo->pageSize))
+        RETURN(RC_WRITE_FAILED);
+    memset(zeroPage, 0, mgmtInfo->pageSize);
+    for (i=0; i<count; i++)
+        if (pwrite(mgmtInfo->fd, zeroPage, mgmtInfo->pageSize,
+                   offset + (off_t) i * mgmtInfo->pageSize) != mgmtInfo->pageSize)
+        {
+            free(zeroPage);
+            RETURN(RC_WRITE_FAILED);
+        }
+    free(zeroPage);
+    RETURN(RC_OK);
+}
+
+/* Get an extent of a tablespace for a segment. Reuses the lowest free
+ * extent, else appends one. Pages read as zeros. */
+static RC allocateExtent(SM_FileHandle *fHandle, PageNumber *start)
+{
+    SM_FileMgmtInfo *mgmtInfo= (SM_FileMgmtInfo*) fHandle->mgmtInfo;
+    PageNumber numPages;
+    RC rc;
+
+    pthread_mutex_lock(&mgmtInfo->lock);
+    numPages= fHandle->totalNumPages;
+    if ((rc= loadFreeMap(mgmtInfo, numPages)) == RC_OK &&
+        (*start= findFreeExtent(mgmtInfo, numPages)) >= 0)
+    {
+        // Old checksums would not match the zeros, the segment
+        // keeps its own in its map pages
+        if (mgmtInfo->checksums)
+            memset(storedChecksum(mgmtInfo, *start), 0,
+                   SM_SEGMENT_EXTENT_PAGES * sizeof(unsigned int));
+        if ((rc= setPagesFree(mgmtInfo, *start, SM_SEGMENT_EXTENT_PAGES, 0)) == RC_OK)
+            rc= zeroPages(mgmtInfo, *start, SM_SEGMENT_EXTENT_PAGES);
+    }
+    else if (rc == RC_OK)
+    {
+        // Append, aligned. Pages skipped to align are free for
+        // allocatePage(). Extents never cross a map page, groups are
+        // a multiple of the extent size.
+        *start= ROUND_UP(numPages, SM_SEGMENT_EXTENT_PAGES);
+        if ((rc= extendPagesLocked(*start + SM_SEGMENT_EXTENT_PAGES, fHandle)) == RC_OK &&
+            (rc= loadFreeMap(mgmtInfo, *start + SM_SEGMENT_EXTENT_PAGES)) == RC_OK &&
+            *start > numPages)
+            rc= setPagesFree(mgmtInfo, numPages, *start - numPages, 1);
+    }
+    pthread_mutex_unlock(&mgmtInfo->lock);
+
+    return rc;
+}
+
+/* Give an extent back to its tablespace */
+static RC freeExtent(SM_FileHandle *fHandle, PageNumber start)
+{
+    SM_FileMgmtInfo *mgmtInfo= (SM_FileMgmtInfo*) fHandle->mgmtInfo;
+    RC rc;
+
+    pthread_mutex_lock(&mgmtInfo->lock);
+    if ((rc= loadFreeMap(mgmtInfo, fHandle->totalNumPages)) == RC_OK)
+        rc= setPagesFree(mgmtInfo, start, SM_SEGMENT_EXTENT_PAGES, 1);
+    pthread_mutex_unlock(&mgmtInfo->lock);
+
+    return rc;
+}
+
+/* Set how many pages the file grows by at a time */
+RC setExtentSize (int extentPages, SM_FileHandle *fHandle)
+{
+    SM_FileMgmtInfo *mgmtInfo;
+
+    // Is storage manager initialized?
+    if (isStorageManagerInitialized() != RC_OK)
+        RETURN(RC_SM_NOT_INIT);
+
+    // Is this handle already in use?
+    if (isFileHandleOpen(fHandle) != RC_OK)
+        RETURN(RC_FILE_HANDLE_NOT_INIT);
+
+    if (extentPages < MIN_EXTENT_PAGES)
+        extentPages= MIN_EXTENT_PAGES;
+    if (extentPages > MAX_EXTENT_PAGES)
+        extentPages= MAX_EXTENT_PAGES;
+
+    mgmtInfo= (SM_FileMgmtInfo*) fHandle->mgmtInfo;
+    pthread_mutex_lock(&mgmtInfo->lock);
+    mgmtInfo->extentPages= extentPages;
+    pthread_mutex_unlock(&mgmtInfo->lock);
+
+    RETURN(RC_OK);
+}
+
+/* Pages the file occupies on disk, totalNumPages or more */
+PageNumber getAllocatedNumPages (SM_FileHandle *fHandle)
+{
+    SM_FileMgmtInfo *mgmtInfo;
+
+    // Is storage manager initialized?
+    if (isStorageManagerInitialized() != RC_OK)
+        return -1;
+
+    // Is this handle already in use?
+    if (isFileHandleOpen(fHandle) != RC_OK)
+        return -1;
+
+    mgmtInfo= (SM_FileMgmtInfo*) fHandle->mgmtInfo;
+    return __atomic_load_n(&mgmtInfo->allocPages, __ATOMIC_ACQUIRE);
+}
+
+
+/************************************************************
+ *                    tablespaces                           *
+ ************************************************************/
+/* Is fileName "<tablespace>:<segment>"? */
+static int isSegmentName(char *fileName)
+{
+    return strchr(fileName, SM_SEGMENT_SEP) != NULL;
+}
+
+/* Split a segment name. *tsName gets a copy of the tablespace part,
+ * returns the segment part, or NULL if a part is empty or too long. */
+static char* splitSegmentName(char *fileName, char **tsName)
+{
+    char *sep= strchr(fileName, SM_SEGMENT_SEP);
+
+    if (!sep || sep == fileName || !sep[1] ||
+        strlen(sep+1) >= SM_MAX_SEGMENT_NAME)
+        return NULL;
+    *tsName= strndup(fileName, sep - fileName);
+    return sep+1;
+}
+
+static SM_SegmentEntry* segmentEntry(SM_Tablespace *ts, int dirPage, int dirSlot)
+{
+    return DIR_ENTRY(ts->dir + (size_t) dirPage * ts->fh.pageSize, dirSlot);
+}
+
+/* Find the directory entry of segName, "" finds an unused one.
+ * Caller holds ts->lock. */
+static int findSegment(SM_Tablespace *ts, char *segName, int *dirPage, int *dirSlot)
+{
+    int i, j;
+
+    for (i=0; i<ts->numDirPages; i++)
+        for (j=0; j<DIR_ENTRIES(ts->fh.pageSize); j++)
+            if (!strcmp(segmentEntry(ts, i, j)->name, segName))
+            {
+                *dirPage= i;
+                *dirSlot= j;
+                return 1;
+            }
+    return 0;
+}
+
+/* Write a directory page back. Caller holds ts->lock. */
+static RC writeDirPage(SM_Tablespace *ts, int dirPage)
+{
+    return writeBlock(ts->dirPageNums[dirPage], &ts->fh,
+                      ts->dir + (size_t) dirPage * ts->fh.pageSize);
+}
+
+/* Add an empty page to the directory in memory, *page points to it.
+ * ts->dir moves, entry pointers taken before are stale. */
+static RC addDirPage(SM_Tablespace *ts, PageNumber pageNum, char **page)
+{
+    size_t size= (size_t) ts->numDirPages * ts->fh.pageSize;
+    PageNumber *dirPageNums;
+    char *dir;
+
+    // Aligned, directory pages go to disk as they are
+    if (posix_memalign((void**) &dir, SM_IO_ALIGN, size + ts->fh.pageSize))
+        RETURN(RC_READ_FAILED);
+    dirPageNums= (PageNumber*) realloc(ts->dirPageNums,
+                                       (ts->numDirPages+1) * sizeof(PageNumber));
+    if (!dirPageNums)
+    {
+        free(dir);
+        RETURN(RC_READ_FAILED);
+    }
+    if (ts->dir)
+        memcpy(dir, ts->dir, size);
+    memset(dir + size, 0, ts->fh.pageSize);
+    free(ts->dir);
+
+    ts->dir= dir;
+    ts->dirPageNums= dirPageNums;
+    ts->dirPageNums[ts->numDirPages++]= pageNum;
+    *page= dir + size;
+    RETURN(RC_OK);
+}
+
+/* Read the directory chain */
+static RC loadDirectory(SM_Tablespace *ts)
+{
+    PageNumber pageNum= 0;
+    char *page;
+    RC rc;
+
+    do
+    {
+        if ((rc= addDirPage(ts, pageNum, &page)) != RC_OK ||
+            (rc= readBlock(pageNum, &ts->fh, page)) != RC_OK)
+            return rc;
+        if (memcmp(((SM_DirPageHeader*) page)->magic, SM_DIR_MAGIC,
+                   sizeof(((SM_DirPageHeader*) page)->magic)))
+            RETURN(RC_BAD_PAGE_FILE);
+        pageNum= ((SM_DirPageHeader*) page)->nextPage;
+    } while (pageNum);
+
+    RETURN(RC_OK);
+}
+
+/* Open a tablespace, or take another reference to it if open. The
+ * list stays locked while opening, so two threads never open one
+ * tablespace twice. */
+static RC acquireTablespace(char *fileName, int flags, SM_Tablespace **tablespace)
+{
+    SM_Tablespace *ts;
+    RC rc;
+
+    pthread_mutex_lock(&storageManager.tablespacesLock);
+    for (ts= storageManager.tablespaces; ts; ts= ts->next)
+        if (!strcmp(ts->fileName, fileName))
+        {
+            ts->refCount++;
+            pthread_mutex_unlock(&storageManager.tablespacesLock);
+            *tablespace= ts;
+            RETURN(RC_OK);
+        }
+
+    if (!(ts= (SM_Tablespace*) calloc(1, sizeof(SM_Tablespace))))
+    {
+        pthread_mutex_unlock(&storageManager.tablespacesLock);
+        RETURN(RC_FILE_NOT_FOUND);
+    }
+
+    // Segments go through the fd, the tablespace is never mapped
+    if ((rc= openPageFileWithFlags(fileName, &ts->fh, flags & SM_OPEN_DIRECT)) != RC_OK)
+    {
+        pthread_mutex_unlock(&storageManager.tablespacesLock);
+        free(ts);
+        return rc;
+    }
+    if ((rc= loadDirectory(ts)) != RC_OK)
+    {
+        closePageFile(&ts->fh);
+        pthread_mutex_unlock(&storageManager.tablespacesLock);
+        free(ts->dir);
+        free(ts->dirPageNums);
+        free(ts);
+        return rc;
+    }
+
+    ts->fileName= strdup(fileName);
+    ts->refCount= 1;
+    pthread_mutex_init(&ts->lock, NULL);
+    ts->next= storageManager.tablespaces;
+    storageManager.tablespaces= ts;
+    pthread_mutex_unlock(&storageManager.tablespacesLock);
+
+    *tablespace= ts;
+    RETURN(RC_OK);
+}
+
+/* Drop a reference, the last one closes the tablespace. That is done
+ * with the list locked, so a new open waits for the file to be closed. */
+static RC releaseTablespace(SM_Tablespace *ts)
+{
+    SM_Tablespace **link;
+    RC rc;
+
+    pthread_mutex_lock(&storageManager.tablespacesLock);
+    if (--ts->refCount > 0)
+    {
+        pthread_mutex_unlock(&storageManager.tablespacesLock);
+        RETURN(RC_OK);
+    }
+
+    for (link= &storageManager.tablespaces; *link != ts; link= &(*link)->next)
+        ;
+    *link= ts->next;
+
+    rc= closePageFile(&ts->fh);
+    pthread_mutex_unlock(&storageManager.tablespacesLock);
+    pthread_mutex_destroy(&ts->lock);
+    free(ts->fileName);
+    free(ts->dir);
+    free(ts->dirPageNums);
+    free(ts);
+    return rc;
+}
+
+/* Make room for 'count' extents. Caller holds mgmtInfo->lock. */
+static RC reserveExtents(SM_FileMgmtInfo *mgmtInfo, PageNumber count)
+{
+    SM_ExtentArray *old= mgmtInfo->extents, *extents;
+    PageNumber capacity= old ? old->capacity : 4;
+
+    if (old && count <= old->capacity)
+        RETURN(RC_OK);
+    while (capacity < count)
+        capacity*= 2;
+
+    extents= (SM_ExtentArray*) malloc(sizeof(SM_ExtentArray) +
+                                      capacity * sizeof(PageNumber));
+    if (!extents)
+        RETURN(RC_WRITE_FAILED);
+    extents->retired= old;
+    extents->capacity= capacity;
+    extents->count= old ? old->count : 0;
+    if (old)
+        memcpy(extents->start, old->start, old->count * sizeof(PageNumber));
+
+    __atomic_store_n(&mgmtInfo->extents, extents, __ATOMIC_RELEASE);
+    RETURN(RC_OK);
+}
+
+static void freeExtentArrays(SM_ExtentArray *extents)
+{
+    SM_ExtentArray *retired;
+
+    for (; extents; extents= retired)
+    {
+        retired= extents->retired;
+        free(extents);
+    }
+}
+
+/* Read the extent list of a segment being opened. Caller holds
+ * tablespace->lock. */
+static RC loadExtentList(SM_FileMgmtInfo *mgmtInfo, SM_SegmentEntry *entry)
+{
+    SM_Tablespace *ts= mgmtInfo->tablespace;
+    PageNumber perPage= LIST_EXTENTS(mgmtInfo->pageSize);
+    PageNumber *list, i;
+    RC rc;
+
+    if ((rc= reserveExtents(mgmtInfo, entry->numExtents)) != RC_OK)
+        return rc;
+    if (posix_memalign((void**) &mgmtInfo->extentList, SM_IO_ALIGN,
+                       mgmtInfo->pageSize))
+    {
+        mgmtInfo->extentList= NULL;
+        RETURN(RC_READ_FAILED);
+    }
+    memset(mgmtInfo->extentList, 0, mgmtInfo->pageSize);
+    list= (PageNumber*) mgmtInfo->extentList;
+
+    for (i=0; i<entry->numExtents; i++)
+    {
+        if (i % perPage == 0)
+        {
+            mgmtInfo->extentListPage= i ? list[0] : entry->extentList;
+            if ((rc= readBlock(mgmtInfo->extentListPage, &ts->fh,
+                               mgmtInfo->extentList)) != RC_OK)
+                return rc;
+        }
+        mgmtInfo->extents->start[i]= list[1 + i % perPage];
+    }
+    mgmtInfo->extents->count= entry->numExtents;
+    mgmtInfo->allocPages= slotsToPages(mgmtInfo,
+                              entry->numExtents * SM_SEGMENT_EXTENT_PAGES);
+    RETURN(RC_OK);
+}
+
+/* Add an extent to the segment's extent list. Caller holds
+ * mgmtInfo->lock. */
+static RC appendExtentList(SM_FileMgmtInfo *mgmtInfo, PageNumber start)
+{
+    SM_Tablespace *ts= mgmtInfo->tablespace;
+    PageNumber perPage= LIST_EXTENTS(mgmtInfo->pageSize);
+    PageNumber i= mgmtInfo->extents->count;
+    PageNumber *list= (PageNumber*) mgmtInfo->extentList;
+    PageNumber pageNum;
+    RC rc;
+
+    // Last list page is full, chain a new one
+    if (i % perPage == 0)
+    {
+        if ((rc= allocatePage(&ts->fh, &pageNum)) != RC_OK)
+            return rc;
+        if (i)
+        {
+            list[0]= pageNum;
+            if ((rc= writeBlock(mgmtInfo->extentListPage, &ts->fh,
+                                mgmtInfo->extentList)) != RC_OK)
+                return rc;
+        }
+        else
+        {
+            pthread_mutex_lock(&ts->lock);
+            segmentEntry(ts, mgmtInfo->dirPage, mgmtInfo->dirSlot)->extentList= pageNum;
+            pthread_mutex_unlock(&ts->lock);
+        }
+        memset(list, 0, mgmtInfo->pageSize);
+        mgmtInfo->extentListPage= pageNum;
+    }
+
+    list[1 + i % perPage]= start;
+    return writeBlock(mgmtInfo->extentListPage, &ts->fh, mgmtInfo->extentList);
+}
+
+/* Segment version of growFile(), adds extents until pages [0, numPages)
+ * have their slots. Caller holds mgmtInfo->lock. */
+static RC growSegment(SM_FileMgmtInfo *mgmtInfo, PageNumber numPages)
+{
+    SM_Tablespace *ts= mgmtInfo->tablespace;
+    PageNumber numExtents= (SLOTS_END(mgmtInfo, numPages) + SM_SEGMENT_EXTENT_PAGES-1) /
+                           SM_SEGMENT_EXTENT_PAGES;
+    SM_ExtentArray *extents;
+    PageNumber start;
+    RC rc, dirRc;
+
+    if ((rc= reserveExtents(mgmtInfo, numExtents)) != RC_OK)
+        return rc;
+    extents= mgmtInfo->extents;
+
+    while (extents->count < numExtents)
+    {
+        if ((rc= allocateExtent(&ts->fh, &start)) != RC_OK)
+            break;
+        if ((rc= appendExtentList(mgmtInfo, start)) != RC_OK)
+        {
+            freeExtent(&ts->fh, start);
+            break;
+        }
+        // Slots of the new extent can be looked up from now
+        extents->start[extents->count]= start;
+        __atomic_store_n(&extents->count, extents->count+1, __ATOMIC_RELEASE);
+    }
+
+    // Extents added so far are the segment's, also if one failed
+    pthread_mutex_lock(&ts->lock);
+    segmentEntry(ts, mgmtInfo->dirPage, mgmtInfo->dirSlot)->numExtents= extents->count;
+    dirRc= writeDirPage(ts, mgmtInfo->dirPage);
+    pthread_mutex_unlock(&ts->lock);
+
+    __atomic_store_n(&mgmtInfo->allocPages,
+                     slotsToPages(mgmtInfo, extents->count * SM_SEGMENT_EXTENT_PAGES),
+                     __ATOMIC_RELEASE);
+    return (rc != RC_OK) ? rc : dirRc;
+}
+
+/* Create segment fileName, empty but for 1 zero page like a new page
+ * file. pageSize must be the tablespace's, or 0. */
+static RC createSegment(char *fileName, int pageSize)
+{
+    SM_Tablespace *ts;
+    SM_DirPageHeader *header;
+    SM_FileHandle fHandle;
+    char *tsName, *segName, *page;
+    int dirPage, dirSlot;
+    PageNumber pageNum;
+    RC rc;
+
+    if (!(segName= splitSegmentName(fileName, &tsName)))
+        RETURN(RC_FILE_CREATE_FAILED);
+    rc= acquireTablespace(tsName, SM_OPEN_DEFAULT, &ts);
+    free(tsName);
+    if (rc != RC_OK)
+        return rc;
+
+    pthread_mutex_lock(&ts->lock);
+    if (pageSize && pageSize != ts->fh.pageSize)
+        rc= set_errormsg(RC_INVALID_PAGE_SIZE);
+    else if (findSegment(ts, segName, &dirPage, &dirSlot))
+        rc= set_errormsg(RC_FILE_CREATE_FAILED);
+    else if (!findSegment(ts, "", &dirPage, &dirSlot) &&
+             (rc= allocatePage(&ts->fh, &pageNum)) == RC_OK &&
+             (rc= addDirPage(ts, pageNum, &page)) == RC_OK)
+    {
+        // Directory is full, chain another page
+        memcpy(((SM_DirPageHeader*) page)->magic, SM_DIR_MAGIC,
+               sizeof(((SM_DirPageHeader*) page)->magic));
+        dirPage= ts->numDirPages-1;
+        dirSlot= 0;
+        header= (SM_DirPageHeader*) (ts->dir + (size_t) (dirPage-1) * ts->fh.pageSize);
+        header->nextPage= pageNum;
+        if ((rc= writeDirPage(ts, dirPage)) == RC_OK)
+            rc= writeDirPage(ts, dirPage-1);
+    }
+    if (rc == RC_OK)
+    {
+        memset(segmentEntry(ts, dirPage, dirSlot), 0, sizeof(SM_SegmentEntry));
+        strcpy(segmentEntry(ts, dirPage, dirSlot)->name, segName);
+        rc= writeDirPage(ts, dirPage);
+    }
+    pthread_mutex_unlock(&ts->lock);
+
+    if (rc == RC_OK && (rc= openSegment(fileName, &fHandle, SM_OPEN_DEFAULT)) == RC_OK)
+    {
+        if ((rc= ensureCapacity(1, &fHandle)) == RC_OK)
+            rc= closePageFile(&fHandle);
+        else
+            closePageFile(&fHandle);
+    }
+
+    releaseTablespace(ts);
+    return rc;
+}
+
+/* Open segment fileName. The tablespace is opened too, unless it is
+ * open already, then flags are those it was opened with. */
+static RC openSegment(char *fileName, SM_FileHandle *fHandle, int flags)
+{
+    SM_FileMgmtInfo *mgmtInfo= NULL, *segment;
+    SM_Tablespace *ts;
+    char *tsName, *segName;
+    int dirPage, dirSlot;
+    RC rc= RC_OK;
+
+    if (!(segName= splitSegmentName(fileName, &tsName)))
+        RETURN(RC_FILE_NOT_FOUND);
+    rc= acquireTablespace(tsName, flags, &ts);
+    free(tsName);
+    if (rc != RC_OK)
+        return rc;
+
+    pthread_mutex_lock(&ts->lock);
+    if (!findSegment(ts, segName, &dirPage, &dirSlot))
+        rc= set_errormsg(RC_FILE_NOT_FOUND);
+
+    // One handle per segment, it keeps the extents and free space map
+    for (segment= ts->segments; segment && rc == RC_OK; segment= segment->nextSegment)
+        if (segment->dirPage == dirPage && segment->dirSlot == dirSlot)
+            rc= set_errormsg(RC_FILE_HANDLE_IN_USE);
+
+    if (rc == RC_OK &&
+        !(mgmtInfo= (SM_FileMgmtInfo*) calloc(1, sizeof(SM_FileMgmtInfo))))
+        rc= set_errormsg(RC_FILE_NOT_FOUND);
+
+    if (rc == RC_OK)
+    {
+        mgmtInfo->fd= ((SM_FileMgmtInfo*) ts->fh.mgmtInfo)->fd;
+        mgmtInfo->flags= ((SM_FileMgmtInfo*) ts->fh.mgmtInfo)->flags;
+        mgmtInfo->pageSize= ts->fh.pageSize;
+        mgmtInfo->groupPages= ((SM_FileMgmtInfo*) ts->fh.mgmtInfo)->groupPages;
+        mgmtInfo->checksums= ((SM_FileMgmtInfo*) ts->fh.mgmtInfo)->checksums;
+        mgmtInfo->extentPages= SM_SEGMENT_EXTENT_PAGES;
+        mgmtInfo->tablespace= ts;
+        mgmtInfo->dirPage= dirPage;
+        mgmtInfo->dirSlot= dirSlot;
+        pthread_mutex_init(&mgmtInfo->lock, NULL);
+        initSyncState(mgmtInfo, flags);
+
+        // Initialize the fHandle
+        fHandle->fileName= strdup(fileName);
+        fHandle->curPagePos= 0;
+        fHandle->pageSize= ts->fh.pageSize;
+        fHandle->totalNumPages= segmentEntry(ts, dirPage, dirSlot)->numPages;
+        fHandle->mgmtInfo= mgmtInfo;
+
+        if ((rc= loadExtentList(mgmtInfo, segmentEntry(ts, dirPage, dirSlot))) == RC_OK &&
+            (rc= registerFileHandle(fHandle)) == RC_OK)
+        {
+            mgmtInfo->nextSegment= ts->segments;
+            ts->segments= mgmtInfo;
+        }
+        else
+        {
+            pthread_mutex_destroy(&mgmtInfo->lock);
+            destroySyncState(mgmtInfo);
+            freeExtentArrays(mgmtInfo->extents);
+            free(mgmtInfo->extentList);
+            free(mgmtInfo);
+            fHandle->mgmtInfo= NULL;
+            free(fHandle->fileName);
+            fHandle->fileName= NULL;
+        }
+    }
+    pthread_mutex_unlock(&ts->lock);
+
+    if (rc != RC_OK)
+        releaseTablespace(ts);
+    return rc;
+}
+
+/* Write the segment's size to its directory entry, if it changed */
+static RC saveSegmentSize(SM_FileHandle *fHandle)
+{
+    SM_FileMgmtInfo *mgmtInfo= (SM_FileMgmtInfo*) fHandle->mgmtInfo;
+    SM_Tablespace *ts= mgmtInfo->tablespace;
+    SM_SegmentEntry *entry;
+    RC rc= RC_OK;
+
+    pthread_mutex_lock(&ts->lock);
+    entry= segmentEntry(ts, mgmtInfo->dirPage, mgmtInfo->dirSlot);
+    if (entry->numPages != fHandle->totalNumPages)
+    {
+        entry->numPages= fHandle->totalNumPages;
+        rc= writeDirPage(ts, mgmtInfo->dirPage);
+    }
+    pthread_mutex_unlock(&ts->lock);
+    return rc;
+}
+
+/* Save the segment's size, and let go of its tablespace. The rest of
+ * the handle is cleaned up by closePageFile(). */
+static RC closeSegment(SM_FileHandle *fHandle)
+{
+    SM_FileMgmtInfo *mgmtInfo= (SM_FileMgmtInfo*) fHandle->mgmtInfo;
+    SM_FileMgmtInfo **link;
+    SM_Tablespace *ts= mgmtInfo->tablespace;
+    RC rc, tsRc;
+
+    rc= saveSegmentSize(fHandle);
+    pthread_mutex_lock(&ts->lock);
+    for (link= &ts->segments; *link != mgmtInfo; link= &(*link)->nextSegment)
+        ;
+    *link= mgmtInfo->nextSegment;
+    pthread_mutex_unlock(&ts->lock);
+
+    freeExtentArrays(mgmtInfo->extents);
+    free(mgmtInfo->extentList);
+
+    tsRc= releaseTablespace(ts);
+    return (rc != RC_OK) ? rc : tsRc;
+}
+
+/* Give all pages of segment entry back to the tablespace. Caller holds
+ * ts->lock. */
+static RC freeSegmentPages(SM_Tablespace *ts, SM_SegmentEntry *entry)
+{
+    PageNumber perPage= LIST_EXTENTS(ts->fh.pageSize);
+    PageNumber listPage= entry->extentList, i;
+    PageNumber *list;
+    RC rc= RC_OK;
+
+    if (!entry->numExtents)
+        RETURN(RC_OK);
+    if (posix_memalign((void**) &list, SM_IO_ALIGN, ts->fh.pageSize))
+        RETURN(RC_READ_FAILED);
+
+    for (i=0; i<entry->numExtents && rc == RC_OK; i++)
+    {
+        if (i % perPage == 0)
+        {
+            // Previous list page is done with
+            if (i && (rc= freePage(listPage, &ts->fh)) == RC_OK)
+                listPage= list[0];
+            if (rc != RC_OK ||
+                (rc= readBlock(listPage, &ts->fh, (SM_PageHandle) list)) != RC_OK)
+                break;
+        }
+        rc= freeExtent(&ts->fh, list[1 + i % perPage]);
+    }
+    if (rc == RC_OK)
+        rc= freePage(listPage, &ts->fh);
+
+    free(list);
+    return rc;
+}
+
+/* Drop segment fileName, its extents are reused by other segments */
+static RC dropSegment(char *fileName)
+{
+    SM_FileMgmtInfo *segment;
+    SM_Tablespace *ts;
+    char *tsName, *segName;
+    int dirPage, dirSlot;
+    RC rc= RC_OK, tsRc;
+
+    if (!(segName= splitSegmentName(fileName, &tsName)))
+        RETURN(RC_FILE_DESTROY_FAILED);
+    rc= acquireTablespace(tsName, SM_OPEN_DEFAULT, &ts);
+    free(tsName);
+    if (rc != RC_OK)
+        return rc;
+
+    pthread_mutex_lock(&ts->lock);
+    if (!findSegment(ts, segName, &dirPage, &dirSlot))
+        rc= set_errormsg(RC_FILE_DESTROY_FAILED);
+    for (segment= ts->segments; segment && rc == RC_OK; segment= segment->nextSegment)
+        if (segment->dirPage == dirPage && segment->dirSlot == dirSlot)
+            rc= set_errormsg(RC_FILE_HANDLE_IN_USE);
+
+    if (rc == RC_OK &&
+        (rc= freeSegmentPages(ts, segmentEntry(ts, dirPage, dirSlot))) == RC_OK)
+    {
+        memset(segmentEntry(ts, dirPage, dirSlot), 0, sizeof(SM_SegmentEntry));
+        rc= writeDirPage(ts, dirPage);
+    }
+    pthread_mutex_unlock(&ts->lock);
+
+    tsRc= releaseTablespace(ts);
+    return (rc != RC_OK) ? rc : tsRc;
+}
+
+/* Create tablespace fileName, with pages of 'pageSize' bytes and no
+ * segments */
+RC createTablespace (char *fileName, int pageSize)
+{
+    SM_FileHandle fHandle;
+    SM_PageHandle page;
+    RC rc;
+
+    if ((rc= createPageFileWithPageSize(fileName, pageSize)) != RC_OK ||
+        (rc= openPageFile(fileName, &fHandle)) != RC_OK)
+        return rc;
+
+    // Page 0 is the first directory page
+    page= (SM_PageHandle) calloc(1, pageSize);
+    memcpy(((SM_DirPageHeader*) page)->magic, SM_DIR_MAGIC,
+           sizeof(((SM_DirPageHeader*) page)->magic));
+    rc= writeBlock(0, &fHandle, page);
+    free(page);
+
+    if (rc != RC_OK)
+    {
+        closePageFile(&fHandle);
+        return rc;
+    }
+    return closePageFile(&fHandle);
+}
+
+/* Keep tablespace fileName open until closeTablespace(), so opening
+ * and closing its segments costs no file open */
+RC openTablespace (char *fileName)
+{
+    SM_Tablespace *ts;
+    RC rc;
+
+    // Is storage manager initialized?
+    if (isStorageManagerInitialized() != RC_OK)
+        RETURN(RC_SM_NOT_INIT);
+
+    if ((rc= acquireTablespace(fileName, SM_OPEN_DEFAULT, &ts)) != RC_OK)
+        return rc;
+    // Our reference keeps ts open while dropping the older one
+    pthread_mutex_lock(&storageManager.tablespacesLock);
+    if (ts->keptOpen)
+        ts->refCount--;
+    ts->keptOpen= 1;
+    pthread_mutex_unlock(&storageManager.tablespacesLock);
+
+    RETURN(RC_OK);
+}
+
+/* Undo openTablespace(), the tablespace closes with its last segment */
+RC closeTablespace (char *fileName)
+{
+    SM_Tablespace *ts;
+
+    // Is storage manager initialized?
+    if (isStorageManagerInitialized() != RC_OK)
+        RETURN(RC_SM_NOT_INIT);
+
+    pthread_mutex_lock(&storageManager.tablespacesLock);
+    for (ts= storageManager.tablespaces; ts; ts= ts->next)
+        if (ts->keptOpen && !strcmp(ts->fileName, fileName))
+        {
+            // The kept reference is now ours to drop
+            ts->keptOpen= 0;
+            pthread_mutex_unlock(&storageManager.tablespacesLock);
+            return releaseTablespace(ts);
+        }
+    pthread_mutex_unlock(&storageManager.tablespacesLock);
+
+    RETURN(RC_FILE_HANDLE_NOT_INIT);
+}
@@ -6,39 +6,172 @@
 /************************************************************
  *                    handle data structures                *
  ************************************************************/
+/* 64 bit, page files can grow past 2GB */
+typedef long long PageNumber;
+
 typedef struct SM_FileHandle {
   char *fileName;
-  int totalNumPages;
-  int curPagePos;
+  PageNumber totalNumPages;
+  PageNumber curPagePos;
+  int pageSize;
   void *mgmtInfo;
 } SM_FileHandle;
 
 typedef char* SM_PageHandle;
 
+/* page file open modes, can be or'ed */
+#define SM_OPEN_DEFAULT 0x0
+#define SM_OPEN_MMAP    0x1 // Map the file, allows getBlockPtr()
+#define SM_OPEN_DIRECT  0x2 // Bypass kernel page cache (O_DIRECT), ignored
+                            // with SM_OPEN_MMAP. Buffers aligned to
+                            // SM_IO_ALIGN avoid an extra copy.
+#define SM_OPEN_SYNC    0x4 // SM_DURABILITY_SYNC, see syncPageFile()
+#define SM_OPEN_GROUP_COMMIT 0x8 // SM_DURABILITY_GROUP
+#define SM_OPEN_NO_VERIFY 0x10 // Skip page checksum checks on read
+#define SM_IO_ALIGN     4096
+
+/* page size is chosen per file at creation and kept in the file
+ * header, which takes the first SM_HEADER_SIZE bytes of the file.
+ * PAGE_SIZE is the default. */
+#define SM_MIN_PAGE_SIZE 4096
+#define SM_MAX_PAGE_SIZE 65536 // Powers of 2 in between
+#define SM_HEADER_SIZE   4096
+
 /************************************************************
  *                    interface                             *
  ************************************************************/
 /* manipulating page files */
 extern void initStorageManager (void);
 extern RC createPageFile (char *fileName);
+extern RC createPageFileWithPageSize (char *fileName, int pageSize);
 extern RC openPageFile (char *fileName, SM_FileHandle *fHandle);
+extern RC openPageFileWithFlags (char *fileName, SM_FileHandle *fHandle, int flags);
 extern RC closePageFile (SM_FileHandle *fHandle);
 extern RC destroyPageFile (char *fileName);
 
 /* reading blocks from disc */
-extern RC readBlock (int pageNum, SM_FileHandle *fHandle, SM_PageHandle memPage);
-extern int getBlockPos (SM_FileHandle *fHandle);
+extern RC readBlock (PageNumber pageNum, SM_FileHandle *fHandle, SM_PageHandle memPage);
+extern PageNumber getBlockPos (SM_FileHandle *fHandle);
 extern RC readFirstBlock (SM_FileHandle *fHandle, SM_PageHandle memPage);
 extern RC readPreviousBlock (SM_FileHandle *fHandle, SM_PageHandle memPage);
 extern RC readCurrentBlock (SM_FileHandle *fHandle, SM_PageHandle memPage);
 extern RC readNextBlock (SM_FileHandle *fHandle, SM_PageHandle memPage);
 extern RC readLastBlock (SM_FileHandle *fHandle, SM_PageHandle memPage);
 
+/* Run of 'count' consecutive pages, each into its own buffer.
+ * One vectored syscall moves up to 256 pages. */
+extern RC readBlocks (PageNumber startPage, int count, SM_FileHandle *fHandle, SM_PageHandle memPages[]);
+
+/* zero-copy page access, SM_OPEN_MMAP only */
+extern RC getBlockPtr (PageNumber pageNum, SM_FileHandle *fHandle, SM_PageHandle *pagePtr);
+
 /* writing blocks to a page file */
-extern RC writeBlock (int pageNum, SM_FileHandle *fHandle, SM_PageHandle memPage);
+extern RC writeBlock (PageNumber pageNum, SM_FileHandle *fHandle, SM_PageHandle memPage);
 extern RC writeCurrentBlock (SM_FileHandle *fHandle, SM_PageHandle memPage);
+extern RC writeBlocks (PageNumber startPage, int count, SM_FileHandle *fHandle, SM_PageHandle memPages[]);
 extern RC appendEmptyBlock (SM_FileHandle *fHandle);
-extern RC ensureCapacity (int numberOfPages, SM_FileHandle *fHandle);
+extern RC ensureCapacity (PageNumber numberOfPages, SM_FileHandle *fHandle);
+
+/* file growth. Files grow in extents preallocated with fallocate(),
+ * totalNumPages is the logical size within them. */
+#define SM_DEFAULT_EXTENT_PAGES 64 // 256KB
+extern RC setExtentSize (int extentPages, SM_FileHandle *fHandle);
+extern PageNumber getAllocatedNumPages (SM_FileHandle *fHandle); // -1 if not open
+
+/* page allocation. Freed pages are tracked in a free space map kept
+ * in the page file, allocatePage() reuses them before growing the file. */
+extern RC allocatePage (SM_FileHandle *fHandle, PageNumber *pageNum);
+extern RC freePage (PageNumber pageNum, SM_FileHandle *fHandle);
+extern int isPageFree (PageNumber pageNum, SM_FileHandle *fHandle);
+
+/* durability. Written pages reach the kernel, not the disk, until
+ * syncPageFile(). What that does depends on the handle's mode:
+ *   SM_DURABILITY_NONE  nothing, the default
+ *   SM_DURABILITY_SYNC  one fdatasync() per call
+ *   SM_DURABILITY_GROUP concurrent callers share one fdatasync(). The
+ *                       first waits groupWindowUsec for others to join
+ *                       if the last sync was shared, callers arriving
+ *                       during a sync share the next one.
+ * The buffer manager syncs after forcePage() and forceFlushPool().
+ * Segments sync their tablespace file, and save their size first. */
+#define SM_DURABILITY_NONE  0
+#define SM_DURABILITY_SYNC  1
+#define SM_DURABILITY_GROUP 2
+#define SM_DEFAULT_GROUP_WINDOW_USEC 100
+extern RC setDurability (SM_FileHandle *fHandle, int mode, int groupWindowUsec);
+extern RC syncPageFile (SM_FileHandle *fHandle);
+extern long long getNumSyncs (SM_FileHandle *fHandle); // fdatasync() calls
+
+/* compressed page files. Every page, free space map pages too, is
+ * stored LZ compressed in a record of its own, found through a page
+ * to offset table kept in the file. Callers read and write whole
+ * pages as usual. Such files are never mapped or opened for direct
+ * I/O, and can not hold tablespaces. */
+extern RC createCompressedPageFile (char *fileName, int pageSize);
+extern long long getStoredBytes (SM_FileHandle *fHandle); // -1 if not compressed
+
+/* access pattern hints, passed to the kernel (posix_fadvise(), and
+ * madvise() for mapped handles) to steer its readahead:
+ *   SM_ACCESS_NORMAL     default readahead
+ *   SM_ACCESS_SEQUENTIAL pages are read in order, e.g. table scans,
+ *                        the kernel reads further ahead
+ *   SM_ACCESS_RANDOM     point lookups, no readahead
+ *   SM_ACCESS_WILLNEED   read the pages in now, in the background
+ *   SM_ACCESS_DONTNEED   the pages may leave the page cache
+ * setAccessPattern() takes the first three for the whole file,
+ * adviseBlocks() any of them for a range of pages. */
+#define SM_ACCESS_NORMAL     0
+#define SM_ACCESS_SEQUENTIAL 1
+#define SM_ACCESS_RANDOM     2
+#define SM_ACCESS_WILLNEED   3
+#define SM_ACCESS_DONTNEED   4
+extern RC setAccessPattern (SM_FileHandle *fHandle, int pattern);
+extern RC adviseBlocks (PageNumber startPage, int count, SM_FileHandle *fHandle, int pattern);
+
+/* page checksums. Page files keep a CRC32C of every page in their
+ * free space map pages. Writes update it, reads check it and fail
+ * with RC_CHECKSUM_MISMATCH if the page changed on disk, unless the
+ * handle was opened with SM_OPEN_NO_VERIFY. Pages handed out by
+ * getBlockPtr() are not checked until written again, nor are files
+ * created before checksums. Several
+ * handles may read a file, but one should write it. Checksums go to
+ * disk on syncPageFile() and close, other handles see them then, and
+ * after a crash pages written since may fail their check. */
+extern long long getChecksumFailures (SM_FileHandle *fHandle); // NULL: all files
+
+/* tablespaces. A tablespace is one page file holding many segments,
+ * each used like a page file of its own: "<tablespace>:<segment>" as
+ * fileName to createPageFile(), openPageFile() and destroyPageFile()
+ * names a segment, so tables and indexes can be created in it too.
+ * Segments share the tablespace's fd and page size, and grow by
+ * extents of SM_SEGMENT_EXTENT_PAGES tablespace pages, listed in a
+ * segment directory. A segment's size is saved when it is closed.
+ * While a tablespace is kept open by openTablespace(), opening its
+ * segments costs no file open. */
+#define SM_SEGMENT_SEP          ':'
+#define SM_MAX_SEGMENT_NAME     64 // Including the terminating 0
+#define SM_SEGMENT_EXTENT_PAGES 16 // Multiple of 8
+extern RC createTablespace (char *fileName, int pageSize);
+extern RC openTablespace (char *fileName);
+extern RC closeTablespace (char *fileName);
+
+/* asynchronous I/O, backed by io_uring or a thread pool.
+ * Submit returns a ticket, memPages must stay valid until the ticket
+ * is collected with pollAsyncIO() or waitAsyncIO(). */
+typedef struct SM_AsyncQueue SM_AsyncQueue;
+typedef int SM_AsyncTicket;
+
+#define SM_ASYNC_DEFAULT    0x0
+#define SM_ASYNC_THREADS    0x1 // Use the thread pool even if io_uring works
+#define SM_ASYNC_MAX_PAGES  64  // Largest run per request
+
+extern RC initAsyncQueue (SM_AsyncQueue **queue, int depth, int flags);
+extern RC shutdownAsyncQueue (SM_AsyncQueue *queue);
+extern int isAsyncQueueUring (SM_AsyncQueue *queue);
+extern RC submitReadBlocks (SM_AsyncQueue *queue, PageNumber startPage, int count, SM_FileHandle *fHandle, SM_PageHandle memPages[], SM_AsyncTicket *ticket);
+extern RC submitWriteBlocks (SM_AsyncQueue *queue, PageNumber startPage, int count, SM_FileHandle *fHandle, SM_PageHandle memPages[], SM_AsyncTicket *ticket);
+extern RC pollAsyncIO (SM_AsyncQueue *queue, SM_AsyncTicket ticket, RC *result);
+extern RC waitAsyncIO (SM_AsyncQueue *queue, SM_AsyncTicket ticket);
 
 /* Supporting miscelleneous functions */
 extern RC isStorageManagerInitialized(void);
@@ -0,0 +1,543 @@
+#define _GNU_SOURCE
+#include <storage_mgr.h>
+#include <storage_mgr_io.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+/*
+ * Asynchronous page I/O
+ *
+ * A queue has 'depth' request slots. submitReadBlocks()/
+ * submitWriteBlocks() take a free slot and hand the request to the
+ * backend, the returned ticket names that slot. pollAsyncIO()/
+ * waitAsyncIO() return the result and free the slot again.
+ *
+ * Backends:
+ * 1) io_uring, talking to the kernel with raw syscalls. Requests go
+ *    into the submission ring as READV/WRITEV, completions are reaped
+ *    from the completion ring by whichever thread waits.
+ * 2) Thread pool, used when io_uring is not available (old kernel,
+ *    seccomp) or SM_ASYNC_THREADS is asked for. Workers do the same
+ *    transfers with preadv()/pwritev().
+ *
+ * Handles that can not do raw I/O (mapped files) complete at submit.
+ */
+
+#define MAX_ASYNC_DEPTH     4096  // Slot number must fit TICKET_SLOT_BITS
+#define TICKET_SLOT_BITS    12
+#define TICKET_SLOT(t)      ((t) & ((1 << TICKET_SLOT_BITS)-1))
+#define TICKET_GEN(t)       ((unsigned int)(t) >> TICKET_SLOT_BITS)
+#define MAKE_TICKET(s, g)   ((int) (((g) << TICKET_SLOT_BITS) | (s)))
+#define GEN_MASK            0x7ffff // Keeps tickets positive
+#define ASYNC_THREADS       4
+#define NO_SLOT             -1
+
+typedef struct SM_AsyncRequest {
+    int inUse;
+    int done;
+    unsigned int gen;  // Bumped on every reuse, tickets carry it
+    RC rc;
+
+    int write;
+    PageNumber startPage;
+    int count;
+    SM_FileHandle *fHandle;
+    SM_PageHandle pages[SM_ASYNC_MAX_PAGES];
+    struct iovec iov[SM_ASYNC_MAX_PAGES];
+    int fd;            // From startRawIO()
+    off_t offset;
+
+    int next; // Free list, or thread pool FIFO
+} SM_AsyncRequest;
+
+typedef struct SM_Uring {
+    int fd;
+    void *sqRing, *cqRing;
+    size_t sqRingSize, cqRingSize;
+    struct io_uring_sqe *sqes;
+    size_t sqesSize;
+
+    unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+    unsigned *cqHead, *cqTail, *cqMask;
+    struct io_uring_cqe *cqes;
+} SM_Uring;
+
+struct SM_AsyncQueue {
+    int depth;
+    SM_AsyncRequest *reqs;
+    int freeList;
+
+    pthread_mutex_t lock;
+    pthread_cond_t done;    // Signalled when requests complete
+
+    // io_uring backend
+    int useUring;
+    int reaping;            // A thread is waiting in io_uring_enter()
+    SM_Uring ring;
+
+    // Thread pool backend
+    pthread_t workers[ASYNC_THREADS];
+    int numWorkers;
+    int pendHead, pendTail; // FIFO of submitted requests
+    pthread_cond_t pending;
+    int stopping;
+};
+
+// Handy lock macros
+#define AQ_LOCK()   pthread_mutex_lock(&queue->lock);
+#define AQ_UNLOCK() pthread_mutex_unlock(&queue->lock);
+
+/**************************************************
+ * io_uring backend
+ */
+static int uringSetup(unsigned entries, struct io_uring_params *p)
+{
+    return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uringEnter(int fd, unsigned toSubmit, unsigned minComplete,
+                      unsigned flags)
+{
+    return (int) syscall(__NR_io_uring_enter, fd, toSubmit, minComplete,
+                         flags, NULL, 0);
+}
+
+static void closeUring(SM_Uring *ring)
+{
+    if (ring->sqes)
+        munmap(ring->sqes, ring->sqesSize);
+    if (ring->cqRing && ring->cqRing != ring->sqRing)
+        munmap(ring->cqRing, ring->cqRingSize);
+    if (ring->sqRing)
+        munmap(ring->sqRing, ring->sqRingSize);
+    if (ring->fd >= 0)
+        close(ring->fd);
+    memset(ring, 0, sizeof(SM_Uring));
+    ring->fd= -1;
+}
+
+// Returns 0 if the ring is ready
+static int openUring(SM_Uring *ring, int depth)
+{
+    struct io_uring_params p;
+    char *sq, *cq;
+
+    memset(ring, 0, sizeof(SM_Uring));
+    memset(&p, 0, sizeof(p));
+    if ((ring->fd= uringSetup(depth, &p)) < 0)
+        return -1;
+
+    // Map submission ring, completion ring and SQE array
+    ring->sqRingSize= p.sq_off.array + p.sq_entries*sizeof(unsigned);
+    ring->cqRingSize= p.cq_off.cqes + p.cq_entries*sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (ring->cqRingSize > ring->sqRingSize)
+            ring->sqRingSize= ring->cqRingSize;
+        ring->cqRingSize= ring->sqRingSize;
+    }
+    ring->sqRing= mmap(NULL, ring->sqRingSize, PROT_READ|PROT_WRITE,
+                       MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sqRing == MAP_FAILED)
+    {
+        ring->sqRing= NULL;
+        closeUring(ring);
+        return -1;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        ring->cqRing= ring->sqRing;
+    else
+    {
+        ring->cqRing= mmap(NULL, ring->cqRingSize, PROT_READ|PROT_WRITE,
+                           MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cqRing == MAP_FAILED)
+        {
+            ring->cqRing= NULL;
+            closeUring(ring);
+            return -1;
+        }
+    }
+    ring->sqesSize= p.sq_entries*sizeof(struct io_uring_sqe);
+    ring->sqes= mmap(NULL, ring->sqesSize, PROT_READ|PROT_WRITE,
+                     MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED)
+    {
+        ring->sqes= NULL;
+        closeUring(ring);
+        return -1;
+    }
+
+    sq= (char*) ring->sqRing;
+    cq= (char*) ring->cqRing;
+    ring->sqHead= (unsigned*) (sq + p.sq_off.head);
+    ring->sqTail= (unsigned*) (sq + p.sq_off.tail);
+    ring->sqMask= (unsigned*) (sq + p.sq_off.ring_mask);
+    ring->sqArray= (unsigned*) (sq + p.sq_off.array);
+    ring->cqHead= (unsigned*) (cq + p.cq_off.head);
+    ring->cqTail= (unsigned*) (cq + p.cq_off.tail);
+    ring->cqMask= (unsigned*) (cq + p.cq_off.ring_mask);
+    ring->cqes= (struct io_uring_cqe*) (cq + p.cq_off.cqes);
+
+    return 0;
+}
+
+// Queue one READV/WRITEV. Caller holds queue lock. Outstanding
+// requests never exceed depth, so the submission ring has room.
+static int uringSubmit(SM_Uring *ring, int slot, int write, int fd,
+                       struct iovec *iov, int iovcnt, off_t offset)
+{
+    unsigned tail= *ring->sqTail;
+    unsigned idx= tail & *ring->sqMask;
+    struct io_uring_sqe *sqe= &ring->sqes[idx];
+    int rc;
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode= write ? IORING_OP_WRITEV : IORING_OP_READV;
+    sqe->fd= fd;
+    sqe->addr= (unsigned long) iov;
+    sqe->len= iovcnt;
+    sqe->off= offset;
+    sqe->user_data= slot;
+    ring->sqArray[idx]= idx;
+    __atomic_store_n(ring->sqTail, tail+1, __ATOMIC_RELEASE);
+
+    while ((rc= uringEnter(ring->fd, 1, 0, 0)) < 0 && errno == EINTR)
+        ;
+    return (rc == 1) ? 0 : -1;
+}
+
+// Complete a request, caller holds queue lock. Failed ones finish
+// too, written pages get their checksums then.
+static void completeRequest(SM_AsyncQueue *queue, SM_AsyncRequest *req, RC rc)
+{
+    req->rc= finishRawIO(req->fHandle, req->startPage, req->count, req->write,
+                         req->pages, rc != RC_OK);
+    req->done= 1;
+}
+
+// Move finished requests from the completion ring into their slots.
+// Caller holds queue lock.
+static void uringReap(SM_AsyncQueue *queue)
+{
+    SM_Uring *ring= &queue->ring;
+    unsigned head= *ring->cqHead;
+    unsigned tail= __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE);
+    struct io_uring_cqe *cqe;
+    SM_AsyncRequest *req;
+
+    for (; head != tail; head++)
+    {
+        cqe= &ring->cqes[head & *ring->cqMask];
+        req= &queue->reqs[cqe->user_data];
+        // Short transfer is only possible past end of file
+        if (cqe->res != req->count*req->fHandle->pageSize)
+            completeRequest(queue, req,
+                            req->write ? RC_WRITE_FAILED : RC_READ_FAILED);
+        else
+            completeRequest(queue, req, RC_OK);
+    }
+    __atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&queue->done);
+}
+
+/**************************************************
+ * Thread pool backend
+ */
+static void *asyncWorker(void *arg)
+{
+    SM_AsyncQueue *queue= (SM_AsyncQueue*) arg;
+    SM_AsyncRequest *req;
+    ssize_t n;
+    int slot;
+
+    AQ_LOCK();
+    while (1)
+    {
+        while (queue->pendHead == NO_SLOT && !queue->stopping)
+            pthread_cond_wait(&queue->pending, &queue->lock);
+        if (queue->pendHead == NO_SLOT)
+            break;
+
+        // Take oldest request
+        slot= queue->pendHead;
+        req= &queue->reqs[slot];
+        queue->pendHead= req->next;
+        if (queue->pendHead == NO_SLOT)
+            queue->pendTail= NO_SLOT;
+        AQ_UNLOCK();
+
+        if (req->write)
+            n= pwritev(req->fd, req->iov, req->count, req->offset);
+        else
+            n= preadv(req->fd, req->iov, req->count, req->offset);
+
+        // Short transfer is only possible past end of file
+        AQ_LOCK();
+        if (n != (ssize_t) req->count*req->fHandle->pageSize)
+            completeRequest(queue, req, req->write ? RC_WRITE_FAILED : RC_READ_FAILED);
+        else
+            completeRequest(queue, req, RC_OK);
+        pthread_cond_broadcast(&queue->done);
+    }
+    AQ_UNLOCK();
+
+    return NULL;
+}
+
+/**************************************************
+ * Interface
+ */
+RC initAsyncQueue (SM_AsyncQueue **queuePtr, int depth, int flags)
+{
+    SM_AsyncQueue *queue;
+    int i;
+
+    if (isStorageManagerInitialized() != RC_OK)
+        RETURN(RC_SM_NOT_INIT);
+    if (depth < 1)
+        depth= 1;
+    if (depth > MAX_ASYNC_DEPTH)
+        depth= MAX_ASYNC_DEPTH;
+
+    queue= (SM_AsyncQueue*) malloc(sizeof(SM_AsyncQueue));
+    memset(queue, 0, sizeof(SM_AsyncQueue));
+    queue->depth= depth;
+    queue->reqs= (SM_AsyncRequest*) malloc(depth*sizeof(SM_AsyncRequest));
+    memset(queue->reqs, 0, depth*sizeof(SM_AsyncRequest));
+    for (i=0; i<depth; i++)
+        queue->reqs[i].next= (i+1 < depth) ? i+1 : NO_SLOT;
+    queue->freeList= 0;
+    queue->pendHead= queue->pendTail= NO_SLOT;
+    queue->ring.fd= -1;
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->done, NULL);
+    pthread_cond_init(&queue->pending, NULL);
+
+    // Prefer io_uring, else start the workers
+    if (!(flags & SM_ASYNC_THREADS) && openUring(&queue->ring, depth) == 0)
+        queue->useUring= 1;
+    else
+    {
+        for (i=0; i<ASYNC_THREADS; i++)
+            if (pthread_create(&queue->workers[i], NULL, asyncWorker, queue) == 0)
+                queue->numWorkers++;
+        if (!queue->numWorkers)
+        {
+            shutdownAsyncQueue(queue);
+            RETURN(RC_ASYNC_INIT_FAILED);
+        }
+    }
+
+    *queuePtr= queue;
+    RETURN(RC_OK);
+}
+
+RC shutdownAsyncQueue (SM_AsyncQueue *queue)
+{
+    int i;
+
+    // Let outstanding requests finish
+    for (i=0; i<queue->depth; i++)
+        if (queue->reqs[i].inUse)
+            waitAsyncIO(queue, MAKE_TICKET(i, queue->reqs[i].gen));
+
+    AQ_LOCK();
+    queue->stopping= 1;
+    pthread_cond_broadcast(&queue->pending);
+    AQ_UNLOCK();
+    for (i=0; i<queue->numWorkers; i++)
+        pthread_join(queue->workers[i], NULL);
+
+    if (queue->useUring)
+        closeUring(&queue->ring);
+    pthread_cond_destroy(&queue->pending);
+    pthread_cond_destroy(&queue->done);
+    pthread_mutex_destroy(&queue->lock);
+    free(queue->reqs);
+    free(queue);
+
+    RETURN(RC_OK);
+}
+
+int isAsyncQueueUring (SM_AsyncQueue *queue)
+{
+    return queue->useUring;
+}
+
+static RC submitRun(SM_AsyncQueue *queue, int write, PageNumber startPage, int count,
+                    SM_FileHandle *fHandle, SM_PageHandle memPages[],
+                    SM_AsyncTicket *ticket)
+{
+    SM_AsyncRequest *req;
+    int slot, fd, i;
+    off_t offset;
+    RC rc;
+
+    if (count < 1 || count > SM_ASYNC_MAX_PAGES)
+        RETURN(RC_READ_NON_EXISTING_PAGE);
+
+    // Validate now, so errors show up at submit time
+    rc= startRawIO(fHandle, startPage, count, write, memPages, &fd, &offset);
+    if (rc != RC_OK)
+        return rc;
+
+    AQ_LOCK();
+    if ((slot= queue->freeList) == NO_SLOT)
+    {
+        AQ_UNLOCK();
+        RETURN(RC_ASYNC_QUEUE_FULL);
+    }
+    req= &queue->reqs[slot];
+    queue->freeList= req->next;
+
+    req->inUse= 1;
+    req->done= 0;
+    req->gen= (req->gen+1) & GEN_MASK;
+    req->write= write;
+    req->startPage= startPage;
+    req->count= count;
+    req->fHandle= fHandle;
+    req->fd= fd;
+    req->offset= offset;
+    for (i=0; i<count; i++)
+    {
+        req->pages[i]= memPages[i];
+        req->iov[i].iov_base= memPages[i];
+        req->iov[i].iov_len= fHandle->pageSize;
+    }
+    req->next= NO_SLOT;
+    *ticket= MAKE_TICKET(slot, req->gen);
+
+    if (fd < 0)
+    {
+        // No raw I/O for this handle, do it right away
+        AQ_UNLOCK();
+        rc= write ? writeBlocks(startPage, count, fHandle, req->pages)
+                  : readBlocks(startPage, count, fHandle, req->pages);
+        AQ_LOCK();
+        req->rc= rc;
+        req->done= 1;
+    }
+    else if (queue->useUring)
+    {
+        if (uringSubmit(&queue->ring, slot, write, fd, req->iov, count, offset))
+            completeRequest(queue, req, write ? RC_WRITE_FAILED : RC_READ_FAILED);
+    }
+    else
+    {
+        // Hand to worker threads
+        if (queue->pendTail == NO_SLOT)
+            queue->pendHead= slot;
+        else
+            queue->reqs[queue->pendTail].next= slot;
+        queue->pendTail= slot;
+        pthread_cond_signal(&queue->pending);
+    }
+    AQ_UNLOCK();
+
+    RETURN(RC_OK);
+}
+
+RC submitReadBlocks (SM_AsyncQueue *queue, PageNumber startPage, int count,
+                     SM_FileHandle *fHandle, SM_PageHandle memPages[],
+                     SM_AsyncTicket *ticket)
+{
+    return submitRun(queue, 0, startPage, count, fHandle, memPages, ticket);
+}
+
+RC submitWriteBlocks (SM_AsyncQueue *queue, PageNumber startPage, int count,
+                      SM_FileHandle *fHandle, SM_PageHandle memPages[],
+                      SM_AsyncTicket *ticket)
+{
+    return submitRun(queue, 1, startPage, count, fHandle, memPages, ticket);
+}
+
+// Slot of a live ticket, or NO_SLOT. Caller holds queue lock.
+static int ticketSlot(SM_AsyncQueue *queue, SM_AsyncTicket ticket)
+{
+    int slot= TICKET_SLOT(ticket);
+
+    if (ticket < 0 || slot >= queue->depth || !queue->reqs[slot].inUse ||
+        queue->reqs[slot].gen != TICKET_GEN(ticket))
+        return NO_SLOT;
+    return slot;
+}
+
+// Hand back result and free the slot. Caller holds queue lock.
+static RC retireRequest(SM_AsyncQueue *queue, int slot)
+{
+    SM_AsyncRequest *req= &queue->reqs[slot];
+
+    req->inUse= 0;
+    req->next= queue->freeList;
+    queue->freeList= slot;
+    return req->rc;
+}
+
+RC pollAsyncIO (SM_AsyncQueue *queue, SM_AsyncTicket ticket, RC *result)
+{
+    int slot;
+
+    AQ_LOCK();
+    if ((slot= ticketSlot(queue, ticket)) == NO_SLOT)
+    {
+        AQ_UNLOCK();
+        RETURN(RC_ASYNC_INVALID_TICKET);
+    }
+
+    // Pick up whatever the kernel has finished, without blocking
+    if (queue->useUring && !queue->reaping)
+        uringReap(queue);
+
+    if (!queue->reqs[slot].done)
+    {
+        AQ_UNLOCK();
+        RETURN(RC_ASYNC_PENDING);
+    }
+    *result= retireRequest(queue, slot);
+    AQ_UNLOCK();
+
+    RETURN(RC_OK);
+}
+
+RC waitAsyncIO (SM_AsyncQueue *queue, SM_AsyncTicket ticket)
+{
+    int slot;
+    RC rc;
+
+    AQ_LOCK();
+    if ((slot= ticketSlot(queue, ticket)) == NO_SLOT)
+    {
+        AQ_UNLOCK();
+        RETURN(RC_ASYNC_INVALID_TICKET);
+    }
+
+    while (!queue->reqs[slot].done)
+    {
+        if (queue->useUring && !queue->reaping)
+        {
+            // Become the reaper, block in the kernel without the lock
+            queue->reaping= 1;
+            AQ_UNLOCK();
+            while (uringEnter(queue->ring.fd, 0, 1, IORING_ENTER_GETEVENTS) < 0
+                   && errno == EINTR)
+                ;
+            AQ_LOCK();
+            queue->reaping= 0;
+            uringReap(queue);
+        }
+        else
+            pthread_cond_wait(&queue->done, &queue->lock);
+    }
+    rc= retireRequest(queue, slot);
+    AQ_UNLOCK();
+
+    return rc;
+}
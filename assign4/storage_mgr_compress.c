@@ -0,0 +1,415 @@
+#define _GNU_SOURCE
+#include <storage_mgr.h>
+#include <storage_mgr_io.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "lz_codec.h"
+
+/*
+ * Compressed slot store
+ *
+ * A compressed page file keeps the slots of a plain page file (pages
+ * and free space map pages alike) but stores each one compressed, in
+ * a record of its own anywhere after the header. Records take whole
+ * SLOT_UNITs. The slot table maps slot numbers to records; it is a
+ * chain of table pages, the first right after the header:
+ *   [header][table 0][records and further table pages...]
+ * Table page t holds the entries of slots [t*E, (t+1)*E), E=
+ * TABLE_ENTRIES(). An entry with no record reads as a zero page.
+ *
+ * A slot is rewritten in place when its record is big enough, else it
+ * moves to a new record and the old one becomes free space. Free
+ * space is only tracked in memory, in a list per record size, and is
+ * found again on open as the gaps between records.
+ */
+
+#define SLOT_UNIT            256
+#define SLOT_TABLE_MAGIC     "DBSLOTT"
+#define TABLE_ENTRIES(pageSize) ((PageNumber) ((pageSize) / sizeof(SM_SlotEntry)) - 1)
+#define ROUND_UP(n, m)       ((((n)+(m)-1) / (m)) * (m))
+
+typedef struct SM_SlotEntry {
+  long long offset;  // Record in the file, 0 if none
+  int length;        // Stored bytes, pageSize if stored uncompressed
+  int capacity;      // Record size, multiple of SLOT_UNIT
+} SM_SlotEntry;
+
+// Table page starts with this, in place of entry 0
+typedef struct SM_SlotTableHeader {
+  long long next;    // Next table page, 0 ends the chain
+  char magic[8];
+} SM_SlotTableHeader;
+
+typedef struct SM_FreeList {
+  off_t *offsets;
+  int count, capacity;
+} SM_FreeList;
+
+struct SM_SlotStore {
+  int fd;
+  int pageSize;
+  // Guards everything below. Record I/O is done under it, a record
+  // may move and be reused by another write otherwise.
+  pthread_mutex_t lock;
+  SM_SlotEntry *slots;  // numTablePages * TABLE_ENTRIES()
+  off_t *tablePages;
+  PageNumber numTablePages, tableCapacity;
+  PageNumber usedSlots; // Slots below this one may have a record
+  off_t fileEnd;        // New records go here
+  long long storedBytes;
+  SM_FreeList *freeLists; // Index is record size in SLOT_UNITs
+  int numFreeLists;
+};
+
+/* Give back record space at offset, in pieces no larger than a page */
+static int freeSpace(SM_SlotStore *store, off_t offset, off_t size)
+{
+    SM_FreeList *list;
+    off_t piece;
+
+    // Space at the end is appended to again
+    if (offset + size == store->fileEnd)
+    {
+        store->fileEnd= offset;
+        return 0;
+    }
+
+    for (; size > 0; offset+= piece, size-= piece)
+    {
+        piece= size < store->pageSize ? size : store->pageSize;
+        list= &store->freeLists[piece / SLOT_UNIT];
+        if (list->count == list->capacity)
+        {
+            off_t *offsets= (off_t*) realloc(list->offsets,
+                              (list->capacity*2 + 16) * sizeof(off_t));
+            if (!offsets)
+                return -1;
+            list->offsets= offsets;
+            list->capacity= list->capacity*2 + 16;
+        }
+        list->offsets[list->count++]= offset;
+    }
+    return 0;
+}
+
+/* Record space of 'size' bytes, the smallest free piece that fits,
+ * else at the end of the file. A larger piece is split. */
+static off_t allocSpace(SM_SlotStore *store, int size)
+{
+    SM_FreeList *list;
+    off_t offset;
+    int units= size / SLOT_UNIT, k;
+
+    for (k= units; k < store->numFreeLists; k++)
+    {
+        list= &store->freeLists[k];
+        if (!list->count)
+            continue;
+        offset= list->offsets[--list->count];
+        if (k > units)
+            freeSpace(store, offset + size, (off_t) (k - units) * SLOT_UNIT);
+        return offset;
+    }
+
+    offset= store->fileEnd;
+    store->fileEnd+= size;
+    return offset;
+}
+
+/* Make room for the entries of numTablePages table pages */
+static int growSlotArrays(SM_SlotStore *store, PageNumber numTablePages)
+{
+    PageNumber perPage= TABLE_ENTRIES(store->pageSize);
+    SM_SlotEntry *slots;
+    off_t *tablePages;
+
+    if (numTablePages <= store->tableCapacity)
+        return 0;
+    if (numTablePages < 2 * store->tableCapacity)
+        numTablePages= 2 * store->tableCapacity;
+    slots= (SM_SlotEntry*) realloc(store->slots,
+                                   numTablePages * perPage * sizeof(SM_SlotEntry));
+    if (slots)
+        store->slots= slots;
+    tablePages= (off_t*) realloc(store->tablePages, numTablePages * sizeof(off_t));
+    if (tablePages)
+        store->tablePages= tablePages;
+    if (!slots || !tablePages)
+        return -1;
+    memset(slots + store->tableCapacity * perPage, 0,
+           (numTablePages - store->tableCapacity) * perPage * sizeof(SM_SlotEntry));
+    store->tableCapacity= numTablePages;
+    return 0;
+}
+
+/* Empty slot table page at offset, linked to nothing */
+static int writeEmptyTablePage(int fd, int pageSize, off_t offset)
+{
+    char *page= (char*) calloc(1, pageSize);
+    SM_SlotTableHeader *header= (SM_SlotTableHeader*) page;
+    int failed;
+
+    if (!page)
+        return -1;
+    memcpy(header->magic, SLOT_TABLE_MAGIC, sizeof(header->magic));
+    failed= pwrite(fd, page, pageSize, offset) != pageSize;
+    free(page);
+    return failed ? -1 : 0;
+}
+
+/* Add table pages until 'slot' has an entry */
+static RC growSlotTable(SM_SlotStore *store, PageNumber slot)
+{
+    PageNumber perPage= TABLE_ENTRIES(store->pageSize);
+    long long offset;
+
+    while (slot >= store->numTablePages * perPage)
+    {
+        if (growSlotArrays(store, store->numTablePages + 1))
+            RETURN(RC_WRITE_FAILED);
+
+        // Written before it is linked, so the chain is never broken
+        offset= allocSpace(store, store->pageSize);
+        if (writeEmptyTablePage(store->fd, store->pageSize, offset) ||
+            pwrite(store->fd, &offset, sizeof(offset),
+                   store->tablePages[store->numTablePages-1]) != sizeof(offset))
+        {
+            freeSpace(store, offset, store->pageSize);
+            RETURN(RC_WRITE_FAILED);
+        }
+        store->tablePages[store->numTablePages++]= offset;
+    }
+    RETURN(RC_OK);
+}
+
+static int compareRecords(const void *a, const void *b)
+{
+    const SM_SlotEntry *ra= (const SM_SlotEntry*) a, *rb= (const SM_SlotEntry*) b;
+    return (ra->offset > rb->offset) - (ra->offset < rb->offset);
+}
+
+/* Free space is what lies between records and table pages */
+static RC findFreeSpace(SM_SlotStore *store)
+{
+    PageNumber n= 0, i;
+    SM_SlotEntry *records;
+    off_t end= SM_HEADER_SIZE;
+
+    records= (SM_SlotEntry*) malloc((store->usedSlots + store->numTablePages) *
+                                    sizeof(SM_SlotEntry));
+    if (!records)
+        RETURN(RC_READ_FAILED);
+    for (i= 0; i < store->usedSlots; i++)
+        if (store->slots[i].capacity)
+            records[n++]= store->slots[i];
+    for (i= 0; i < store->numTablePages; i++)
+    {
+        records[n].offset= store->tablePages[i];
+        records[n++].capacity= store->pageSize;
+    }
+    qsort(records, n, sizeof(SM_SlotEntry), compareRecords);
+
+    for (i= 0; i < n; i++)
+    {
+        if (records[i].offset > end)
+            freeSpace(store, end, records[i].offset - end);
+        if (records[i].offset + records[i].capacity > end)
+            end= records[i].offset + records[i].capacity;
+    }
+    if (end > store->fileEnd)
+        store->fileEnd= end;
+    else if (store->fileEnd > end)
+        freeSpace(store, end, store->fileEnd - end);
+
+    free(records);
+    RETURN(RC_OK);
+}
+
+static void freeSlotStore(SM_SlotStore *store)
+{
+    int k;
+
+    if (store->freeLists)
+        for (k= 0; k < store->numFreeLists; k++)
+            free(store->freeLists[k].offsets);
+    free(store->freeLists);
+    free(store->slots);
+    free(store->tablePages);
+    free(store);
+}
+
+/************************************************************
+ *                    interface                             *
+ ************************************************************/
+RC createSlotStore (int fd, int pageSize)
+{
+    if (writeEmptyTablePage(fd, pageSize, SM_HEADER_SIZE))
+        RETURN(RC_WRITE_FAILED);
+    RETURN(RC_OK);
+}
+
+RC openSlotStore (int fd, int pageSize, SM_SlotStore **slotStore)
+{
+    PageNumber perPage= TABLE_ENTRIES(pageSize), i;
+    SM_SlotStore *store;
+    SM_SlotTableHeader *header;
+    struct stat st;
+    char *page;
+    off_t offset= SM_HEADER_SIZE;
+    RC rc= RC_OK;
+
+    if (fstat(fd, &st) < 0 || !(page= (char*) malloc(pageSize)))
+        RETURN(RC_READ_FAILED);
+    if (!(store= (SM_SlotStore*) calloc(1, sizeof(SM_SlotStore))))
+    {
+        free(page);
+        RETURN(RC_READ_FAILED);
+    }
+    store->fd= fd;
+    store->pageSize= pageSize;
+    store->fileEnd= st.st_size;
+    store->numFreeLists= pageSize / SLOT_UNIT + 1;
+    store->freeLists= (SM_FreeList*) calloc(store->numFreeLists, sizeof(SM_FreeList));
+    header= (SM_SlotTableHeader*) page;
+
+    // Load the chain of table pages
+    while (offset && rc == RC_OK)
+    {
+        if (!store->freeLists || growSlotArrays(store, store->numTablePages + 1) ||
+            pread(fd, page, pageSize, offset) != pageSize)
+            rc= set_errormsg(RC_READ_FAILED);
+        else if (memcmp(header->magic, SLOT_TABLE_MAGIC, sizeof(header->magic)))
+            rc= set_errormsg(RC_BAD_PAGE_FILE);
+        else
+        {
+            memcpy(store->slots + store->numTablePages * perPage,
+                   page + sizeof(SM_SlotEntry), perPage * sizeof(SM_SlotEntry));
+            store->tablePages[store->numTablePages++]= offset;
+            offset= header->next;
+        }
+    }
+    free(page);
+
+    for (i= store->numTablePages * perPage; i > 0 && !store->slots[i-1].capacity; i--)
+        ;
+    store->usedSlots= i;
+    for (i= 0; i < store->usedSlots; i++)
+        store->storedBytes+= store->slots[i].length;
+
+    if (rc == RC_OK)
+        rc= findFreeSpace(store);
+    if (rc != RC_OK)
+    {
+        freeSlotStore(store);
+        return rc;
+    }
+
+    pthread_mutex_init(&store->lock, NULL);
+    *slotStore= store;
+    RETURN(RC_OK);
+}
+
+void closeSlotStore (SM_SlotStore *store)
+{
+    pthread_mutex_destroy(&store->lock);
+    freeSlotStore(store);
+}
+
+RC readSlot (SM_SlotStore *store, PageNumber slot, char *page)
+{
+    char record[SM_MAX_PAGE_SIZE];
+    SM_SlotEntry entry= { 0, 0, 0 };
+    int failed= 0;
+
+    pthread_mutex_lock(&store->lock);
+    if (slot < store->usedSlots)
+        entry= store->slots[slot];
+    if (entry.capacity)
+        failed= pread(store->fd, entry.length == store->pageSize ? page : record,
+                      entry.length, entry.offset) != entry.length;
+    pthread_mutex_unlock(&store->lock);
+
+    if (failed)
+        RETURN(RC_READ_FAILED);
+    if (!entry.capacity)
+        memset(page, 0, store->pageSize);
+    else if (entry.length < store->pageSize &&
+             lzDecompress(record, entry.length, page, store->pageSize) != store->pageSize)
+        RETURN(RC_READ_FAILED);
+    RETURN(RC_OK);
+}
+
+RC writeSlot (SM_SlotStore *store, PageNumber slot, char *page)
+{
+    PageNumber perPage= TABLE_ENTRIES(store->pageSize);
+    char record[SM_MAX_PAGE_SIZE];
+    SM_SlotEntry *entry, old;
+    char *data= record;
+    int length, size;
+    RC rc;
+
+    // Stored as is, unless that saves at least a unit
+    length= lzCompress(page, store->pageSize, record, store->pageSize - SLOT_UNIT);
+    if (!length)
+    {
+        data= page;
+        length= store->pageSize;
+    }
+    size= ROUND_UP(length, SLOT_UNIT);
+
+    pthread_mutex_lock(&store->lock);
+    if ((rc= growSlotTable(store, slot)) != RC_OK)
+    {
+        pthread_mutex_unlock(&store->lock);
+        return rc;
+    }
+
+    entry= &store->slots[slot];
+    old= *entry;
+    entry->offset= size <= old.capacity ? old.offset : allocSpace(store, size);
+    entry->length= length;
+    entry->capacity= size;
+
+    // Record first, then the entry pointing at it
+    if (pwrite(store->fd, data, length, entry->offset) != length ||
+        pwrite(store->fd, entry, sizeof(SM_SlotEntry),
+               store->tablePages[slot / perPage] +
+               (slot % perPage + 1) * sizeof(SM_SlotEntry)) != sizeof(SM_SlotEntry))
+    {
+        if (entry->offset != old.offset)
+            freeSpace(store, entry->offset, size);
+        *entry= old;
+        pthread_mutex_unlock(&store->lock);
+        RETURN(RC_WRITE_FAILED);
+    }
+
+    // Old record moved, or shrank
+    if (entry->offset != old.offset && old.capacity)
+        freeSpace(store, old.offset, old.capacity);
+    else if (size < old.capacity)
+        freeSpace(store, old.offset + size, old.capacity - size);
+
+    if (slot >= store->usedSlots)
+        store->usedSlots= slot + 1;
+    store->storedBytes+= length - old.length;
+    pthread_mutex_unlock(&store->lock);
+    RETURN(RC_OK);
+}
+
+PageNumber getUsedSlots (SM_SlotStore *store)
+{
+    return store->usedSlots;
+}
+
+long long getStoredSlotBytes (SM_SlotStore *store)
+{
+    long long bytes;
+
+    pthread_mutex_lock(&store->lock);
+    bytes= store->storedBytes;
+    pthread_mutex_unlock(&store->lock);
+    return bytes;
+}
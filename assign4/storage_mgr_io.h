@@ -0,0 +1,33 @@
+#ifndef STORAGE_MGR_IO_H
+#define STORAGE_MGR_IO_H
+
+#include <sys/types.h>
+#include "storage_mgr.h"
+
+// Raw page I/O, shared by storage manager modules only.
+//
+// startRawIO() validates a run of pages and returns the fd and offset
+// to transfer them at, or *fd= -1 when the handle needs readBlocks()/
+// writeBlocks() instead. finishRawIO() must be called once the
+// transfer is over, also if it failed: written pages get their
+// checksums then.
+RC startRawIO (SM_FileHandle *fHandle, PageNumber startPage, int count, int write,
+               SM_PageHandle memPages[], int *fd, off_t *offset);
+RC finishRawIO (SM_FileHandle *fHandle, PageNumber startPage, int count, int write,
+                SM_PageHandle memPages[], int failed);
+
+// Compressed slot store of a compressed page file, storage_mgr_compress.c.
+// Slots are those of a plain page file, each stored compressed in a
+// record of its own, found through a slot table. Never written slots
+// read as zeros. The store is thread safe.
+typedef struct SM_SlotStore SM_SlotStore;
+
+RC createSlotStore (int fd, int pageSize);        // Empty, for a new file
+RC openSlotStore (int fd, int pageSize, SM_SlotStore **store);
+void closeSlotStore (SM_SlotStore *store);
+RC readSlot (SM_SlotStore *store, PageNumber slot, char *page);
+RC writeSlot (SM_SlotStore *store, PageNumber slot, char *page);
+PageNumber getUsedSlots (SM_SlotStore *store);    // Slots past it are zeros
+long long getStoredSlotBytes (SM_SlotStore *store);
+
+#endif
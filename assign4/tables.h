@@ -22,7 +22,7 @@ typedef struct Value {
 } Value;
 
 typedef struct RID {
-  int page;
+  PageNumber page;
   int slot;
 } RID;
 
@@ -0,0 +1,2689 @@
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+
+#include "dberror.h"
+#include "expr.h"
+#include "btree_mgr.h"
+#include "record_mgr.h"
+#include "tables.h"
+#include "page_table.h"
+#include "test_helper.h"
+
+// Page files larger than 2GB, 64 bit page numbers.
+// Files are sparse, so little real disk space is used.
+// Also per file page sizes, mapped page files, runs of pages,
+// asynchronous I/O, direct I/O, file growth by extents, reuse of
+// freed pages, tablespaces, durability modes, compressed page files,
+// page checksums, access pattern hints, threads reading and writing
+// one file, many open files, threads opening and closing files at
+// once, threads sharing a buffer pool, LRU, LFU, LRU-K, ARC and
+// CLOCK-Pro replacement, the background writer, prefetch.
+#define TESTPF          "test_pagefile_2g.bin"
+#define TESTTS          "test_tablespace.bin"
+#define PAGES_2GB       (2LL*1024*1024*1024 / PAGE_SIZE)
+#define FAR_PAGE        (PAGES_2GB + 12345)     // Just past 2GB
+#define FARTHER_PAGE    (3*PAGES_2GB + 7)       // Past 6GB
+#define PT_TEST_PAGES   1000
+#define RUN_PAGES       600  // Over two syscalls' worth (256 pages)
+#define RUN_START       3
+#define ASYNC_RUNS      4    // Queue depth, all runs in flight at once
+#define ASYNC_PAGES     (ASYNC_RUNS * SM_ASYNC_MAX_PAGES)
+#define DIRECT_PAGES    40
+#define DIRECT_FRAMES   8
+#define EXTENT_PAGES    16
+#define APPEND_THREADS  8
+#define APPENDS_PER_THREAD 2000
+#define MAPPED_PAGES    5000 // Some mapping extents
+#define UNMAPPED_PAGE   (16LL*1024*1024*1024 / PAGE_SIZE + 100) // Past the reserve
+#define SYNC_THREADS    8
+#define SYNCS_PER_THREAD 10
+#define CHECKSUM_PAGES  3000 // Some map pages, whatever their group size
+#define CORRUPT_PAGE    1500
+#define BLOCK_THREADS   8
+#define BLOCK_SHARED    16   // Pages all threads read
+#define BLOCK_OWN       50   // Pages each thread writes
+#define BLOCK_ROUNDS    20
+#define MANY_FILES      300  // More than the old handle limit of 256
+#define OPEN_THREADS    8
+#define OPEN_ROUNDS     40
+#define OPEN_PAGES      20
+#define POOL_THREADS    8
+#define POOL_FRAMES     256  // Some partitions, far fewer than pages
+#define POOL_SHARED     64   // Pages all threads read
+#define POOL_OWN        100  // Pages each thread updates
+#define POOL_PINS       4000
+#define LRU_FRAMES      8
+#define LRU_PAGES       20
+#define LRU_PINS        2000
+#define LFU_SCAN        150  // Misses enough to age any count to 0
+#define WRITER_FRAMES   64
+#define PREFETCH_FRAMES 32
+#define PREFETCH_PAGES  8
+#define INDEX_KEYS      1000
+
+typedef struct BlockThread {
+  SM_FileHandle *fh;
+  int n;
+} BlockThread;
+
+typedef struct PoolThread {
+  BM_BufferPool *bm;
+  int n;
+} PoolThread;
+
+#define ASSERT_EQUALS_PAGE(expected,real,message)			\
+  do {									\
+    if ((expected) != (real))						\
+      {									\
+	printf("[%s-%s-L%i-%s] FAILED: expected <%lld> but was <%lld>: %s\n",TEST_INFO, (long long) (expected), (long long) (real), message); \
+	exit(1);							\
+      }									\
+    printf("[%s-%s-L%i-%s] OK: expected <%lld> and was <%lld>: %s\n",TEST_INFO, (long long) (expected), (long long) (real), message); \
+  } while(0)
+
+// test methods
+static void testLargeStorageFile (void);
+static void testLargeBufferPool (void);
+static void testLargePageTable (void);
+static void testLargeRID (void);
+static void testPageSizes (void);
+static void testMappedPageFile (void);
+static void testPageRuns (void);
+static void testAsyncIO (void);
+static void testDirectIO (void);
+static void testFileExtents (void);
+static void testFreePages (void);
+static void testFreePagesInTable (void);
+static void testFreeIndexNodes (void);
+static void testTablespace (void);
+static void testTablesInTablespace (void);
+static void testDurability (void);
+static void testCompressedPageFile (void);
+static void testPageChecksums (void);
+static void testAccessHints (void);
+static void testConcurrentBlockIO (void);
+static void testManyOpenFiles (void);
+static void testConcurrentOpen (void);
+static void testConcurrentPool (void);
+static void testLRU (void);
+static void testLFU (void);
+static void testLRUK (void);
+static void testARC (void);
+static void testClockPro (void);
+static void testBackgroundWriter (void);
+static void testPrefetch (void);
+
+// helper methods
+static void stampPage (SM_PageHandle page, PageNumber pn);
+static RC pollUntilDone (SM_AsyncQueue *queue, SM_AsyncTicket ticket);
+static void fillRecordPage (SM_PageHandle page, PageNumber pn);
+static int countOpenFiles (void);
+static void *writeAndSync (void *fh);
+static void *appendBlocks (void *fh);
+static void *readAndWrite (void *arg);
+static off_t findPageOffset (char *fileName, PageNumber pn);
+static void *openUseClose (void *id);
+static void *pinAndUpdate (void *id);
+static int isPageInPool (BM_BufferPool *bm, PageNumber pn);
+static void pinPages (BM_BufferPool *bm, PageNumber first, int count);
+static void dirtyPages (BM_BufferPool *bm, PageNumber first, int count);
+static int countDirty (BM_BufferPool *bm);
+
+// test name
+char *testName;
+
+// main method
+int
+main (void)
+{
+  testName = "";
+
+  initStorageManager();
+
+  testLargeStorageFile();
+  testLargeBufferPool();
+  testLargePageTable();
+  testLargeRID();
+  testPageSizes();
+  testMappedPageFile();
+  testPageRuns();
+  testAsyncIO();
+  testDirectIO();
+  testFileExtents();
+  testFreePages();
+  testFreePagesInTable();
+  testFreeIndexNodes();
+  testTablespace();
+  testTablesInTablespace();
+  testDurability();
+  testCompressedPageFile();
+  testPageChecksums();
+  testAccessHints();
+  testConcurrentBlockIO();
+  testManyOpenFiles();
+  testConcurrentOpen();
+  testConcurrentPool();
+  testLRU();
+  testLFU();
+  testLRUK();
+  testARC();
+  testClockPro();
+  testBackgroundWriter();
+  testPrefetch();
+
+  return 0;
+}
+
+// ************************************************************
+void
+testLargeStorageFile (void)
+{
+  SM_FileHandle fh;
+  SM_PageHandle ph;
+
+  testName = "test page file beyond 2GB";
+
+  ph = (SM_PageHandle) malloc(PAGE_SIZE);
+
+  destroyPageFile(TESTPF);
+  TEST_CHECK(createPageFile(TESTPF));
+  TEST_CHECK(openPageFile(TESTPF, &fh));
+
+  // write past the 2GB boundary, then further
+  stampPage(ph, FAR_PAGE);
+  TEST_CHECK(writeBlock(FAR_PAGE, &fh, ph));
+  ASSERT_EQUALS_PAGE(FAR_PAGE+1, fh.totalNumPages, "file grows past 2GB");
+  stampPage(ph, FARTHER_PAGE);
+  TEST_CHECK(writeBlock(FARTHER_PAGE, &fh, ph));
+  ASSERT_EQUALS_PAGE(FARTHER_PAGE+1, fh.totalNumPages, "file grows past 6GB");
+
+  TEST_CHECK(appendEmptyBlock(&fh));
+  ASSERT_EQUALS_PAGE(FARTHER_PAGE+2, fh.totalNumPages, "append past 6GB");
+  TEST_CHECK(closePageFile(&fh));
+
+  // read back after reopen
+  TEST_CHECK(openPageFile(TESTPF, &fh));
+  ASSERT_EQUALS_PAGE(FARTHER_PAGE+2, fh.totalNumPages, "size survives reopen");
+
+  TEST_CHECK(readBlock(FAR_PAGE, &fh, ph));
+  ASSERT_EQUALS_PAGE(FAR_PAGE, *(PageNumber*) ph, "page past 2GB reads back");
+  ASSERT_EQUALS_PAGE(FAR_PAGE, getBlockPos(&fh), "position past 2GB");
+  TEST_CHECK(readBlock(FARTHER_PAGE, &fh, ph));
+  ASSERT_EQUALS_PAGE(FARTHER_PAGE, *(PageNumber*) ph, "page past 6GB reads back");
+  TEST_CHECK(readLastBlock(&fh, ph));
+  ASSERT_EQUALS_PAGE(0, *(PageNumber*) ph, "appended page is empty");
+
+  // a page in the hole reads as zeros
+  TEST_CHECK(readBlock(FAR_PAGE+1, &fh, ph));
+  ASSERT_EQUALS_PAGE(0, *(PageNumber*) ph, "page in hole is empty");
+
+  ASSERT_ERROR(readBlock(FARTHER_PAGE+2, &fh, ph), "reading past end fails");
+
+  TEST_CHECK(closePageFile(&fh));
+  TEST_CHECK(destroyPageFile(TESTPF));
+  free(ph);
+
+  TEST_DONE();
+}
+
+// ************************************************************
+void
+testLargeBufferPool (void)
+{
+  BM_BufferPool *bm = MAKE_POOL();
+  BM_PageHandle *h = MAKE_PAGE_HANDLE();
+  SM_FileHandle fh;
+  SM_PageHandle ph;
+  PageNumber pages[] = { 0, FAR_PAGE, FAR_PAGE+1, FARTHER_PAGE };
+  int numPages = 4;
+  int i;
+
+  testName = "test buffer pool beyond 2GB";
+
+  destroyPageFile(TESTPF);
+  TEST_CHECK(createPageFile(TESTPF));
+
+  // dirty pages past 2GB, then evict them through a small pool
+  TEST_CHECK(initBufferPool(bm, TESTPF, 2, RS_LRU, NULL));
+  for (i = 0; i < numPages; i++)
+    {
+      TEST_CHECK(pinPage(bm, h, pages[i]));
+      ASSERT_EQUALS_PAGE(pages[i], h->pageNum, "pinned page number");
+      stampPage(h->data, pages[i]);
+      TEST_CHECK(markDirty(bm, h));
+      TEST_CHECK(unpinPage(bm, h));
+    }
+  for (i = 0; i < numPages; i++)
+    {
+      TEST_CHECK(pinPage(bm, h, pages[i]));
+      ASSERT_EQUALS_PAGE(pages[i], *(PageNumber*) h->data, "page content after eviction");
+      TEST_CHECK(unpinPage(bm, h));
+    }
+  TEST_CHECK(shutdownBufferPool(bm));
+
+  // check on disk
+  ph = (SM_PageHandle) malloc(PAGE_SIZE);
+  TEST_CHECK(openPageFile(TESTPF, &fh));
+  ASSERT_EQUALS_PAGE(FARTHER_PAGE+1, fh.totalNumPages, "file size");
+  for (i = 0; i < numPages; i++)
+    {
+      TEST_CHECK(readBlock(pages[i], &fh, ph));
+      ASSERT_EQUALS_PAGE(pages[i], *(PageNumber*) ph, "page content on disk");
+    }
+  TEST_CHECK(closePageFile(&fh));
+  TEST_CHECK(destroyPageFile(TESTPF));
+
+  free(ph);
+  free(bm);
+  free(h);
+
+  TEST_DONE();
+}
+
+// ************************************************************
+void
+testLargePageTable (void)
+{
+  BM_PageTable pt;
+  BM_PageFrame frames[4], manyFrames[PT_TEST_PAGES];
+  // same low 32 bits, must not share a slot
+  PageNumber pages[] = { 5, 5 + (1LL << 32), 5 + (1LL << 40), (1LL << 62) + 5 };
+  int i;
+
+  testName = "test page table with 64 bit page numbers";
+
+  initPageTable(&pt, 4);
+  for (i = 0; i < 4; i++)
+    setPageFrame(&pt, pages[i], &frames[i]);
+  for (i = 0; i < 4; i++)
+    ASSERT_TRUE(findPageFrame(&pt, pages[i]) == &frames[i], "frame of 64 bit page");
+
+  resetPageFrame(&pt, pages[1]);
+  ASSERT_TRUE(findPageFrame(&pt, pages[1]) == NULL, "removed page is gone");
+  ASSERT_TRUE(findPageFrame(&pt, pages[0]) == &frames[0], "other page is kept");
+
+  for (i = 0; i < 4; i++)
+    resetPageFrame(&pt, pages[i]);
+  ASSERT_EQUALS_INT(0, pt.refCount, "page table is empty");
+  freePageTable(&pt);
+
+  // full table, removals move colliding entries back
+  initPageTable(&pt, PT_TEST_PAGES);
+  for (i = 0; i < PT_TEST_PAGES; i++)
+    setPageFrame(&pt, i * 1000003LL, &manyFrames[i]);
+  for (i = 0; i < PT_TEST_PAGES; i += 2)
+    resetPageFrame(&pt, i * 1000003LL);
+  for (i = 0; i < PT_TEST_PAGES; i++)
+    if (findPageFrame(&pt, i * 1000003LL) != (i % 2 ? &manyFrames[i] : NULL))
+      break;
+  ASSERT_EQUALS_INT(PT_TEST_PAGES, i, "odd pages kept, even ones gone");
+  freePageTable(&pt);
+
+  TEST_DONE();
+}
+
+// ************************************************************
+void
+testLargeRID (void)
+{
+  RID insert[] = {
+    {FAR_PAGE, 1},
+    {FARTHER_PAGE, 3},
+    {1LL << 40, 2},
+    {3, 5},
+  };
+  int numInserts = 4;
+  BTreeHandle *tree = NULL;
+  BT_ScanHandle *sc = NULL;
+  Value *key;
+  RID rid;
+  int i;
+
+  testName = "test b-tree with RIDs beyond 2GB";
+
+  TEST_CHECK(initIndexManager(NULL));
+  TEST_CHECK(createBtree("testidx", DT_INT, 2));
+  TEST_CHECK(openBtree(&tree, "testidx"));
+
+  for(i = 0; i < numInserts; i++)
+    {
+      MAKE_VALUE(key, DT_INT, i);
+      TEST_CHECK(insertKey(tree, key, insert[i]));
+      free(key);
+    }
+
+  for(i = 0; i < numInserts; i++)
+    {
+      MAKE_VALUE(key, DT_INT, i);
+      TEST_CHECK(findKey(tree, key, &rid));
+      ASSERT_EQUALS_PAGE(insert[i].page, rid.page, "RID page");
+      ASSERT_EQUALS_INT(insert[i].slot, rid.slot, "RID slot");
+      free(key);
+    }
+
+  // scan returns them in key order
+  TEST_CHECK(openTreeScan(tree, &sc));
+  for(i = 0; i < numInserts; i++)
+    {
+      TEST_CHECK(nextEntry(sc, &rid));
+      ASSERT_EQUALS_PAGE(insert[i].page, rid.page, "RID page from scan");
+    }
+  ASSERT_ERROR(nextEntry(sc, &rid), "no more entries");
+  TEST_CHECK(closeTreeScan(sc));
+
+  TEST_CHECK(closeBtree(tree));
+  TEST_CHECK(deleteBtree("testidx"));
+  TEST_CHECK(shutdownIndexManager());
+  initStorageManager(); // shut down with the index manager
+
+  TEST_DONE();
+}
+
+// ************************************************************
+void
+testPageSizes (void)
+{
+  SM_FileHandle fh;
+  SM_PageHandle ph;
+  RM_TableData *table = (RM_TableData *) malloc(sizeof(RM_TableData));
+  BTreeHandle *tree = NULL;
+  Schema *schema;
+  Record *r;
+  RID rid;
+  char *names[] = { "a" };
+  DataType dt[] = { DT_STRING };
+  int sizes[] = { 100 };
+  int keys[] = { 0 };
+  int pageSize, i;
+
+  testName = "test per file page sizes";
+
+  for (pageSize = SM_MIN_PAGE_SIZE; pageSize <= SM_MAX_PAGE_SIZE; pageSize *= 2)
+    {
+      // size survives reopen, last byte of a page is its own
+      destroyPageFile(TESTPF);
+      TEST_CHECK(createPageFileWithPageSize(TESTPF, pageSize));
+      TEST_CHECK(openPageFile(TESTPF, &fh));
+      ASSERT_EQUALS_INT(pageSize, fh.pageSize, "page size from header");
+      ASSERT_EQUALS_PAGE(1, fh.totalNumPages, "new file has one page");
+
+      ph = (SM_PageHandle) malloc(pageSize);
+      for (i = 0; i < 3; i++)
+        {
+          memset(ph, 'a' + i, pageSize);
+          TEST_CHECK(writeBlock(i, &fh, ph));
+        }
+      TEST_CHECK(closePageFile(&fh));
+
+      TEST_CHECK(openPageFile(TESTPF, &fh));
+      ASSERT_EQUALS_PAGE(3, fh.totalNumPages, "pages after reopen");
+      for (i = 0; i < 3; i++)
+        {
+          TEST_CHECK(readBlock(i, &fh, ph));
+          ASSERT_TRUE(ph[0] == 'a' + i && ph[pageSize-1] == 'a' + i, "whole page reads back");
+        }
+      TEST_CHECK(closePageFile(&fh));
+      TEST_CHECK(destroyPageFile(TESTPF));
+      free(ph);
+    }
+
+  ASSERT_ERROR(createPageFileWithPageSize(TESTPF, 1024), "page size too small");
+  ASSERT_ERROR(createPageFileWithPageSize(TESTPF, 3*4096), "page size not a power of 2");
+  ASSERT_ERROR(createPageFileWithPageSize(TESTPF, 2*SM_MAX_PAGE_SIZE), "page size too large");
+
+  // records per page follow the page size
+  schema = createSchema(1, names, dt, sizes, 1, keys);
+  TEST_CHECK(createTableWithPageSize("test_table_ps", schema, 65536));
+  TEST_CHECK(openTable(table, "test_table_ps"));
+  TEST_CHECK(createRecord(&r, schema));
+  for (i = 0; i < 100; i++)
+    TEST_CHECK(insertRecord(table, r));
+  ASSERT_EQUALS_PAGE(1, r->id.page, "100 records fit one 64KB page");
+  TEST_CHECK(closeTable(table));
+  TEST_CHECK(deleteTable("test_table_ps"));
+  freeRecord(r);
+  freeSchema(schema);
+
+  // order too high for 4KB pages fits in 64KB pages
+  TEST_CHECK(initIndexManager(NULL));
+  ASSERT_ERROR(createBtree("testidx", DT_INT, 1000), "order 1000 needs larger pages");
+  TEST_CHECK(createBtreeWithPageSize("testidx", DT_INT, 1000, 65536));
+  TEST_CHECK(openBtree(&tree, "testidx"));
+  for (i = 0; i < 1000; i++)
+    {
+      Value *key;
+      MAKE_VALUE(key, DT_INT, i);
+      rid.page = i;
+      rid.slot = i;
+      TEST_CHECK(insertKey(tree, key, rid));
+      free(key);
+    }
+  TEST_CHECK(getNumNodes(tree, &i));
+  ASSERT_EQUALS_INT(1, i, "1000 keys in a single node");
+  TEST_CHECK(closeBtree(tree));
+  TEST_CHECK(deleteBtree("testidx"));
+  TEST_CHECK(shutdownIndexManager());
+  initStorageManager(); // shut down with the index manager
+
+  free(table);
+
+  TEST_DONE();
+}
+
+// ************************************************************
+void
+testMappedPageFile (void)
+{
+  SM_FileHandle fh;
+  SM_PageHandle ph, first, again, last;
+  RC rc;
+
+  testName = "test mapped page files";
+
+  ph = (SM_PageHandle) malloc(PAGE_SIZE);
+  destroyPageFile(TESTPF);
+  TEST_CHECK(createPageFile(TESTPF));
+
+  // not mapped, no pointers
+  TEST_CHECK(openPageFile(TESTPF, &fh));
+  rc = getBlockPtr(0, &fh, &first);
+  ASSERT_EQUALS_INT(RC_PAGE_NOT_MAPPED, rc, "no pointer without SM_OPEN_MMAP");
+  TEST_CHECK(closePageFile(&fh));
+
+  // pointers stay valid while the mapping grows
+  TEST_CHECK(openPageFileWithFlags(TESTPF, &fh, SM_OPEN_MMAP));
+  stampPage(ph, 1);
+  TEST_CHECK(writeBlock(0, &fh, ph));
+  TEST_CHECK(getBlockPtr(0, &fh, &first));
+  TEST_CHECK(ensureCapacity(MAPPED_PAGES, &fh));
+  TEST_CHECK(getBlockPtr(0, &fh, &again));
+  ASSERT_TRUE(first == again, "mapping did not move");
+  ASSERT_EQUALS_PAGE(1, *(PageNumber*) first, "page through old pointer");
+  TEST_CHECK(getBlockPtr(MAPPED_PAGES - 1, &fh, &last));
+  ASSERT_EQUALS_PAGE(0, *(PageNumber*) last, "new page is zeros");
+  *(PageNumber*) last = MAPPED_PAGES - 1;
+  TEST_CHECK(readBlock(MAPPED_PAGES - 1, &fh, ph));
+  ASSERT_EQUALS_PAGE(MAPPED_PAGES - 1, *(PageNumber*) ph, "pointer write read back");
+  rc = getBlockPtr(MAPPED_PAGES, &fh, &last);
+  ASSERT_EQUALS_INT(RC_READ_NON_EXISTING_PAGE, rc, "no pointer past the end");
+
+  // past the reserved address space pages are read and written, not mapped
+  stampPage(ph, UNMAPPED_PAGE);
+  TEST_CHECK(writeBlock(UNMAPPED_PAGE, &fh, ph));
+  rc = getBlockPtr(UNMAPPED_PAGE, &fh, &last);
+  ASSERT_EQUALS_INT(RC_PAGE_NOT_MAPPED, rc, "page past the reserve not mapped");
+  memset(ph, 0, PAGE_SIZE);
+  TEST_CHECK(readBlock(UNMAPPED_PAGE, &fh, ph));
+  ASSERT_EQUALS_PAGE(UNMAPPED_PAGE, *(PageNumber*) ph, "page past the reserve read back");
+  ASSERT_EQUALS_PAGE(1, *(PageNumber*) first, "old pointer still valid");
+  TEST_CHECK(closePageFile(&fh));
+
+  // a new handle reserves enough for the whole file
+  TEST_CHECK(openPageFileWithFlags(TESTPF, &fh, SM_OPEN_MMAP));
+  ASSERT_EQUALS_PAGE(UNMAPPED_PAGE + 1, fh.totalNumPages, "size kept");
+  TEST_CHECK(getBlockPtr(UNMAPPED_PAGE, &fh, &last));
+  ASSERT_EQUALS_PAGE(UNMAPPED_PAGE, *(PageNumber*) last, "page past the old reserve mapped");
+  TEST_CHECK(getBlockPtr(MAPPED_PAGES - 1, &fh, &last));
+  ASSERT_EQUALS_PAGE(MAPPED_PAGES - 1, *(PageNumber*) last, "pointer write kept");
+  TEST_CHECK(closePageFile(&fh));
+  TEST_CHECK(destroyPageFile(TESTPF));
+
+  free(ph);
+
+  TEST_DONE();
+}
+
+// ************************************************************
+void
+testPageRuns (void)
+{
+  SM_FileHandle fh;
+  SM_PageHandle bufs[RUN_PAGES], in[RUN_PAGES], out[RUN_PAGES];
+  int flags[] = { SM_OPEN_DEFAULT, SM_OPEN_MMAP, SM_OPEN_DIRECT };
+  int m, i, rc;
+
+  testName = "test runs of pages";
+
+  // buffers scattered over the heap, out of address order
+  for (i = 0; i < RUN_PAGES; i++)
+    bufs[i] = (SM_PageHandle) malloc(PAGE_SIZE);
+  for (i = 0; i < RUN_PAGES; i++)
+    {
+      out[i] = bufs[(i * 7) % RUN_PAGES];
+      in[i] = bufs[RUN_PAGES - 1 - i];
+    }
+
+  for (m = 0; m < 3; m++)
+    {
+      destroyPageFile(TESTPF);
+      TEST_CHECK(createPageFile(TESTPF));
+      TEST_CHECK(openPageFileWithFlags(TESTPF, &fh, flags[m]));
+      for (i = 0; i < RUN_PAGES; i++)
+        stampPage(out[i], RUN_START + i);
+      TEST_CHECK(writeBlocks(RUN_START, RUN_PAGES, &fh, out));
+      ASSERT_EQUALS_PAGE(RUN_START + RUN_PAGES, fh.totalNumPages, "run grows the file");
+      for (i = 0; i < RUN_PAGES; i++)
+        stampPage(in[i], -1);
+      TEST_CHECK(readBlocks(RUN_START, RUN_PAGES, &fh, in));
+      for (i = 0; i < RUN_PAGES; i++)
+        if (*(PageNumber*) in[i] != RUN_START + i)
+          ASSERT_EQUALS_PAGE(RUN_START + i, *(PageNumber*) in[i], "page of run");
+
+      // pages either side of the syscall boundary are in place on disk
+      TEST_CHECK(readBlock(RUN_START + 255, &fh, in[0]));
+      ASSERT_EQUALS_PAGE(RUN_START + 255, *(PageNumber*) in[0], "last page of first syscall");
+      TEST_CHECK(readBlock(RUN_START + 256, &fh, in[0]));
+      ASSERT_EQUALS_PAGE(RUN_START + 256, *(PageNumber*) in[0], "first page of second syscall");
+
+      rc = readBlocks(RUN_START + 1, RUN_PAGES, &fh, in);
+      ASSERT_EQUALS_INT(RC_READ_NON_EXISTING_PAGE, rc, "run past the end");
+      rc = readBlocks(0, 0, &fh, in);
+      ASSERT_EQUALS_INT(RC_READ_NON_EXISTING_PAGE, rc, "empty run");
+      rc = writeBlocks(-1, 2, &fh, out);
+      ASSERT_EQUALS_INT(RC_READ_NON_EXISTING_PAGE, rc, "run before the start");
+      TEST_CHECK(closePageFile(&fh));
+    }
+  TEST_CHECK(destroyPageFile(TESTPF));
+
+  for (i = 0; i < RUN_PAGES; i++)
+    free(bufs[i]);
+
+  TEST_DONE();
+}
+
+// ************************************************************
+void
+testAsyncIO (void)
+{
+  SM_FileHandle fh;
+  SM_AsyncQueue *queue;
+  SM_AsyncTicket tickets[ASYNC_RUNS], ticket;
+  SM_PageHandle written[ASYNC_PAGES], read[ASYNC_PAGES], ph;
+  BM_BufferPool *bm = MAKE_POOL();
+  BM_PageHandle *h = MAKE_PAGE_HANDLE();
+  BM_Pool_MgmtData *mgmtData;
+  int backends[] = { SM_ASYNC_DEFAULT, SM_ASYNC_THREADS };
+  int b, c, r, i;
+  RC rc, result;
+
+  testName = "test asynchronous I/O";
+
+  ph = (SM_PageHandle) malloc(PAGE_SIZE);
+  for (i = 0; i < ASYNC_PAGES; i++)
+    {
+      written[i] = (SM_PageHandle) malloc(PAGE_SIZE);
+      read[i] = (SM_PageHandle) malloc(PAGE_SIZE);
+    }
+  destroyPageFile(TESTPF);
+  TEST_CHECK(createPageFile(TESTPF));
+  TEST_CHECK(openPageFile(TESTPF, &fh));
+
+  // what either backend writes, both read back the same
+  for (b = 0; b < 2; b++)
+    {
+      TEST_CHECK(initAsyncQueue(&queue, ASYNC_RUNS, backends[b]));
+      for (i = 0; i < ASYNC_PAGES; i++)
+        stampPage(written[i], b * ASYNC_PAGES + i);
+      for (r = 0; r < ASYNC_RUNS; r++)
+        TEST_CHECK(submitWriteBlocks(queue, r * SM_ASYNC_MAX_PAGES, SM_ASYNC_MAX_PAGES, &fh,
+                                     &written[r * SM_ASYNC_MAX_PAGES], &tickets[r]));
+      for (r = 0; r < ASYNC_RUNS; r++)
+        TEST_CHECK(waitAsyncIO(queue, tickets[r]));
+      TEST_CHECK(shutdownAsyncQueue(queue));
+      ASSERT_EQUALS_PAGE(ASYNC_PAGES, fh.totalNumPages, "writes grow the file");
+
+      for (c = 0; c < 2; c++)
+        {
+          TEST_CHECK(initAsyncQueue(&queue, ASYNC_RUNS, backends[c]));
+          for (i = 0; i < ASYNC_PAGES; i++)
+            memset(read[i], 0xff, PAGE_SIZE);
+          for (r = 0; r < ASYNC_RUNS; r++)
+            TEST_CHECK(submitReadBlocks(queue, r * SM_ASYNC_MAX_PAGES, SM_ASYNC_MAX_PAGES, &fh,
+                                        &read[r * SM_ASYNC_MAX_PAGES], &tickets[r]));
+          for (r = ASYNC_RUNS - 1; r >= 0; r--)
+            TEST_CHECK(pollUntilDone(queue, tickets[r]));
+          for (i = 0; i < ASYNC_PAGES; i++)
+            if (memcmp(written[i], read[i], PAGE_SIZE))
+              ASSERT_EQUALS_PAGE(b * ASYNC_PAGES + i, *(PageNumber*) read[i], "page read back");
+          TEST_CHECK(shutdownAsyncQueue(queue));
+        }
+    }
+
+  for (b = 0; b < 2; b++)
+    {
+      TEST_CHECK(initAsyncQueue(&queue, ASYNC_RUNS, backends[b]));
+
+      // a full queue takes no more, until a ticket is collected
+      for (r = 0; r < ASYNC_RUNS; r++)
+        TEST_CHECK(submitReadBlocks(queue, r, 1, &fh, &read[r], &tickets[r]));
+      rc = submitReadBlocks(queue, 0, 1, &fh, &read[ASYNC_RUNS], &ticket);
+      ASSERT_EQUALS_INT(RC_ASYNC_QUEUE_FULL, rc, "full queue");
+      TEST_CHECK(waitAsyncIO(queue, tickets[0]));
+      TEST_CHECK(submitReadBlocks(queue, 0, 1, &fh, &read[ASYNC_RUNS], &ticket));
+
+      // a collected ticket is stale, even when its slot is taken again
+      rc = pollAsyncIO(queue, tickets[0], &result);
+      ASSERT_EQUALS_INT(RC_ASYNC_INVALID_TICKET, rc, "stale ticket polled");
+      rc = waitAsyncIO(queue, tickets[0]);
+      ASSERT_EQUALS_INT(RC_ASYNC_INVALID_TICKET, rc, "stale ticket waited for");
+      TEST_CHECK(pollUntilDone(queue, ticket));
+      for (r = 1; r < ASYNC_RUNS; r++)
+        TEST_CHECK(pollUntilDone(queue, tickets[r]));
+      ASSERT_EQUALS_PAGE(ASYNC_PAGES + ASYNC_RUNS - 1, *(PageNumber*) read[ASYNC_RUNS - 1], "last write read back");
+      rc = pollAsyncIO(queue, -1, &result);
+      ASSERT_EQUALS_INT(RC_ASYNC_INVALID_TICKET, rc, "negative ticket");
+      rc = pollAsyncIO(queue, 0x7fffffff, &result);
+      ASSERT_EQUALS_INT(RC_ASYNC_INVALID_TICKET, rc, "ticket never handed out");
+
+      // bad runs fail at submit, and take no slot
+      rc = submitReadBlocks(queue, 0, SM_ASYNC_MAX_PAGES + 1, &fh, read, &ticket);
+      ASSERT_EQUALS_INT(RC_READ_NON_EXISTING_PAGE, rc, "run too long");
+      rc = submitReadBlocks(queue, ASYNC_PAGES, 1, &fh, read, &ticket);
+      ASSERT_EQUALS_INT(RC_READ_NON_EXISTING_PAGE, rc, "read past the end");
+      for (r = 0; r < ASYNC_RUNS; r++)
+        TEST_CHECK(submitReadBlocks(queue, r, 1, &fh, &read[r], &tickets[r]));
+      for (r = 0; r < ASYNC_RUNS; r++)
+        TEST_CHECK(waitAsyncIO(queue, tickets[r]));
+      TEST_CHECK(shutdownAsyncQueue(queue));
+    }
+  TEST_CHECK(closePageFile(&fh));
+
+  // mapped handles complete at submit, with the same result
+  TEST_CHECK(openPageFileWithFlags(TESTPF, &fh, SM_OPEN_MMAP));
+  TEST_CHECK(initAsyncQueue(&queue, ASYNC_RUNS, SM_ASYNC_DEFAULT));
+  stampPage(ph, 42);
+  TEST_CHECK(submitWriteBlocks(queue, 7, 1, &fh, &ph, &ticket));
+  rc = pollAsyncIO(queue, ticket, &result);
+  ASSERT_EQUALS_INT(RC_OK, rc, "done at submit");
+  TEST_CHECK(result);
+  TEST_CHECK(submitReadBlocks(queue, 7, 1, &fh, read, &ticket));
+  TEST_CHECK(waitAsyncIO(queue, ticket));
+  ASSERT_EQUALS_PAGE(42, *(PageNumber*) read[0], "mapped page read back");
+  TEST_CHECK(shutdownAsyncQueue(queue));
+  TEST_CHECK(closePageFile(&fh));
+
+  // a buffer pool makes its flush queue when it first flushes pages
+  TEST_CHECK(initBufferPool(bm, TESTPF, 4, RS_FIFO, NULL));
+  mgmtData = (BM_Pool_MgmtData*) bm->mgmtData;
+  for (i = 0; i < 2; i++)
+    {
+      TEST_CHECK(pinPage(bm, h, i));
+      TEST_CHECK(markDirty(bm, h));
+      TEST_CHECK(forcePage(bm, h));
+      TEST_CHECK(unpinPage(bm, h));
+    }
+  ASSERT_TRUE(mgmtData->flushQueue == NULL, "no queue before a flush");
+  for (i = 0; i < 2; i++)
+    {
+      TEST_CHECK(pinPage(bm, h, i));
+      stampPage(h->data, 100 + i);
+      TEST_CHECK(markDirty(bm, h));
+      TEST_CHECK(unpinPage(bm, h));
+    }
+  TEST_CHECK(forceFlushPool(bm));
+  ASSERT_TRUE(mgmtData->flushQueue != NULL, "queue made by the flush");
+  TEST_CHECK(shutdownBufferPool(bm));
+  TEST_CHECK(openPageFile(TESTPF, &fh));
+  TEST_CHECK(readBlock(1, &fh, ph));
+  ASSERT_EQUALS_PAGE(101, *(PageNumber*) ph, "flushed page");
+  TEST_CHECK(closePageFile(&fh));
+  TEST_CHECK(initBufferPool(bm, TESTPF, 4, RS_FIFO, NULL));
+  TEST_CHECK(shutdownBufferPool(bm));
+  TEST_CHECK(destroyPageFile(TESTPF));
+
+  for (i = 0; i < ASYNC_PAGES; i++)
+    {
+      free(written[i]);
+      free(read[i]);
+    }
+  free(ph);
+  free(h);
+  free(bm);
+
+  TEST_DONE();
+}
+
+// ************************************************************
+void
+testDirectIO (void)
+{
+  SM_FileHandle fh;
+  SM_PageHandle pages[DIRECT_PAGES], mem[DIRECT_PAGES];
+  BM_BufferPool *bm = MAKE_POOL();
+  BM_PageHandle *h = MAKE_PAGE_HANDLE();
+  int pageSizes[] = { PAGE_SIZE, 4 * PAGE_SIZE };
+  int flags[] = { SM_OPEN_DEFAULT, SM_OPEN_DIRECT };
+  struct stat st;
+  int p, m, i, strategy;
+  RC rc;
+
+  testName = "test direct I/O";
+
+  // every other buffer unaligned, they go through a bounce page
+  for (i = 0; i < DIRECT_PAGES; i++)
+    {
+      if (posix_memalign((void**) &mem[i], SM_IO_ALIGN, 4 * PAGE_SIZE + 1))
+        mem[i] = NULL;
+      ASSERT_TRUE(mem[i] != NULL, "buffer allocated");
+      memset(mem[i], 0, 4 * PAGE_SIZE + 1);
+      pages[i] = mem[i] + i % 2;
+    }
+
+  for (p = 0; p < 2; p++)
+    {
+      destroyPageFile(TESTPF);
+      TEST_CHECK(createPageFileWithPageSize(TESTPF, pageSizes[p]));
+      TEST_CHECK(openPageFileWithFlags(TESTPF, &fh, SM_OPEN_DIRECT));
+      for (i = 0; i < DIRECT_PAGES; i++)
+        stampPage(pages[i], i);
+      TEST_CHECK(writeBlocks(0, DIRECT_PAGES / 2, &fh, pages));
+      for (i = DIRECT_PAGES / 2; i < DIRECT_PAGES; i++)
+        TEST_CHECK(writeBlock(i, &fh, pages[i]));
+      for (i = 0; i < DIRECT_PAGES; i++)
+        stampPage(pages[i], -1);
+      TEST_CHECK(readBlocks(0, DIRECT_PAGES, &fh, pages));
+      for (i = 0; i < DIRECT_PAGES; i++)
+        if (*(PageNumber*) pages[i] != i)
+          ASSERT_EQUALS_PAGE(i, *(PageNumber*) pages[i], "page read back");
+      TEST_CHECK(closePageFile(&fh));
+
+      // a short final page, cut by a crash or another program, fails
+      // to read in both modes, until it is written again
+      ASSERT_TRUE(stat(TESTPF, &st) == 0 && truncate(TESTPF, st.st_size - pageSizes[p] / 2) == 0,
+                  "cut last page");
+      for (m = 0; m < 2; m++)
+        {
+          TEST_CHECK(openPageFileWithFlags(TESTPF, &fh, flags[m]));
+          rc = readBlock(fh.totalNumPages - 1, &fh, pages[1]);
+          ASSERT_EQUALS_INT(RC_READ_FAILED, rc, "short final page");
+          TEST_CHECK(readBlock(fh.totalNumPages - 2, &fh, pages[1]));
+          TEST_CHECK(closePageFile(&fh));
+        }
+      TEST_CHECK(openPageFileWithFlags(TESTPF, &fh, SM_OPEN_DIRECT));
+      stampPage(pages[1], fh.totalNumPages - 1);
+      TEST_CHECK(writeBlock(fh.totalNumPages - 1, &fh, pages[1]));
+      TEST_CHECK(readBlock(fh.totalNumPages - 1, &fh, pages[0]));
+      ASSERT_EQUALS_PAGE(fh.totalNumPages - 1, *(PageNumber*) pages[0], "rewritten final page");
+      TEST_CHECK(closePageFile(&fh));
+    }
+
+  // buffer pools keep working, frames are aligned
+  for (strategy = RS_FIFO; strategy <= RS_CLOCK_PRO; strategy++)
+    {
+      TEST_CHECK(initBufferPoolWithFlags(bm, TESTPF, DIRECT_FRAMES, strategy, NULL, SM_OPEN_DIRECT));
+      for (i = 0; i < DIRECT_PAGES; i++)
+        {
+          TEST_CHECK(pinPage(bm, h, i));
+          ASSERT_TRUE(((unsigned long) h->data & (SM_IO_ALIGN - 1)) == 0, "frame aligned");
+          if (*(PageNumber*) h->data != i * (strategy + 1))
+            ASSERT_EQUALS_PAGE(i * (strategy + 1), *(PageNumber*) h->data, "page through the pool");
+          *(PageNumber*) h->data = i * (strategy + 2);
+          TEST_CHECK(markDirty(bm, h));
+          TEST_CHECK(unpinPage(bm, h));
+        }
+      TEST_CHECK(shutdownBufferPool(bm));
+    }
+  TEST_CHECK(destroyPageFile(TESTPF));
+
+  for (i = 0; i < DIRECT_PAGES; i++)
+    free(mem[i]);
+  free(h);
+  free(bm);
+
+  TEST_DONE();
+}
+
+// ************************************************************
+void
+testFileExtents (void)
+{
+  SM_FileHandle fh;
+  SM_PageHandle ph;
+  int flags[] = { SM_OPEN_DEFAULT, SM_OPEN_MMAP };
+  pthread_t tid[APPEND_THREADS];
+  struct stat st;
+  off_t size;
+  PageNumber allocated;
+  int m, i;
+  RC rc;
+
+  testName = "test file growth by extents";
+
+  ph = (SM_PageHandle) malloc(PAGE_SIZE);
+
+  for (m = 0; m < 2; m++)
+    {
+      destroyPageFile(TESTPF);
+      TEST_CHECK(createPageFile(TESTPF));
+      TEST_CHECK(openPageFileWithFlags(TESTPF, &fh, flags[m]));
+      TEST_CHECK(setExtentSize(EXTENT_PAGES, &fh));
+
+      // appends take pages of the extent, the file does not change
+      TEST_CHECK(appendEmptyBlock(&fh));
+      allocated = getAllocatedNumPages(&fh);
+      ASSERT_TRUE(allocated > fh.totalNumPages && allocated % EXTENT_PAGES == 0, "whole extent allocated");
+      ASSERT_TRUE(stat(TESTPF, &st) == 0, "file size");
+      size = st.st_size;
+      while (fh.totalNumPages < allocated)
+        TEST_CHECK(appendEmptyBlock(&fh));
+      ASSERT_EQUALS_PAGE(allocated, getAllocatedNumPages(&fh), "no new extent");
+      ASSERT_TRUE(stat(TESTPF, &st) == 0 && st.st_size == size, "file not written");
+      memset(ph, 0xff, PAGE_SIZE);
+      TEST_CHECK(readBlock(fh.totalNumPages - 1, &fh, ph));
+      for (i = 0; i < PAGE_SIZE && ph[i] == 0; i++)
+        ;
+      ASSERT_EQUALS_INT(PAGE_SIZE, i, "appended page is zeros");
+
+      // one more takes the next extent
+      TEST_CHECK(ensureCapacity(allocated + 1, &fh));
+      ASSERT_EQUALS_PAGE(allocated + 1, fh.totalNumPages, "logical size");
+      ASSERT_TRUE(getAllocatedNumPages(&fh) >= allocated + EXTENT_PAGES, "next extent allocated");
+      ASSERT_TRUE(stat(TESTPF, &st) == 0 && st.st_size > size, "file grown");
+      size = st.st_size;
+      TEST_CHECK(closePageFile(&fh));
+
+      // close drops the unused tail
+      ASSERT_TRUE(stat(TESTPF, &st) == 0 && st.st_size < size, "tail trimmed");
+      TEST_CHECK(openPageFile(TESTPF, &fh));
+      ASSERT_EQUALS_PAGE(allocated + 1, fh.totalNumPages, "size kept");
+      ASSERT_EQUALS_PAGE(fh.totalNumPages, getAllocatedNumPages(&fh), "nothing allocated past the end");
+
+      // extents of one page, the smallest
+      TEST_CHECK(setExtentSize(0, &fh));
+      TEST_CHECK(appendEmptyBlock(&fh));
+      ASSERT_EQUALS_PAGE(fh.totalNumPages, getAllocatedNumPages(&fh), "page by page");
+      TEST_CHECK(closePageFile(&fh));
+      rc = setExtentSize(EXTENT_PAGES, &fh);
+      ASSERT_EQUALS_INT(RC_FILE_HANDLE_NOT_INIT, rc, "closed handle");
+      ASSERT_EQUALS_PAGE(-1, getAllocatedNumPages(&fh), "nothing allocated by a closed handle");
+    }
+
+  // threads appending to one handle each add their pages
+  TEST_CHECK(openPageFile(TESTPF, &fh));
+  allocated = fh.totalNumPages;
+  for (i = 0; i < APPEND_THREADS; i++)
+    pthread_create(&tid[i], NULL, appendBlocks, &fh);
+  for (i = 0; i < APPEND_THREADS; i++)
+    pthread_join(tid[i], NULL);
+  ASSERT_EQUALS_PAGE(allocated + APPEND_THREADS * APPENDS_PER_THREAD, fh.totalNumPages, "no append lost");
+  TEST_CHECK(closePageFile(&fh));
+  TEST_CHECK(destroyPageFile(TESTPF));
+
+  free(ph);
+
+  TEST_DONE();
+}
+
+// ************************************************************
+void
+testFreePages (void)
+{
+  SM_FileHandle fh;
+  SM_PageHandle ph, pages[4];
+  PageNumber group = PAGE_SIZE * 8;     // pages per free space map page
+  PageNumber pn;
+  int i;
+
+  testName = "test free page map";
+
+  ph = (SM_PageHandle) malloc(PAGE_SIZE);
+  destroyPageFile(TESTPF);
+  TEST_CHECK(createPageFile(TESTPF));
+  TEST_CHECK(openPageFile(TESTPF, &fh));
+
+  // nothing free yet, so pages are appended
+  TEST_CHECK(allocatePage(&fh, &pn));
+  ASSERT_EQUALS_PAGE(1, pn, "first allocation appends");
+  TEST_CHECK(allocatePage(&fh, &pn));
+  ASSERT_EQUALS_PAGE(2, pn, "second allocation appends");
+  for (i = 0; i < 3; i++)
+    {
+      stampPage(ph, i + 100);
+      TEST_CHECK(writeBlock(i, &fh, ph));
+    }
+
+  // freed pages are reused lowest first, and come back empty
+  ASSERT_TRUE(!isPageFree(1, &fh), "page in use");
+  TEST_CHECK(freePage(2, &fh));
+  TEST_CHECK(freePage(1, &fh));
+  ASSERT_TRUE(isPageFree(1, &fh) && isPageFree(2, &fh), "pages are free");
+  ASSERT_ERROR(freePage(1, &fh), "double free fails");
+  ASSERT_ERROR(freePage(3, &fh), "free past end fails");
+
+  TEST_CHECK(allocatePage(&fh, &pn));
+  ASSERT_EQUALS_PAGE(1, pn, "lowest free page reused");
+  TEST_CHECK(readBlock(pn, &fh, ph));
+  ASSERT_EQUALS_PAGE(0, *(PageNumber*) ph, "reused page is empty");
+  ASSERT_EQUALS_PAGE(3, fh.totalNumPages, "file did not grow");
+
+  // free pages in a later group, then reopen
+  TEST_CHECK(ensureCapacity(group + 10, &fh));
+  TEST_CHECK(freePage(group + 5, &fh));
+  TEST_CHECK(closePageFile(&fh));
+
+  TEST_CHECK(openPageFile(TESTPF, &fh));
+  ASSERT_TRUE(isPageFree(2, &fh), "free page survives reopen");
+  ASSERT_TRUE(isPageFree(group + 5, &fh), "free page of 2nd group survives reopen");
+  ASSERT_TRUE(!isPageFree(1, &fh), "reused page survives reopen");
+  TEST_CHECK(readBlock(0, &fh, ph));
+  ASSERT_EQUALS_PAGE(100, *(PageNumber*) ph, "page 0 kept");
+  TEST_CHECK(allocatePage(&fh, &pn));
+  ASSERT_EQUALS_PAGE(2, pn, "reuse after reopen");
+  TEST_CHECK(allocatePage(&fh, &pn));
+  ASSERT_EQUALS_PAGE(group + 5, pn, "reuse in 2nd group");
+  TEST_CHECK(allocatePage(&fh, &pn));
+  ASSERT_EQUALS_PAGE(group + 10, pn, "append when nothing is free");
+
+  // a run of pages across a map page
+  for (i = 0; i < 4; i++)
+    {
+      pages[i] = (SM_PageHandle) malloc(PAGE_SIZE);
+      stampPage(pages[i], group - 2 + i);
+    }
+  TEST_CHECK(writeBlocks(group - 2, 4, &fh, pages));
+  for (i = 0; i < 4; i++)
+    memset(pages[i], 0, PAGE_SIZE);
+  TEST_CHECK(readBlocks(group - 2, 4, &fh, pages));
+  for (i = 0; i < 4; i++)
+    {
+      ASSERT_EQUALS_PAGE(group - 2 + i, *(PageNumber*) pages[i], "run across map page");
+      free(pages[i]);
+    }
+  ASSERT_TRUE(isPageFree(2, &fh) == 0 && isPageFree(group, &fh) == 0, "map pages not overwritten");
+
+  TEST_CHECK(closePageFile(&fh));
+  TEST_CHECK(destroyPageFile(TESTPF));
+  free(ph);
+
+  TEST_DONE();
+}
+
+// ************************************************************
+void
+testFreePagesInTable (void)
+{
+  RM_TableData *table = (RM_TableData *) malloc(sizeof(RM_TableData));
+  SM_FileHandle fh;
+  Schema *schema;
+  Record *r;
+  RID rids[2000];
+  char *names[] = { "a" };
+  DataType dt[] = { DT_STRING };
+  int sizes[] = { 100 };
+  int keys[] = { 0 };
+  PageNumber pages;
+  int round, i, n;
+
+  testName = "test tables reuse freed pages";
+
+  // delete all records, then insert again
+  schema = createSchema(1, names, dt, sizes, 1, keys);
+  TEST_CHECK(createTable("test_table_free", schema));
+  TEST_CHECK(openTable(table, "test_table_free"));
+  TEST_CHECK(createRecord(&r, schema));
+  for (round = 0; round < 3; round++)
+    {
+      for (i = 0; i < 2000; i++)
+        {
+          TEST_CHECK(insertRecord(table, r));
+          rids[i] = r->id;
+        }
+      for (i = 0; i < 2000; i++)
+        TEST_CHECK(deleteRecord(table, rids[i]));
+      ASSERT_EQUALS_INT(0, getNumTuples(table), "table is empty");
+
+      // free pages and free space list survive reopen
+      TEST_CHECK(closeTable(table));
+      TEST_CHECK(openTable(table, "test_table_free"));
+    }
+
+  // scans see only live records
+  for (i = 0; i < 10; i++)
+    TEST_CHECK(insertRecord(table, r));
+  {
+    RM_ScanHandle *sc = (RM_ScanHandle *) malloc(sizeof(RM_ScanHandle));
+    TEST_CHECK(startScan(table, sc, NULL));
+    for (n = 0; next(sc, r) == RC_OK; n++)
+      ;
+    TEST_CHECK(closeScan(sc));
+    free(sc);
+  }
+  ASSERT_EQUALS_INT(10, n, "scan after churn");
+  TEST_CHECK(closeTable(table));
+
+  TEST_CHECK(openPageFile("test_table_free", &fh));
+  pages = fh.totalNumPages;
+  TEST_CHECK(closePageFile(&fh));
+  ASSERT_TRUE(pages <= 2000 / (PAGE_SIZE / 101) + 2, "table file does not grow with churn");
+  TEST_CHECK(deleteTable("test_table_free"));
+  freeRecord(r);
+  freeSchema(schema);
+
+  free(table);
+
+  TEST_DONE();
+}
+
+// ************************************************************
+void
+testFreeIndexNodes (void)
+{
+  BTreeHandle *tree;
+  BT_ScanHandle *sc;
+  SM_FileHandle fh;
+  Value *key;
+  RID rid;
+  PageNumber pages = 0;
+  int i, n, round;
+  RC rc;
+
+  testName = "test b-tree frees merged nodes";
+
+  TEST_CHECK(initIndexManager(NULL));
+  TEST_CHECK(createBtree("testidx", DT_INT, 2));
+  TEST_CHECK(openBtree(&tree, "testidx"));
+  MAKE_VALUE(key, DT_INT, 0);
+
+  // leaves 1:[1,2] 2:[3,4] 4:[5], root 3
+  for (i = 1; i <= 5; i++)
+    {
+      key->v.intV = rid.page = rid.slot = i;
+      TEST_CHECK(insertKey(tree, key, rid));
+    }
+  TEST_CHECK(getNumNodes(tree, &n));
+  ASSERT_EQUALS_INT(4, n, "root and 3 leaves");
+
+  // left most leaf runs empty, its only neighbor is right of it
+  for (i = 1; i <= 2; i++)
+    {
+      key->v.intV = i;
+      TEST_CHECK(deleteKey(tree, key));
+    }
+  TEST_CHECK(getNumNodes(tree, &n));
+  ASSERT_EQUALS_INT(3, n, "leaf merged with right neighbor");
+  key->v.intV = 1;
+  ASSERT_ERROR(findKey(tree, key, &rid), "deleted key is gone");
+  key->v.intV = 4;
+  TEST_CHECK(findKey(tree, key, &rid));
+  ASSERT_EQUALS_PAGE(4, rid.page, "moved key found");
+
+  // leaf chain skips the freed leaf
+  TEST_CHECK(openTreeScan(tree, &sc));
+  for (i = 3; (rc = nextEntry(sc, &rid)) == RC_OK; i++)
+    ASSERT_EQUALS_PAGE(i, rid.page, "scan in key order");
+  ASSERT_EQUALS_INT(RC_IM_NO_MORE_ENTRIES, rc, "scan ends");
+  ASSERT_EQUALS_INT(6, i, "scan sees 3 keys");
+  TEST_CHECK(closeTreeScan(sc));
+  TEST_CHECK(closeBtree(tree));
+
+  TEST_CHECK(openPageFile("testidx", &fh));
+  ASSERT_TRUE(isPageFree(2, &fh), "right neighbor page is free");
+  TEST_CHECK(closePageFile(&fh));
+
+  // next split reuses it
+  TEST_CHECK(openBtree(&tree, "testidx"));
+  for (i = 6; i <= 7; i++)
+    {
+      key->v.intV = rid.page = rid.slot = i;
+      TEST_CHECK(insertKey(tree, key, rid));
+    }
+  TEST_CHECK(closeBtree(tree));
+  TEST_CHECK(openPageFile("testidx", &fh));
+  ASSERT_TRUE(!isPageFree(2, &fh), "freed page reused");
+  ASSERT_EQUALS_PAGE(5, fh.totalNumPages, "file did not grow");
+  TEST_CHECK(closePageFile(&fh));
+  TEST_CHECK(deleteBtree("testidx"));
+
+  // fill and empty again, merges and moves between inner nodes too
+  TEST_CHECK(createBtree("testidx", DT_INT, 4));
+  for (round = 0; round < 3; round++)
+    {
+      TEST_CHECK(openBtree(&tree, "testidx"));
+      for (i = 0; i < INDEX_KEYS; i++)
+        {
+          key->v.intV = rid.page = rid.slot = (i * 7) % INDEX_KEYS;
+          TEST_CHECK(insertKey(tree, key, rid));
+        }
+      for (i = 0; i < INDEX_KEYS; i++)
+        if ((i * 13) % INDEX_KEYS % 2)
+          {
+            key->v.intV = (i * 13) % INDEX_KEYS;
+            TEST_CHECK(deleteKey(tree, key));
+          }
+      for (i = 0; i < INDEX_KEYS; i++)
+        {
+          key->v.intV = i;
+          rc = findKey(tree, key, &rid);
+          if (i % 2)
+            ASSERT_TRUE(rc == RC_IM_KEY_NOT_FOUND, "odd keys deleted");
+          else
+            ASSERT_TRUE(rc == RC_OK && rid.page == i, "even keys kept");
+        }
+      for (i = INDEX_KEYS - 2; i >= 0; i -= 2)
+        {
+          key->v.intV = i;
+          TEST_CHECK(deleteKey(tree, key));
+        }
+      TEST_CHECK(getNumEntries(tree, &n));
+      ASSERT_EQUALS_INT(0, n, "tree is empty");
+      TEST_CHECK(getNumNodes(tree, &n));
+      ASSERT_EQUALS_INT(0, n, "all nodes freed");
+      TEST_CHECK(closeBtree(tree));
+
+      TEST_CHECK(openPageFile("testidx", &fh));
+      if (!round)
+        pages = fh.totalNumPages;
+      ASSERT_EQUALS_PAGE(pages, fh.totalNumPages, "index file does not grow with churn");
+      TEST_CHECK(closePageFile(&fh));
+    }
+  TEST_CHECK(deleteBtree("testidx"));
+  TEST_CHECK(shutdownIndexManager());
+  initStorageManager(); // shut down with the index manager
+  free(key);
+
+  TEST_DONE();
+}
+
+// ************************************************************
+void
+testTablespace (void)
+{
+  SM_FileHandle fa, fb, fc;
+  SM_PageHandle ph, pages[4];
+  PageNumber tsPages, pn;
+  int i, files;
+
+  testName = "test segments of a tablespace";
+
+  ph = (SM_PageHandle) malloc(PAGE_SIZE);
+  destroyPageFile(TESTTS);
+  TEST_CHECK(createTablespace(TESTTS, PAGE_SIZE));
+  TEST_CHECK(openTablespace(TESTTS));
+  TEST_CHECK(createPageFile(TESTTS ":a"));
+  TEST_CHECK(createPageFile(TESTTS ":b"));
+  ASSERT_ERROR(createPageFile(TESTTS ":a"), "segment exists");
+  ASSERT_ERROR(createPageFileWithPageSize(TESTTS ":c", 2 * PAGE_SIZE), "page size is the tablespace's");
+  ASSERT_ERROR(openPageFile(TESTTS ":c", &fc), "no such segment");
+
+  // segments do not cost a file open
+  files = countOpenFiles();
+  TEST_CHECK(openPageFile(TESTTS ":a", &fa));
+  TEST_CHECK(openPageFile(TESTTS ":b", &fb));
+  ASSERT_EQUALS_INT(files, countOpenFiles(), "no fd per segment");
+  ASSERT_EQUALS_PAGE(1, fa.totalNumPages, "new segment has 1 page");
+  ASSERT_ERROR(openPageFile(TESTTS ":a", &fc), "one handle per segment");
+
+  // interleaved writes, each segment gets its own extents
+  for (i = 0; i < 40; i++)
+    {
+      stampPage(ph, 1000 + i);
+      TEST_CHECK(writeBlock(i, &fa, ph));
+      stampPage(ph, 2000 + i);
+      TEST_CHECK(writeBlock(i, &fb, ph));
+    }
+  for (i = 0; i < 4; i++)
+    {
+      pages[i] = (SM_PageHandle) malloc(PAGE_SIZE);
+      stampPage(pages[i], 3000 + i);
+    }
+  TEST_CHECK(writeBlocks(SM_SEGMENT_EXTENT_PAGES - 3, 4, &fb, pages));
+  TEST_CHECK(readBlocks(SM_SEGMENT_EXTENT_PAGES - 3, 4, &fa, pages));
+  for (i = 0; i < 4; i++)
+    {
+      ASSERT_EQUALS_PAGE(1000 + SM_SEGMENT_EXTENT_PAGES - 3 + i, *(PageNumber*) pages[i], "run across extents");
+      free(pages[i]);
+    }
+
+  // free page map of a segment
+  TEST_CHECK(freePage(7, &fa));
+  TEST_CHECK(allocatePage(&fa, &pn));
+  ASSERT_EQUALS_PAGE(7, pn, "segment page reused");
+  TEST_CHECK(closePageFile(&fa));
+  TEST_CHECK(closePageFile(&fb));
+
+  // everything survives closing the tablespace
+  TEST_CHECK(closeTablespace(TESTTS));
+  TEST_CHECK(openPageFile(TESTTS ":b", &fb));
+  ASSERT_EQUALS_PAGE(40, fb.totalNumPages, "segment size kept");
+  for (i = 0; i < 40; i++)
+    {
+      TEST_CHECK(readBlock(i, &fb, ph));
+      ASSERT_EQUALS_PAGE(i >= SM_SEGMENT_EXTENT_PAGES - 3 && i < SM_SEGMENT_EXTENT_PAGES + 1 ?
+                         3000 + i - SM_SEGMENT_EXTENT_PAGES + 3 : 2000 + i,
+                         *(PageNumber*) ph, "segment page kept");
+    }
+  TEST_CHECK(closePageFile(&fb));
+
+  TEST_CHECK(openPageFile(TESTTS, &fc));
+  tsPages = fc.totalNumPages;
+  TEST_CHECK(closePageFile(&fc));
+
+  // extents of a dropped segment are reused, and read as zeros
+  TEST_CHECK(destroyPageFile(TESTTS ":a"));
+  ASSERT_ERROR(destroyPageFile(TESTTS ":a"), "segment is gone");
+  TEST_CHECK(createPageFile(TESTTS ":c"));
+  TEST_CHECK(openPageFile(TESTTS ":c", &fc));
+  TEST_CHECK(ensureCapacity(40, &fc));
+  for (i = 0; i < 40; i++)
+    {
+      TEST_CHECK(readBlock(i, &fc, ph));
+      ASSERT_EQUALS_PAGE(0, *(PageNumber*) ph, "reused extent is empty");
+    }
+  TEST_CHECK(closePageFile(&fc));
+
+  TEST_CHECK(openPageFile(TESTTS, &fc));
+  ASSERT_EQUALS_PAGE(tsPages, fc.totalNumPages, "tablespace did not grow");
+  TEST_CHECK(closePageFile(&fc));
+
+  // a plain page file is no tablespace
+  destroyPageFile(TESTPF);
+  TEST_CHECK(createPageFile(TESTPF));
+  ASSERT_ERROR(createPageFile(TESTPF ":a"), "not a tablespace");
+  TEST_CHECK(destroyPageFile(TESTPF));
+
+  TEST_CHECK(destroyPageFile(TESTTS));
+  free(ph);
+
+  TEST_DONE();
+}
+
+// ************************************************************
+void
+testTablesInTablespace (void)
+{
+  RM_TableData *tables = (RM_TableData *) malloc(100 * sizeof(RM_TableData));
+  BTreeHandle *tree;
+  Schema *schema;
+  Record *r;
+  Value *key;
+  RID rid;
+  char *names[] = { "a" };
+  DataType dt[] = { DT_INT };
+  int sizes[] = { 0 };
+  int keys[] = { 0 };
+  char name[64];
+  int i, j, files, n;
+
+  testName = "test tables and indexes in a tablespace";
+
+  destroyPageFile(TESTTS);
+  TEST_CHECK(createTablespace(TESTTS, PAGE_SIZE));
+  TEST_CHECK(openTablespace(TESTTS));
+
+  // more tables than fit a directory page
+  schema = createSchema(1, names, dt, sizes, 1, keys);
+  TEST_CHECK(createRecord(&r, schema));
+  for (i = 0; i < 100; i++)
+    {
+      sprintf(name, "%s:table%d", TESTTS, i);
+      TEST_CHECK(createTable(name, schema));
+    }
+
+  // all open at once, without a file open each
+  files = countOpenFiles();
+  for (i = 0; i < 100; i++)
+    {
+      sprintf(name, "%s:table%d", TESTTS, i);
+      TEST_CHECK(openTable(&tables[i], name));
+      for (j = 0; j < 5; j++)
+        TEST_CHECK(insertRecord(&tables[i], r));
+    }
+  ASSERT_EQUALS_INT(files, countOpenFiles(), "no fd per table");
+  for (i = 0; i < 100; i++)
+    TEST_CHECK(closeTable(&tables[i]));
+
+  // an index next to them
+  TEST_CHECK(initIndexManager(NULL));
+  TEST_CHECK(createBtree(TESTTS ":index", DT_INT, 100));
+  TEST_CHECK(openBtree(&tree, TESTTS ":index"));
+  for (i = 0; i < 500; i++)
+    {
+      MAKE_VALUE(key, DT_INT, i);
+      rid.page = i;
+      rid.slot = 0;
+      TEST_CHECK(insertKey(tree, key, rid));
+      freeVal(key);
+    }
+  TEST_CHECK(closeBtree(tree));
+  TEST_CHECK(closeTablespace(TESTTS));
+
+  // reopen
+  TEST_CHECK(openBtree(&tree, TESTTS ":index"));
+  TEST_CHECK(getNumEntries(tree, &n));
+  ASSERT_EQUALS_INT(500, n, "index entries kept");
+  for (i = 0; i < 500; i += 37)
+    {
+      MAKE_VALUE(key, DT_INT, i);
+      TEST_CHECK(findKey(tree, key, &rid));
+      ASSERT_EQUALS_INT(i, (int) rid.page, "key found");
+      freeVal(key);
+    }
+  TEST_CHECK(closeBtree(tree));
+  TEST_CHECK(deleteBtree(TESTTS ":index"));
+  TEST_CHECK(shutdownIndexManager());
+  initStorageManager(); // shut down with the index manager
+
+  for (i = 0; i < 100; i++)
+    {
+      sprintf(name, "%s:table%d", TESTTS, i);
+      TEST_CHECK(openTable(&tables[i], name));
+      ASSERT_EQUALS_INT(5, getNumTuples(&tables[i]), "table records kept");
+      TEST_CHECK(closeTable(&tables[i]));
+      TEST_CHECK(deleteTable(name));
+    }
+
+  TEST_CHECK(destroyPageFile(TESTTS));
+  freeRecord(r);
+  freeSchema(schema);
+  free(tables);
+
+  TEST_DONE();
+}
+
+// ************************************************************
+void
+testDurability (void)
+{
+  SM_FileHandle fh;
+  SM_PageHandle ph;
+  BM_BufferPool *bm = MAKE_POOL();
+  BM_PageHandle *h = MAKE_PAGE_HANDLE();
+  pthread_t tid[SYNC_THREADS];
+  long long syncs;
+  RC rc;
+  int i;
+
+  testName = "test durability modes";
+
+  ph = (SM_PageHandle) malloc(PAGE_SIZE);
+  destroyPageFile(TESTPF);
+  TEST_CHECK(createPageFile(TESTPF));
+
+  // no durability by default, sync is a no-op
+  TEST_CHECK(openPageFile(TESTPF, &fh));
+  stampPage(ph, 1);
+  TEST_CHECK(writeBlock(0, &fh, ph));
+  TEST_CHECK(syncPageFile(&fh));
+  ASSERT_EQUALS_INT(0, (int) getNumSyncs(&fh), "no sync without durability");
+  rc = setDurability(&fh, SM_DURABILITY_GROUP + 1, 0);
+  ASSERT_EQUALS_INT(RC_INVALID_DURABILITY, rc, "unknown mode");
+  rc = setDurability(&fh, SM_DURABILITY_GROUP, -1);
+  ASSERT_EQUALS_INT(RC_INVALID_DURABILITY, rc, "negative group window");
+  TEST_CHECK(closePageFile(&fh));
+
+  // one sync per call
+  TEST_CHECK(openPageFileWithFlags(TESTPF, &fh, SM_OPEN_SYNC));
+  for (i = 0; i < 5; i++)
+    {
+      TEST_CHECK(writeBlock(i, &fh, ph));
+      TEST_CHECK(syncPageFile(&fh));
+    }
+  ASSERT_EQUALS_INT(5, (int) getNumSyncs(&fh), "sync per call");
+
+  // concurrent callers share syncs
+  TEST_CHECK(setDurability(&fh, SM_DURABILITY_GROUP, 2000));
+  for (i = 0; i < SYNC_THREADS; i++)
+    pthread_create(&tid[i], NULL, writeAndSync, &fh);
+  for (i = 0; i < SYNC_THREADS; i++)
+    pthread_join(tid[i], NULL);
+  syncs = getNumSyncs(&fh) - 5;
+  ASSERT_TRUE(syncs > 0 && syncs < SYNC_THREADS * SYNCS_PER_THREAD, "group commit shares syncs");
+  TEST_CHECK(closePageFile(&fh));
+
+  // forcePage of a durable buffer pool syncs
+  TEST_CHECK(initBufferPoolWithFlags(bm, TESTPF, 3, RS_FIFO, NULL, SM_OPEN_GROUP_COMMIT));
+  TEST_CHECK(pinPage(bm, h, 2));
+  stampPage(h->data, 42);
+  TEST_CHECK(markDirty(bm, h));
+  TEST_CHECK(forcePage(bm, h));
+  TEST_CHECK(unpinPage(bm, h));
+  ASSERT_EQUALS_INT(1, (int) getNumSyncs(&((BM_Pool_MgmtData*) bm->mgmtData)->fh), "forcePage synced");
+  TEST_CHECK(shutdownBufferPool(bm));
+  TEST_CHECK(destroyPageFile(TESTPF));
+
+  // a segment syncs its tablespace file, and saves its size first
+  destroyPageFile(TESTTS);
+  TEST_CHECK(createTablespace(TESTTS, PAGE_SIZE));
+  TEST_CHECK(createPageFile(TESTTS ":s"));
+  TEST_CHECK(openPageFileWithFlags(TESTTS ":s", &fh, SM_OPEN_SYNC));
+  TEST_CHECK(ensureCapacity(30, &fh));
+  TEST_CHECK(syncPageFile(&fh));
+  ASSERT_EQUALS_INT(1, (int) getNumSyncs(&fh), "segment synced");
+  TEST_CHECK(closePageFile(&fh));
+  TEST_CHECK(destroyPageFile(TESTTS));
+
+  free(ph);
+  free(h);
+  free(bm);
+
+  TEST_DONE();
+}
+
+// ************************************************************
+void
+testCompressedPageFile (void)
+{
+  SM_FileHandle fh;
+  SM_PageHandle ph, expect, mapped;
+  BM_BufferPool *bm = MAKE_POOL();
+  BM_PageHandle *h = MAKE_PAGE_HANDLE();
+  struct stat st;
+  PageNumber pn;
+  int i, j;
+
+  testName = "test compressed page file";
+
+  ph = (SM_PageHandle) malloc(PAGE_SIZE);
+  expect = (SM_PageHandle) malloc(PAGE_SIZE);
+  destroyPageFile(TESTPF);
+  TEST_CHECK(createCompressedPageFile(TESTPF, PAGE_SIZE));
+  ASSERT_ERROR(createCompressedPageFile(TESTTS ":a", PAGE_SIZE), "no compressed segments");
+  TEST_CHECK(openPageFileWithFlags(TESTPF, &fh, SM_OPEN_MMAP));
+  ASSERT_EQUALS_PAGE(1, fh.totalNumPages, "new file has 1 page");
+  TEST_CHECK(readBlock(0, &fh, ph));
+  ASSERT_EQUALS_PAGE(0, *(PageNumber*) ph, "new page is empty");
+  ASSERT_ERROR(getBlockPtr(0, &fh, &mapped), "compressed file is not mapped");
+
+  // record like pages shrink
+  for (i = 0; i < 100; i++)
+    {
+      fillRecordPage(ph, i);
+      TEST_CHECK(writeBlock(i, &fh, ph));
+    }
+  ASSERT_TRUE(getStoredBytes(&fh) < 100 * PAGE_SIZE / 4, "pages compressed");
+
+  // incompressible pages, then compressible again, move records around
+  for (i = 0; i < 100; i += 3)
+    {
+      for (j = 0; j < PAGE_SIZE; j++)
+        ph[j] = (char) rand();
+      TEST_CHECK(writeBlock(i, &fh, ph));
+      TEST_CHECK(readBlock(i, &fh, expect));
+      ASSERT_TRUE(memcmp(ph, expect, PAGE_SIZE) == 0, "random page kept");
+    }
+  for (i = 0; i < 100; i += 6)
+    {
+      fillRecordPage(ph, i);
+      TEST_CHECK(writeBlock(i, &fh, ph));
+    }
+
+  // free page map is stored compressed too
+  TEST_CHECK(freePage(50, &fh));
+  TEST_CHECK(allocatePage(&fh, &pn));
+  ASSERT_EQUALS_PAGE(50, pn, "freed page reused");
+  fillRecordPage(ph, 50);
+  TEST_CHECK(writeBlock(50, &fh, ph));
+  TEST_CHECK(ensureCapacity(300, &fh));
+  TEST_CHECK(closePageFile(&fh));
+
+  // everything survives reopening
+  TEST_CHECK(openPageFile(TESTPF, &fh));
+  ASSERT_EQUALS_PAGE(300, fh.totalNumPages, "size kept");
+  for (i = 0; i < 300; i++)
+    {
+      TEST_CHECK(readBlock(i, &fh, ph));
+      if (i >= 100)
+        ASSERT_EQUALS_PAGE(0, *(PageNumber*) ph, "page past the written ones is empty");
+      else if (i % 3 != 0 || i % 6 == 0)
+        {
+          fillRecordPage(expect, i);
+          ASSERT_TRUE(memcmp(ph, expect, PAGE_SIZE) == 0, "record page kept");
+        }
+    }
+  ASSERT_TRUE(isPageFree(50, &fh) == 0, "free page map kept");
+  TEST_CHECK(closePageFile(&fh));
+  stat(TESTPF, &st);
+  ASSERT_TRUE(st.st_size < 100 * PAGE_SIZE, "file smaller than its pages");
+
+  // buffer pool sees plain pages
+  TEST_CHECK(initBufferPool(bm, TESTPF, 3, RS_LRU, NULL));
+  for (i = 200; i < 210; i++)
+    {
+      TEST_CHECK(pinPage(bm, h, i));
+      fillRecordPage(h->data, i);
+      TEST_CHECK(markDirty(bm, h));
+      TEST_CHECK(unpinPage(bm, h));
+    }
+  TEST_CHECK(shutdownBufferPool(bm));
+  TEST_CHECK(openPageFile(TESTPF, &fh));
+  for (i = 200; i < 210; i++)
+    {
+      TEST_CHECK(readBlock(i, &fh, ph));
+      fillRecordPage(expect, i);
+      ASSERT_TRUE(memcmp(ph, expect, PAGE_SIZE) == 0, "page written through buffer pool");
+    }
+  TEST_CHECK(closePageFile(&fh));
+  TEST_CHECK(destroyPageFile(TESTPF));
+
+  free(ph);
+  free(expect);
+  free(h);
+  free(bm);
+
+  TEST_DONE();
+}
+
+// ************************************************************
+void
+testPageChecksums (void)
+{
+  SM_FileHandle fh;
+  SM_PageHandle ph, mapped, pages[10];
+  SM_AsyncQueue *queue;
+  SM_AsyncTicket ticket;
+  long long allFailures;
+  off_t offset;
+  char byte;
+  int fd, i;
+  RC rc;
+
+  testName = "test page checksums";
+
+  ph = (SM_PageHandle) malloc(PAGE_SIZE);
+  for (i = 0; i < 10; i++)
+    pages[i] = (SM_PageHandle) malloc(PAGE_SIZE);
+  destroyPageFile(TESTPF);
+  TEST_CHECK(createPageFile(TESTPF));
+  TEST_CHECK(openPageFile(TESTPF, &fh));
+  for (i = 0; i < CHECKSUM_PAGES; i++)
+    {
+      stampPage(ph, i);
+      TEST_CHECK(writeBlock(i, &fh, ph));
+    }
+  TEST_CHECK(closePageFile(&fh));
+
+  // good pages pass, single and in runs across map pages
+  TEST_CHECK(openPageFile(TESTPF, &fh));
+  for (i = 0; i < CHECKSUM_PAGES; i++)
+    {
+      TEST_CHECK(readBlock(i, &fh, ph));
+      ASSERT_EQUALS_PAGE(i, *(PageNumber*) ph, "page read back");
+    }
+  for (i = 0; i < CHECKSUM_PAGES; i += 10)
+    TEST_CHECK(readBlocks(i, 10, &fh, pages));
+  ASSERT_EQUALS_PAGE(0, getChecksumFailures(&fh), "no failures");
+  TEST_CHECK(closePageFile(&fh));
+
+  // flip a byte on disk, behind the storage manager's back
+  allFailures = getChecksumFailures(NULL);
+  offset = findPageOffset(TESTPF, CORRUPT_PAGE);
+  ASSERT_TRUE(offset > 0, "page found in file");
+  fd = open(TESTPF, O_RDWR);
+  ASSERT_TRUE(pread(fd, &byte, 1, offset + 100) == 1, "read byte");
+  byte ^= 0x10;
+  ASSERT_TRUE(pwrite(fd, &byte, 1, offset + 100) == 1, "flip byte");
+  close(fd);
+
+  TEST_CHECK(openPageFile(TESTPF, &fh));
+  rc = readBlock(CORRUPT_PAGE, &fh, ph);
+  ASSERT_EQUALS_INT(RC_CHECKSUM_MISMATCH, rc, "corrupt page detected");
+  rc = readBlocks(CORRUPT_PAGE - 5, 10, &fh, pages);
+  ASSERT_EQUALS_INT(RC_CHECKSUM_MISMATCH, rc, "corrupt page in a run detected");
+  TEST_CHECK(readBlock(CORRUPT_PAGE + 1, &fh, ph));
+  ASSERT_EQUALS_PAGE(2, getChecksumFailures(&fh), "failures of the file counted");
+  ASSERT_EQUALS_PAGE(allFailures + 2, getChecksumFailures(NULL), "failures of all files counted");
+
+  // also through the async queue
+  TEST_CHECK(initAsyncQueue(&queue, 4, SM_ASYNC_DEFAULT));
+  TEST_CHECK(submitReadBlocks(queue, CORRUPT_PAGE, 1, &fh, pages, &ticket));
+  rc = waitAsyncIO(queue, ticket);
+  ASSERT_EQUALS_INT(RC_CHECKSUM_MISMATCH, rc, "async read detects corrupt page");
+  TEST_CHECK(submitReadBlocks(queue, CORRUPT_PAGE + 1, 1, &fh, pages, &ticket));
+  TEST_CHECK(waitAsyncIO(queue, ticket));
+  TEST_CHECK(shutdownAsyncQueue(queue));
+  TEST_CHECK(closePageFile(&fh));
+
+  // async writes keep checksums in memory until close, on both backends
+  for (i = 0; i < 10; i++)
+    stampPage(pages[i], i);
+  TEST_CHECK(openPageFile(TESTPF, &fh));
+  TEST_CHECK(initAsyncQueue(&queue, 4, SM_ASYNC_DEFAULT));
+  TEST_CHECK(submitWriteBlocks(queue, 0, 10, &fh, pages, &ticket));
+  TEST_CHECK(waitAsyncIO(queue, ticket));
+  TEST_CHECK(shutdownAsyncQueue(queue));
+  TEST_CHECK(initAsyncQueue(&queue, 4, SM_ASYNC_THREADS));
+  TEST_CHECK(submitWriteBlocks(queue, 10, 10, &fh, pages, &ticket));
+  TEST_CHECK(waitAsyncIO(queue, ticket));
+  TEST_CHECK(submitReadBlocks(queue, 0, 10, &fh, pages, &ticket));
+  TEST_CHECK(waitAsyncIO(queue, ticket));
+  TEST_CHECK(shutdownAsyncQueue(queue));
+  TEST_CHECK(closePageFile(&fh));
+  TEST_CHECK(openPageFile(TESTPF, &fh));
+  TEST_CHECK(readBlocks(0, 10, &fh, pages));
+  ASSERT_EQUALS_PAGE(9, *(PageNumber*) pages[9], "async write read back");
+  TEST_CHECK(readBlocks(10, 10, &fh, pages));
+  TEST_CHECK(closePageFile(&fh));
+
+  // checks can be skipped, and rewriting the page repairs it
+  TEST_CHECK(openPageFileWithFlags(TESTPF, &fh, SM_OPEN_NO_VERIFY));
+  TEST_CHECK(readBlock(CORRUPT_PAGE, &fh, ph));
+  ASSERT_EQUALS_PAGE(CORRUPT_PAGE, *(PageNumber*) ph, "unchecked read");
+  TEST_CHECK(closePageFile(&fh));
+  TEST_CHECK(openPageFile(TESTPF, &fh));
+  stampPage(ph, CORRUPT_PAGE);
+  TEST_CHECK(writeBlock(CORRUPT_PAGE, &fh, ph));
+  TEST_CHECK(readBlock(CORRUPT_PAGE, &fh, ph));
+  TEST_CHECK(closePageFile(&fh));
+
+  // a mapped handle checks the pages it copies out
+  TEST_CHECK(openPageFileWithFlags(TESTPF, &fh, SM_OPEN_MMAP));
+  TEST_CHECK(readBlock(CORRUPT_PAGE, &fh, ph));
+  ASSERT_EQUALS_PAGE(CORRUPT_PAGE, *(PageNumber*) ph, "repaired page read back");
+
+  // writes through getBlockPtr() leave no stale checksum behind
+  TEST_CHECK(getBlockPtr(CORRUPT_PAGE, &fh, &mapped));
+  mapped[100] ^= 0x10;
+  byte = mapped[100];
+  TEST_CHECK(readBlock(CORRUPT_PAGE, &fh, ph));
+  ASSERT_TRUE(ph[100] == byte, "pointer write read back");
+  TEST_CHECK(writeBlock(CORRUPT_PAGE, &fh, ph));
+  TEST_CHECK(readBlock(CORRUPT_PAGE, &fh, ph));
+  TEST_CHECK(closePageFile(&fh));
+  TEST_CHECK(openPageFile(TESTPF, &fh));
+  TEST_CHECK(readBlock(CORRUPT_PAGE, &fh, ph));
+  ASSERT_TRUE(ph[100] == byte, "pointer write kept on close");
+  TEST_CHECK(closePageFile(&fh));
+  TEST_CHECK(destroyPageFile(TESTPF));
+
+  free(ph);
+  for (i = 0; i < 10; i++)
+    free(pages[i]);
+
+  TEST_DONE();
+}
+
+// ************************************************************
+void
+testAccessHints (void)
+{
+  SM_FileHandle fh;
+  SM_PageHandle ph;
+  char *files[] = { TESTPF, TESTTS ":hints" };
+  int flags[] = { SM_OPEN_DEFAULT, SM_OPEN_MMAP, SM_OPEN_DIRECT };
+  int f, m, i;
+
+  testName = "test access pattern hints";
+
+  ph = (SM_PageHandle) malloc(PAGE_SIZE);
+  destroyPageFile(TESTTS);
+  TEST_CHECK(createTablespace(TESTTS, PAGE_SIZE));
+
+  // hints never change what is read, whatever the kind of file
+  for (f = 0; f < 2; f++)
+    for (m = 0; m < 3; m++)
+      {
+        destroyPageFile(files[f]);
+        TEST_CHECK(createPageFile(files[f]));
+        TEST_CHECK(openPageFileWithFlags(files[f], &fh, flags[m]));
+        TEST_CHECK(setAccessPattern(&fh, SM_ACCESS_SEQUENTIAL));
+        for (i = 0; i < 100; i++)
+          {
+            stampPage(ph, i);
+            TEST_CHECK(writeBlock(i, &fh, ph));
+          }
+        TEST_CHECK(adviseBlocks(0, 100, &fh, SM_ACCESS_DONTNEED));
+        TEST_CHECK(adviseBlocks(10, 50, &fh, SM_ACCESS_WILLNEED));
+        TEST_CHECK(setAccessPattern(&fh, SM_ACCESS_RANDOM));
+        for (i = 99; i >= 0; i -= 7)
+          {
+            TEST_CHECK(readBlock(i, &fh, ph));
+            ASSERT_EQUALS_PAGE(i, *(PageNumber*) ph, "page read after hints");
+          }
+        ASSERT_ERROR(setAccessPattern(&fh, SM_ACCESS_WILLNEED), "whole file takes a pattern only");
+        ASSERT_ERROR(adviseBlocks(0, 1, &fh, 99), "unknown hint");
+        ASSERT_ERROR(adviseBlocks(90, 20, &fh, SM_ACCESS_WILLNEED), "hint past the end");
+        TEST_CHECK(setAccessPattern(&fh, SM_ACCESS_NORMAL));
+        TEST_CHECK(closePageFile(&fh));
+        TEST_CHECK(destroyPageFile(files[f]));
+      }
+
+  // compressed pages take the hints, and ignore the ranges
+  TEST_CHECK(createCompressedPageFile(TESTPF, PAGE_SIZE));
+  TEST_CHECK(openPageFile(TESTPF, &fh));
+  TEST_CHECK(setAccessPattern(&fh, SM_ACCESS_SEQUENTIAL));
+  TEST_CHECK(adviseBlocks(0, 1, &fh, SM_ACCESS_WILLNEED));
+  TEST_CHECK(closePageFile(&fh));
+  TEST_CHECK(destroyPageFile(TESTPF));
+  TEST_CHECK(destroyPageFile(TESTTS));
+
+  free(ph);
+
+  TEST_DONE();
+}
+
+// ************************************************************
+// file offset of the page stamped pn, 0 if not found
+off_t
+findPageOffset (char *fileName, PageNumber pn)
+{
+  char page[PAGE_SIZE];
+  off_t offset;
+  int fd;
+
+  fd = open(fileName, O_RDONLY);
+  for (offset = SM_HEADER_SIZE; pread(fd, page, PAGE_SIZE, offset) == PAGE_SIZE;
+       offset += PAGE_SIZE)
+    if (*(PageNumber*) page == pn)
+      break;
+  if (*(PageNumber*) page != pn)
+    offset = 0;
+  close(fd);
+  return offset;
+}
+
+// ************************************************************
+void
+testConcurrentBlockIO (void)
+{
+  SM_FileHandle fh;
+  SM_PageHandle ph;
+  BlockThread args[BLOCK_THREADS];
+  pthread_t tid[BLOCK_THREADS];
+  int flags[] = { SM_OPEN_DEFAULT, SM_OPEN_MMAP, SM_OPEN_DIRECT };
+  int m, i;
+
+  testName = "test threads reading and writing one file";
+
+  ph = (SM_PageHandle) malloc(PAGE_SIZE);
+
+  // one handle, no locking by the callers; threads grow the file too
+  for (m = 0; m < 3; m++)
+    {
+      destroyPageFile(TESTPF);
+      TEST_CHECK(createPageFile(TESTPF));
+      TEST_CHECK(openPageFileWithFlags(TESTPF, &fh, flags[m]));
+      for (i = 0; i < BLOCK_SHARED; i++)
+        {
+          stampPage(ph, i);
+          TEST_CHECK(writeBlock(i, &fh, ph));
+        }
+      for (i = 0; i < BLOCK_THREADS; i++)
+        {
+          args[i].fh = &fh;
+          args[i].n = i;
+          pthread_create(&tid[i], NULL, readAndWrite, &args[i]);
+        }
+      for (i = 0; i < BLOCK_THREADS; i++)
+        pthread_join(tid[i], NULL);
+      ASSERT_EQUALS_PAGE(BLOCK_SHARED + BLOCK_THREADS * BLOCK_OWN, fh.totalNumPages, "file grown by all threads");
+      TEST_CHECK(closePageFile(&fh));
+
+      // what the threads wrote last
+      TEST_CHECK(openPageFile(TESTPF, &fh));
+      for (i = 0; i < BLOCK_THREADS * BLOCK_OWN; i++)
+        {
+          TEST_CHECK(readBlock(BLOCK_SHARED + i, &fh, ph));
+          if (*(PageNumber*) ph != BLOCK_ROUNDS - 1)
+            ASSERT_EQUALS_PAGE(BLOCK_ROUNDS - 1, *(PageNumber*) ph, "last write kept");
+        }
+      TEST_CHECK(closePageFile(&fh));
+    }
+  TEST_CHECK(destroyPageFile(TESTPF));
+
+  free(ph);
+
+  TEST_DONE();
+}
+
+// ************************************************************
+void
+testManyOpenFiles (void)
+{
+  SM_FileHandle *fhs;
+  SM_PageHandle ph;
+  char fileName[64];
+  int files, i, rc;
+
+  testName = "test many open files";
+
+  ph = (SM_PageHandle) malloc(PAGE_SIZE);
+  fhs = (SM_FileHandle*) malloc(MANY_FILES * sizeof(SM_FileHandle));
+  files = countOpenFiles();
+
+  // all open at once
+  for (i = 0; i < MANY_FILES; i++)
+    {
+      sprintf(fileName, "test_open_%d.bin", i);
+      destroyPageFile(fileName);
+      TEST_CHECK(createPageFile(fileName));
+      TEST_CHECK(openPageFile(fileName, &fhs[i]));
+      stampPage(ph, i);
+      TEST_CHECK(writeBlock(0, &fhs[i], ph));
+    }
+  ASSERT_EQUALS_INT(files + MANY_FILES, countOpenFiles(), "all files open");
+  for (i = 0; i < MANY_FILES; i++)
+    {
+      TEST_CHECK(readBlock(0, &fhs[i], ph));
+      if (*(PageNumber*) ph != i)
+        ASSERT_EQUALS_PAGE(i, *(PageNumber*) ph, "page of each file");
+    }
+
+  // close every other one, the rest stay valid
+  for (i = 0; i < MANY_FILES; i += 2)
+    TEST_CHECK(closePageFile(&fhs[i]));
+  for (i = 0; i < MANY_FILES; i++)
+    {
+      rc = readBlock(0, &fhs[i], ph);
+      if (i % 2 == 0 && rc != RC_FILE_HANDLE_NOT_INIT)
+        ASSERT_EQUALS_INT(RC_FILE_HANDLE_NOT_INIT, rc, "closed handle rejected");
+      if (i % 2 == 1 && *(PageNumber*) ph != i)
+        ASSERT_EQUALS_PAGE(i, *(PageNumber*) ph, "open handle still valid");
+    }
+
+  // and reopen them
+  for (i = 0; i < MANY_FILES; i += 2)
+    {
+      sprintf(fileName, "test_open_%d.bin", i);
+      TEST_CHECK(openPageFile(fileName, &fhs[i]));
+    }
+  for (i = 0; i < MANY_FILES; i++)
+    {
+      TEST_CHECK(readBlock(0, &fhs[i], ph));
+      if (*(PageNumber*) ph != i)
+        ASSERT_EQUALS_PAGE(i, *(PageNumber*) ph, "page after reopen");
+      rc = openPageFile(fhs[i].fileName, &fhs[i]);
+      if (rc != RC_FILE_HANDLE_IN_USE)
+        ASSERT_EQUALS_INT(RC_FILE_HANDLE_IN_USE, rc, "open handle in use");
+    }
+
+  for (i = 0; i < MANY_FILES; i++)
+    {
+      sprintf(fileName, "test_open_%d.bin", i);
+      TEST_CHECK(closePageFile(&fhs[i]));
+      TEST_CHECK(destroyPageFile(fileName));
+    }
+  ASSERT_EQUALS_INT(files, countOpenFiles(), "all files closed");
+
+  free(fhs);
+  free(ph);
+
+  TEST_DONE();
+}
+
+// ************************************************************
+void
+testConcurrentOpen (void)
+{
+  SM_FileHandle fh, closed;
+  SM_PageHandle ph;
+  pthread_t tid[OPEN_THREADS];
+  int ids[OPEN_THREADS];
+  int files, i, rc;
+
+  testName = "test threads opening and closing files";
+
+  ph = (SM_PageHandle) malloc(PAGE_SIZE);
+  destroyPageFile(TESTTS);
+  TEST_CHECK(createTablespace(TESTTS, PAGE_SIZE));
+
+  // a file open all along, its handle must stay valid
+  destroyPageFile(TESTPF);
+  TEST_CHECK(createPageFile(TESTPF));
+  TEST_CHECK(openPageFile(TESTPF, &fh));
+  stampPage(ph, 7);
+  TEST_CHECK(writeBlock(0, &fh, ph));
+  files = countOpenFiles();
+
+  for (i = 0; i < OPEN_THREADS; i++)
+    {
+      ids[i] = i;
+      pthread_create(&tid[i], NULL, openUseClose, &ids[i]);
+    }
+  for (i = 0; i < OPEN_THREADS; i++)
+    pthread_join(tid[i], NULL);
+
+  ASSERT_EQUALS_INT(files, countOpenFiles(), "all files closed");
+  TEST_CHECK(readBlock(0, &fh, ph));
+  ASSERT_EQUALS_PAGE(7, *(PageNumber*) ph, "handle open before still valid");
+
+  // a closed handle is rejected, however the registry moved around it
+  TEST_CHECK(openPageFile(TESTPF, &closed));
+  TEST_CHECK(closePageFile(&closed));
+  rc = readBlock(0, &closed, ph);
+  ASSERT_EQUALS_INT(RC_FILE_HANDLE_NOT_INIT, rc, "closed handle rejected");
+
+  TEST_CHECK(closePageFile(&fh));
+  TEST_CHECK(destroyPageFile(TESTPF));
+  TEST_CHECK(destroyPageFile(TESTTS));
+  free(ph);
+
+  TEST_DONE();
+}
+
+// ************************************************************
+void
+testConcurrentPool (void)
+{
+  BM_BufferPool *bm = MAKE_POOL();
+  SM_FileHandle fh;
+  SM_PageHandle ph;
+  pthread_t tid[POOL_THREADS];
+  PoolThread args[POOL_THREADS];
+  int i, p, bad = 0;
+
+  testName = "test threads sharing a buffer pool";
+
+  ph = (SM_PageHandle) malloc(PAGE_SIZE);
+  destroyPageFile(TESTPF);
+  TEST_CHECK(createPageFile(TESTPF));
+  TEST_CHECK(openPageFile(TESTPF, &fh));
+  for (i = 0; i < POOL_SHARED + POOL_THREADS * POOL_OWN; i++)
+    {
+      stampPage(ph, i < POOL_SHARED ? i : 0);
+      TEST_CHECK(writeBlock(i, &fh, ph));
+    }
+  TEST_CHECK(closePageFile(&fh));
+
+  // threads read shared pages and count up in their own, misses and
+  // write backs of one thread overlap with hits of the others
+  TEST_CHECK(initBufferPool(bm, TESTPF, POOL_FRAMES, RS_LRU, NULL));
+  ASSERT_TRUE(((BM_Pool_MgmtData*) bm->mgmtData)->numPartitions > 1, "pool is partitioned");
+  for (i = 0; i < POOL_THREADS; i++)
+    {
+      args[i].bm = bm;
+      args[i].n = i;
+      pthread_create(&tid[i], NULL, pinAndUpdate, &args[i]);
+    }
+  for (i = 0; i < POOL_THREADS; i++)
+    pthread_join(tid[i], NULL);
+  ASSERT_TRUE(getNumReadIO(bm) > POOL_FRAMES, "pages were evicted");
+  TEST_CHECK(shutdownBufferPool(bm));
+
+  // every count made it to disk, each thread did POOL_PINS / 2 on its
+  // own pages, round robin
+  TEST_CHECK(openPageFile(TESTPF, &fh));
+  for (i = 0; i < POOL_THREADS; i++)
+    for (p = 0; p < POOL_OWN; p++)
+      {
+        TEST_CHECK(readBlock(POOL_SHARED + i * POOL_OWN + p, &fh, ph));
+        if (*(PageNumber*) ph != POOL_PINS / 2 / POOL_OWN)
+          bad++;
+      }
+  ASSERT_EQUALS_INT(0, bad, "updates of all threads on disk");
+  TEST_CHECK(closePageFile(&fh));
+  TEST_CHECK(destroyPageFile(TESTPF));
+
+  free(ph);
+  free(bm);
+
+  TEST_DONE();
+}
+
+// ************************************************************
+void
+testLRU (void)
+{
+  BM_BufferPool *bm = MAKE_POOL();
+  BM_PageHandle *h = MAKE_PAGE_HANDLE();
+  BM_PageHandle held[2];
+  int victims[] = { 4, 5, 1, 0 };
+  long lastUse[LRU_PAGES];
+  int inPool[LRU_PAGES];
+  unsigned int seed = 1;
+  int i, j, pn, victim, cached;
+
+  testName = "test LRU replacement";
+
+  destroyPageFile(TESTPF);
+  TEST_CHECK(createPageFile(TESTPF));
+  TEST_CHECK(initBufferPool(bm, TESTPF, 4, RS_LRU, NULL));
+
+  // least recently unpinned first, pinned frames skipped
+  pinPages(bm, 0, 4);
+  pinPages(bm, 2, 1);
+  pinPages(bm, 0, 1);
+  TEST_CHECK(pinPage(bm, &held[0], 1));
+  pinPages(bm, 4, 1);
+  ASSERT_TRUE(!isPageInPool(bm, 3), "least recently used replaced");
+  TEST_CHECK(pinPage(bm, &held[1], 0));
+  TEST_CHECK(pinPage(bm, h, 0));
+  TEST_CHECK(unpinPage(bm, h));
+  pinPages(bm, 5, 1);
+  ASSERT_TRUE(!isPageInPool(bm, 2) && isPageInPool(bm, 0), "page still pinned skipped");
+  TEST_CHECK(unpinPage(bm, &held[0]));
+  TEST_CHECK(unpinPage(bm, &held[1]));
+  for (i = 0; i < 4; i++)
+    {
+      pinPages(bm, 6 + i, 1);
+      ASSERT_TRUE(!isPageInPool(bm, victims[i]) && (i == 3 || isPageInPool(bm, victims[i + 1])),
+                  "victims in order of last unpin");
+    }
+  TEST_CHECK(shutdownBufferPool(bm));
+
+  // random pins, the pool holds what a plain LRU list would
+  TEST_CHECK(initBufferPool(bm, TESTPF, LRU_FRAMES, RS_LRU, NULL));
+  memset(inPool, 0, sizeof(inPool));
+  cached = 0;
+  for (i = 0; i < LRU_PINS; i++)
+    {
+      seed = seed * 1103515245 + 12345;
+      pn = (seed >> 16) % LRU_PAGES;
+      if (!inPool[pn] && cached++ == LRU_FRAMES)
+        {
+          victim = -1;
+          for (j = 0; j < LRU_PAGES; j++)
+            if (inPool[j] && (victim < 0 || lastUse[j] < lastUse[victim]))
+              victim = j;
+          inPool[victim] = 0;
+          cached--;
+        }
+      inPool[pn] = 1;
+      lastUse[pn] = i;
+      pinPages(bm, pn, 1);
+      for (j = 0; j < LRU_PAGES; j++)
+        if (inPool[j] != isPageInPool(bm, j))
+          ASSERT_EQUALS_INT(inPool[j], isPageInPool(bm, j), "same pages as a plain LRU list");
+    }
+  TEST_CHECK(shutdownBufferPool(bm));
+  TEST_CHECK(destroyPageFile(TESTPF));
+
+  free(bm);
+  free(h);
+
+  TEST_DONE();
+}
+
+// ************************************************************
+void
+testLFU (void)
+{
+  BM_BufferPool *bm = MAKE_POOL();
+  BM_PageHandle *h = MAKE_PAGE_HANDLE();
+  BM_PageHandle held[3];
+  RC rc;
+  int i;
+
+  testName = "test LFU replacement";
+
+  destroyPageFile(TESTPF);
+  TEST_CHECK(createPageFile(TESTPF));
+  TEST_CHECK(initBufferPool(bm, TESTPF, 3, RS_LFU, NULL));
+
+  // page 0 hot, page 1 warm, page 2 used once
+  for (i = 0; i < 8; i++)
+    {
+      TEST_CHECK(pinPage(bm, h, 0));
+      TEST_CHECK(unpinPage(bm, h));
+    }
+  for (i = 0; i < 4; i++)
+    {
+      TEST_CHECK(pinPage(bm, h, 1));
+      TEST_CHECK(unpinPage(bm, h));
+    }
+  TEST_CHECK(pinPage(bm, h, 2));
+  TEST_CHECK(unpinPage(bm, h));
+
+  // least recently used would be page 0, least frequently used is 2
+  TEST_CHECK(pinPage(bm, h, 3));
+  TEST_CHECK(unpinPage(bm, h));
+  ASSERT_TRUE(isPageInPool(bm, 0), "hot page kept");
+  ASSERT_TRUE(isPageInPool(bm, 1), "warm page kept");
+  ASSERT_TRUE(!isPageInPool(bm, 2), "page used once replaced");
+
+  // pages used once each, counts of the old ones age to nothing
+  for (i = 4; i < 4 + LFU_SCAN; i++)
+    {
+      TEST_CHECK(pinPage(bm, h, i));
+      TEST_CHECK(unpinPage(bm, h));
+    }
+  ASSERT_TRUE(!isPageInPool(bm, 0), "hot page aged out");
+  ASSERT_TRUE(isPageInPool(bm, 3 + LFU_SCAN), "last page kept");
+  rc = getNumReadIO(bm);
+  ASSERT_EQUALS_INT(4 + LFU_SCAN, rc, "one read per page");
+
+  // pinned frames are never replaced
+  for (i = 0; i < 3; i++)
+    TEST_CHECK(pinPage(bm, &held[i], i));
+  ASSERT_TRUE(pinPage(bm, h, 3) == RC_BUFFER_POOL_FULL, "all frames pinned");
+  for (i = 0; i < 3; i++)
+    TEST_CHECK(unpinPage(bm, &held[i]));
+
+  TEST_CHECK(shutdownBufferPool(bm));
+  TEST_CHECK(destroyPageFile(TESTPF));
+
+  free(bm);
+  free(h);
+
+  TEST_DONE();
+}
+
+// ************************************************************
+void
+testLRUK (void)
+{
+  BM_BufferPool *bm = MAKE_POOL();
+  BM_LRUKParams params = { 2, 64, 0 };
+  BM_LRUKParams correlated = { 2, 0, 3 };
+  BM_LRUKParams bad = { LRU_K_MAX + 1, 0, 0 };
+  RC rc;
+
+  testName = "test LRU-K replacement";
+
+  destroyPageFile(TESTPF);
+  TEST_CHECK(createPageFile(TESTPF));
+  rc = initBufferPool(bm, TESTPF, 3, RS_LRU_K, &bad);
+  ASSERT_EQUALS_INT(RC_INVALID_STRATEGY_DATA, rc, "k out of range");
+
+  // pages 0 and 1 used twice, a scan then only replaces its own pages
+  TEST_CHECK(initBufferPool(bm, TESTPF, 3, RS_LRU_K, &params));
+  pinPages(bm, 0, 1);
+  pinPages(bm, 0, 1);
+  pinPages(bm, 1, 1);
+  pinPages(bm, 1, 1);
+  pinPages(bm, 2, 10);
+  ASSERT_TRUE(isPageInPool(bm, 0), "page used twice kept in scan");
+  ASSERT_TRUE(isPageInPool(bm, 1), "other page used twice kept in scan");
+
+  // page 5 was replaced, back in it has its first use from history,
+  // so two, and outlasts page 0 whose second use is older
+  pinPages(bm, 5, 1);
+  pinPages(bm, 20, 5);
+  ASSERT_TRUE(isPageInPool(bm, 5), "page used again kept");
+  ASSERT_TRUE(isPageInPool(bm, 1), "page used twice later kept");
+  ASSERT_TRUE(!isPageInPool(bm, 0), "page used twice first replaced");
+  TEST_CHECK(shutdownBufferPool(bm));
+
+  // uses right after each other are one
+  TEST_CHECK(initBufferPool(bm, TESTPF, 3, RS_LRU_K, &correlated));
+  pinPages(bm, 0, 1);
+  pinPages(bm, 0, 1);
+  pinPages(bm, 1, 10);
+  ASSERT_TRUE(!isPageInPool(bm, 0), "correlated uses count once");
+  TEST_CHECK(shutdownBufferPool(bm));
+
+  TEST_CHECK(destroyPageFile(TESTPF));
+  free(bm);
+
+  TEST_DONE();
+}
+
+// ************************************************************
+void
+testARC (void)
+{
+  BM_BufferPool *bm = MAKE_POOL();
+
+  testName = "test ARC replacement";
+
+  destroyPageFile(TESTPF);
+  TEST_CHECK(createPageFile(TESTPF));
+  TEST_CHECK(initBufferPool(bm, TESTPF, 4, RS_ARC, NULL));
+
+  // pages 0 and 1 used twice, a scan then only replaces its own pages
+  pinPages(bm, 0, 1);
+  pinPages(bm, 0, 1);
+  pinPages(bm, 1, 1);
+  pinPages(bm, 1, 1);
+  pinPages(bm, 2, 20);
+  ASSERT_TRUE(isPageInPool(bm, 0), "page used twice kept in scan");
+  ASSERT_TRUE(isPageInPool(bm, 1), "other page used twice kept in scan");
+
+  // page 19 was replaced just now, used again it is remembered as
+  // seen before and kept too
+  ASSERT_TRUE(!isPageInPool(bm, 19), "scanned page replaced");
+  pinPages(bm, 19, 1);
+  pinPages(bm, 30, 20);
+  ASSERT_TRUE(isPageInPool(bm, 19), "page seen before kept in scan");
+  ASSERT_TRUE(isPageInPool(bm, 1), "page used twice still kept");
+  ASSERT_TRUE(isPageInPool(bm, 49), "last page of scan in pool");
+  TEST_CHECK(shutdownBufferPool(bm));
+
+  TEST_CHECK(destroyPageFile(TESTPF));
+  free(bm);
+
+  TEST_DONE();
+}
+
+// ************************************************************
+void
+testClockPro (void)
+{
+  BM_BufferPool *bm = MAKE_POOL();
+  BM_PageHandle *h = MAKE_PAGE_HANDLE();
+  BM_PageHandle held[4];
+  RC rc;
+  int i;
+
+  testName = "test CLOCK-Pro replacement";
+
+  destroyPageFile(TESTPF);
+  TEST_CHECK(createPageFile(TESTPF));
+
+  // pages 0 and 1 used again while in their test period turn hot, a
+  // scan then only replaces cold pages
+  TEST_CHECK(initBufferPool(bm, TESTPF, 16, RS_CLOCK_PRO, NULL));
+  pinPages(bm, 0, 2);
+  pinPages(bm, 0, 2);
+  pinPages(bm, 2, 40);
+  ASSERT_TRUE(isPageInPool(bm, 0), "hot page kept in scan");
+  ASSERT_TRUE(isPageInPool(bm, 1), "other hot page kept in scan");
+
+  // page 25 was replaced in its test period, back it is hot
+  ASSERT_TRUE(!isPageInPool(bm, 25), "scanned page replaced");
+  pinPages(bm, 25, 1);
+  pinPages(bm, 100, 40);
+  ASSERT_TRUE(isPageInPool(bm, 25), "page back in test period kept");
+  ASSERT_TRUE(isPageInPool(bm, 0), "hot page still kept");
+  TEST_CHECK(shutdownBufferPool(bm));
+
+  // with the cold frames pinned, hot ones turn cold to make room
+  TEST_CHECK(initBufferPool(bm, TESTPF, 4, RS_CLOCK_PRO, NULL));
+  pinPages(bm, 0, 2);
+  pinPages(bm, 0, 2);
+  pinPages(bm, 0, 2);
+  for (i = 0; i < 2; i++)
+    TEST_CHECK(pinPage(bm, &held[i], 2 + i));
+  for (i = 2; i < 4; i++)
+    TEST_CHECK(pinPage(bm, &held[i], 2 + i));
+  rc = pinPage(bm, h, 6);
+  ASSERT_EQUALS_INT(RC_BUFFER_POOL_FULL, rc, "all frames pinned");
+  for (i = 0; i < 4; i++)
+    TEST_CHECK(unpinPage(bm, &held[i]));
+  TEST_CHECK(shutdownBufferPool(bm));
+
+  TEST_CHECK(destroyPageFile(TESTPF));
+  free(bm);
+  free(h);
+
+  TEST_DONE();
+}
+
+// ************************************************************
+void
+testBackgroundWriter (void)
+{
+  BM_BufferPool *bm = MAKE_POOL();
+  BM_PageHandle h;
+  PageNumber pn;
+  RC rc;
+  int tries;
+
+  testName = "test background writer";
+
+  destroyPageFile(TESTPF);
+  TEST_CHECK(createPageFile(TESTPF));
+  TEST_CHECK(initBufferPool(bm, TESTPF, WRITER_FRAMES, RS_LRU, NULL));
+
+  rc = startBackgroundWriter(bm, 20, 50);
+  ASSERT_EQUALS_INT(RC_INVALID_WRITER_THRESHOLD, rc, "low threshold above high");
+
+  // without it, dirty victims are written by pinPage()
+  dirtyPages(bm, 0, WRITER_FRAMES);
+  pinPages(bm, WRITER_FRAMES, WRITER_FRAMES / 2);
+  ASSERT_EQUALS_INT(WRITER_FRAMES / 2, getNumForegroundWriteIO(bm), "victims written by pinPage");
+  ASSERT_EQUALS_INT(0, getNumBackgroundWriteIO(bm), "no background writes");
+  TEST_CHECK(forceFlushPool(bm));
+
+  // past half the frames dirty, the least recently used are written
+  // until a quarter are
+  dirtyPages(bm, 100, WRITER_FRAMES * 3 / 4);
+  TEST_CHECK(startBackgroundWriter(bm, 50, 25));
+  for (tries = 0; tries < 200 && countDirty(bm) > WRITER_FRAMES / 4; tries++)
+    usleep(10000);
+  ASSERT_EQUALS_INT(WRITER_FRAMES / 4, countDirty(bm), "dirty frames down to low threshold");
+  ASSERT_EQUALS_INT(WRITER_FRAMES / 2, getNumBackgroundWriteIO(bm), "written in background");
+  ASSERT_EQUALS_INT(WRITER_FRAMES / 2, getNumForegroundWriteIO(bm), "no more victims written");
+
+  // pinPage() now finds clean victims, a markDirty() past the high
+  // threshold wakes the writer
+  dirtyPages(bm, 200, WRITER_FRAMES);
+  for (tries = 0; tries < 200 && countDirty(bm) > WRITER_FRAMES / 2; tries++)
+    usleep(10000);
+  ASSERT_TRUE(countDirty(bm) <= WRITER_FRAMES / 2, "dirty frames below high threshold");
+  TEST_CHECK(stopBackgroundWriter(bm));
+  TEST_CHECK(shutdownBufferPool(bm));
+
+  // all writes made it to the file
+  TEST_CHECK(initBufferPool(bm, TESTPF, WRITER_FRAMES, RS_LRU, NULL));
+  for (pn = 100; pn < 200 + WRITER_FRAMES; pn++)
+    {
+      if (pn == 100 + WRITER_FRAMES * 3 / 4)
+        pn = 200;
+      TEST_CHECK(pinPage(bm, &h, pn));
+      if (*(PageNumber*) h.data != pn)
+        ASSERT_EQUALS_PAGE(pn, *(PageNumber*) h.data, "page written back");
+      TEST_CHECK(unpinPage(bm, &h));
+    }
+  TEST_CHECK(shutdownBufferPool(bm));
+
+  TEST_CHECK(destroyPageFile(TESTPF));
+  free(bm);
+
+  TEST_DONE();
+}
+
+// ************************************************************
+void
+testPrefetch (void)
+{
+  BM_BufferPool *bm = MAKE_POOL();
+  BM_PageHandle h;
+  PageNumber pn, *frames[2];
+  int tries, *fixCounts, i, run;
+  ReplacementStrategy strategy;
+
+  testName = "test prefetch";
+
+  destroyPageFile(TESTPF);
+  TEST_CHECK(createPageFile(TESTPF));
+  TEST_CHECK(initBufferPool(bm, TESTPF, PREFETCH_FRAMES, RS_LRU, NULL));
+  dirtyPages(bm, 0, 2 * PREFETCH_FRAMES);
+  TEST_CHECK(shutdownBufferPool(bm));
+
+  // pages are read in the background, unpinned
+  TEST_CHECK(initBufferPool(bm, TESTPF, PREFETCH_FRAMES, RS_LRU, NULL));
+  TEST_CHECK(prefetchRange(bm, 0, PREFETCH_PAGES));
+  for (tries = 0; tries < 200 && getNumReadIO(bm) < PREFETCH_PAGES; tries++)
+    usleep(10000);
+  ASSERT_EQUALS_INT(PREFETCH_PAGES, getNumReadIO(bm), "pages read ahead");
+
+  // pins are hits, or wait for the read going on
+  TEST_CHECK(prefetchRange(bm, PREFETCH_PAGES, PREFETCH_PAGES));
+  for (pn = 0; pn < 2 * PREFETCH_PAGES; pn++)
+    {
+      TEST_CHECK(pinPage(bm, &h, pn));
+      if (*(PageNumber*) h.data != pn)
+        ASSERT_EQUALS_PAGE(pn, *(PageNumber*) h.data, "prefetched page content");
+      TEST_CHECK(unpinPage(bm, &h));
+    }
+  ASSERT_EQUALS_INT(2 * PREFETCH_PAGES, getNumReadIO(bm), "each page read once");
+  fixCounts = getFixCounts(bm);
+  for (i = 0; i < PREFETCH_FRAMES && fixCounts[i] == 0; i++)
+    ;
+  ASSERT_EQUALS_INT(PREFETCH_FRAMES, i, "prefetched pages not pinned");
+  free(fixCounts);
+
+  // pages in the pool, past the end of the file, or that need a dirty
+  // page written first are skipped
+  TEST_CHECK(prefetchPage(bm, 1));
+  TEST_CHECK(prefetchPage(bm, 10 * PREFETCH_FRAMES));
+  dirtyPages(bm, PREFETCH_PAGES, PREFETCH_FRAMES);
+  TEST_CHECK(prefetchRange(bm, PREFETCH_FRAMES + PREFETCH_PAGES, PREFETCH_PAGES));
+  ASSERT_EQUALS_INT(PREFETCH_FRAMES + PREFETCH_PAGES, getNumReadIO(bm), "nothing more read");
+  TEST_CHECK(shutdownBufferPool(bm));
+
+  // a skipped prefetch leaves the replacement order as it was: the
+  // same pins evict the same pages with or without it
+  for (strategy = RS_FIFO; strategy <= RS_CLOCK_PRO; strategy++)
+    {
+      for (run = 0; run < 2; run++)
+        {
+          TEST_CHECK(initBufferPool(bm, TESTPF, PREFETCH_FRAMES, strategy, NULL));
+          dirtyPages(bm, 0, PREFETCH_FRAMES);
+          if (run)
+            TEST_CHECK(prefetchRange(bm, PREFETCH_FRAMES, PREFETCH_PAGES));
+          ASSERT_EQUALS_INT(0, getNumReadIO(bm) - PREFETCH_FRAMES, "prefetch skipped");
+          pinPages(bm, PREFETCH_FRAMES, PREFETCH_PAGES);
+          frames[run] = getFrameContents(bm);
+          TEST_CHECK(shutdownBufferPool(bm));
+        }
+      if (memcmp(frames[0], frames[1], PREFETCH_FRAMES * sizeof(PageNumber)) != 0)
+        ASSERT_TRUE(FALSE, "same pages evicted after a skipped prefetch");
+      free(frames[0]);
+      free(frames[1]);
+    }
+
+  TEST_CHECK(destroyPageFile(TESTPF));
+  free(bm);
+
+  TEST_DONE();
+}
+
+// ************************************************************
+// pin and unpin pages first..first+count-1 in turn
+void
+pinPages (BM_BufferPool *bm, PageNumber first, int count)
+{
+  BM_PageHandle h;
+  PageNumber pn;
+
+  for (pn = first; pn < first + count; pn++)
+    {
+      TEST_CHECK(pinPage(bm, &h, pn));
+      TEST_CHECK(unpinPage(bm, &h));
+    }
+}
+
+// ************************************************************
+// stamp pages first..first+count-1 with their numbers, as dirty
+void
+dirtyPages (BM_BufferPool *bm, PageNumber first, int count)
+{
+  BM_PageHandle h;
+  PageNumber pn;
+
+  for (pn = first; pn < first + count; pn++)
+    {
+      TEST_CHECK(pinPage(bm, &h, pn));
+      stampPage(h.data, pn);
+      TEST_CHECK(markDirty(bm, &h));
+      TEST_CHECK(unpinPage(bm, &h));
+    }
+}
+
+// ************************************************************
+// frames of bm marked dirty
+int
+countDirty (BM_BufferPool *bm)
+{
+  bool *dirty = getDirtyFlags(bm);
+  int i, n = 0;
+
+  for (i = 0; i < bm->numPages; i++)
+    n += dirty[i];
+  free(dirty);
+  return n;
+}
+
+// ************************************************************
+// page pn has a frame in bm
+int
+isPageInPool (BM_BufferPool *bm, PageNumber pn)
+{
+  PageNumber *frames = getFrameContents(bm);
+  int i, found = 0;
+
+  for (i = 0; i < bm->numPages; i++)
+    if (frames[i] == pn)
+      found = 1;
+  free(frames);
+  return found;
+}
+
+// ************************************************************
+// write a page and sync it, SYNCS_PER_THREAD times
+void *
+writeAndSync (void *fh)
+{
+  char page[PAGE_SIZE];
+  int i;
+
+  for (i = 0; i < SYNCS_PER_THREAD; i++)
+    {
+      stampPage(page, i);
+      TEST_CHECK(writeBlock(i, (SM_FileHandle*) fh, page));
+      TEST_CHECK(syncPageFile((SM_FileHandle*) fh));
+    }
+  return NULL;
+}
+
+// ************************************************************
+// append APPENDS_PER_THREAD empty pages
+void *
+appendBlocks (void *fh)
+{
+  int i;
+
+  for (i = 0; i < APPENDS_PER_THREAD; i++)
+    TEST_CHECK(appendEmptyBlock((SM_FileHandle*) fh));
+  return NULL;
+}
+
+// ************************************************************
+// read the shared pages and check them, then write the round number
+// to our own pages and read them back, BLOCK_ROUNDS times. Thread n
+// owns BLOCK_OWN pages after the shared ones, the last first.
+void *
+readAndWrite (void *arg)
+{
+  SM_FileHandle *fh = ((BlockThread*) arg)->fh;
+  PageNumber own = BLOCK_SHARED + ((BlockThread*) arg)->n * BLOCK_OWN;
+  char page[PAGE_SIZE];
+  int round, i;
+
+  for (round = 0; round < BLOCK_ROUNDS; round++)
+    {
+      for (i = 0; i < BLOCK_SHARED; i++)
+        {
+          TEST_CHECK(readBlock(i, fh, page));
+          if (*(PageNumber*) page != i)
+            ASSERT_EQUALS_PAGE(i, *(PageNumber*) page, "shared page content");
+        }
+      for (i = BLOCK_OWN - 1; i >= 0; i--)
+        {
+          stampPage(page, round);
+          TEST_CHECK(writeBlock(own + i, fh, page));
+        }
+      for (i = 0; i < BLOCK_OWN; i++)
+        {
+          TEST_CHECK(readBlock(own + i, fh, page));
+          if (*(PageNumber*) page != round)
+            ASSERT_EQUALS_PAGE(round, *(PageNumber*) page, "own page content");
+        }
+    }
+  return NULL;
+}
+
+// ************************************************************
+// a file and a segment of TESTTS of our own: create, open, write,
+// read back, close and destroy them, OPEN_ROUNDS times
+void *
+openUseClose (void *id)
+{
+  SM_FileHandle fh, seg;
+  char fileName[64], segName[64], page[PAGE_SIZE];
+  int n = *(int*) id, round, i;
+
+  sprintf(fileName, "test_open_%d.bin", n);
+  sprintf(segName, TESTTS ":open%d", n);
+  for (round = 0; round < OPEN_ROUNDS; round++)
+    {
+      TEST_CHECK(createPageFile(fileName));
+      TEST_CHECK(createPageFile(segName));
+      TEST_CHECK(openPageFileWithFlags(fileName, &fh, round % 2 ? SM_OPEN_MMAP : SM_OPEN_DEFAULT));
+      TEST_CHECK(openPageFile(segName, &seg));
+      for (i = 0; i < OPEN_PAGES; i++)
+        {
+          stampPage(page, n * 1000 + i);
+          TEST_CHECK(writeBlock(i, &fh, page));
+          TEST_CHECK(writeBlock(i, &seg, page));
+        }
+      for (i = 0; i < OPEN_PAGES; i++)
+        {
+          TEST_CHECK(readBlock(i, &fh, page));
+          if (*(PageNumber*) page != n * 1000 + i)
+            ASSERT_EQUALS_PAGE(n * 1000 + i, *(PageNumber*) page, "page of own file");
+          TEST_CHECK(readBlock(i, &seg, page));
+          if (*(PageNumber*) page != n * 1000 + i)
+            ASSERT_EQUALS_PAGE(n * 1000 + i, *(PageNumber*) page, "page of own segment");
+        }
+      TEST_CHECK(closePageFile(&seg));
+      TEST_CHECK(closePageFile(&fh));
+      TEST_CHECK(destroyPageFile(segName));
+      TEST_CHECK(destroyPageFile(fileName));
+    }
+  return NULL;
+}
+
+// ************************************************************
+// pin a shared page and check it, then one of our own and count it
+// up, POOL_PINS / 2 times. Thread n owns POOL_OWN pages after the
+// shared ones.
+void *
+pinAndUpdate (void *arg)
+{
+  BM_BufferPool *bm = ((PoolThread*) arg)->bm;
+  BM_PageHandle h;
+  int n = ((PoolThread*) arg)->n;
+  PageNumber own = POOL_SHARED + n * POOL_OWN;
+  unsigned int seed = n + 1;
+  int i, pn;
+
+  for (i = 0; i < POOL_PINS / 2; i++)
+    {
+      seed = seed * 1103515245 + 12345;
+      pn = (seed >> 16) % POOL_SHARED;
+      TEST_CHECK(pinPage(bm, &h, pn));
+      if (*(PageNumber*) h.data != pn)
+        ASSERT_EQUALS_PAGE(pn, *(PageNumber*) h.data, "shared page content");
+      TEST_CHECK(unpinPage(bm, &h));
+
+      TEST_CHECK(pinPage(bm, &h, own + i % POOL_OWN));
+      if (*(PageNumber*) h.data != i / POOL_OWN)
+        ASSERT_EQUALS_PAGE(i / POOL_OWN, *(PageNumber*) h.data, "own page count");
+      (*(PageNumber*) h.data)++;
+      TEST_CHECK(markDirty(bm, &h));
+      TEST_CHECK(unpinPage(bm, &h));
+    }
+  return NULL;
+}
+
+// ************************************************************
+// regular files open in this process, other fds (io_uring) not counted
+int
+countOpenFiles (void)
+{
+  DIR *dir = opendir("/proc/self/fd");
+  struct dirent *de;
+  struct stat st;
+  int n = 0;
+
+  while ((de = readdir(dir)))
+    if (fstat(atoi(de->d_name), &st) == 0 && S_ISREG(st.st_mode))
+      n++;
+  closedir(dir);
+  return n;
+}
+
+// ************************************************************
+// fixed length records of an int and a space padded string
+void
+fillRecordPage (SM_PageHandle page, PageNumber pn)
+{
+  int r;
+
+  stampPage(page, pn);
+  for (r = 0; (r + 1) * 40 <= PAGE_SIZE - (int) sizeof(PageNumber); r++)
+    {
+      char *record = page + sizeof(PageNumber) + r * 40;
+      *(int*) record = (int) pn * 100 + r;
+      memset(record + sizeof(int), ' ', 36);
+      sprintf(record + sizeof(int), "name-%lld-%d", (long long) pn, r);
+      record[sizeof(int) + strlen(record + sizeof(int))] = ' ';
+    }
+}
+
+// ************************************************************
+// poll a ticket, never waiting, until its request is done
+RC
+pollUntilDone (SM_AsyncQueue *queue, SM_AsyncTicket ticket)
+{
+  RC rc, result;
+
+  while ((rc = pollAsyncIO(queue, ticket, &result)) == RC_ASYNC_PENDING)
+    sched_yield();
+  return rc == RC_OK ? result : rc;
+}
+
+// ************************************************************
+void
+stampPage (SM_PageHandle page, PageNumber pn)
+{
+  memset(page, 0, PAGE_SIZE);
+  *(PageNumber*) page = pn;
+}